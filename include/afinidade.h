@@ -0,0 +1,37 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __AFINIDADE_H
+#define __AFINIDADE_H
+
+/* the threads which can be placed through rmon2.conf */
+#define AFINIDADE_CAPTURA	0	/**< libpcap capture thread */
+#define AFINIDADE_CONTABIL	1	/**< accounting thread or workers */
+#define AFINIDADE_PTSL		2	/**< PTSL trace server */
+#define AFINIDADE_SNMP		3	/**< the thread answering SNMP */
+#define AFINIDADE_PAPEIS	4
+
+void afinidade_inicializa();
+void afinidade_aplica(const unsigned int papel, const unsigned int indice);
+
+#endif /* __AFINIDADE_H */
@@ -0,0 +1,31 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __AGREGADOR_H
+#define __AGREGADOR_H
+
+int agregador_abre(const char *if_name, const unsigned int controle);
+int agregador_ativo();
+void agregador_consolida();
+void agregador_fecha();
+
+#endif /* __AGREGADOR_H */
@@ -30,6 +30,8 @@
 
 unsigned int alhost_quantidade();
 int alhost_insereAtualiza(pedb_t *dados);
+void alhost_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 int alhost_remove_pdir(const unsigned int pdir_localindex);
 
 int alhost_helper(const unsigned int indice, uint32_t *hlcindex,
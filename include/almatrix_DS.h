@@ -27,8 +27,11 @@
 
 unsigned int almatrix_DS_quantidade();
 int almatrix_DS_insereAtualiza(pedb_t *dados);
+void almatrix_DS_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 // int almatrix_DS_removePeloIP(const in_addr_t address, const int interface);
 void almatrix_DS_hashStats();
+int almatrix_DS_remove_pdir(const unsigned int pdir_localindex);
 
 int almatrix_ds_helper(const unsigned int indice, uint32_t *hlmindex,
 		uint32_t *al_tmark, uint32_t *plindex_net,
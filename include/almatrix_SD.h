@@ -27,7 +27,10 @@
 
 unsigned int almatrix_SD_quantidade();
 int almatrix_SD_insereAtualiza(pedb_t *dados);
+void almatrix_SD_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 void almatrix_SD_hashStats();
+int almatrix_SD_remove_pdir(const unsigned int pdir_localindex);
 
 int almatrix_sd_helper(const unsigned int indice, uint32_t *hlmindex,
 		uint32_t *al_tmark, uint32_t *plindex_net,
@@ -27,6 +27,8 @@
 
 /* protocolDir */
 #define PDIR_CONF "/etc/rmon2/protocoldir.conf"	    /* arquivo hardcoded */
+/* assinaturas de payload, para portas desconhecidas (opcional) */
+#define ASSINATURAS_CONF "/etc/rmon2/signatures.conf"
 
 /* protocolDist */
 #define PDIST_DEBUG 0
@@ -61,3 +63,59 @@
 
 #define MEDIR_DESEMPENHO		0
 
+/* decodifica */
+/* quadros decodificados de uma vez (16 a 64) */
+#define DECODIFICA_LOTE			32
+
+/* shards */
+/* intervalo mnimo (centsimos) entre consolidaes das tabelas dos workers */
+#define SHARDS_INTERVALO		100
+
+/* descartes */
+/* intervalo (centsimos) entre publicaes dos DroppedFrames */
+#define DESCARTES_INTERVALO		100
+
+/* duplicatas */
+/* posies (potncia de 2) da tabela de pacotes recentes de cada worker */
+#define DUPLICATAS_TAM			4096
+
+/* fluxos */
+/* posies (potncia de 2) do cache de fluxos de cada worker */
+#define FLUXOS_TAM			2048
+/* contadores de linhas de tabela que um fluxo alimenta, no mximo */
+#define FLUXO_CONTAS			16
+/* fluxos com pacotes de um lote ainda no somados s tabelas, no mximo */
+#define FLUXOS_PENDENTES		16
+
+/* assinaturas */
+/* bytes do incio do payload comparados com as assinaturas */
+#define ASSINATURAS_JANELA		32
+/* pacotes com payload examinados por conversa antes de desistir */
+#define ASSINATURAS_PACOTES		4
+/* posies (potncia de 2) do cache de conversas de cada worker */
+#define ASSINATURAS_CONVERSAS		4096
+/* assinaturas, e estados do autmato que as reconhece, no mximo */
+#define ASSINATURAS_MAX			256
+#define ASSINATURAS_ESTADOS		4096
+
+/* agregador */
+/* capacidade dos mapas do programa XDP: portas conhecidas, classes de
+   protocolos e endereos IPv4 */
+#define AGREGADOR_PORTAS		4096
+#define AGREGADOR_PROTOCOLOS		4096
+#define AGREGADOR_HOSTS			65536
+
+/* tabelas */
+/* linhas garantidas em cada tabela de nlHost, alHost, matrizes e
+   protocolDist, na principal e em cada shard */
+#define TABELAS_ENTRADAS		65536
+/* posies (potncia de 2) de cada uma; aceitam at 7/8 disso, ento
+   devem ser pelo menos TABELAS_ENTRADAS * 8 / 7 */
+#define TABELAS_POSICOES		131072
+
+/* interfaces */
+/* quantas interfaces podem ser monitoradas ao mesmo tempo */
+#define MAX_INTERFACES			8
+/* hlHost, hlMatrix e protocolDist so indexadas pelo ifIndex da interface */
+#define IFINDEX_MAX			256
+
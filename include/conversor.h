@@ -23,8 +23,25 @@
 #ifndef __CONVERSOR_H
 #define __CONVERSOR_H
 
+#include <stdint.h>
+#include <sys/time.h>
+
+/* load shedding levels; each one also sheds what the ones below it do */
+#define CORTE_NENHUM	0	/* full analysis */
+#define CORTE_TRACOS	1	/* no PTSL traces */
+#define CORTE_MATRIZES	2	/* no nlMatrix/alMatrix either */
+#define CORTE_HOSTS	3	/* no nlHost/alHost either: protocolDist only */
+#define CORTE_NIVEIS	4
+
 int init_sniffer();
+int init_replay();
+int captura_arquivo(const char *arquivo, const double velocidade);
+int captura_arquivo_lote(const char *arquivo, const unsigned int worker,
+		const struct timeval *origem, uint64_t *pacotes);
 void *captura_processa_pacote();
 void *fila_inicia_captura();
+unsigned int conversor_amostragem();
+unsigned int conversor_corte();
+uint32_t conversor_cortados(const unsigned int nivel);
 
 #endif /* __CONVERSOR_H */
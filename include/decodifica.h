@@ -0,0 +1,60 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef __DECODIFICA_H
+#define __DECODIFICA_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+
+/* flags of a decoded frame */
+#define DECODIFICA_VALIDO	0x01	/**< ether2.ipv4 over TCP, UDP or ICMP */
+#define DECODIFICA_BROADCAST	0x02	/**< sent to ff:ff:ff:ff:ff:ff */
+
+/** \brief A batch of frames and their decoded headers, one array per field
+ *
+ *  The caller fills \a quadro, \a capturado and \a tam and sets \a qtd;
+ *  decodifica_lote() fills the rest.  Ports are in host order, addresses in
+ *  network order, offsets count from the start of the frame.
+ */
+typedef struct decodifica_lote_s {
+	unsigned int	 qtd;
+	const uint8_t	*quadro[DECODIFICA_LOTE];
+	uint32_t	 capturado[DECODIFICA_LOTE];	/* bytes at quadro */
+	uint32_t	 tam[DECODIFICA_LOTE];		/* on the wire */
+	in_addr_t	 ip_orig[DECODIFICA_LOTE];
+	in_addr_t	 ip_dest[DECODIFICA_LOTE];
+	uint16_t	 sport[DECODIFICA_LOTE];
+	uint16_t	 dport[DECODIFICA_LOTE];
+	uint8_t		 transporte[DECODIFICA_LOTE];	/* IPPROTO_* */
+	uint8_t		 flags[DECODIFICA_LOTE];	/* DECODIFICA_* */
+	uint8_t		 offset_trans[DECODIFICA_LOTE];
+	uint8_t		 offset_aplic[DECODIFICA_LOTE];
+} decodifica_lote_t;
+
+void decodifica_inicializa();
+void decodifica_lote(decodifica_lote_t *lote);
+
+#endif /* __DECODIFICA_H */
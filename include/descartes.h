@@ -0,0 +1,39 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __DESCARTES_H
+#define __DESCARTES_H
+
+#include <stdint.h>
+
+/* which tables missed a frame (see descartes_tabela()) */
+#define DESCARTE_NL	0x1	/* nlHost or nlMatrix */
+#define DESCARTE_AL	0x2	/* alHost or alMatrix */
+#define DESCARTE_PDIST	0x4	/* protocolDist */
+
+void descartes_captura(const unsigned int interface, const uint32_t quantos);
+void descartes_tabela(const unsigned int worker, const unsigned int interface,
+		const unsigned int quais);
+int descartes_vencido(unsigned long *proximo);
+void descartes_publica();
+
+#endif /* __DESCARTES_H */
@@ -20,17 +20,36 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+/* what pkt_decode() needs; PTSL traces and payload signatures may ask for
+   more, up to FILA_SNAPLEN */
+#define FILA_SNAPLEN_MIN	68
+
 #if PTSL
 #   define FILA_SNAPLEN	192
 #else
-#   define FILA_SNAPLEN	68
+#   define FILA_SNAPLEN	128	/* TCP with options, plus a signature window */
 #endif
 
-#define FILA_MAX	8192
+#define FILA_MAX	8192			/* deve ser potncia de 2 */
+#define FILA_MASCARA	(FILA_MAX - 1)
+
+#define FILA_LOTE	64	/* mximo de pacotes por lote (enfileirar/retirar) */
+#define FILA_GIROS	512	/* tentativas do consumidor antes de dormir */
+#define FILA_HIST	8	/* faixas dos histogramas de tamanho de lote */
+
+/* ocupaes da fila a partir das quais o consumidor corta anlises */
+#define FILA_CORTE_TRACOS	(FILA_MAX / 4)		/* PTSL */
+#define FILA_CORTE_MATRIZES	(FILA_MAX / 2)		/* nl/alMatrix */
+#define FILA_CORTE_HOSTS	(FILA_MAX / 4 * 3)	/* nl/alHost */
+
+/* mantm os ndices do produtor e do consumidor em linhas de cache distintas */
+#define FILA_CACHELINE	64
+#define FILA_ALINHADO	__attribute__((aligned(FILA_CACHELINE)))
 
 
 typedef struct fila_s {
 	uint32_t	tam;			/* tamanho total do pacote */
+	uint32_t	capturado;		/* bytes guardados em dados */
 	u_char		dados[FILA_SNAPLEN];	/* o incio do pacote capturado */
 } fila_t;
 
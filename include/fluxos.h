@@ -0,0 +1,122 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* with PTSL, requires include/stateful.h */
+
+#ifndef __FLUXOS_H
+#define __FLUXOS_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+#include "pedb.h"
+
+/** \brief The counters of a table row, as a flow feeds them */
+typedef struct fluxo_conta_s {
+	uint32_t	*pkts;
+	uint32_t	*octets;	/* NULL: counts packets only */
+	unsigned long	*create_time;	/* NULL: the row keeps no times */
+	unsigned long	*timemark;
+} fluxo_conta_t;
+
+/** \brief A flow, and every table row its packets are accounted in */
+typedef struct fluxo_s {
+	/* the key: what pkt_process() looks at */
+	in_addr_t	ip_orig;
+	in_addr_t	ip_dest;
+	uint16_t	sport;
+	uint16_t	dport;
+	uint8_t		transporte;
+	uint8_t		broadcast;
+	unsigned int	interface;
+	unsigned int	acoes;
+	unsigned int	geracao;	/* valid while it is the current one */
+
+	/* what pkt_process() left in the pedb for the first packet */
+	unsigned int	nl_localindex;
+	unsigned int	al_localindex;
+#if PTSL
+	unsigned int	direcao;
+	in_addr_t	ip_cliente;
+	in_addr_t	ip_servidor;
+	unsigned int	porta_cliente;
+	unsigned int	porta_servidor;
+	traco_t		*prim_traco_rede;
+	traco_t		*prim_traco_transporte;
+	traco_t		*prim_traco_aplicacao;
+#endif
+
+	/* packets of the current batch, not yet added to the rows */
+	uint32_t	lote_pkts;
+	uint32_t	lote_octets;
+
+	unsigned int	contas_qtd;	/* > FLUXO_CONTAS: not to be kept */
+	fluxo_conta_t	contas[FLUXO_CONTAS];
+} fluxo_t;
+
+
+/** \brief Called by the tables, for each row they updated with the packet
+ *  being recorded in \a f (NULL if none is).
+ */
+static inline void
+fluxo_registra(fluxo_t *f, uint32_t *pkts, uint32_t *octets,
+		unsigned long *create_time, unsigned long *timemark)
+{
+	fluxo_conta_t	*c;
+
+	if ((f == NULL) || (f->contas_qtd > FLUXO_CONTAS))
+		return;
+
+	if (f->contas_qtd == FLUXO_CONTAS) {
+		f->contas_qtd++;
+		return;
+	}
+
+	c = &f->contas[f->contas_qtd++];
+	c->pkts = pkts;
+	c->octets = octets;
+	c->create_time = create_time;
+	c->timemark = timemark;
+}
+
+
+/** \brief The packet being recorded in \a f missed some table, so the flow
+ *  cannot be replayed from its rows.
+ */
+static inline void
+fluxo_abandona(fluxo_t *f)
+{
+	if (f != NULL)
+		f->contas_qtd = FLUXO_CONTAS + 1;
+}
+
+
+void fluxos_invalida();
+void fluxos_sincroniza(const unsigned int worker);
+const fluxo_t *fluxos_antecipa(const pedb_t *dados, const int etapa);
+fluxo_t *fluxos_localiza(pedb_t *dados);
+void fluxos_conta(fluxo_t *f, pedb_t *dados);
+void fluxos_descarrega(const pedb_t *dados);
+void fluxos_conclui(pedb_t *dados);
+
+#endif /* __FLUXOS_H */
@@ -35,7 +35,10 @@ typedef	struct {
 
 unsigned int nlhost_quantidade();
 int nlhost_insereAtualiza(pedb_t *dados);
+void nlhost_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 int nlhost_remove_pdir(const uint32_t pdir_localindex);
+int nlhost_consolida_soma(const nlhost_t *e);
 
 void nlhost_hashStats();
 
@@ -27,7 +27,10 @@
 
 unsigned int nlmatrix_DS_quantidade();
 int nlmatrix_DS_insereAtualiza(pedb_t *dados);
+void nlmatrix_DS_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 void nlmatrix_DS_hashStats();
+int nlmatrix_DS_remove_pdir(const unsigned int pdir_localindex);
 
 int nlmatrix_ds_helper(const unsigned int indice, uint32_t tripa[]);
 
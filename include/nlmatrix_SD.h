@@ -27,7 +27,10 @@
 
 unsigned int nlmatrix_SD_quantidade();
 int nlmatrix_SD_insereAtualiza(pedb_t *dados);
+void nlmatrix_SD_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa);
 void nlmatrix_SD_hashStats();
+int nlmatrix_SD_remove_pdir(const unsigned int pdir_localindex);
 
 int nlmatrix_sd_helper(const unsigned int indice, uint32_t tripa[]);
 
@@ -31,7 +31,14 @@ typedef struct PEDB_st {
 	int		rede_sport;	/* porta origem */
 	int		rede_dport;	/* porta destino */
 	unsigned int    interface;	/* a interface de captura (1, at descobrir pq  1) */
-	int		tamanho;	/* tamanho do pacote */
+	unsigned int    worker;		/* o worker que contabiliza o pacote (shard) */
+	unsigned int    descartes;	/* tabelas sem espao para o pacote (DESCARTE_*) */
+	int		tamanho;	/* tamanho do pacote (vezes o peso) */
+	unsigned int    peso;		/* pacotes que este representa (amostragem) */
+	unsigned int    amostra;	/* pacotes desde o ltimo amostrado */
+	unsigned int    corte;		/* anlises cortadas pela carga (CORTE_*) */
+	unsigned int    acoes;		/* o que o lote permite (PDIR_ACAO_*) */
+	struct fluxo_s	*fluxo;		/* onde as tabelas registram o pacote (fluxos.h) */
 	unsigned long	uptime;		/* uptime da mquina na hora que o pacote chegou */
 	in_addr_t	ip_orig;	/* endereo IP origem */
 	in_addr_t	ip_dest;	/* endereo IP destino */
@@ -41,6 +48,8 @@ typedef struct PEDB_st {
 	unsigned int    offset_rede;	/* offset in bytes from 0 to network protocol */
 	unsigned int    offset_trans;	/* transport protocol */
 	unsigned int    offset_aplic;	/* application protocol */
+	const unsigned char *quadro;	/* the frame, for payload signatures */
+	unsigned int    capturado;	/* bytes of it captured */
 
 #if PTSL
 	unsigned int    direcao;	/* tells whether packet is from client or server */
@@ -0,0 +1,61 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __PKT_SNIFFER_H
+#define __PKT_SNIFFER_H
+
+#include <stdint.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+/** \brief How many rings can be opened at once (interfaces times workers) */
+#define MAX_SNIFFERS	128
+
+/*
+ *  walking a TPACKET_V3 block: the first frame is at offset_to_first_pkt and
+ *  each frame header tells where the next one is.
+ */
+#define BLOCO_QTD_FRAMES(b)	((b)->hdr.bh1.num_pkts)
+#define BLOCO_PRIMEIRO(b)	((struct tpacket3_hdr *) \
+		((uint8_t *)(b) + (b)->hdr.bh1.offset_to_first_pkt))
+#define BLOCO_PROXIMO(f)	((struct tpacket3_hdr *) \
+		((uint8_t *)(f) + (f)->tp_next_offset))
+#define FRAME_DADOS(f)		((const uint8_t *)(f) + (f)->tp_mac)
+#define FRAME_CAPLEN(f)		((f)->tp_snaplen)
+#define FRAME_INSTANTE(f)	((uint64_t)(f)->tp_sec * 1000000 + \
+		(f)->tp_nsec / 1000)	/* capture time, microseconds */
+
+int sniffer_open_interface_by_name(const char *if_name,
+		const unsigned int snaplen);
+int sniffer_define_filtro(const int sniffer, struct sock_filter *programa,
+		const unsigned int tamanho);
+int sniffer_fanout_fd(const int fd, const uint16_t grupo);
+int sniffer_define_fanout(const int sniffer, const uint16_t grupo);
+int sniffer_ifindex(const int sniffer);
+struct tpacket_block_desc *sniffer_proximo_bloco(const int sniffer,
+		const int timeout_ms);
+void sniffer_libera_bloco(const int sniffer, struct tpacket_block_desc *bloco);
+int sniffer_estatisticas(const int sniffer, uint32_t *pacotes,
+		uint32_t *descartes);
+void sniffer_close(const int sniffer);
+
+#endif /* __PKT_SNIFFER_H */
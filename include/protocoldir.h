@@ -28,6 +28,15 @@
 #define CONFIG_SUPPORTED_OFF	2
 #define CONFIG_SUPPORTED_ON	3
 
+/* what pkt_process() does with a packet of an encapsulation (acoes) */
+#define PDIR_ACAO_PDIST		0x01
+#define PDIR_ACAO_NLHOST	0x02
+#define PDIR_ACAO_NLMATRIX	0x04
+#define PDIR_ACAO_ALHOST	0x08
+#define PDIR_ACAO_ALMATRIX	0x10
+#define PDIR_ACAO_TRACOS	0x20
+#define PDIR_ACOES_TODAS	0x3f
+
 typedef struct ProtDir_struct {
     /* para facilitar a vida da hash */
 	uint32_t	transp_aplic;
@@ -46,6 +55,7 @@ typedef struct ProtDir_struct {
 	unsigned int	host_config;
 	unsigned int	matrix_config;
 	unsigned int	row_status;
+	unsigned int	acoes;		/* PDIR_ACAO_*, from the configs */
 
 	unsigned char	param1;
 	unsigned char	param2;
@@ -61,12 +71,21 @@ typedef struct ProtDir_struct {
 } pdir_node_t;
 
 
+/* called whenever the set of encapsulations changes */
+typedef void (*pdir_observador_t)();
+/* how many of them can be registered */
+#define PDIR_OBSERVADORES	4
+
 /* prottipos */
 pdir_node_t *pdir_localiza(const unsigned int enlace, const unsigned int rede,
 	const unsigned int transporte, const unsigned int aplicacao);
+pdir_node_t *pdir_localiza_ipv4(const unsigned int transporte,
+	const unsigned int porta);
 
 int protdir_init();
 int init_protocoldir(char *filename);
+int pdir_recarrega(char *filename);
+unsigned int pdir_recargas();
 
 void protdir_dumpTable();
 
@@ -120,6 +139,10 @@ int pdir_tabela_proximo(unsigned int *res);
 
 int pdir_tabela_testa(const unsigned int indice);
 
+void pdir_define_observador(pdir_observador_t funcao);
+int pdir_ipv4_interesse(unsigned char *transportes);
+unsigned int pdir_ipv4_portas(uint32_t *chaves, const unsigned int max);
+
 #if PTSL
 int pdir_possui_traco(const unsigned int indice);
 
@@ -129,6 +152,10 @@ int pdir_traco_busca_idstring(traco_t *traco, unsigned char *str, unsigned int t
 
 int pdir_traco_run(const unsigned int id_traco);
 
+int pdir_traco_remove(const unsigned int id_traco);
+
+unsigned int pdir_tracos_alcance();
+
 traco_t *pdir_cria_traco(unsigned int idlink, unsigned int idnet, unsigned int idtrans,
 	unsigned int idapp, unsigned int nr_estados, unsigned int nr_msgs,
 	unsigned int nr_vars, descricao_t *descr_ptr, unsigned int id);
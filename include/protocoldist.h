@@ -20,6 +20,8 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+struct fluxo_s;		/* fluxos.h */
+
 /* estruturas */
 typedef struct ProtDistControl_st {
 	uint32_t	dropped_frames;	/* counter32 */
@@ -91,8 +93,10 @@ int pdist_stats_tabela_busca_octets(const unsigned int indice, uint32_t *copia);
 
 int protdist_stats_deleteEntry(const unsigned int index_control,
 	const unsigned int index_stats);
-int pdist_update(const unsigned int, const unsigned int, const uint32_t,
-		const uint32_t);
+int pdist_update(const unsigned int, const unsigned int, const unsigned int,
+		const uint32_t, const uint32_t, struct fluxo_s *);
+int pdist_consolida_soma(const unsigned int, const unsigned int,
+		const uint32_t, const uint32_t);
 
 int pdist_stats_tabela_prepara();
 int pdist_stats_tabela_primeiro();
@@ -33,7 +33,20 @@
 
 /*
  *  Thanks Felipe W. Damasio for this macro
+ *
+ *  On x86-64 "=A" is a single 64-bit register, not EDX:EAX, so both halves
+ *  must be read separately there.
  */
+#if defined(__x86_64__)
+#define rdtsc(ticks) \
+	do { \
+		uint32_t __rdtsc_lo, __rdtsc_hi; \
+		__asm__ volatile (".byte 0x0f, 0x31" \
+				: "=a" (__rdtsc_lo), "=d" (__rdtsc_hi)); \
+		(ticks) = ((uint64_t)__rdtsc_hi << 32) | __rdtsc_lo; \
+	} while (0)
+#else
 #define rdtsc(ticks) \
 	__asm__ volatile (".byte 0x0f, 0x31" : "=A" (ticks));
+#endif
 
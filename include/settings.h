@@ -20,4 +20,30 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
-char *conf_get_interface();
+#ifndef __SETTINGS_H
+#define __SETTINGS_H
+
+/** \brief Where the agent configuration lives */
+#define CONF_ARQUIVO		"/etc/rmon2/rmon2.conf"
+
+/* values accepted by the "capture" key */
+#define CONF_CAPTURE_PCAP	"pcap"
+#define CONF_CAPTURE_TPACKET	"tpacket"
+#define CONF_CAPTURE_AF_XDP	"af_xdp"
+#define CONF_CAPTURE_NONE	"none"
+
+/* values accepted by the "aggregation" key */
+#define CONF_AGGREGATION_USER	"user"
+#define CONF_AGGREGATION_EBPF	"ebpf"
+
+unsigned int conf_get_interfaces(char **nomes, const unsigned int max);
+unsigned int conf_get_cpus(const char *chave, unsigned int *cpus,
+		const unsigned int max);
+int conf_get_isolate_snmp();
+char *conf_get_capture();
+char *conf_get_aggregation();
+unsigned int conf_get_workers();
+unsigned int conf_get_sampling();
+unsigned int conf_get_dedup_window();
+
+#endif /* __SETTINGS_H */
@@ -0,0 +1,65 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SHARDS_H
+#define __SHARDS_H
+
+/** \brief Maximum number of accounting workers */
+#define MAX_WORKERS	32
+
+/* the two steps of the tables' *_antecipa(), for a batch of packets: first
+   the slot of a key in the worker's shard, then the entry it points at */
+#define ANTECIPA_POSICAO	0
+#define ANTECIPA_ENTRADA	1
+
+int shards_inicializa(const unsigned int workers);
+int shards_aloca(const unsigned int worker);
+void shards_ativa();
+unsigned int shards_quantidade();
+void shards_trava(const unsigned int worker);
+void shards_destrava(const unsigned int worker);
+void shards_consolida();
+
+/* implemented by each sharded table */
+int nlhost_shard_aloca(const unsigned int worker);
+void nlhost_consolida_zera();
+void nlhost_consolida(const unsigned int worker);
+int alhost_shard_aloca(const unsigned int worker);
+void alhost_consolida_zera();
+void alhost_consolida(const unsigned int worker);
+int nlmatrix_SD_shard_aloca(const unsigned int worker);
+void nlmatrix_SD_consolida_zera();
+void nlmatrix_SD_consolida(const unsigned int worker);
+int nlmatrix_DS_shard_aloca(const unsigned int worker);
+void nlmatrix_DS_consolida_zera();
+void nlmatrix_DS_consolida(const unsigned int worker);
+int almatrix_SD_shard_aloca(const unsigned int worker);
+void almatrix_SD_consolida_zera();
+void almatrix_SD_consolida(const unsigned int worker);
+int almatrix_DS_shard_aloca(const unsigned int worker);
+void almatrix_DS_consolida_zera();
+void almatrix_DS_consolida(const unsigned int worker);
+int pdist_shard_aloca(const unsigned int worker);
+void pdist_consolida_zera();
+void pdist_consolida(const unsigned int worker);
+
+#endif /* __SHARDS_H */
@@ -23,6 +23,8 @@
 #ifndef __STATEFUL_H
 #define __STATEFUL_H
 
+#include <stdint.h>
+
 /*
  *  forward type declarations
  */
@@ -217,7 +219,7 @@ struct instancia_s {
  */
 struct li_inst_s {
 	li_inst_t	*li_prox;
-	unsigned int	validade_ms;	/* deadline for this pendency, in miliseconds
+	uint64_t	validade_ms;	/* deadline for this pendency, in miliseconds
 	and in system uptime 'format' */
 	estado_t	*pendente_ptr;	/* which state is pending */
 	traco_t		*traco_ptr;
@@ -23,8 +23,12 @@
 #ifndef _SYSUPTIME_H
 #define _SYSUPTIME_H
 
+#include <stdint.h>
+
 int init_sysuptime();
 unsigned long sysuptime();
-unsigned long sysuptime_mili();
+uint64_t sysuptime_mili();
+void sysuptime_lote();
+void sysuptime_define(const uint64_t mili);
 
 #endif /* _SYSUPTIME_H */
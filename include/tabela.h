@@ -0,0 +1,225 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __TABELA_H
+#define __TABELA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#define TABELA_SIMD	1
+#include <emmintrin.h>
+#else
+#define TABELA_SIMD	0
+#endif
+
+/** \brief Slots whose control bytes are compared at once */
+#define TABELA_GRUPO	16
+
+/* the control byte of a slot: never used, freed (probes go on past it), or
+   the high bit and 7 bits of the hash of its entry */
+#define TABELA_VAZIO	0x00
+#define TABELA_APAGADO	0x01
+#define TABELA_OCUPADO	0x80
+
+/** \brief Entries a table of \a posicoes slots takes before refusing more */
+#define TABELA_MAXIMO(posicoes)	((posicoes) / 8 * 7)
+
+/** \brief A hash table of fixed capacity, with its entries inline.
+ *
+ *  Entries never move, so pointers to them stay valid until removed.
+ */
+typedef struct tabela_s {
+	uint8_t		*controle;	/* one byte per slot */
+	unsigned char	*entradas;
+	size_t		 tamanho;	/* of an entry */
+	unsigned int	 posicoes;	/* power of 2, TABELA_GRUPO at least */
+	unsigned int	 maximo;
+	unsigned int	 quantidade;
+	unsigned int	 profundidade;	/* longest probe of an insertion, in
+					   groups past the first */
+} tabela_t;
+
+/** \brief Defines a table \a nome of \a posicoes entries of \a tipo in
+ *  static storage; like any static array, it costs no memory until used. */
+#define TABELA_ESTATICA(nome, tipo, posicoes) \
+	static uint8_t nome##_controle[posicoes] __attribute__((aligned(64))); \
+	static tipo nome##_entradas[posicoes] __attribute__((aligned(64))); \
+	static tabela_t nome = { nome##_controle, \
+		(unsigned char *)nome##_entradas, sizeof(tipo), (posicoes), \
+		TABELA_MAXIMO(posicoes), 0, 0 }
+
+/** \brief Walks the occupied \a slot of \a t */
+#define TABELA_PERCORRE(t, slot) \
+	for ((slot) = tabela_proximo((t), 0); (slot) < (t)->posicoes; \
+			(slot) = tabela_proximo((t), (slot) + 1))
+
+
+tabela_t *tabela_cria(const size_t tamanho, const unsigned int posicoes);
+unsigned int tabela_insere(tabela_t *t, const uint32_t hash);
+void tabela_remove(tabela_t *t, const unsigned int slot);
+unsigned int tabela_proximo(const tabela_t *t, unsigned int slot);
+
+
+/** \brief Spreads a key over the 32 bits: the group comes from the high
+ *  ones, the control byte from the low 7. */
+static inline uint32_t
+tabela_hash(const uint32_t chave)
+{
+	uint64_t	x = chave * 0x9e3779b97f4a7c15ULL;
+
+	return (uint32_t)(x >> 32) ^ (uint32_t)x;
+}
+
+
+/* bit i set: byte i of the group at `c' is `byte' */
+static inline unsigned int
+tabela_iguais(const uint8_t *c, const uint8_t byte)
+{
+#if TABELA_SIMD
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *)c),
+				_mm_set1_epi8((char)byte)));
+#else
+	unsigned int	bits = 0;
+	unsigned int	i;
+
+	for (i = 0; i < TABELA_GRUPO; i++)
+		bits |= (unsigned int)(c[i] == byte) << i;
+	return bits;
+#endif
+}
+
+
+/* bit i set: slot i of the group at `c' holds an entry */
+static inline unsigned int
+tabela_ocupados(const uint8_t *c)
+{
+#if TABELA_SIMD
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)c));
+#else
+	unsigned int	bits = 0;
+	unsigned int	i;
+
+	for (i = 0; i < TABELA_GRUPO; i++)
+		bits |= (unsigned int)(c[i] >> 7) << i;
+	return bits;
+#endif
+}
+
+
+/* the first group probed for `hash' */
+static inline unsigned int
+tabela_grupo(const tabela_t *t, const uint32_t hash)
+{
+	return (hash >> 7) & (t->posicoes / TABELA_GRUPO - 1);
+}
+
+/* the group probed after `grupo', at step `passo'; with triangular steps
+   every group is probed once */
+static inline unsigned int
+tabela_seguinte(const tabela_t *t, const unsigned int grupo,
+		const unsigned int passo)
+{
+	return (grupo + passo + 1) & (t->posicoes / TABELA_GRUPO - 1);
+}
+
+
+static inline void *
+tabela_entrada(const tabela_t *t, const unsigned int slot)
+{
+	return t->entradas + (size_t)slot * t->tamanho;
+}
+
+
+/** \brief Whether \a slot is inside \a t and holds an entry */
+static inline int
+tabela_ocupada(const tabela_t *t, const unsigned int slot)
+{
+	return (slot < t->posicoes) &&
+		((t->controle[slot] & TABELA_OCUPADO) != 0);
+}
+
+
+/** \brief Looks up the entry \a confere() says is \a chave, among those
+ *  whose key gave \a hash.
+ *
+ *  \return Its slot, or \a t->posicoes if there is none.
+ */
+static inline unsigned int
+tabela_busca(const tabela_t *t, const uint32_t hash,
+		int (*confere)(const void *entrada, const void *chave),
+		const void *chave)
+{
+	const uint8_t	 marca = TABELA_OCUPADO | (hash & 0x7f);
+	const uint8_t	*c;
+	unsigned int	 grupo = tabela_grupo(t, hash);
+	unsigned int	 passo;
+	unsigned int	 bits;
+	unsigned int	 slot;
+
+	for (passo = 0; passo <= t->profundidade; passo++) {
+		c = t->controle + grupo * TABELA_GRUPO;
+		for (bits = tabela_iguais(c, marca); bits != 0;
+				bits &= bits - 1) {
+			slot = grupo * TABELA_GRUPO + __builtin_ctz(bits);
+			if (confere(tabela_entrada(t, slot), chave))
+				return slot;
+		}
+
+		/* an insertion would have stopped here */
+		if (tabela_iguais(c, TABELA_VAZIO) != 0)
+			break;
+		grupo = tabela_seguinte(t, grupo, passo);
+	}
+
+	return t->posicoes;
+}
+
+
+/** \brief Prefetches the control bytes tabela_busca() first looks at */
+static inline void
+tabela_antecipa_grupo(const tabela_t *t, const uint32_t hash)
+{
+	__builtin_prefetch(t->controle + tabela_grupo(t, hash) * TABELA_GRUPO,
+			0, 3);
+}
+
+
+/** \brief Prefetches, to be written, the first entry of the first group
+ *  whose control byte matches \a hash */
+static inline void
+tabela_antecipa_entrada(const tabela_t *t, const uint32_t hash)
+{
+	unsigned int	grupo = tabela_grupo(t, hash);
+	unsigned int	bits;
+
+	bits = tabela_iguais(t->controle + grupo * TABELA_GRUPO,
+			TABELA_OCUPADO | (hash & 0x7f));
+	if (bits != 0)
+		__builtin_prefetch(tabela_entrada(t,
+					grupo * TABELA_GRUPO +
+					__builtin_ctz(bits)), 1, 3);
+}
+
+#endif /* __TABELA_H */
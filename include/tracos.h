@@ -40,5 +40,5 @@ traco_t *tracos_localiza_por_id(const unsigned int id);
 
 traco_t *tracos_localiza_corrige_id(const unsigned int id);
 
-int tracos_verifica(pedb_t *prepacote, unsigned char *area_dados_ptr);
+int tracos_verifica(pedb_t *prepacote, const unsigned char *area_dados_ptr);
 
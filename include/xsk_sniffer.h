@@ -0,0 +1,42 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XSK_SNIFFER_H
+#define __XSK_SNIFFER_H
+
+#include <stdint.h>
+
+/** \brief A frame received through AF_XDP, still inside the UMEM */
+typedef struct xsk_quadro_s {
+	const uint8_t	*dados;
+	uint32_t	 tam;
+	uint64_t	 endereco;	/* UMEM offset, needed to recycle it */
+} xsk_quadro_t;
+
+int xsk_open_interface_by_name(const char *if_name);
+unsigned int xsk_recebe(const int sniffer, xsk_quadro_t *quadros,
+		const unsigned int max, const int timeout_ms);
+void xsk_libera(const int sniffer, const xsk_quadro_t *quadros);
+int xsk_estatisticas(const int sniffer, uint32_t *descartes);
+void xsk_close(const int sniffer);
+
+#endif /* __XSK_SNIFFER_H */
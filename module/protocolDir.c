@@ -55,6 +55,30 @@ static pthread_t thr_servidor;
 #endif
 
 
+/*
+ * snmpd rereads its configuration on SIGHUP, and protocolDir follows; the
+ * first read is at startup, right after init_protocolDir(), so it is skipped.
+ */
+static int
+protocolDir_recarrega(int majorID, int minorID, void *serverarg,
+                      void *clientarg)
+{
+    static int primeira = 1;
+
+    if (primeira) {
+	primeira = 0;
+	return SNMP_ERR_NOERROR;
+    }
+
+    if (pdir_recarrega(NULL) != SUCCESS)
+	snmp_log(LOG_ERR, "protocolDir: reload failed, table left as it was\n");
+    else
+	snmp_log(LOG_INFO, "protocolDir reloaded\n");
+
+    return SNMP_ERR_NOERROR;
+}
+
+
 /** \brief Initialize the protocolDirTable table by defining its contents and
  * how it's structured.
  */
@@ -134,6 +158,9 @@ init_protocolDir(void)
 #endif
 
     initialize_table_protocolDirTable();
+    snmp_register_callback(SNMP_CALLBACK_LIBRARY,
+                           SNMP_CALLBACK_POST_READ_CONFIG,
+                           protocolDir_recarrega, NULL);
 
     snmp_log(LOG_INFO, "success: protocolDir initialized\n");
 }
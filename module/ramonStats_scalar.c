@@ -0,0 +1,223 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2003 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+/*
+ * Agent-specific scalars, which are not part of RMON2: they tell managers
+ * how far the tables can be trusted.  Registered under the experimental
+ * arc, 1.3.6.1.3.2021 (named after the RFC), until the agent has a MIB of
+ * its own:
+ *
+ *	ramonSamplingRate	.1.0	Gauge32, N of the 1-in-N sampling (1 is
+ *					no sampling, the counters are exact)
+ *	ramonShedLevel		.2.0	Gauge32, current load shedding level:
+ *					0 none, 1 no PTSL, 2 no matrices either,
+ *					3 no hosts either (protocolDist only)
+ *	ramonShedTracePkts	.3.0	Counter32, packets not seen by PTSL
+ *	ramonShedMatrixPkts	.4.0	Counter32, packets not in the matrices
+ *	ramonShedHostPkts	.5.0	Counter32, packets not in the hosts
+ *	ramonDuplicatePkts	.6.0	Counter32, repeated frames dropped
+ *	ramonProtocolDirReload	.7.0	Integer32, read-write: how many times
+ *					protocolDir was reloaded; setting it
+ *					to 1 reloads it from its file
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <net-snmp/agent/net-snmp-agent-includes.h>
+#include "ramonStats_scalar.h"
+
+#include "conversor.h"
+#include "duplicatas.h"
+#include "protocoldir.h"
+#include "exit_codes.h"
+
+
+#define RAMONSTATS_OID(n)	{ 1, 3, 6, 1, 3, 2021, n, 0 }
+
+
+static void
+registra(const char *nome, Netsnmp_Node_Handler *handler, oid *id,
+         size_t tam)
+{
+    netsnmp_register_read_only_instance(netsnmp_create_handler_registration
+                                        (nome, handler, id, tam,
+                                         HANDLER_CAN_RONLY));
+}
+
+
+/** Initializes the ramonStats_scalar module */
+void
+init_ramonStats_scalar(void)
+{
+    static oid ramonSamplingRate_oid[] = RAMONSTATS_OID(1);
+    static oid ramonShedLevel_oid[] = RAMONSTATS_OID(2);
+    static oid ramonShedTracePkts_oid[] = RAMONSTATS_OID(3);
+    static oid ramonShedMatrixPkts_oid[] = RAMONSTATS_OID(4);
+    static oid ramonShedHostPkts_oid[] = RAMONSTATS_OID(5);
+    static oid ramonDuplicatePkts_oid[] = RAMONSTATS_OID(6);
+    static oid ramonProtocolDirReload_oid[] = RAMONSTATS_OID(7);
+
+    DEBUGMSGTL(("ramonStats_scalar", "Initializing\n"));
+
+    registra("ramonSamplingRate", get_ramonSamplingRate,
+             ramonSamplingRate_oid, OID_LENGTH(ramonSamplingRate_oid));
+    registra("ramonShedLevel", get_ramonShedLevel,
+             ramonShedLevel_oid, OID_LENGTH(ramonShedLevel_oid));
+    registra("ramonShedTracePkts", get_ramonShedTracePkts,
+             ramonShedTracePkts_oid, OID_LENGTH(ramonShedTracePkts_oid));
+    registra("ramonShedMatrixPkts", get_ramonShedMatrixPkts,
+             ramonShedMatrixPkts_oid, OID_LENGTH(ramonShedMatrixPkts_oid));
+    registra("ramonShedHostPkts", get_ramonShedHostPkts,
+             ramonShedHostPkts_oid, OID_LENGTH(ramonShedHostPkts_oid));
+    registra("ramonDuplicatePkts", get_ramonDuplicatePkts,
+             ramonDuplicatePkts_oid, OID_LENGTH(ramonDuplicatePkts_oid));
+    netsnmp_register_instance(netsnmp_create_handler_registration
+                              ("ramonProtocolDirReload",
+                               do_ramonProtocolDirReload,
+                               ramonProtocolDirReload_oid,
+                               OID_LENGTH(ramonProtocolDirReload_oid),
+                               HANDLER_CAN_RWRITE));
+}
+
+
+/* answers a GET with `valor', of type `tipo' */
+static int
+responde(netsnmp_agent_request_info *reqinfo,
+         netsnmp_request_info *requests, const u_char tipo, u_long valor)
+{
+    switch (reqinfo->mode) {
+	case MODE_GET:
+	    snmp_set_var_typed_value(requests->requestvb, tipo,
+				     (u_char *)&valor, sizeof(valor));
+	    break;
+
+
+	default:
+	    return SNMP_ERR_GENERR;
+    }
+
+    return SNMP_ERR_NOERROR;
+}
+
+
+int
+get_ramonSamplingRate(netsnmp_mib_handler *handler,
+                      netsnmp_handler_registration *reginfo,
+                      netsnmp_agent_request_info *reqinfo,
+                      netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_GAUGE, conversor_amostragem());
+}
+
+
+int
+get_ramonShedLevel(netsnmp_mib_handler *handler,
+                   netsnmp_handler_registration *reginfo,
+                   netsnmp_agent_request_info *reqinfo,
+                   netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_GAUGE, conversor_corte());
+}
+
+
+int
+get_ramonShedTracePkts(netsnmp_mib_handler *handler,
+                       netsnmp_handler_registration *reginfo,
+                       netsnmp_agent_request_info *reqinfo,
+                       netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_COUNTER,
+                    conversor_cortados(CORTE_TRACOS));
+}
+
+
+int
+get_ramonShedMatrixPkts(netsnmp_mib_handler *handler,
+                        netsnmp_handler_registration *reginfo,
+                        netsnmp_agent_request_info *reqinfo,
+                        netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_COUNTER,
+                    conversor_cortados(CORTE_MATRIZES));
+}
+
+
+int
+get_ramonShedHostPkts(netsnmp_mib_handler *handler,
+                      netsnmp_handler_registration *reginfo,
+                      netsnmp_agent_request_info *reqinfo,
+                      netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_COUNTER,
+                    conversor_cortados(CORTE_HOSTS));
+}
+
+
+int
+get_ramonDuplicatePkts(netsnmp_mib_handler *handler,
+                       netsnmp_handler_registration *reginfo,
+                       netsnmp_agent_request_info *reqinfo,
+                       netsnmp_request_info *requests)
+{
+    return responde(reqinfo, requests, ASN_COUNTER, duplicatas_removidas());
+}
+
+
+int
+do_ramonProtocolDirReload(netsnmp_mib_handler *handler,
+                          netsnmp_handler_registration *reginfo,
+                          netsnmp_agent_request_info *reqinfo,
+                          netsnmp_request_info *requests)
+{
+    switch (reqinfo->mode) {
+	case MODE_GET:
+	    return responde(reqinfo, requests, ASN_INTEGER, pdir_recargas());
+
+	case MODE_SET_RESERVE1:
+	    if (requests->requestvb->type != ASN_INTEGER)
+		netsnmp_set_request_error(reqinfo, requests,
+					  SNMP_ERR_WRONGTYPE);
+	    else if (*requests->requestvb->val.integer != 1)
+		netsnmp_set_request_error(reqinfo, requests,
+					  SNMP_ERR_WRONGVALUE);
+	    break;
+
+	case MODE_SET_ACTION:
+	    /* on failure, the table is left as it was: nothing to undo */
+	    if (pdir_recarrega(NULL) != SUCCESS)
+		netsnmp_set_request_error(reqinfo, requests,
+					  SNMP_ERR_GENERR);
+	    break;
+
+	case MODE_SET_RESERVE2:
+	case MODE_SET_FREE:
+	case MODE_SET_COMMIT:
+	case MODE_SET_UNDO:
+	    break;
+
+	default:
+	    return SNMP_ERR_GENERR;
+    }
+
+    return SNMP_ERR_NOERROR;
+}
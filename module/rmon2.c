@@ -31,7 +31,9 @@
 
 #include "rmon2.h"
 #include "sysuptime.h"
+#include "afinidade.h"
 #include "protocolDir_scalar.h"
+#include "ramonStats_scalar.h"
 #include "protocolDir.h"
 #include "protocolDist.h"
 #include "nlHost.h"
@@ -59,6 +61,9 @@ init_rmon2()
 		return;
 	}
 
+	/* before any thread is created, as they inherit our CPUs */
+	afinidade_inicializa();
+
 	init_protocolDir_scalar();
 	init_protocolDir();
 	init_protocolDist();
@@ -66,6 +71,7 @@ init_rmon2()
 	init_alHost();
 	init_nlMatrix();
 	init_alMatrix();
+	init_ramonStats_scalar();
 
 	snmp_log(LOG_INFO, "rmon2: initialized.\n");
 }
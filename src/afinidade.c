@@ -0,0 +1,269 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file afinidade.c
+ *
+ *  CPU and NUMA placement of the agent threads.  rmon2.conf can give a CPU
+ *  list to each kind of thread (cpu_capture, cpu_accounting, cpu_ptsl and
+ *  cpu_snmp).  Accounting workers take one CPU of their list each, in turn;
+ *  the other threads may run on any CPU of theirs.  Threads inherit the
+ *  placement of their creator, which is snmpd's own thread in the module, so
+ *  a thread without a list is given back the mask the agent started with,
+ *  less the cpu_snmp CPUs when cpu_isolate_snmp is set.
+ *
+ *  When every CPU of a thread is on the same NUMA node, the thread also
+ *  prefers that node for its memory: the table shards, allocated by the
+ *  workers themselves, and their entries then stay local to the worker.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "settings.h"
+#include "afinidade.h"
+#include "log.h"
+
+
+#ifdef __linux__
+
+/** \brief Maximum number of CPUs in a list */
+#define AFINIDADE_CPUS	256
+
+/** \brief Placement of one kind of thread */
+typedef struct afinidade_papel_s {
+	const char	*chave;		/**< rmon2.conf key */
+	const char	*nome;		/**< for the log */
+	unsigned int	cpus[AFINIDADE_CPUS];
+	unsigned int	qtd;		/**< 0: not configured */
+} afinidade_papel_t;
+
+static afinidade_papel_t	papeis[AFINIDADE_PAPEIS] = {
+	{ "cpu_capture",	"capture",	{ 0 }, 0 },
+	{ "cpu_accounting",	"accounting",	{ 0 }, 0 },
+	{ "cpu_ptsl",		"PTSL server",	{ 0 }, 0 },
+	{ "cpu_snmp",		"SNMP",		{ 0 }, 0 },
+};
+
+/** \brief Mask of the thread which started the agent, for the others */
+static cpu_set_t	afinidade_livre;
+/** \brief Whether afinidade_inicializa() ran */
+static int		afinidade_pronta;
+
+
+/* NUMA node of a CPU, or -1 if the kernel doesn't say */
+static int
+afinidade_no(const unsigned int cpu)
+{
+	char		caminho[64];
+	DIR		*dir;
+	struct dirent	*d;
+	int		no = -1;
+
+	snprintf(caminho, sizeof(caminho), "/sys/devices/system/cpu/cpu%u", cpu);
+	dir = opendir(caminho);
+	if (dir == NULL)
+		return -1;
+
+	while ((d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "node", 4) == 0) {
+			no = atoi(d->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return no;
+}
+
+
+/* writes a mask as a CPU list ("0-3,8") */
+static void
+afinidade_descreve(const cpu_set_t *cpus, char *texto, const size_t tam)
+{
+	unsigned int	c;
+	unsigned int	ultima;
+	size_t		usado = 0;
+
+	texto[0] = '\0';
+	for (c = 0; (c < CPU_SETSIZE) && (usado < tam); c++) {
+		if (!CPU_ISSET(c, cpus))
+			continue;
+
+		for (ultima = c; (ultima + 1 < CPU_SETSIZE) &&
+				CPU_ISSET(ultima + 1, cpus); ultima++)
+			;
+
+		if (ultima == c)
+			usado += snprintf(texto + usado, tam - usado, "%s%u",
+					usado ? "," : "", c);
+		else
+			usado += snprintf(texto + usado, tam - usado, "%s%u-%u",
+					usado ? "," : "", c, ultima);
+		c = ultima;
+	}
+}
+
+
+/*
+ * places the calling thread on `cpus', prefers their node for memory if they
+ * share one, and logs where it ended up
+ */
+static void
+afinidade_fixa(const char *nome, const unsigned int indice,
+		cpu_set_t *cpus)
+{
+	char		texto[128];
+	unsigned long	nos;
+	unsigned int	c;
+	int		no = -2;	/* none seen yet */
+	int		este;
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) != 0)
+		Debug("%s thread %u: could not set its CPUs", nome, indice);
+
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) != 0)
+		return;
+
+	for (c = 0; c < CPU_SETSIZE; c++) {
+		if (!CPU_ISSET(c, cpus))
+			continue;
+		este = afinidade_no(c);
+		if ((este < 0) || ((no != -2) && (este != no))) {
+			no = -1;
+			break;
+		}
+		no = este;
+	}
+
+	if ((no >= 0) && (no < (int)(8 * sizeof(nos)))) {
+		nos = 1UL << no;
+		if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nos,
+					8 * sizeof(nos)) != 0)
+			no = -1;
+	}
+
+	afinidade_descreve(cpus, texto, sizeof(texto));
+	if (no >= 0)
+		Debug("%s thread %u on CPUs %s, memory from node %d",
+				nome, indice, texto, no);
+	else
+		Debug("%s thread %u on CPUs %s", nome, indice, texto);
+}
+
+
+/** \brief Reads the placement from rmon2.conf and places the calling thread.
+ *
+ *  Must be called from the thread answering SNMP requests (snmpd's own, in
+ *  the module), before any other thread of the agent is created.
+ */
+void
+afinidade_inicializa()
+{
+	afinidade_papel_t	*p;
+	unsigned int		lidas;
+	unsigned int		c;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &afinidade_livre) != 0)
+		return;
+
+	for (p = papeis; p < papeis + AFINIDADE_PAPEIS; p++) {
+		lidas = conf_get_cpus(p->chave, p->cpus, AFINIDADE_CPUS);
+		p->qtd = 0;
+		for (c = 0; c < lidas; c++) {
+			if (p->cpus[c] < CPU_SETSIZE)
+				p->cpus[p->qtd++] = p->cpus[c];
+			else
+				Debug("%s: CPU %u ignored", p->chave, p->cpus[c]);
+		}
+	}
+
+	if (conf_get_isolate_snmp()) {
+		p = &papeis[AFINIDADE_SNMP];
+		for (c = 0; c < p->qtd; c++)
+			CPU_CLR(p->cpus[c], &afinidade_livre);
+		if (CPU_COUNT(&afinidade_livre) == 0) {
+			Debug("cpu_snmp takes every CPU, not isolating it");
+			sched_getaffinity(0, sizeof(cpu_set_t), &afinidade_livre);
+		}
+	}
+
+	afinidade_pronta = 1;
+	afinidade_aplica(AFINIDADE_SNMP, 0);
+}
+
+
+/** \brief Places the calling thread, according to its kind.
+ *
+ *  \param papel	One of the AFINIDADE_ kinds of thread.
+ *  \param indice	Which worker, for AFINIDADE_CONTABIL (0 otherwise).
+ */
+void
+afinidade_aplica(const unsigned int papel, const unsigned int indice)
+{
+	afinidade_papel_t	*p;
+	cpu_set_t		cpus;
+	unsigned int		c;
+
+	if (!afinidade_pronta || (papel >= AFINIDADE_PAPEIS))
+		return;
+	p = &papeis[papel];
+
+	if (p->qtd == 0) {
+		cpus = afinidade_livre;
+	}
+	else if (papel == AFINIDADE_CONTABIL) {
+		CPU_ZERO(&cpus);
+		CPU_SET(p->cpus[indice % p->qtd], &cpus);
+	}
+	else {
+		CPU_ZERO(&cpus);
+		for (c = 0; c < p->qtd; c++)
+			CPU_SET(p->cpus[c], &cpus);
+	}
+
+	afinidade_fixa(p->nome, indice, &cpus);
+}
+
+#else	/* !__linux__ */
+
+void
+afinidade_inicializa()
+{
+}
+
+
+void
+afinidade_aplica(const unsigned int papel, const unsigned int indice)
+{
+}
+
+#endif	/* __linux__ */
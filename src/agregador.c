@@ -0,0 +1,766 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file agregador.c
+ *
+ *  In-kernel aggregation of protocolDist and nlHost.  An XDP program attached
+ *  to each monitored interface classifies IPv4 frames like pkt_decode() and
+ *  pkt_process() do, and adds them to per-CPU BPF hash maps; the frame then
+ *  goes on up the stack, and is never copied to the agent.  When the SNMP
+ *  side walks one of these tables, the maps are summed over the CPUs and
+ *  translated into protocolDir local indexes.
+ *
+ *  The kernel keeps one counter per (transport, port) class, port being the
+ *  known application port of the frame (source first, then destination) or
+ *  0; ether2.ipv4 and each transport are the sums of their classes.
+ *
+ *  Like xsk_sniffer.c, no libbpf: the program is assembled here.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "rowstatus.h"
+
+#if PTSL
+#include "stateful.h"
+#endif
+
+#include "pedb.h"
+#include "protocoldir.h"
+#include "protocoldist.h"
+#include "hlhost.h"
+#include "nlhost.h"
+#include "sysuptime.h"
+#include "shards.h"
+#include "agregador.h"
+#include "log.h"
+
+
+/*
+ *  local defines
+ */
+
+/** \brief Counters of a (transport, port) class, per CPU */
+typedef struct agregador_protocolo_s {
+	uint64_t	pkts;
+	uint64_t	octets;
+} agregador_protocolo_t;
+
+/** \brief Counters of an IPv4 address, per CPU */
+typedef struct agregador_host_s {
+	uint64_t	in_pkts;
+	uint64_t	in_octets;
+	uint64_t	out_pkts;
+	uint64_t	out_octets;
+	uint64_t	out_bcast;
+	uint64_t	visto;		/* CLOCK_MONOTONIC, nanoseconds */
+} agregador_host_t;
+
+/** \brief The maps and program of one interface */
+typedef struct agregador_s {
+	unsigned int	controle;	/* protocolDist/hlHost control index */
+	int		portas_fd;	/* (transport << 16) | port -> 1 */
+	int		protocolos_fd;	/* class -> agregador_protocolo_t */
+	int		hosts_fd;	/* IPv4 address -> agregador_host_t */
+	int		prog_fd;
+	int		link_fd;	/* closing it detaches the program */
+} agregador_t;
+
+/* stack of the XDP program (offsets from r10) */
+#define PILHA_CLASSE	-8
+#define PILHA_DESTINO	-12
+#define PILHA_ORIGEM	-16
+#define PILHA_DPORT	-20
+#define PILHA_SPORT	-24
+#define PILHA_AGORA	-32
+#define PILHA_ZEROS	-80	/* sizeof(agregador_host_t) zeroes */
+
+/* instructions, numbered registers */
+#define I_MOV_REG(d, s)		{ .code = BPF_ALU64 | BPF_MOV | BPF_X, \
+	.dst_reg = d, .src_reg = s }
+#define I_MOV_IMM(d, i)		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, \
+	.dst_reg = d, .imm = i }
+#define I_ALU_REG(op, d, s)	{ .code = BPF_ALU64 | BPF_##op | BPF_X, \
+	.dst_reg = d, .src_reg = s }
+#define I_ALU_IMM(op, d, i)	{ .code = BPF_ALU64 | BPF_##op | BPF_K, \
+	.dst_reg = d, .imm = i }
+#define I_LDX(t, d, s, o)	{ .code = BPF_LDX | BPF_MEM | BPF_##t, \
+	.dst_reg = d, .src_reg = s, .off = o }
+#define I_STX(t, d, s, o)	{ .code = BPF_STX | BPF_MEM | BPF_##t, \
+	.dst_reg = d, .src_reg = s, .off = o }
+#define I_JMP_REG(op, d, s, o)	{ .code = BPF_JMP | BPF_##op | BPF_X, \
+	.dst_reg = d, .src_reg = s, .off = o }
+#define I_JMP_IMM(op, d, i, o)	{ .code = BPF_JMP | BPF_##op | BPF_K, \
+	.dst_reg = d, .imm = i, .off = o }
+#define I_JMP32_IMM(op, d, i, o) { .code = BPF_JMP32 | BPF_##op | BPF_K, \
+	.dst_reg = d, .imm = i, .off = o }
+#define I_JA(o)			{ .code = BPF_JMP | BPF_JA, .off = o }
+#define I_CALL(f)		{ .code = BPF_JMP | BPF_CALL, \
+	.imm = BPF_FUNC_##f }
+#define I_EXIT()		{ .code = BPF_JMP | BPF_EXIT }
+/* 64 bit immediate, takes two slots */
+#define I_LD_MAPA(d, fd)	{ .code = BPF_LD | BPF_DW | BPF_IMM, \
+	.dst_reg = d, .src_reg = BPF_PSEUDO_MAP_FD, .imm = fd }, { .code = 0 }
+
+/*
+ *  r0 = &mapa[r10 + chave], inserting zeroes first if it is missing; if that
+ *  fails too, jumps `falha' instructions past the block.  20 instructions.
+ */
+#define I_OBTEM(mapa, chave, falha) \
+	I_LD_MAPA(1, mapa), \
+	I_MOV_REG(2, 10), \
+	I_ALU_IMM(ADD, 2, chave), \
+	I_CALL(map_lookup_elem), \
+	I_JMP_IMM(JNE, 0, 0, 14), \
+	I_LD_MAPA(1, mapa), \
+	I_MOV_REG(2, 10), \
+	I_ALU_IMM(ADD, 2, chave), \
+	I_MOV_REG(3, 10), \
+	I_ALU_IMM(ADD, 3, PILHA_ZEROS), \
+	I_MOV_IMM(4, BPF_NOEXIST), \
+	I_CALL(map_update_elem), \
+	I_LD_MAPA(1, mapa), \
+	I_MOV_REG(2, 10), \
+	I_ALU_IMM(ADD, 2, chave), \
+	I_CALL(map_lookup_elem), \
+	I_JMP_IMM(JEQ, 0, 0, falha)
+
+#define PROTO(c)	offsetof(agregador_protocolo_t, c)
+#define HOST(c)		offsetof(agregador_host_t, c)
+
+
+/*
+ *  global variables
+ */
+static agregador_t	agregadores[MAX_INTERFACES];
+static unsigned int	agregadores_qtd;
+/* possible CPUs, one value each in a per-CPU map */
+static unsigned int	cpus;
+/* application ports of the protocolDir, sorted */
+static uint32_t		portas[AGREGADOR_PORTAS];
+static unsigned int	portas_qtd;
+
+
+static inline int
+sys_bpf(const int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/** \brief Loads the XDP program of an interface.
+ *
+ *  Roughly:
+ *  \code
+ *  if (not ether2.ipv4 or not TCP, UDP nor ICMP) return XDP_PASS;
+ *  classe = proto << 16;
+ *  if (portas[proto, sport]) classe |= sport;
+ *  else if (portas[proto, dport]) classe |= dport;
+ *  protocolos[classe] += { 1, len };
+ *  if (!broadcast) hosts[daddr].in += { 1, len };
+ *  hosts[saddr].out += { 1, len, broadcast };
+ *  return XDP_PASS;
+ *  \endcode
+ *  r6 holds the frame length, r7 the class and r8 the broadcast flag.
+ */
+static int
+agregador_carrega_programa(const agregador_t *a)
+{
+	struct bpf_insn	programa[] = {
+		/* 0: r6 = bpf_xdp_get_buff_len(ctx) */
+		I_MOV_REG(6, 1),
+		I_CALL(xdp_get_buff_len),
+		I_MOV_REG(1, 6),
+		I_MOV_REG(6, 0),
+		/* 4: r2 = data, r3 = data_end; ethernet + IPv4 must be there */
+		I_LDX(W, 2, 1, offsetof(struct xdp_md, data)),
+		I_LDX(W, 3, 1, offsetof(struct xdp_md, data_end)),
+		I_MOV_REG(4, 2),
+		I_ALU_IMM(ADD, 4, 34),
+		I_JMP_REG(JGT, 4, 3, 157),
+		/* 9: ether_type 0x0800, IP version 4 */
+		I_LDX(B, 4, 2, 12),
+		I_JMP_IMM(JNE, 4, 0x08, 155),
+		I_LDX(B, 4, 2, 13),
+		I_JMP_IMM(JNE, 4, 0x00, 153),
+		I_LDX(B, 4, 2, 14),
+		I_MOV_REG(5, 4),
+		I_ALU_IMM(RSH, 5, 4),
+		I_JMP_IMM(JNE, 5, 4, 149),
+		/* 17: r4 = IP header length */
+		I_ALU_IMM(AND, 4, 0x0f),
+		I_ALU_IMM(LSH, 4, 2),
+		/* 19: addresses, as they are in the frame */
+		I_LDX(W, 5, 2, 26),
+		I_STX(W, 10, 5, PILHA_ORIGEM),
+		I_LDX(W, 5, 2, 30),
+		I_STX(W, 10, 5, PILHA_DESTINO),
+		/* 23: r8 = destination MAC is ff:ff:ff:ff:ff:ff */
+		I_MOV_IMM(8, 0),
+		I_LDX(W, 5, 2, 0),
+		I_JMP32_IMM(JNE, 5, -1, 3),
+		I_LDX(H, 5, 2, 4),
+		I_JMP_IMM(JNE, 5, 0xffff, 1),
+		I_MOV_IMM(8, 1),
+		/* 29: r7 = transport */
+		I_LDX(B, 7, 2, 23),
+		I_JMP_IMM(JEQ, 7, IPPROTO_ICMP, 38),
+		I_JMP_IMM(JEQ, 7, IPPROTO_TCP, 2),
+		I_JMP_IMM(JEQ, 7, IPPROTO_UDP, 1),
+		I_JA(132),
+		/* 34: TCP or UDP, the ports must be there */
+		I_ALU_REG(ADD, 2, 4),
+		I_MOV_REG(5, 2),
+		I_ALU_IMM(ADD, 5, 18),
+		I_JMP_REG(JGT, 5, 3, 128),
+		/* 38: keys (transport << 16) | port, in host order */
+		I_LDX(B, 5, 2, 14),
+		I_ALU_IMM(LSH, 5, 8),
+		I_LDX(B, 0, 2, 15),
+		I_ALU_REG(OR, 5, 0),
+		I_MOV_REG(9, 7),
+		I_ALU_IMM(LSH, 9, 16),
+		I_ALU_REG(OR, 5, 9),
+		I_STX(W, 10, 5, PILHA_SPORT),
+		I_LDX(B, 5, 2, 16),
+		I_ALU_IMM(LSH, 5, 8),
+		I_LDX(B, 0, 2, 17),
+		I_ALU_REG(OR, 5, 0),
+		I_ALU_REG(OR, 5, 9),
+		I_STX(W, 10, 5, PILHA_DPORT),
+		/* 52: class of the transport, unless a port is known */
+		I_MOV_REG(7, 9),
+		I_LD_MAPA(1, a->portas_fd),
+		I_MOV_REG(2, 10),
+		I_ALU_IMM(ADD, 2, PILHA_SPORT),
+		I_CALL(map_lookup_elem),
+		I_JMP_IMM(JEQ, 0, 0, 2),
+		I_LDX(W, 7, 10, PILHA_SPORT),
+		I_JA(9),
+		/* 61 */
+		I_LD_MAPA(1, a->portas_fd),
+		I_MOV_REG(2, 10),
+		I_ALU_IMM(ADD, 2, PILHA_DPORT),
+		I_CALL(map_lookup_elem),
+		I_JMP_IMM(JEQ, 0, 0, 3),
+		I_LDX(W, 7, 10, PILHA_DPORT),
+		I_JA(1),
+		/* 69: ICMP has no ports */
+		I_ALU_IMM(LSH, 7, 16),
+		/* 70: the class, zeroes for new entries and the time */
+		I_STX(W, 10, 7, PILHA_CLASSE),
+		I_MOV_IMM(1, 0),
+		I_STX(DW, 10, 1, PILHA_ZEROS),
+		I_STX(DW, 10, 1, PILHA_ZEROS + 8),
+		I_STX(DW, 10, 1, PILHA_ZEROS + 16),
+		I_STX(DW, 10, 1, PILHA_ZEROS + 24),
+		I_STX(DW, 10, 1, PILHA_ZEROS + 32),
+		I_STX(DW, 10, 1, PILHA_ZEROS + 40),
+		I_CALL(ktime_get_ns),
+		I_STX(DW, 10, 0, PILHA_AGORA),
+		/* 80: protocolos[classe] */
+		I_OBTEM(a->protocolos_fd, PILHA_CLASSE, 6),
+		I_LDX(DW, 1, 0, PROTO(pkts)),
+		I_ALU_IMM(ADD, 1, 1),
+		I_STX(DW, 0, 1, PROTO(pkts)),
+		I_LDX(DW, 1, 0, PROTO(octets)),
+		I_ALU_REG(ADD, 1, 6),
+		I_STX(DW, 0, 1, PROTO(octets)),
+		/* 106: hosts[destination], unless broadcast */
+		I_JMP_IMM(JNE, 8, 0, 28),
+		I_OBTEM(a->hosts_fd, PILHA_DESTINO, 8),
+		I_LDX(DW, 1, 0, HOST(in_pkts)),
+		I_ALU_IMM(ADD, 1, 1),
+		I_STX(DW, 0, 1, HOST(in_pkts)),
+		I_LDX(DW, 1, 0, HOST(in_octets)),
+		I_ALU_REG(ADD, 1, 6),
+		I_STX(DW, 0, 1, HOST(in_octets)),
+		I_LDX(DW, 1, 10, PILHA_AGORA),
+		I_STX(DW, 0, 1, HOST(visto)),
+		/* 135: hosts[source] */
+		I_OBTEM(a->hosts_fd, PILHA_ORIGEM, 11),
+		I_LDX(DW, 1, 0, HOST(out_pkts)),
+		I_ALU_IMM(ADD, 1, 1),
+		I_STX(DW, 0, 1, HOST(out_pkts)),
+		I_LDX(DW, 1, 0, HOST(out_octets)),
+		I_ALU_REG(ADD, 1, 6),
+		I_STX(DW, 0, 1, HOST(out_octets)),
+		I_LDX(DW, 1, 0, HOST(out_bcast)),
+		I_ALU_REG(ADD, 1, 8),
+		I_STX(DW, 0, 1, HOST(out_bcast)),
+		I_LDX(DW, 1, 10, PILHA_AGORA),
+		I_STX(DW, 0, 1, HOST(visto)),
+		/* 166 */
+		I_MOV_IMM(0, XDP_PASS),
+		I_EXIT(),
+	};
+	static char	licenca[] = "GPL";
+	static char	log_verificador[65536];
+	union bpf_attr	attr;
+	int		fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)programa;
+	attr.insn_cnt = sizeof(programa) / sizeof(struct bpf_insn);
+	attr.license = (uintptr_t)licenca;
+	attr.log_buf = (uintptr_t)log_verificador;
+	attr.log_size = sizeof(log_verificador);
+	attr.log_level = 1;
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd == -1) {
+		perror("agregador.bpf_prog_load");
+		Debug("verifier said: %s", log_verificador);
+	}
+
+	return fd;
+}
+
+
+static int
+agregador_cria_mapa(const unsigned int tipo, const unsigned int tam_chave,
+		const unsigned int tam_valor, const unsigned int max)
+{
+	union bpf_attr	attr;
+	int		fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = tipo;
+	attr.key_size = tam_chave;
+	attr.value_size = tam_valor;
+	attr.max_entries = max;
+
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd == -1)
+		perror("agregador.bpf_map_create");
+
+	return fd;
+}
+
+
+/** \brief How many values a per-CPU map returns: the possible CPUs. */
+static unsigned int
+agregador_conta_cpus()
+{
+	FILE		*arq;
+	char		linha[256];
+	char		*p;
+	unsigned int	maior = 0;
+
+	arq = fopen("/sys/devices/system/cpu/possible", "r");
+	if (arq == NULL)
+		return sysconf(_SC_NPROCESSORS_CONF);
+
+	/* "0-7", "0,2-3" ... the last number is the highest CPU */
+	if (fgets(linha, sizeof(linha), arq) != NULL) {
+		for (p = linha; *p != '\0'; p++) {
+			if ((p == linha) || (p[-1] == '-') || (p[-1] == ','))
+				maior = strtoul(p, NULL, 10);
+		}
+	}
+	fclose(arq);
+
+	return maior + 1;
+}
+
+
+/** \brief Steps through the keys of a map.
+ *
+ *  \param  primeira	If nonzero, \a chave is ignored and the first key is
+ *			returned.
+ *  \retval nonzero if \a chave now holds the next key.
+ *  \retval 0	    at the end of the map.
+ */
+static int
+agregador_proxima(const int fd, uint32_t *chave, const int primeira)
+{
+	union bpf_attr	attr;
+	uint32_t	proxima;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = primeira ? 0 : (uintptr_t)chave;
+	attr.next_key = (uintptr_t)&proxima;
+	if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) == -1)
+		return 0;
+
+	*chave = proxima;
+	return 1;
+}
+
+
+static int
+agregador_le(const int fd, const uint32_t chave, void *valor)
+{
+	union bpf_attr	attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = (uintptr_t)&chave;
+	attr.value = (uintptr_t)valor;
+
+	return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+
+static int
+agregador_compara(const void *a, const void *b)
+{
+	const uint32_t	x = *(const uint32_t *)a;
+	const uint32_t	y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/** \brief Makes the known ports of an interface match the protocolDir.
+ *
+ *  New ports are added before old ones are removed, so a frame being
+ *  classified never misses a port present in both.
+ */
+static void
+agregador_sincroniza(const agregador_t *a)
+{
+	static uint32_t	velhas[AGREGADOR_PORTAS];
+	union bpf_attr	attr;
+	uint32_t	chave;
+	uint32_t	um = 1;
+	unsigned int	n = 0;
+	unsigned int	i;
+	int		primeira;
+
+	for (i = 0; i < portas_qtd; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = a->portas_fd;
+		attr.key = (uintptr_t)&portas[i];
+		attr.value = (uintptr_t)&um;
+		attr.flags = BPF_ANY;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1)
+			perror("agregador.bpf_map_update_elem");
+	}
+
+	for (primeira = 1; agregador_proxima(a->portas_fd, &chave, primeira);
+			primeira = 0) {
+		if ((n < AGREGADOR_PORTAS) && (bsearch(&chave, portas, portas_qtd,
+					sizeof(uint32_t), agregador_compara) == NULL))
+			velhas[n++] = chave;
+	}
+
+	for (i = 0; i < n; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = a->portas_fd;
+		attr.key = (uintptr_t)&velhas[i];
+		sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+	}
+}
+
+
+static void
+agregador_lista_portas()
+{
+	portas_qtd = pdir_ipv4_portas(portas, AGREGADOR_PORTAS);
+	if (portas_qtd == AGREGADOR_PORTAS)
+		Debug("only the first %u application ports are classified "
+				"in the kernel", AGREGADOR_PORTAS);
+	qsort(portas, portas_qtd, sizeof(uint32_t), agregador_compara);
+}
+
+
+/** \brief protocolDir observer: refreshes the known ports of every program. */
+static void
+agregador_portas()
+{
+	unsigned int	i;
+
+	agregador_lista_portas();
+	for (i = 0; i < agregadores_qtd; i++)
+		agregador_sincroniza(&agregadores[i]);
+}
+
+
+static void
+agregador_libera(agregador_t *a)
+{
+	if (a->link_fd >= 0)
+		close(a->link_fd);
+	if (a->prog_fd >= 0)
+		close(a->prog_fd);
+	if (a->portas_fd >= 0)
+		close(a->portas_fd);
+	if (a->protocolos_fd >= 0)
+		close(a->protocolos_fd);
+	if (a->hosts_fd >= 0)
+		close(a->hosts_fd);
+
+	memset(a, 0, sizeof(agregador_t));
+}
+
+
+/** \brief Starts counting protocolDist and nlHost of an interface in the
+ *  kernel.
+ *
+ *  Needs a 5.18 or newer kernel.  If anything goes wrong the interface is
+ *  left as it was, and the caller should account it in userspace.
+ *
+ *  \param  controle	Control index of the interface rows.
+ *  \retval SUCCESS	If the program is attached.
+ *  \retval ERROR_FULL	If MAX_INTERFACES are already aggregated.
+ *  \retval ERROR_IO	Otherwise.
+ */
+int
+agregador_abre(const char *if_name, const unsigned int controle)
+{
+	agregador_t	*a;
+	union bpf_attr	attr;
+	unsigned int	ifindex;
+
+	if (agregadores_qtd == MAX_INTERFACES)
+		return ERROR_FULL;
+
+	ifindex = if_nametoindex(if_name);
+	if (ifindex == 0) {
+		perror("agregador.if_nametoindex");
+		return ERROR_IO;
+	}
+
+	if (cpus == 0)
+		cpus = agregador_conta_cpus();
+
+	a = &agregadores[agregadores_qtd];
+	a->controle = controle;
+	a->link_fd = a->prog_fd = -1;
+
+	a->portas_fd = agregador_cria_mapa(BPF_MAP_TYPE_HASH, sizeof(uint32_t),
+			sizeof(uint32_t), AGREGADOR_PORTAS);
+	a->protocolos_fd = agregador_cria_mapa(BPF_MAP_TYPE_PERCPU_HASH,
+			sizeof(uint32_t), sizeof(agregador_protocolo_t),
+			AGREGADOR_PROTOCOLOS);
+	a->hosts_fd = agregador_cria_mapa(BPF_MAP_TYPE_PERCPU_HASH,
+			sizeof(uint32_t), sizeof(agregador_host_t),
+			AGREGADOR_HOSTS);
+	if ((a->portas_fd == -1) || (a->protocolos_fd == -1) ||
+			(a->hosts_fd == -1))
+		goto erro;
+
+	a->prog_fd = agregador_carrega_programa(a);
+	if (a->prog_fd == -1)
+		goto erro;
+
+	/* the ports must be known before the first frame */
+	agregador_lista_portas();
+	agregador_sincroniza(a);
+
+	/* a bpf link is detached automatically if we die */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = a->prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	a->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (a->link_fd == -1) {
+		perror("agregador.bpf_link_create");
+		goto erro;
+	}
+
+	agregadores_qtd++;
+	pdir_define_observador(agregador_portas);
+	Debug("`%s': protocolDist and nlHost counted by XDP, %u CPUs",
+			if_name, cpus);
+
+	return SUCCESS;
+
+erro:
+	agregador_libera(a);
+	return ERROR_IO;
+}
+
+
+/** \brief Tells whether protocolDist and nlHost are counted in the kernel. */
+int
+agregador_ativo()
+{
+	return (agregadores_qtd > 0);
+}
+
+
+/** \brief Detaches every program; the maps (and counts) go away. */
+void
+agregador_fecha()
+{
+	while (agregadores_qtd > 0)
+		agregador_libera(&agregadores[--agregadores_qtd]);
+}
+
+
+/* sums each class into ether2.ipv4, its transport and its application */
+static void
+agregador_soma_protocolos(const agregador_t *a, const pdir_node_t *rede,
+		agregador_protocolo_t *valores)
+{
+	pdir_node_t	*ptr;
+	uint64_t	pkts;
+	uint64_t	octets;
+	uint32_t	chave;
+	unsigned int	c;
+	int		primeira;
+
+	for (primeira = 1; agregador_proxima(a->protocolos_fd, &chave, primeira);
+			primeira = 0) {
+		if (agregador_le(a->protocolos_fd, chave, valores) == -1)
+			continue;
+
+		pkts = octets = 0;
+		for (c = 0; c < cpus; c++) {
+			pkts += valores[c].pkts;
+			octets += valores[c].octets;
+		}
+
+		if (rede != NULL)
+			pdist_consolida_soma(a->controle, rede->local_index,
+					pkts, octets);
+
+		ptr = pdir_localiza(1, ETHERTYPE_IP, chave >> 16, 0);
+		if (ptr != NULL)
+			pdist_consolida_soma(a->controle, ptr->local_index,
+					pkts, octets);
+
+		if ((chave & 0xffff) == 0)
+			continue;
+		ptr = pdir_localiza(1, ETHERTYPE_IP, chave >> 16, chave & 0xffff);
+		if (ptr != NULL)
+			pdist_consolida_soma(a->controle, ptr->local_index,
+					pkts, octets);
+	}
+}
+
+
+#ifdef USE_TIMEFILTER
+/* sysUpTime of a CLOCK_MONOTONIC instant in the past */
+static unsigned long
+agregador_uptime(const uint64_t visto, const unsigned long agora)
+{
+	struct timespec	ts;
+	uint64_t	relogio;
+	uint64_t	atras;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	relogio = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if (visto >= relogio)
+		return agora;
+
+	atras = (relogio - visto) / 10000000;
+	return (atras < agora) ? agora - atras : 0;
+}
+#endif
+
+
+static void
+agregador_soma_hosts(const agregador_t *a, const unsigned int localindex,
+		agregador_host_t *valores)
+{
+	nlhost_t	e;
+	uint64_t	visto;
+	uint32_t	chave;
+	unsigned long	agora = sysuptime();
+	unsigned int	c;
+	int		primeira;
+
+	for (primeira = 1; agregador_proxima(a->hosts_fd, &chave, primeira);
+			primeira = 0) {
+		if (agregador_le(a->hosts_fd, chave, valores) == -1)
+			continue;
+
+		memset(&e, 0, sizeof(e));
+		visto = 0;
+		for (c = 0; c < cpus; c++) {
+			e.in_pkts += valores[c].in_pkts;
+			e.in_octets += valores[c].in_octets;
+			e.out_pkts += valores[c].out_pkts;
+			e.out_octets += valores[c].out_octets;
+			e.out_macbroadcast_pkts += valores[c].out_bcast;
+			if (valores[c].visto > visto)
+				visto = valores[c].visto;
+		}
+
+		e.address = chave;
+		e.localindex = localindex;
+		e.hlhost_index = a->controle;
+		e.create_time = agora;
+#ifdef USE_TIMEFILTER
+		e.timemark = agregador_uptime(visto, agora);
+#endif
+		nlhost_consolida_soma(&e);
+	}
+}
+
+
+/** \brief Rebuilds protocolDist and nlHost from the maps of every program.
+ *
+ *  Called by shards_consolida(), so at most once every SHARDS_INTERVALO.
+ */
+void
+agregador_consolida()
+{
+	pdir_node_t	*rede;
+	void		*valores;
+	unsigned int	i;
+
+	if (agregadores_qtd == 0)
+		return;
+
+	valores = malloc(cpus * sizeof(agregador_host_t));
+	if (valores == NULL) {
+		Debug("not enough memory");
+		return;
+	}
+
+	pdist_consolida_zera();
+	nlhost_consolida_zera();
+
+	rede = pdir_localiza(1, ETHERTYPE_IP, 0, 0);
+	for (i = 0; i < agregadores_qtd; i++) {
+		if (pdist_control_busca_status(agregadores[i].controle) ==
+				ROWSTATUS_ACTIVE)
+			agregador_soma_protocolos(&agregadores[i], rede, valores);
+
+		if ((rede != NULL) && (rede->host_config == PDIR_CFG_supportedOn) &&
+				(hlhost_getRowstatus(agregadores[i].controle) ==
+				 ROWSTATUS_ACTIVE))
+			agregador_soma_hosts(&agregadores[i], rede->local_index,
+					valores);
+	}
+
+	free(valores);
+}
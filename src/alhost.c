@@ -28,253 +28,228 @@
 
 #include "configuracao.h"
 
-#include "primo.h"
-#include "funcao_hash.h"
-
 #if PTSL
 #include "stateful.h"
 #endif
 
 #include "pedb.h"
+#include "fluxos.h"
 #include "alhost.h"
 #include "hlhost.h"
 #include "exit_codes.h"
+#include "shards.h"
+#include "tabela.h"
 #include "log.h"
 
 
 /* local defines */
-#define ALHOST_MAX  65536
-#define ALHOST_TAM  PRIMO
+#define ALHOST_TAM  TABELAS_POSICOES
+
 
+/* the merged table (read by SNMP) */
+TABELA_ESTATICA(principal, alhost_t, ALHOST_TAM);
+/* where each worker accounts: its private shard or, with a single worker,
+   straight into principal */
+static tabela_t		*tabelas[MAX_WORKERS] = { &principal, };
 
-static alhost_t	    *tabela_hash[ALHOST_TAM];
-static unsigned int quantidade;
-static unsigned int profundidade;
+#define ALHOST(t, indice)	((alhost_t *)tabela_entrada((t), (indice)))
 
 
 #define QUERO_PROXIMO	1
 #define	QUERO_PRIMEIRO	1
-#undef	QUERO_REMOVER
+#define	QUERO_REMOVER	1
 #include "lista_indices.h"
 
 
 unsigned int alhost_quantidade()
 {
-    return quantidade;
+    return principal.quantidade;
 }
 
 
-static unsigned int alhost_localiza(const unsigned int chave,
-		const in_addr_t address, const uint32_t portas)
+/* an entry is a host, an encapsulation (portas) and an interface */
+static int alhost_confere(const void *entrada, const void *chave)
 {
-	unsigned int i = 0;		/* offset da hash */
-	unsigned int hash_index;	// = hash(chave, i);
-
-	/* compute the hash and try to access */
-	HASH(chave, i, hash_index);
-	if ((tabela_hash[hash_index] != NULL) &&
-			(tabela_hash[hash_index]->nlhost_address == address) &&
-			(tabela_hash[hash_index]->portas == portas)) {
-		/* Whee! found! */
-		return hash_index;
-	}
-
-	/* not found in the first try, so we start the probing */
-	i++;
-	while (i <= profundidade) {
-		HASH(chave, i, hash_index);
-		if ((tabela_hash[hash_index] == NULL) ||
-				(tabela_hash[hash_index]->nlhost_address != address) ||
-				(tabela_hash[hash_index]->portas != portas)) {
-			/* nao encontrou a entrada - tentar a proxima hash */
-			i++;
-		}
-		else {
-			/* achou. tomara ;) */
-			return hash_index;
-		}
-	}
+	const alhost_t	*e = entrada;
+	const alhost_t	*c = chave;
 
-	/* we cannot return a negative number, so... */
-	return ALHOST_TAM;
+	return (e->hlhost_index == c->hlhost_index) &&
+		(e->nlhost_address == c->nlhost_address) &&
+		(e->portas == c->portas);
 }
 
 
-int alhost_insereAtualiza(pedb_t *dados)
+static unsigned int alhost_localiza(const tabela_t *t, const unsigned int chave,
+		const in_addr_t address, const uint32_t portas,
+		const unsigned int interface)
 {
-	/* ser usado tambm como verificao da posio na tabela */
-	uint32_t	    portas = (dados->nl_localindex << 16) | dados->al_localindex;
+	alhost_t	modelo;
 
-	uint32_t	    chave_entrada = dados->ip_dest ^ portas;
-	uint32_t	    chave_saida = dados->ip_orig ^ portas;
+	modelo.nlhost_address = address;
+	modelo.portas = portas;
+	modelo.hlhost_index = interface;
 
-	unsigned int    indice_saida;
-	unsigned int    indice_entrada;
-	unsigned int    i;
+	/* we cannot return a negative number, so... ALHOST_TAM */
+	return tabela_busca(t, tabela_hash(chave), alhost_confere, &modelo);
+}
 
 
-	if (dados->is_broadcast == 0) {
-		/* atualizar/criar ENTRADA de pacotes */
-		indice_entrada = alhost_localiza(chave_entrada, dados->ip_dest, portas);
+/*
+ *  prefetching ahead of alhost_insereAtualiza(), as in nlhost_antecipa()
+ */
+void alhost_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa)
+{
+	if (etapa == ANTECIPA_POSICAO)
+		tabela_antecipa_grupo(tabelas[worker], tabela_hash(chave));
+	else
+		tabela_antecipa_entrada(tabelas[worker], tabela_hash(chave));
+}
 
-		if (indice_entrada != ALHOST_TAM) {
-#if DEBUG_ALHOST == 1
-			Debug("atualizando (%u)\n", indice_entrada);
-#endif
-			tabela_hash[indice_entrada]->in_pkts++;
-			tabela_hash[indice_entrada]->in_octets += dados->tamanho;
 
-#ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#endif
-		}
-		else {
-			/* alocar uma posio na tabela */
-			i = 0;
-			HASH(chave_entrada, i, indice_entrada);
-
-			/* TODO: verificar se essa ordem  boa (nlhost_tam)(* != NULL) */
-			while ((i < ALHOST_MAX) && (tabela_hash[indice_entrada] != NULL)) {
-				i++;
-				HASH(chave_entrada, i, indice_entrada);
-			}
-			if (i >= ALHOST_MAX) {
-				Debug("tabela cheia (%u/%u) - descartando",
-						quantidade, ALHOST_MAX);
-				return ERROR_FULL;
-			}
-			if (i > profundidade) {
-				profundidade = i;
-			}
+/*
+ *  the entry of `address' in `t', for the packet in `dados' and the
+ *  encapsulation in `portas'; created, zeroed, if new.  NULL if the table
+ *  is full.
+ */
+static alhost_t *alhost_obtem(tabela_t *t, const pedb_t *dados,
+		const in_addr_t address, const uint32_t portas)
+{
+	alhost_t	*p;
+	uint32_t	chave = address ^ portas;
+	unsigned int	indice;
 
-			/* criar a entrada */
-			tabela_hash[indice_entrada] = calloc(1, sizeof(alhost_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-			if (tabela_hash[indice_entrada] == NULL) {
-				Debug("Error in input entry memory allocation!");
-				return ERROR_MALLOC;
-			}
-#endif
+	indice = alhost_localiza(t, chave, address, portas, dados->interface);
+	if (indice != ALHOST_TAM) {
 #if DEBUG_ALHOST == 1
-			Debug("inserindo (%u)", indice_entrada);
+		Debug("atualizando (%u)\n", indice);
 #endif
-			tabela_hash[indice_entrada]->nlhost_address = dados->ip_dest;
-			tabela_hash[indice_entrada]->portas = portas;
-			tabela_hash[indice_entrada]->localindex_app = dados->al_localindex;
-			tabela_hash[indice_entrada]->localindex_net = dados->nl_localindex;
-			tabela_hash[indice_entrada]->in_pkts = 1;
-			tabela_hash[indice_entrada]->in_octets = dados->tamanho;
-			tabela_hash[indice_entrada]->hlhost_index = dados->interface;
-
-			/* zerar os de saida, ainda nao registrados */
-			tabela_hash[indice_entrada]->out_pkts = 0;
-			tabela_hash[indice_entrada]->out_octets = 0;
-			tabela_hash[indice_entrada]->create_time = dados->uptime;
-
-#ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#else
-			tabela_hash[indice_entrada]->timemark = 0;
-#endif
-
-			/* atualizar hlhost */
-			if (hlhost_atualizaAlInserts(dados->interface) != SUCCESS) {
-				Debug("hlhost_atualizaAlInserts(%d) falhou",
-						dados->interface);
-			}
+		p = ALHOST(t, indice);
 
-			if (lista_insere(indice_entrada) != SUCCESS) {
-				Debug("lista_insere() falhou");
-			}
-			quantidade++;
-		}
-	}
-
-	/* atualizar/criar SAIDA de pacotes */
-	indice_saida = alhost_localiza(chave_saida, dados->ip_orig, portas);
-	if (indice_saida != ALHOST_TAM) {
-#if DEBUG_ALHOST == 1
-		Debug("atualizando (%u)\n", indice_saida);
-#endif
-		tabela_hash[indice_saida]->out_pkts++;
-		tabela_hash[indice_saida]->out_octets += dados->tamanho;
+		if (dados->uptime < p->create_time)
+			p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
+		p->timemark = dados->uptime;
 #endif
+		return p;
 	}
-	else {
-		/* alocar uma posio na tabela */
-		i = 0;
-		HASH(chave_saida, i, indice_saida);
-
-		while ((i < ALHOST_MAX) && (tabela_hash[indice_saida] != NULL)) {
-			i++;
-			HASH(chave_saida, i, indice_saida);
-		}
-		if (i >= ALHOST_MAX) {
-			Debug("tabela cheia (%u/%u) - descartando",
-					quantidade, ALHOST_MAX);
-			return ERROR_FULL;
-		}
-		if (i > profundidade) {
-			profundidade = i;
-		}
 
-		/* criar a entrada */
-		tabela_hash[indice_saida] = calloc(1, sizeof(alhost_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-		if (tabela_hash[indice_saida] == NULL) {
-			Debug("Error in output entry memory allocation!");
-			return ERROR_MALLOC;
-		}
-#endif
+	/* alocar uma posio na tabela */
+	indice = tabela_insere(t, tabela_hash(chave));
+	if (indice == ALHOST_TAM) {
+		Debug("tabela cheia (%u/%u) - descartando",
+				t->quantidade, t->maximo);
+		return NULL;
+	}
 #if DEBUG_ALHOST == 1
-		Debug("inserindo (%u)", indice_saida);
+	Debug("inserindo (%u)", indice);
 #endif
-		tabela_hash[indice_saida]->nlhost_address = dados->ip_orig;
-		tabela_hash[indice_saida]->portas = portas;
-		tabela_hash[indice_saida]->localindex_app = dados->al_localindex;
-		tabela_hash[indice_saida]->localindex_net = dados->nl_localindex;
-		tabela_hash[indice_saida]->out_pkts = 1;
-		tabela_hash[indice_saida]->out_octets = dados->tamanho;
-		tabela_hash[indice_saida]->in_pkts = 0;
-		tabela_hash[indice_saida]->in_octets = 0;
-		tabela_hash[indice_saida]->hlhost_index = dados->interface;
-
-		tabela_hash[indice_saida]->create_time = dados->uptime;
+
+	p = ALHOST(t, indice);
+	p->nlhost_address = address;
+	p->portas = portas;
+	p->localindex_app = dados->al_localindex;
+	p->localindex_net = dados->nl_localindex;
+	p->hlhost_index = dados->interface;
+	p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#else
-		tabela_hash[indice_saida]->timemark = 0;
+	p->timemark = dados->uptime;
 #endif
 
-		/* atualiza hlhost */
+	if (t == &principal) {
+		/* atualizar hlhost */
 		if (hlhost_atualizaAlInserts(dados->interface) != SUCCESS) {
 			Debug("hlhost_atualizaAlInserts(%d) falhou",
 					dados->interface);
 		}
 
-		if (lista_insere(indice_saida) != SUCCESS) {
+		if (lista_insere(indice) != SUCCESS) {
 			Debug("lista_insere() falhou");
 		}
+	}
+
+	return p;
+}
+
+
+int alhost_insereAtualiza(pedb_t *dados)
+{
+	tabela_t	*t = tabelas[dados->worker];
+	/* ser usado tambm como verificao da posio na tabela */
+	uint32_t	portas = (dados->nl_localindex << 16) | dados->al_localindex;
+	alhost_t	*p;
+
+	if (dados->is_broadcast == 0) {
+		/* atualizar/criar ENTRADA de pacotes */
+		p = alhost_obtem(t, dados, dados->ip_dest, portas);
+		if (p == NULL)
+			return ERROR_FULL;
+
+		p->in_pkts += dados->peso;
+		p->in_octets += dados->tamanho;
 
-		quantidade++;
+		fluxo_registra(dados->fluxo, &p->in_pkts, &p->in_octets,
+				&p->create_time, &p->timemark);
 	}
 
+	/* atualizar/criar SAIDA de pacotes */
+	p = alhost_obtem(t, dados, dados->ip_orig, portas);
+	if (p == NULL)
+		return ERROR_FULL;
+
+	p->out_pkts += dados->peso;
+	p->out_octets += dados->tamanho;
+
+	fluxo_registra(dados->fluxo, &p->out_pkts, &p->out_octets,
+			&p->create_time, &p->timemark);
+
 	return SUCCESS;
 }
 
 
+/* remove de `t' as entradas contabilizadas no encapsulamento */
+static void alhost_purga(tabela_t *t, const unsigned int pdir_localindex)
+{
+	alhost_t	*e;
+	unsigned int	indice;
+
+	TABELA_PERCORRE(t, indice) {
+		e = ALHOST(t, indice);
+		if ((e->localindex_net != pdir_localindex) &&
+				(e->localindex_app != pdir_localindex))
+			continue;
+
+		if (t == &principal)
+			lista_remove_indice(indice);
+		tabela_remove(t, indice);
+	}
+}
+
+
 /*
    remove todas as entradas relacionadas com o encapsulamento sendo removido
-   pela protocolDir
+   pela protocolDir, tambm das shards dos workers; cada tabela onde um
+   worker contabiliza  purgada com ele travado
    */
 int alhost_remove_pdir(const unsigned int pdir_localindex)
 {
-	/* FIXME!!! code me, na verdade */
-	return ERROR_NEEDCODING;
+	unsigned int	w;
+
+	/* the flows may point at the entries going away */
+	fluxos_invalida();
+
+	for (w = 0; w < shards_quantidade(); w++) {
+		shards_trava(w);
+		alhost_purga(tabelas[w], pdir_localindex);
+		shards_destrava(w);
+	}
+
+	if (tabelas[0] != &principal)
+		alhost_purga(&principal, pdir_localindex);
+
+	return SUCCESS;
 }
 
 
@@ -291,12 +266,12 @@ int alhost_helper(const unsigned int indice, uint32_t *hlcindex,
 		uint32_t *al_tmark, uint32_t *plindex_nl, uint32_t *nl_address,
 		uint32_t *plindex_al)
 {
-	if (tabela_hash[indice] != NULL) {
-		*hlcindex = tabela_hash[indice]->hlhost_index;
-		*al_tmark = tabela_hash[indice]->timemark;
-		*plindex_nl = tabela_hash[indice]->localindex_net;
-		*nl_address = tabela_hash[indice]->nlhost_address;
-		*plindex_al = tabela_hash[indice]->localindex_app;
+	if (tabela_ocupada(&principal, indice)) {
+		*hlcindex = ALHOST(&principal, indice)->hlhost_index;
+		*al_tmark = ALHOST(&principal, indice)->timemark;
+		*plindex_nl = ALHOST(&principal, indice)->localindex_net;
+		*nl_address = ALHOST(&principal, indice)->nlhost_address;
+		*plindex_al = ALHOST(&principal, indice)->localindex_app;
 
 		return SUCCESS;
 	}
@@ -314,6 +289,8 @@ int alhost_helper(const unsigned int indice, uint32_t *hlcindex,
  */
 int alhost_tabela_prepara(unsigned int *ptr)
 {
+	shards_consolida();
+
 	if (lista_primeiro() == SUCCESS) {
 		*ptr = lista_atual->indice;
 		return SUCCESS;
@@ -348,7 +325,7 @@ int alhost_tabela_proximo(unsigned int *ptr)
  */
 int alhost_testa(const unsigned int indice)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
+	if (tabela_ocupada(&principal, indice)) {
 		return SUCCESS;
 	}
 	else {
@@ -362,8 +339,8 @@ int alhost_testa(const unsigned int indice)
  */
 int alhost_busca_inpkts(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->in_pkts;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALHOST(&principal, indice)->in_pkts;
 		return SUCCESS;
 	}
 	else {
@@ -377,8 +354,8 @@ int alhost_busca_inpkts(const unsigned int indice, uint32_t *ptr)
  */
 int alhost_busca_outpkts(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->out_pkts;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALHOST(&principal, indice)->out_pkts;
 		return SUCCESS;
 	}
 	else {
@@ -392,8 +369,8 @@ int alhost_busca_outpkts(const unsigned int indice, uint32_t *ptr)
  */
 int alhost_busca_inoctets(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->in_octets;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALHOST(&principal, indice)->in_octets;
 		return SUCCESS;
 	}
 	else {
@@ -407,8 +384,8 @@ int alhost_busca_inoctets(const unsigned int indice, uint32_t *ptr)
  */
 int alhost_busca_outoctets(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->out_octets;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALHOST(&principal, indice)->out_octets;
 		return SUCCESS;
 	}
 	else {
@@ -422,8 +399,8 @@ int alhost_busca_outoctets(const unsigned int indice, uint32_t *ptr)
  */
 int alhost_busca_createtime(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALHOST_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->create_time;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALHOST(&principal, indice)->create_time;
 		return SUCCESS;
 	}
 	else {
@@ -431,3 +408,87 @@ int alhost_busca_createtime(const unsigned int indice, uint32_t *ptr)
 	}
 }
 
+
+/*
+ *  allocates the private shard of one worker (only used with 2+ workers);
+ *  called from the worker itself, so the pages come from its NUMA node
+ */
+int alhost_shard_aloca(const unsigned int worker)
+{
+	tabelas[worker] = tabela_cria(sizeof(alhost_t), ALHOST_TAM);
+	if (tabelas[worker] == NULL)
+		return ERROR_CALLOC;
+
+	return SUCCESS;
+}
+
+
+/*
+ *  zeroes the counters of the merged table, before the shards are summed
+ */
+void alhost_consolida_zera()
+{
+	lista_t		*l;
+	alhost_t	*p;
+
+	for (l = lista_cabeca; l != NULL; l = l->prox) {
+		p = ALHOST(&principal, l->indice);
+		p->in_pkts = 0;
+		p->in_octets = 0;
+		p->out_pkts = 0;
+		p->out_octets = 0;
+	}
+}
+
+
+/*
+ *  sums the shard of worker `w' into the merged table, creating the entries
+ *  it does not have yet.  The shard must be locked by the caller.
+ */
+void alhost_consolida(const unsigned int w)
+{
+	alhost_t	*e;
+	alhost_t	*p;
+	unsigned int	indice;
+	unsigned int	destino;
+	uint32_t	hash;
+
+	TABELA_PERCORRE(tabelas[w], indice) {
+		e = ALHOST(tabelas[w], indice);
+
+		hash = tabela_hash(e->nlhost_address ^ e->portas);
+		destino = tabela_busca(&principal, hash, alhost_confere, e);
+		if (destino == ALHOST_TAM) {
+			/* new in the merged table */
+			destino = tabela_insere(&principal, hash);
+			if (destino == ALHOST_TAM) {
+				Debug("tabela cheia - descartando");
+				continue;
+			}
+
+			p = ALHOST(&principal, destino);
+			*p = *e;
+			p->in_pkts = 0;
+			p->in_octets = 0;
+			p->out_pkts = 0;
+			p->out_octets = 0;
+
+			if (hlhost_atualizaAlInserts(p->hlhost_index) != SUCCESS) {
+				Debug("hlhost_atualizaAlInserts() falhou");
+			}
+			if (lista_insere(destino) != SUCCESS) {
+				Debug("lista_insere() falhou");
+			}
+		}
+
+		p = ALHOST(&principal, destino);
+		p->in_pkts += e->in_pkts;
+		p->in_octets += e->in_octets;
+		p->out_pkts += e->out_pkts;
+		p->out_octets += e->out_octets;
+		if (e->create_time < p->create_time)
+			p->create_time = e->create_time;
+		if (e->timemark > p->timemark)
+			p->timemark = e->timemark;
+	}
+}
@@ -28,84 +28,95 @@
 
 #include "configuracao.h"
 
-#include "primo.h"
-#include "funcao_hash.h"
-
 #if PTSL
 #include "stateful.h"
 #endif
 
 #include "pedb.h"
+#include "fluxos.h"
 #include "hlmatrix.h"
 #include "almatrix_SD.h"
 #include "exit_codes.h"
+#include "shards.h"
+#include "tabela.h"
 #include "log.h"
 
 
-/* local defines - unuseful elsewhere */
-#define ALMATRIXSD_MAX	65536
-#define ALMATRIXSD_TAM	PRIMO
+/* local defines */
+#define ALMATRIXSD_TAM	TABELAS_POSICOES
+
 
+/* the merged table (read by SNMP) */
+TABELA_ESTATICA(principal, almatrix_t, ALMATRIXSD_TAM);
+/* where each worker accounts: its private shard or, with a single worker,
+   straight into principal */
+static tabela_t		*tabelas[MAX_WORKERS] = { &principal, };
 
-static almatrix_t   *tabela_hash[ALMATRIXSD_TAM];
-static unsigned int quantidade;
-static unsigned int profundidade;
+#define ALMATRIX(t, indice)	((almatrix_t *)tabela_entrada((t), (indice)))
 
 
 #define QUERO_PROXIMO	1
 #define QUERO_PRIMEIRO	1
-#undef	QUERO_REMOVER
+#define QUERO_REMOVER	1
 #undef	QUERO_ORDENAR
 #include "lista_indices.h"
 
 
 unsigned int almatrix_SD_quantidade()
 {
-	return quantidade;
+	return principal.quantidade;
 }
 
 
-/* AMD Guide: pg 32 */
-static unsigned int almatrix_SD_localiza(const in_addr_t src_address, const in_addr_t dest_address,
-		const unsigned int portas, const unsigned int chave)
+/* an entry is a pair of hosts, an encapsulation (portas) and an interface */
+static int almatrix_SD_confere(const void *entrada, const void *chave)
 {
-	unsigned int i = 0;	    /* offset da hash */
-	unsigned int hash_index;
-
-	HASH(chave, i, hash_index);
-	if ((tabela_hash[hash_index] != NULL) &&
-			(tabela_hash[hash_index]->portas == portas) &&
-			(tabela_hash[hash_index]->source_addr == src_address) &&
-			(tabela_hash[hash_index]->destin_addr == dest_address)) {
-		/* found in the first try */
-		return hash_index;
-	}
+	const almatrix_t	*e = entrada;
+	const almatrix_t	*c = chave;
 
-	i++;
-	while (i <= profundidade) {
-		HASH(chave, i, hash_index);
-		if ((tabela_hash[hash_index] == NULL) ||
-				(tabela_hash[hash_index]->portas != portas) ||
-				(tabela_hash[hash_index]->source_addr != src_address) ||
-				(tabela_hash[hash_index]->destin_addr != dest_address)) {
-			/* nao encontrou */
-			i++;
-		}
-		else {
-			/* encontrou a entrada */
-			return hash_index;
-		}
-	}
+	return (e->interface == c->interface) &&
+		(e->portas == c->portas) &&
+		(e->source_addr == c->source_addr) &&
+		(e->destin_addr == c->destin_addr);
+}
+
+
+/* AlMatrix SD: hash usa destin_addr ^ portas */
+static unsigned int almatrix_SD_localiza(const tabela_t *t, const in_addr_t src_address, const in_addr_t dest_address,
+		const unsigned int portas, const unsigned int chave,
+		const unsigned int interface)
+{
+	almatrix_t	modelo;
+
+	modelo.source_addr = src_address;
+	modelo.destin_addr = dest_address;
+	modelo.portas = portas;
+	modelo.interface = interface;
 
-	return ALMATRIXSD_TAM;
+	/* ALMATRIXSD_TAM if not found */
+	return tabela_busca(t, tabela_hash(chave), almatrix_SD_confere,
+			&modelo);
+}
+
+
+/*
+ *  prefetching ahead of almatrix_SD_insereAtualiza(), as in nlhost_antecipa()
+ */
+void almatrix_SD_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa)
+{
+	if (etapa == ANTECIPA_POSICAO)
+		tabela_antecipa_grupo(tabelas[worker], tabela_hash(chave));
+	else
+		tabela_antecipa_entrada(tabelas[worker], tabela_hash(chave));
 }
 
 
 int almatrix_SD_insereAtualiza(pedb_t *dados)
 {
-	unsigned int    i;
+	tabela_t	*t = tabelas[dados->worker];
+	almatrix_t	*p;
 	unsigned int    indice_entrada;
-	unsigned int    indice_saida;
 	uint32_t	    portas;
 	uint32_t	    chave;
 
@@ -114,158 +125,116 @@ int almatrix_SD_insereAtualiza(pedb_t *dados)
 	/* estranho.. pq s atualiza entrada de pacotes se o pacote for unicast?? */
 	if (dados->is_broadcast == 0) {
 		chave = dados->ip_orig ^ portas;
-		indice_entrada = almatrix_SD_localiza(dados->ip_dest, dados->ip_orig, portas, chave);
+		indice_entrada = almatrix_SD_localiza(t, dados->ip_dest, dados->ip_orig, portas, chave,
+				dados->interface);
 
 		/* atualizar/criar ENTRADA de pacotes */
 		if (indice_entrada != ALMATRIXSD_TAM) {
 #if DEBUG_ALMATRIX_SD == 1
 			Debug("atualizando (%d)", indice_entrada);
 #endif
-			tabela_hash[indice_entrada]->pkts++;
-			tabela_hash[indice_entrada]->octets += dados->tamanho;
+			p = ALMATRIX(t, indice_entrada);
+			p->pkts += dados->peso;
+			p->octets += dados->tamanho;
+
+			if (dados->uptime < p->create_time)
+				p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
+			p->timemark = dados->uptime;
 #endif
 		}
 		else {
 			/* alocar uma posio na tabela */
-#if DEBUG_ALMATRIX_SD == 1
-			Debug("inserindo nova (%d)", indice_entrada);
-#endif
-			i = 0;
-			HASH(chave, i, indice_entrada);
-			while ((i < ALMATRIXSD_MAX) && (tabela_hash[indice_entrada] != NULL)) {
-				i++;
-				HASH(chave, i, indice_entrada);
-			}
-			if (i >= ALMATRIXSD_MAX) {
+			indice_entrada = tabela_insere(t, tabela_hash(chave));
+			if (indice_entrada == ALMATRIXSD_TAM) {
 				Debug("tabela cheia (%u/%u) - descartando",
-						quantidade, ALMATRIXSD_MAX);
+						t->quantidade, t->maximo);
 				return ERROR_FULL;
 			}
-			if (i > profundidade) {
-				profundidade = i;
-			}
+#if DEBUG_ALMATRIX_SD == 1
+			Debug("inserindo nova (%d)", indice_entrada);
+#endif
 
 			/* criar a entrada */
-			tabela_hash[indice_entrada] = malloc(sizeof(almatrix_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-			if (tabela_hash[indice_entrada] == NULL) {
-				Debug("erro no malloc!");
-				return ERROR_MALLOC;
-			}
-#endif
-			tabela_hash[indice_entrada]->portas = portas;
-			tabela_hash[indice_entrada]->source_addr = dados->ip_dest;
-			tabela_hash[indice_entrada]->destin_addr = dados->ip_orig;
-			tabela_hash[indice_entrada]->localindex_net = dados->nl_localindex;
-			tabela_hash[indice_entrada]->localindex_app = dados->al_localindex;
+			p = ALMATRIX(t, indice_entrada);
+			p->portas = portas;
+			p->source_addr = dados->ip_dest;
+			p->destin_addr = dados->ip_orig;
+			p->localindex_net = dados->nl_localindex;
+			p->localindex_app = dados->al_localindex;
 
-			tabela_hash[indice_entrada]->pkts = 1;
-			tabela_hash[indice_entrada]->octets = dados->tamanho;
+			p->pkts = dados->peso;
+			p->octets = dados->tamanho;
 
-			tabela_hash[indice_entrada]->interface = dados->interface;
+			p->interface = dados->interface;
 
-			tabela_hash[indice_entrada]->create_time = dados->uptime;
+			p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#else
-			tabela_hash[indice_entrada]->timemark = 0;
+			p->timemark = dados->uptime;
 #endif
 
-			/* atualizar NlInserts na HlHost */
-			if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
-				Debug("hlmatrix_atualizaNlInserts(%d) falhou",
-						dados->interface);
-			}
+			if (t == &principal) {
+				/* atualizar NlInserts na HlHost */
+				if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
+					Debug("hlmatrix_atualizaNlInserts(%d) falhou",
+							dados->interface);
+				}
 
-			if (lista_insere(indice_entrada) != SUCCESS) {
-				Debug("lista_insere() falhou");
+				if (lista_insere(indice_entrada) != SUCCESS) {
+					Debug("lista_insere() falhou");
+				}
 			}
-
-			quantidade++;
 		}
-	}
 
-#if 0
-	/* atualizar/criar SAIDA de pacotes */
-	chave = dados->ip_dest ^ portas;
-	indice_saida = almatrix_SD_localiza(dados->ip_orig, dados->ip_dest, portas, chave);
-
-	if (indice_saida != ALMATRIXSD_TAM) {
-#if DEBUG_ALMATRIX_SD == 1
-		Debug("atualizando (%d)", indice_saida);
-#endif
-		tabela_hash[indice_saida]->pkts++;
-		tabela_hash[indice_saida]->octets += dados->tamanho;
-
-#ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#endif
+		fluxo_registra(dados->fluxo, &p->pkts, &p->octets,
+				&p->create_time, &p->timemark);
 	}
-	else {
-		/* alocar uma posio na tabela */
-#if DEBUG_ALMATRIX_SD == 1
-		Debug("inserindo nova (%d)", indice_saida);
-#endif
-		i = 0;
-		HASH(chave, i, indice_saida);
-
-		while ((i < ALMATRIXSD_MAX) && (tabela_hash[indice_saida] != NULL)) {
-			i++;
-			HASH(chave, i, indice_saida);
-		}
-		if (i >= ALMATRIXSD_MAX) {
-			Debug("tabela cheia (%u/%u) - descartando",
-					quantidade, ALMATRIXSD_MAX);
-			return ERROR_FULL;
-		}
-		if (i > profundidade) {
-			profundidade = i;
-		}
-
-		/* criar a entrada */
-		tabela_hash[indice_saida] = malloc(sizeof(almatrix_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-		if (tabela_hash[indice_saida] == NULL) {
-			Debug("erro no malloc!");
-			return ERROR_MALLOC;
-		}
-#endif
-		tabela_hash[indice_saida]->portas = portas;
-		tabela_hash[indice_saida]->source_addr = dados->ip_orig;
-		tabela_hash[indice_saida]->destin_addr = dados->ip_dest;
-		tabela_hash[indice_saida]->localindex_net = dados->nl_localindex;
-		tabela_hash[indice_saida]->localindex_app = dados->al_localindex;
 
-		tabela_hash[indice_saida]->pkts = 1;
-		tabela_hash[indice_saida]->octets = dados->tamanho;
+	return SUCCESS;
+}
 
-		tabela_hash[indice_saida]->interface = dados->interface;
 
-		tabela_hash[indice_saida]->create_time = dados->uptime;
+/* removes from `t' the entries accounted on the encapsulation */
+static void almatrix_SD_purga(tabela_t *t, const unsigned int pdir_localindex)
+{
+	almatrix_t	*e;
+	unsigned int	indice;
+
+	TABELA_PERCORRE(t, indice) {
+		e = ALMATRIX(t, indice);
+		if ((e->localindex_net != pdir_localindex) &&
+				(e->localindex_app != pdir_localindex))
+			continue;
+
+		if (t == &principal)
+			lista_remove_indice(indice);
+		tabela_remove(t, indice);
+	}
+}
 
-#ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#else
-		tabela_hash[indice_saida]->timemark = 0;
-#endif
 
-		/* atualizar NlInserts na HlHost */
-		if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
-			Debug("hlmatrix_atualizaNlInserts(%d) falhou",
-					dados->interface);
-		}
+/*
+ *  removes the entries of the encapsulation `pdir_localindex', from the
+ *  merged table and from the shards of the workers; a table a worker
+ *  accounts into is only purged with that worker locked
+ */
+int almatrix_SD_remove_pdir(const unsigned int pdir_localindex)
+{
+	unsigned int	w;
 
-		if (lista_insere(indice_saida) != SUCCESS) {
-			Debug("lista_insere() falhou");
-		}
+	/* the flows may point at the entries going away */
+	fluxos_invalida();
 
-		quantidade++;
+	for (w = 0; w < shards_quantidade(); w++) {
+		shards_trava(w);
+		almatrix_SD_purga(tabelas[w], pdir_localindex);
+		shards_destrava(w);
 	}
-#endif
+
+	if (tabelas[0] != &principal)
+		almatrix_SD_purga(&principal, pdir_localindex);
 
 	return SUCCESS;
 }
@@ -273,7 +242,7 @@ int almatrix_SD_insereAtualiza(pedb_t *dados)
 
 void almatrix_SD_hashStats()
 {
-	Debug("entradas: %d, profundidade: %d", quantidade, profundidade);
+	Debug("entradas: %d, profundidade: %d", principal.quantidade, principal.profundidade);
 }
 
 
@@ -286,13 +255,13 @@ int almatrix_sd_helper(const unsigned int indice, uint32_t *hlmindex, uint32_t *
 		uint32_t *plindex_net, uint32_t *nlm_srcaddr, uint32_t *nlm_dstaddr,
 		uint32_t *plindex_app)
 {
-	if ((indice < ALMATRIXSD_TAM) && (tabela_hash[indice] != NULL)) {
-		*hlmindex = tabela_hash[indice]->interface;
-		*al_tmark = tabela_hash[indice]->timemark;
-		*plindex_net = tabela_hash[indice]->localindex_net;
-		*nlm_srcaddr = tabela_hash[indice]->source_addr;
-		*nlm_dstaddr = tabela_hash[indice]->destin_addr;
-		*plindex_app = tabela_hash[indice]->localindex_app;
+	if (tabela_ocupada(&principal, indice)) {
+		*hlmindex = ALMATRIX(&principal, indice)->interface;
+		*al_tmark = ALMATRIX(&principal, indice)->timemark;
+		*plindex_net = ALMATRIX(&principal, indice)->localindex_net;
+		*nlm_srcaddr = ALMATRIX(&principal, indice)->source_addr;
+		*nlm_dstaddr = ALMATRIX(&principal, indice)->destin_addr;
+		*plindex_app = ALMATRIX(&principal, indice)->localindex_app;
 
 		return SUCCESS;
 	}
@@ -308,6 +277,8 @@ int almatrix_sd_helper(const unsigned int indice, uint32_t *hlmindex, uint32_t *
  */
 int almatrix_sd_tabela_prepara(unsigned int *ptr)
 {
+	shards_consolida();
+
 	if (lista_primeiro() == SUCCESS) {
 		*ptr = lista_atual->indice;
 		return SUCCESS;
@@ -334,7 +305,7 @@ int almatrix_sd_tabela_proximo(unsigned int *ptr)
 
 int almatrix_sd_testa(const unsigned int indice)
 {
-	if ((indice < ALMATRIXSD_TAM) && (tabela_hash[indice] != NULL)) {
+	if (tabela_ocupada(&principal, indice)) {
 		return SUCCESS;
 	}
 	else {
@@ -348,8 +319,8 @@ int almatrix_sd_testa(const unsigned int indice)
  */
 int almatrix_sd_busca_pkts(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALMATRIXSD_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->pkts;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALMATRIX(&principal, indice)->pkts;
 		return SUCCESS;
 	}
 	else {
@@ -360,8 +331,8 @@ int almatrix_sd_busca_pkts(const unsigned int indice, uint32_t *ptr)
 
 int almatrix_sd_busca_octets(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALMATRIXSD_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->octets;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALMATRIX(&principal, indice)->octets;
 		return SUCCESS;
 	}
 	else {
@@ -372,8 +343,8 @@ int almatrix_sd_busca_octets(const unsigned int indice, uint32_t *ptr)
 
 int almatrix_sd_busca_createtime(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < ALMATRIXSD_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->create_time;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = ALMATRIX(&principal, indice)->create_time;
 		return SUCCESS;
 	}
 	else {
@@ -381,3 +352,81 @@ int almatrix_sd_busca_createtime(const unsigned int indice, uint32_t *ptr)
 	}
 }
 
+
+/*
+ *  allocates the private shard of one worker (only used with 2+ workers);
+ *  called from the worker itself, so the pages come from its NUMA node
+ */
+int almatrix_SD_shard_aloca(const unsigned int worker)
+{
+	tabelas[worker] = tabela_cria(sizeof(almatrix_t), ALMATRIXSD_TAM);
+	if (tabelas[worker] == NULL)
+		return ERROR_CALLOC;
+
+	return SUCCESS;
+}
+
+
+/*
+ *  zeroes the counters of the merged table, before the shards are summed
+ */
+void almatrix_SD_consolida_zera()
+{
+	lista_t		*l;
+	almatrix_t	*p;
+
+	for (l = lista_cabeca; l != NULL; l = l->prox) {
+		p = ALMATRIX(&principal, l->indice);
+		p->pkts = 0;
+		p->octets = 0;
+	}
+}
+
+
+/*
+ *  sums the shard of worker `w' into the merged table, creating the entries
+ *  it does not have yet.  The shard must be locked by the caller.
+ */
+void almatrix_SD_consolida(const unsigned int w)
+{
+	almatrix_t	*e;
+	almatrix_t	*p;
+	unsigned int	indice;
+	unsigned int	destino;
+	uint32_t	hash;
+
+	TABELA_PERCORRE(tabelas[w], indice) {
+		e = ALMATRIX(tabelas[w], indice);
+
+		hash = tabela_hash(e->destin_addr ^ e->portas);
+		destino = tabela_busca(&principal, hash, almatrix_SD_confere, e);
+		if (destino == ALMATRIXSD_TAM) {
+			/* new in the merged table */
+			destino = tabela_insere(&principal, hash);
+			if (destino == ALMATRIXSD_TAM) {
+				Debug("tabela cheia - descartando");
+				continue;
+			}
+
+			p = ALMATRIX(&principal, destino);
+			*p = *e;
+			p->pkts = 0;
+			p->octets = 0;
+
+			if (hlmatrix_atualizaNlInserts(p->interface) != SUCCESS) {
+				Debug("hlmatrix_atualizaNlInserts() falhou");
+			}
+			if (lista_insere(destino) != SUCCESS) {
+				Debug("lista_insere() falhou");
+			}
+		}
+
+		p = ALMATRIX(&principal, destino);
+		p->pkts += e->pkts;
+		p->octets += e->octets;
+		if (e->create_time < p->create_time)
+			p->create_time = e->create_time;
+		if (e->timemark > p->timemark)
+			p->timemark = e->timemark;
+	}
+}
@@ -0,0 +1,560 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file assinaturas.c
+ *  \brief Classification of applications by the start of their payload
+ *
+ *  A conversation between ports protocolDir does not know is only accounted
+ *  at the transport level.  With signatures configured (ASSINATURAS_CONF),
+ *  the first payload bytes of its first packets go through an Aho-Corasick
+ *  automaton built from all of them, so a single pass over at most
+ *  ASSINATURAS_JANELA bytes tries every signature.  Each signature names the
+ *  encapsulation (transport and port) a matching conversation is accounted
+ *  in, as if it used that port.
+ *
+ *  Each worker keeps the verdict of its recent conversations, both
+ *  directions together, in a small direct mapped cache: after a match, or
+ *  after ASSINATURAS_PACOTES packets with payload and none, a conversation
+ *  is not looked at again.  Until then its flows are not kept by fluxos.c,
+ *  so that every packet of it comes back here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+
+#if PTSL
+#include "stateful.h"
+#endif
+
+#include "pedb.h"
+#include "protocoldir.h"
+#include "fluxos.h"
+#include "shards.h"
+#include "assinaturas.h"
+#include "log.h"
+
+
+/* headers may take up to this many bytes before the payload */
+#define ASSINATURAS_CABECALHOS	(14 + 60 + 60)
+
+/** \brief A signature: where its pattern must be, and what it means */
+typedef struct assinatura_s {
+	unsigned int	transporte;
+	unsigned int	porta;		/* of the encapsulation it stands for */
+	int		deslocamento;	/* start in the payload; -1: anywhere */
+	unsigned int	tam;
+	int		igual;		/* next one with the same pattern, or -1 */
+} assinatura_t;
+
+/** \brief Every signature, and the automaton that finds their patterns */
+typedef struct automato_s {
+	unsigned int	 qtd;
+	assinatura_t	 assinaturas[ASSINATURAS_MAX];
+	unsigned int	 alcance;	/* payload bytes worth looking at */
+	unsigned int	 estados;
+	uint16_t	(*proximo)[256];	/* complete: failures resolved */
+	uint16_t	*sufixo;	/* longest suffix state ending a pattern */
+	int		*saida;		/* first signature ending here, or -1 */
+} automato_t;
+
+/** \brief A conversation, its lower endpoint first, and its verdict */
+typedef struct conversa_s {
+	in_addr_t	ip_a;
+	in_addr_t	ip_b;
+	uint16_t	porta_a;
+	uint16_t	porta_b;
+	uint8_t		transporte;
+	uint8_t		pacotes;	/* with payload, looked at */
+	uint16_t	porta;		/* 0: no signature matched (yet) */
+	unsigned int	interface;
+} conversa_t;
+
+/* NULL: no signatures, nothing is looked at */
+static automato_t	*automato;
+
+/** \brief The conversations of each worker, ASSINATURAS_CONVERSAS of them,
+ *  allocated on first use */
+static conversa_t	*conversas[MAX_WORKERS];
+
+
+/* value of an hexadecimal digit, or -1 */
+static int
+assinaturas_hex(const char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+
+/*
+ * reads the quoted pattern at `p' into `padrao', with C escapes (\xHH,
+ * \r, \n, \t, \\ and \"); returns its length, 0 if it is not valid
+ */
+static unsigned int
+assinaturas_padrao(const char *p, unsigned char *padrao)
+{
+	unsigned int	tam = 0;
+	int		alto;
+	int		baixo;
+
+	for (p++; *p != '"'; p++) {
+		if ((*p == '\0') || (*p == '\n') || (tam == ASSINATURAS_JANELA))
+			return 0;
+		if (*p != '\\') {
+			padrao[tam++] = *p;
+			continue;
+		}
+
+		switch (*++p) {
+		case 'x':
+			alto = assinaturas_hex(p[1]);
+			baixo = (alto < 0) ? -1 : assinaturas_hex(p[2]);
+			if (baixo < 0)
+				return 0;
+			padrao[tam++] = (alto << 4) | baixo;
+			p += 2;
+			break;
+		case 'r':
+			padrao[tam++] = '\r';
+			break;
+		case 'n':
+			padrao[tam++] = '\n';
+			break;
+		case 't':
+			padrao[tam++] = '\t';
+			break;
+		case '\\':
+		case '"':
+			padrao[tam++] = *p;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return tam;
+}
+
+
+/*
+ * adds signature `k', of pattern `padrao', to the trie; returns 0 if there
+ * are no states left for it
+ */
+static int
+assinaturas_trie(automato_t *a, const unsigned int k,
+		const unsigned char *padrao)
+{
+	unsigned int	estado = 0;
+	unsigned int	i;
+	int		*ultima;
+
+	for (i = 0; i < a->assinaturas[k].tam; i++) {
+		if (a->proximo[estado][padrao[i]] == 0)
+			break;
+		estado = a->proximo[estado][padrao[i]];
+	}
+	if (a->estados + a->assinaturas[k].tam - i > ASSINATURAS_ESTADOS)
+		return 0;
+
+	for (; i < a->assinaturas[k].tam; i++) {
+		a->saida[a->estados] = -1;
+		a->proximo[estado][padrao[i]] = a->estados;
+		estado = a->estados++;
+	}
+
+	/* same pattern as earlier signatures: those are tried first */
+	for (ultima = &a->saida[estado]; *ultima >= 0;
+			ultima = &a->assinaturas[*ultima].igual)
+		;
+	*ultima = k;
+
+	return 1;
+}
+
+
+/*
+ * turns the trie into the automaton: each missing transition goes where the
+ * failure one would lead, state by state in breadth-first order, so that
+ * the states it relies on are already complete
+ */
+static int
+assinaturas_completa(automato_t *a)
+{
+	uint16_t	*falha;
+	uint16_t	*fila;
+	unsigned int	 ini = 0;
+	unsigned int	 fim = 0;
+	unsigned int	 s;
+	unsigned int	 f;
+	unsigned int	 t;
+	unsigned int	 c;
+
+	falha = calloc(a->estados, sizeof(uint16_t));
+	fila = calloc(a->estados, sizeof(uint16_t));
+	if ((falha == NULL) || (fila == NULL)) {
+		free(falha);
+		free(fila);
+		return ERROR_CALLOC;
+	}
+
+	a->sufixo[0] = 0;
+	for (c = 0; c < 256; c++) {
+		if (a->proximo[0][c] != 0)
+			fila[fim++] = a->proximo[0][c];
+	}
+
+	while (ini < fim) {
+		s = fila[ini++];
+		f = falha[s];
+		a->sufixo[s] = (a->saida[f] >= 0) ? f : a->sufixo[f];
+
+		for (c = 0; c < 256; c++) {
+			t = a->proximo[s][c];
+			if (t != 0) {
+				falha[t] = a->proximo[f][c];
+				fila[fim++] = t;
+			}
+			else
+				a->proximo[s][c] = a->proximo[f][c];
+		}
+	}
+
+	free(falha);
+	free(fila);
+	return SUCCESS;
+}
+
+
+/*
+ * reads the signatures of `arquivo' into `a', one per line:
+ *
+ *	transport  port  offset  "pattern"
+ *
+ * where offset is where the pattern starts in the payload, or `*' for
+ * anywhere in its first ASSINATURAS_JANELA bytes
+ */
+static void
+assinaturas_le(FILE *arq_ptr, const char *arquivo, automato_t *a)
+{
+	char		linha[256];
+	char		deslocamento[16];
+	unsigned char	padrao[ASSINATURAS_JANELA];
+	unsigned int	transporte;
+	unsigned int	porta;
+	unsigned int	n = 0;
+	assinatura_t	*sig;
+	char		*fim;
+	char		*p;
+
+	while (fgets(linha, sizeof(linha), arq_ptr) != NULL) {
+		n++;
+		p = linha + strspn(linha, " \t");
+		if ((*p == '#') || (*p == '\n') || (*p == '\r') || (*p == '\0'))
+			continue;
+
+		if (a->qtd == ASSINATURAS_MAX) {
+			Debug("%s: only the first %u signatures are used",
+					arquivo, ASSINATURAS_MAX);
+			return;
+		}
+
+		sig = &a->assinaturas[a->qtd];
+		if ((sscanf(p, "%u %u %15s", &transporte, &porta,
+						deslocamento) != 3) ||
+				(transporte == 0) || (transporte > 255) ||
+				(porta == 0) || (porta > 65535) ||
+				((p = strchr(p, '"')) == NULL) ||
+				((sig->tam = assinaturas_padrao(p, padrao)) == 0)) {
+			Debug("%s:%u: not a signature", arquivo, n);
+			continue;
+		}
+
+		sig->transporte = transporte;
+		sig->porta = porta;
+		sig->deslocamento = (strcmp(deslocamento, "*") == 0) ? -1 :
+			(int)strtol(deslocamento, &fim, 10);
+		sig->igual = -1;
+		if ((sig->deslocamento >= 0) && (*fim != '\0')) {
+			Debug("%s:%u: bad offset `%s'", arquivo, n,
+					deslocamento);
+			continue;
+		}
+		if ((sig->deslocamento < -1) || (sig->deslocamento +
+					sig->tam > ASSINATURAS_JANELA)) {
+			Debug("%s:%u: beyond the first %u bytes of payload",
+					arquivo, n, ASSINATURAS_JANELA);
+			continue;
+		}
+
+		if (!assinaturas_trie(a, a->qtd, padrao)) {
+			Debug("%s:%u: out of states (%u)", arquivo, n,
+					ASSINATURAS_ESTADOS);
+			continue;
+		}
+
+		if (sig->deslocamento < 0)
+			a->alcance = ASSINATURAS_JANELA;
+		else if (sig->deslocamento + sig->tam > a->alcance)
+			a->alcance = sig->deslocamento + sig->tam;
+		a->qtd++;
+	}
+}
+
+
+/**
+ * Builds the automaton from the signatures in \a arquivo.  Without that
+ * file, or without signatures in it, payloads are never looked at.
+ *
+ * \retval SUCCESS	If there are signatures to use.
+ * \retval ERROR_IO	If \a arquivo could not be read.
+ * \retval ERROR_EMPTY	If it has no valid signatures.
+ * \retval ERROR_CALLOC	If there was no memory for the automaton.
+ */
+int
+assinaturas_inicializa(const char *arquivo)
+{
+	FILE		*arq_ptr;
+	automato_t	*a;
+
+	arq_ptr = fopen(arquivo, "r");
+	if (arq_ptr == NULL) {
+		Debug("no payload signatures (%s)", arquivo);
+		return ERROR_IO;
+	}
+
+	a = calloc(1, sizeof(automato_t));
+	if (a != NULL) {
+		a->proximo = calloc(ASSINATURAS_ESTADOS, sizeof(*a->proximo));
+		a->sufixo = calloc(ASSINATURAS_ESTADOS, sizeof(uint16_t));
+		a->saida = calloc(ASSINATURAS_ESTADOS, sizeof(int));
+	}
+	if ((a == NULL) || (a->proximo == NULL) || (a->sufixo == NULL) ||
+			(a->saida == NULL)) {
+		fclose(arq_ptr);
+		goto sem_memoria;
+	}
+
+	a->estados = 1;
+	a->saida[0] = -1;
+	assinaturas_le(arq_ptr, arquivo, a);
+	fclose(arq_ptr);
+
+	if (a->qtd == 0) {
+		Debug("%s: no signatures", arquivo);
+		free(a->proximo);
+		free(a->sufixo);
+		free(a->saida);
+		free(a);
+		return ERROR_EMPTY;
+	}
+
+	if (assinaturas_completa(a) != SUCCESS)
+		goto sem_memoria;
+
+	automato = a;
+	Debug("%u payload signatures, %u automaton states", a->qtd,
+			a->estados);
+	return SUCCESS;
+
+sem_memoria:
+	Debug("no memory for the payload signatures");
+	if (a != NULL) {
+		free(a->proximo);
+		free(a->sufixo);
+		free(a->saida);
+		free(a);
+	}
+	return ERROR_CALLOC;
+}
+
+
+/** \brief How many bytes of a frame the signatures may look at; 0 if there
+ *  are none. */
+unsigned int
+assinaturas_alcance()
+{
+	return (automato == NULL) ? 0 : ASSINATURAS_CABECALHOS + automato->alcance;
+}
+
+
+/*
+ * the first signature of transport `transporte' found in `carga', in the
+ * order their patterns end, or -1
+ */
+static int
+assinaturas_busca(const automato_t *a, const unsigned char *carga,
+		unsigned int tam, const unsigned int transporte)
+{
+	const assinatura_t	*sig;
+	unsigned int		 estado = 0;
+	unsigned int		 i;
+	unsigned int		 s;
+	int			 k;
+
+	if (tam > a->alcance)
+		tam = a->alcance;
+
+	for (i = 0; i < tam; i++) {
+		estado = a->proximo[estado][carga[i]];
+
+		for (s = estado; s != 0; s = a->sufixo[s]) {
+			for (k = a->saida[s]; k >= 0; k = sig->igual) {
+				sig = &a->assinaturas[k];
+				if ((sig->transporte == transporte) &&
+						((sig->deslocamento < 0) ||
+						 (sig->deslocamento + sig->tam ==
+						  i + 1)))
+					return k;
+			}
+		}
+	}
+
+	return -1;
+}
+
+
+/*
+ * the captured payload of the packet in `dados', without the Ethernet
+ * padding; returns how many bytes of it there are
+ */
+static unsigned int
+assinaturas_carga(const pedb_t *dados, const unsigned char **carga)
+{
+	const unsigned char	*ip;
+	unsigned int		 fim;
+
+	if (dados->quadro == NULL)
+		return 0;
+
+	ip = dados->quadro + dados->offset_rede;
+	fim = dados->offset_rede + ((ip[2] << 8) | ip[3]);
+	if (fim > dados->capturado)
+		fim = dados->capturado;
+	if (fim <= dados->offset_aplic)
+		return 0;
+
+	*carga = dados->quadro + dados->offset_aplic;
+	return fim - dados->offset_aplic;
+}
+
+
+/**
+ * Classifies by its payload a TCP or UDP packet whose ports are not in
+ * protocolDir.  While its conversation is undecided, the flow being
+ * recorded (dados->fluxo) is not kept, so the next packet comes back here.
+ *
+ * \return The encapsulation of the signature the conversation matched, if
+ *	   it is in protocolDir, or NULL.
+ */
+pdir_node_t *
+assinaturas_classifica(pedb_t *dados)
+{
+	const automato_t	*a = automato;
+	const unsigned char	*carga;
+	conversa_t		 chave;
+	conversa_t		*c;
+	uint64_t		 x;
+	unsigned int		 tam;
+	int			 k;
+
+	if ((a == NULL) || (dados->worker >= MAX_WORKERS) ||
+			((dados->prot_transporte != IPPROTO_TCP) &&
+			 (dados->prot_transporte != IPPROTO_UDP)))
+		return NULL;
+
+	if (conversas[dados->worker] == NULL) {
+		conversas[dados->worker] = calloc(ASSINATURAS_CONVERSAS,
+				sizeof(conversa_t));
+		if (conversas[dados->worker] == NULL) {
+			Debug("no memory for the conversations of worker %u",
+					dados->worker);
+			return NULL;
+		}
+	}
+
+	/* both directions share the entry */
+	memset(&chave, 0, sizeof(chave));
+	if ((dados->ip_orig < dados->ip_dest) ||
+			((dados->ip_orig == dados->ip_dest) &&
+			 (dados->rede_sport <= dados->rede_dport))) {
+		chave.ip_a = dados->ip_orig;
+		chave.ip_b = dados->ip_dest;
+		chave.porta_a = dados->rede_sport;
+		chave.porta_b = dados->rede_dport;
+	}
+	else {
+		chave.ip_a = dados->ip_dest;
+		chave.ip_b = dados->ip_orig;
+		chave.porta_a = dados->rede_dport;
+		chave.porta_b = dados->rede_sport;
+	}
+	chave.transporte = dados->prot_transporte;
+	chave.interface = dados->interface;
+
+	x = ((uint64_t)chave.ip_a << 32) | chave.ip_b;
+	x ^= ((uint64_t)chave.porta_a << 48) | ((uint64_t)chave.porta_b << 32) |
+		(chave.transporte << 8) | chave.interface;
+	x *= 0x9e3779b97f4a7c15ULL;
+	x ^= x >> 29;
+	c = &conversas[dados->worker][x & (ASSINATURAS_CONVERSAS - 1)];
+
+	if ((c->ip_a != chave.ip_a) || (c->ip_b != chave.ip_b) ||
+			(c->porta_a != chave.porta_a) ||
+			(c->porta_b != chave.porta_b) ||
+			(c->transporte != chave.transporte) ||
+			(c->interface != chave.interface))
+		*c = chave;
+
+	if (c->porta != 0)
+		return pdir_localiza_ipv4(c->transporte, c->porta);
+	if (c->pacotes == ASSINATURAS_PACOTES)
+		return NULL;
+
+	/* handshakes and bare ACKs do not count */
+	tam = assinaturas_carga(dados, &carga);
+	if (tam == 0) {
+		fluxo_abandona(dados->fluxo);
+		return NULL;
+	}
+
+	c->pacotes++;
+	k = assinaturas_busca(a, carga, tam, c->transporte);
+	if (k < 0) {
+		if (c->pacotes < ASSINATURAS_PACOTES)
+			fluxo_abandona(dados->fluxo);
+		return NULL;
+	}
+
+	c->porta = a->assinaturas[k].porta;
+	return pdir_localiza_ipv4(c->transporte, c->porta);
+}
@@ -0,0 +1,101 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file carencia.c
+ *  \brief Grace periods, for what the accounting reads without locks
+ *
+ *  The accounting workers look protocolDir up with no lock at all.  To
+ *  replace what they read, a writer publishes the new version with a single
+ *  atomic store, then waits for a grace period before freeing the old one:
+ *  until every worker that was inside a batch at the time of the store has
+ *  left it.  Workers never wait for writers; a batch only costs them two
+ *  stores and a fence.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "configuracao.h"
+#include "shards.h"
+#include "carencia.h"
+
+
+/* how long a writer sleeps between looks at the workers */
+#define CARENCIA_ESPERA_NS	50000
+
+/** \brief Batches each worker started and finished: odd while inside one.
+ *  One cache line per worker, as each writes its own at every batch. */
+static struct {
+	uint64_t	contador;
+	char		resto[64 - sizeof(uint64_t)];
+} estados[MAX_WORKERS] __attribute__((aligned(64)));
+
+
+/** \brief Called by \a worker before it starts a batch. */
+void
+carencia_entra(const unsigned int worker)
+{
+	if (worker >= MAX_WORKERS)
+		return;
+
+	__atomic_store_n(&estados[worker].contador,
+			estados[worker].contador + 1, __ATOMIC_RELAXED);
+	/* what the batch reads is not to be read before the store is seen */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+/** \brief Called by \a worker once a batch is over, and it keeps no
+ *  pointer to anything published. */
+void
+carencia_sai(const unsigned int worker)
+{
+	if (worker >= MAX_WORKERS)
+		return;
+
+	__atomic_store_n(&estados[worker].contador,
+			estados[worker].contador + 1, __ATOMIC_RELEASE);
+}
+
+
+/** \brief Waits until no worker can still be reading what was replaced
+ *  before the call.  Must not be called by a worker. */
+void
+carencia_aguarda()
+{
+	const struct timespec	espera = { 0, CARENCIA_ESPERA_NS };
+	uint64_t		vistos[MAX_WORKERS];
+	unsigned int		w;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (w = 0; w < MAX_WORKERS; w++)
+		vistos[w] = __atomic_load_n(&estados[w].contador,
+				__ATOMIC_ACQUIRE);
+
+	for (w = 0; w < MAX_WORKERS; w++) {
+		/* outside a batch, or in one started after the replacement */
+		while ((vistos[w] & 1) && (__atomic_load_n(
+						&estados[w].contador,
+						__ATOMIC_ACQUIRE) == vistos[w]))
+			nanosleep(&espera, NULL);
+	}
+}
@@ -21,9 +21,12 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 #include <pcap.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -34,46 +37,16 @@
 #include <netinet/udp.h>
 #include <string.h>
 #include <semaphore.h>
-
+#include <poll.h>
+#include <net/if.h>
 #ifdef __linux__
-#	define IP_HEADER		struct iphdr
-#	define IP_VERSION(a)	(a->version)
-#	define IP_HDRLEN(a)		(a->ihl)
-#	define IP_ORIG(a)		(a->saddr)
-#	define IP_DEST(a)		(a->daddr)
-#	define IP_PROTO(a)		(a->protocol)
-#	define TCP_HEADER		struct tcphdr
-#	define TCP_SPORT(a)		(a->source)
-#	define TCP_DPORT(a)		(a->dest)
-#	define TCP_DOFF(a)		(a->doff)
-#	define UDP_HEADER		struct udphdr
-#	define UDP_SPORT(a)		(a->source)
-#	define UDP_DPORT(a)		(a->dest)
-#else
-#	ifdef __FreeBSD__
-#	define IP_HEADER		struct ip
-#	define IP_VERSION(a)	(a->ip_v)
-#	define IP_HDRLEN(a)		(a->ip_hl)
-#	define IP_ORIG(a)		(a->ip_src.s_addr)
-#	define IP_DEST(a)		(a->ip_dst.s_addr)
-#	define IP_PROTO(a)		(a->ip_p)
-#	define TCP_HEADER		struct tcphdr
-#	define TCP_SPORT(a)		(a->th_sport)
-#	define TCP_DPORT(a)		(a->th_dport)
-#	define TCP_DOFF(a)		(a->th_off)
-#	define UDP_HEADER		struct udphdr
-#	define UDP_SPORT(a)		(a->uh_sport)
-#	define UDP_DPORT(a)		(a->uh_dport)
-#	else
-#	error "Unsupported OS (not GNU/Linux nor FreeBSD)."
-#	endif
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #endif
 
 #include "configuracao.h"
 
 #include <pthread.h>
-#define mtx_lock(a) pthread_mutex_lock(a)
-#define mtx_unlock(a) pthread_mutex_unlock(a)
 
 #include "rowstatus.h"
 #include "exit_codes.h"
@@ -89,6 +62,7 @@
 #include "pedb.h"
 
 #include "sysuptime.h"
+#include "rdtsc.h"
 
 #include "conversor.h"
 
@@ -104,48 +78,294 @@
 #include "nlmatrix_DS.h"
 #include "almatrix_SD.h"
 #include "almatrix_DS.h"
+#include "shards.h"
+#include "prefiltro.h"
+#include "descartes.h"
+#include "duplicatas.h"
 #include "settings.h"
+#include "afinidade.h"
+#include "decodifica.h"
+#include "fluxos.h"
+#include "assinaturas.h"
+#include "carencia.h"
 #include "log.h"
 
 #include "fila_cap.h"
+#ifdef __linux__
+#include "pkt_sniffer.h"
+#include "xsk_sniffer.h"
+#include "agregador.h"
+#endif
+
+
+static char owner[] = "monitor";
 
+/* monitored interfaces, and the ifIndex used as their control index */
+static struct {
+	char		*nome;
+	unsigned int	 ifindex;
+} interfaces[MAX_INTERFACES];
+static unsigned int	interfaces_qtd = 0;
 
+/* interface of the single-threaded paths (sniff() and friends) */
 static char *dev;
 
-/* porquice */
-//static char dev[] = "eth0";
-static char owner[] = "monitor";
+/* 1 in every `amostragem' packets is accounted, weighing that much */
+static unsigned int	amostragem = 1;
+
+/* drop repeated frames (see duplicatas.c)? */
+static int		deduplicar = 0;
+
+/* protocolDist and nlHost counted in the kernel (see agregador.c)? */
+static int		agregando = 0;
 
 
 /*****************************************************************************
   Fila de pacotes
+
+  Fila circular com um nico produtor (sniff) e um nico consumidor (o
+  contabilizador), sem travas: cada lado s escreve no seu prprio ndice, e
+  os ndices ficam em linhas de cache separadas.  O produtor publica a cabea
+  uma vez por lote de pcap_dispatch(), e o consumidor retira at FILA_LOTE
+  pacotes por vez.  Os ndices crescem livremente; a posio no vetor 
+  obtida com FILA_MASCARA.
  ****************************************************************************/
 static fila_t		fila[FILA_MAX];   /* o vetor de pacotes */
 
-static pthread_mutex_t	fila_pthmutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t	thr_sniffer;
-static sem_t		fila_semaforo;		/* semforo para proteger fila_tam */
+#ifndef __linux__
+static sem_t		fila_semaforo;		/* para acordar o consumidor */
+#endif
+
+/* ndice publicado pelo produtor (lido pelo consumidor) */
+static struct {
+	volatile uint32_t	indice;
+} fila_cabeca FILA_ALINHADO;
+
+/* ndice publicado pelo consumidor (lido pelo produtor) */
+static struct {
+	volatile uint32_t	indice;
+	volatile uint32_t	dormindo;	/* consumidor bloqueado? */
+} fila_fim FILA_ALINHADO;
+
+/* dados privados do produtor */
+static struct {
+	uint32_t	cabeca;			/* prxima posio livre */
+	uint32_t	fim;			/* ltima cpia de fila_fim */
+	uint32_t	lote;			/* inseridos e no publicados */
+	uint32_t	snaplen;		/* bytes copiados por pacote */
+	uint32_t	amostra;		/* pacotes desde o ltimo amostrado */
+	uint32_t	inseridos;		/* pacotes inseridos na fila */
+	uint32_t	descartes;		/* pacotes descartados */
+	uint32_t	hist[FILA_HIST];	/* tamanhos de lote publicados */
+} fila_prod FILA_ALINHADO;
+
+/* dados privados do consumidor */
+static struct {
+	uint32_t	fim;			/* prximo pacote a processar */
+	uint32_t	removidos;		/* pacotes processados */
+	uint32_t	esperas;		/* vezes em que dormiu */
+	uint32_t	corte;			/* nvel de corte atual */
+	uint32_t	cortados[CORTE_NIVEIS];	/* pacotes sem cada anlise */
+	uint32_t	hist[FILA_HIST];	/* tamanhos de lote retirados */
+} fila_cons FILA_ALINHADO;
 
 
-static uint32_t    	fila_tam;		/* tamanho da fila (crtico) */
-static uint32_t    	fila_descartes;		/* pacotes descartados */
-static uint32_t    	fila_inseridos;		/* pacotes inseridos na fila */
-static unsigned int	fila_cabeca;		/* ndice da cabea da fila */
-static unsigned int	fila_fim;		/* ndice do final da fila */
+/*
+ * hist[i] conta os lotes com 2^i <= tamanho < 2^(i+1)
+ */
+static inline unsigned int
+fila_hist_indice(const uint32_t tamanho)
+{
+	unsigned int	i = 31 - __builtin_clz(tamanho);
+
+	return (i < FILA_HIST) ? i : FILA_HIST - 1;
+}
 
 
 #if FILA_DEBUG
 /* mostrar dados da fila - debug */
 static void fila_info()
 {
-	static int semvalue;
+	unsigned int	i;
 
-	sem_getvalue(&fila_semaforo, &semvalue);
 	Debug("  fila: [%u], inicio: %u, fim: %u, inseres: %u, descartes: %u,"
-		       " semaforo: %d", fila_tam, fila_cabeca, fila_fim,
-		       fila_inseridos, fila_descartes, semvalue);
+		       " esperas: %u", fila_cabeca.indice - fila_fim.indice,
+		       fila_cabeca.indice, fila_fim.indice, fila_prod.inseridos,
+		       fila_prod.descartes, fila_cons.esperas);
+	for (i = 0; i < FILA_HIST; i++) {
+		Debug("  lotes de %u+: %u inseridos, %u removidos", 1 << i,
+				fila_prod.hist[i], fila_cons.hist[i]);
+	}
+	Debug("  corte: %u, sem traos: %u, sem matrizes: %u, sem hosts: %u",
+			fila_cons.corte, fila_cons.cortados[CORTE_TRACOS],
+			fila_cons.cortados[CORTE_MATRIZES],
+			fila_cons.cortados[CORTE_HOSTS]);
+}
+#endif
+
+
+/*
+ * espera ativa educada, enquanto o produtor no publica
+ */
+static inline void
+fila_relaxa()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+
+/*
+ * bloqueia o consumidor enquanto a cabea ainda valer `cabeca'
+ */
+static void
+fila_dorme(const uint32_t cabeca)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &fila_cabeca.indice, FUTEX_WAIT_PRIVATE, cabeca,
+			NULL, NULL, 0);
+#else
+	if (fila_cabeca.indice == cabeca)
+		sem_wait(&fila_semaforo);
+#endif
 }
+
+
+static void
+fila_acorda()
+{
+#ifdef __linux__
+	syscall(SYS_futex, &fila_cabeca.indice, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+#else
+	sem_post(&fila_semaforo);
 #endif
+}
+
+
+/*
+ * Statistical sampling: tells whether the next packet is the 1 in
+ * `amostragem' to be accounted, counting the skipped ones in `contador'.
+ * Deterministic, so a capture path holds one counter for all its packets.
+ */
+static inline int
+amostra_escolhe(uint32_t *contador)
+{
+	if (amostragem == 1)
+		return 1;
+
+	if (++(*contador) < amostragem)
+		return 0;
+
+	*contador = 0;
+	return 1;
+}
+
+
+/*
+ * Tells whether a captured frame is to be accounted: repeats are dropped
+ * first, so that sampling never splits the two copies of a mirrored frame.
+ * `instante' is the capture time, in microseconds.
+ */
+static inline int
+pkt_admite(const unsigned int worker, uint32_t *amostra, const u_char *quadro,
+		const uint32_t caplen, const uint64_t instante)
+{
+	if (deduplicar &&
+			duplicatas_verifica(worker, quadro, caplen, instante))
+		return 0;
+
+	return amostra_escolhe(amostra);
+}
+
+
+/* the capture time of a libpcap header, in microseconds */
+#define PCAP_INSTANTE(h)	((uint64_t)(h)->ts.tv_sec * 1000000 + \
+		(h)->ts.tv_usec)
+
+
+/*
+ * callback de pcap_dispatch(): copia o pacote para a fila, sem public-lo
+ */
+static void
+fila_insere(u_char *usuario __attribute__((unused)),
+		const struct pcap_pkthdr *header,
+		const u_char *data_ptr)
+{
+	fila_t		*p;
+	uint32_t	 tam;
+
+	/* a repeat, or not sampled: not even copied */
+	if (!pkt_admite(0, &fila_prod.amostra, data_ptr, header->caplen,
+				PCAP_INSTANTE(header)))
+		return;
+
+	if (fila_prod.cabeca - fila_prod.fim == FILA_MAX) {
+		/* parece cheia, ver se o consumidor andou */
+		fila_prod.fim = __atomic_load_n(&fila_fim.indice,
+				__ATOMIC_ACQUIRE);
+		if (fila_prod.cabeca - fila_prod.fim == FILA_MAX) {
+			/* fila cheia */
+			fila_prod.descartes++;
+			return;
+		}
+	}
+
+	tam = (header->caplen < fila_prod.snaplen) ?
+		header->caplen : fila_prod.snaplen;
+
+	p = &fila[fila_prod.cabeca & FILA_MASCARA];
+	p->tam = header->len;
+	p->capturado = tam;
+	memcpy(p->dados, data_ptr, tam);
+
+	fila_prod.cabeca++;
+	fila_prod.lote++;
+}
+
+
+/*
+ * torna visveis ao consumidor os pacotes inseridos desde a ltima chamada
+ */
+static void
+fila_publica()
+{
+	if (fila_prod.lote == 0)
+		return;
+
+	__atomic_store_n(&fila_cabeca.indice, fila_prod.cabeca,
+			__ATOMIC_RELEASE);
+
+	fila_prod.inseridos += fila_prod.lote;
+	fila_prod.hist[fila_hist_indice(fila_prod.lote)]++;
+	fila_prod.lote = 0;
+
+	/* casa com a barreira em fila_proximo_lote() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&fila_fim.dormindo, __ATOMIC_RELAXED))
+		fila_acorda();
+}
+
+
+/*
+ * soma os descartes do kernel numa captura libpcap (ps_drop  acumulado)
+ */
+static void
+descartes_pcap(pcap_t *captura, const unsigned int interface,
+		uint32_t *anterior)
+{
+	struct pcap_stat	stats;
+
+	if (pcap_stats(captura, &stats) != 0)
+		return;
+
+	descartes_captura(interface, stats.ps_drop - *anterior);
+	*anterior = stats.ps_drop;
+}
 
 
 /*
@@ -156,15 +376,18 @@ static void
 *sniff()
 {
 	char			 erro_pcap_string[PCAP_ERRBUF_SIZE];
-	struct pcap_pkthdr	 header;
-	const u_char		*data_ptr;
 	pcap_t			*captura;
+	unsigned int		 geracao = 0;	/* of the prefilter */
+	unsigned long		 proximo = 0;	/* next drop collection */
+	uint32_t		 kernel = 0;	/* drops already collected */
+	uint32_t		 cheia = 0;
 #ifdef __linux__
 	struct sched_param	 schedparams;
 	int			 policy;
 #endif
 
 	Debug("sniffer has TID %p", pthread_self());
+	afinidade_aplica(AFINIDADE_CAPTURA, 0);
 
 	/* We'll ask for SCHED_RR scheduling policy */
 #ifdef __linux__
@@ -180,21 +403,11 @@ static void
 	}
 #endif
 
-	/* FIXME colocar "escolhedor" de dev e esquema pra verificar se  ethernet */
+	/* FIXME esquema pra verificar se  ethernet */
 	/* abrir interface "dev", capturando SNAPLEN bytes, em modo promscuo (1),
-	   sem (-1) timeout de leitura */
-	dev = conf_get_interface();
-	if (dev == NULL) {
-		Debug("error while trying to open network interface `%s'", dev);
-		return (void *)ERROR_IO;
-	}
+	   com timeout de 100ms (para trocar o prefiltro mesmo sem trfego) */
 	Debug("opening network device `%s' for capture", dev);
-#ifdef __FreeBSD__
 	captura = pcap_open_live(dev, FILA_SNAPLEN, 1, 100, erro_pcap_string);
-#endif
-#ifdef __linux__
-	captura = pcap_open_live(dev, FILA_SNAPLEN, 1, -1, erro_pcap_string);
-#endif
 	if (captura == NULL) {
 		Error("could not open network device `%s'", dev);
 		return (void *)ERROR_IO;
@@ -207,170 +420,246 @@ static void
 #endif
 
 	while (1) {
-		data_ptr = pcap_next(captura, &header);
+		prefiltro_aplica_pcap(captura, &geracao);
+		/* a libpcap no corta no snaplen do prefiltro, cortamos ns */
+		fila_prod.snaplen = prefiltro_snaplen();
+
+		/* copiar at FILA_LOTE pacotes, e public-los de uma vez */
+		if (pcap_dispatch(captura, FILA_LOTE, fila_insere, NULL) < 0) {
+			Debug("pcap_dispatch: %s", pcap_geterr(captura));
+			continue;
+		}
 
-		if (data_ptr) {
-			if (fila_tam < FILA_MAX) {
-				/* data_ptr no  NULL, fila tem espao */
-				fila[fila_cabeca].tam = header.len;
-				memcpy(fila[fila_cabeca].dados, data_ptr, FILA_SNAPLEN);
-				fila_cabeca = (fila_cabeca + 1) % FILA_MAX;
+		fila_publica();
+
+		if (descartes_vencido(&proximo)) {
+			descartes_pcap(captura, interfaces[0].ifindex, &kernel);
+			descartes_captura(interfaces[0].ifindex,
+					fila_prod.descartes - cheia);
+			cheia = fila_prod.descartes;
+			descartes_publica();
+		}
+	}
+}
 
-				/* entering critical section */
-				mtx_lock(&fila_pthmutex);
-				fila_tam++;
-				/* exiting critical section */
-				mtx_unlock(&fila_pthmutex);
 
-				fila_inseridos++;
+/*
+   espera haver pacotes na fila e diz quantos (at FILA_LOTE) podem ser
+   processados a partir de fila_cons.fim
+   */
+static uint32_t
+fila_proximo_lote()
+{
+	uint32_t	cabeca;
+	uint32_t	disponiveis;
+	unsigned int	giros = 0;
 
-				/* "avisar" chegada de pacote */
-				sem_post(&fila_semaforo);
-			}
-			else
-				/* fila cheia */
-				fila_descartes++;
-#if FILA_DEBUG
-			fila_info();
-#endif
+	while (1) {
+		cabeca = __atomic_load_n(&fila_cabeca.indice, __ATOMIC_ACQUIRE);
+		disponiveis = cabeca - fila_cons.fim;
+		if (disponiveis != 0)
+			break;
+
+		if (giros < FILA_GIROS) {
+			giros++;
+			fila_relaxa();
+			continue;
 		}
+
+		/* cansou de girar, dormir at o produtor publicar */
+		__atomic_store_n(&fila_fim.dormindo, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		fila_dorme(cabeca);
+		__atomic_store_n(&fila_fim.dormindo, 0, __ATOMIC_RELAXED);
+		fila_cons.esperas++;
+		giros = 0;
 	}
+
+	if (disponiveis > FILA_LOTE)
+		disponiveis = FILA_LOTE;
+
+	fila_cons.hist[fila_hist_indice(disponiveis)]++;
+
+	return disponiveis;
 }
 
 
 /*
- * apenas atualiza o tamanho da fila e o fim (???)
+ * Load shedding: the deeper the backlog, the less the consumer analyses of
+ * each packet, so it catches up before the fila overflows and sniff() starts
+ * dropping packets blindly.  A level is entered as soon as the backlog
+ * reaches its threshold, and left only when it falls below half of it.
  */
-static void
-fila_remove()
+static unsigned int
+fila_corte(const uint32_t lote)
 {
-	fila_fim = (fila_fim + 1) % FILA_MAX;
-
-	/* entering critical section */
-	mtx_lock(&fila_pthmutex);
-	fila_tam--;
+	static const uint32_t	limite[CORTE_NIVEIS] = {
+		0, FILA_CORTE_TRACOS, FILA_CORTE_MATRIZES, FILA_CORTE_HOSTS
+	};
+	uint32_t		ocupacao;
+	unsigned int		nivel = fila_cons.corte;
+	unsigned int		n;
+
+	ocupacao = __atomic_load_n(&fila_cabeca.indice, __ATOMIC_RELAXED) -
+		fila_cons.fim;
+
+	while ((nivel + 1 < CORTE_NIVEIS) && (ocupacao >= limite[nivel + 1]))
+		nivel++;
+	while ((nivel > CORTE_NENHUM) && (ocupacao < limite[nivel] / 2))
+		nivel--;
+
+	if (nivel != fila_cons.corte) {
+		Debug("shedding level %u, %u packets queued", nivel, ocupacao);
+		__atomic_store_n(&fila_cons.corte, nivel, __ATOMIC_RELAXED);
+	}
 
-	/* exiting critical section */
-	mtx_unlock(&fila_pthmutex);
+	for (n = CORTE_TRACOS; n <= nivel; n++)
+		__atomic_store_n(&fila_cons.cortados[n],
+				fila_cons.cortados[n] + lote, __ATOMIC_RELAXED);
 
-#if FILA_DEBUG
-	fila_info();
-#endif
+	return nivel;
 }
 
 
 /*
-   entrega o proximo pacote, se houver
-   */
+ * libera para o produtor as posies dos `quantos' pacotes processados
+ */
 static void
-fila_proximo()
+fila_remove_lote(const uint32_t quantos)
 {
-	while (fila_tam == 0) {
-		sem_wait(&fila_semaforo);
-	}
+	fila_cons.fim += quantos;
+	fila_cons.removidos += quantos;
+
+	__atomic_store_n(&fila_fim.indice, fila_cons.fim, __ATOMIC_RELEASE);
+
+#if FILA_DEBUG
+	if ((fila_cons.removidos & 0xffff) < quantos)
+		fila_info();
+#endif
 }
 
 
 static int
 fila_inicializa()
 {
+#ifndef __linux__
 	if (sem_init(&fila_semaforo, 0, 0) != 0) {
 		return ERROR_PKTQUEUE;
 	}
+#endif
 
 	return SUCCESS;
 }
 /*****************************************************************************/
 
 
-static int
-pkt_decode(const u_char *packet, pedb_t *prepacote)
+/*
+ * marca as tabelas que ficaram sem o pacote por falta de espao; o fluxo
+ * do pacote no pode ser guardado sem elas
+ */
+static inline int
+pkt_descarte(pedb_t *dados, const int ret, const unsigned int tabela)
 {
-	struct ether_header	*ether;
-	IP_HEADER		*ip;
-	TCP_HEADER		*tcp;
-	UDP_HEADER		*udp;
-	uint16_t		*u16_ptr;
+	if ((ret == ERROR_FULL) || (ret == ERROR_HASH))
+		dados->descartes |= tabela;
+	if (ret != SUCCESS)
+		fluxo_abandona(dados->fluxo);
 
-	ether = (struct ether_header *)packet;
-	if (ntohs(ether->ether_type) == ETHERTYPE_IP) {
-		/* camada de rede OK */
-		prepacote->prot_enlace = 1;
-	}
-	else {
-		/* no  um pacote ethernet vlido para ns */
-		return ERROR_LINKLAYER;
-	}
+	return ret;
+}
 
-	/* pula o cabealho ethernet */
-	ip = (IP_HEADER *)(packet + 14);
-	if (IP_VERSION(ip) == 4) {
-		/* bom */
-		prepacote->prot_rede = ETHERTYPE_IP;
-		prepacote->ip_orig = IP_ORIG(ip);
-		prepacote->ip_dest = IP_DEST(ip);
-		/* NEW */
-		prepacote->offset_rede = 14;
-		prepacote->offset_trans = prepacote->offset_rede + IP_HDRLEN(ip) * 4;
-	}
-	else {
-		/* pacote IP invlido para ns */
-		return ERROR_NETWORKLAYER;
-	}
 
-	/* verificar se o pacote  broadcast */
-	u16_ptr = (uint16_t *)ether->ether_dhost;
-	if ((u16_ptr[0] & u16_ptr[1] & u16_ptr[2]) == 0xffff) {
-		/* pacote  broadcast sim */
-		prepacote->is_broadcast = 1;
+/*
+ * registra nas tabelas marcadas em `acoes' um pacote do encapsulamento de
+ * ndice `local_index'
+ */
+static inline void
+pkt_despacha(pedb_t *dados, const unsigned int acoes,
+		const unsigned int local_index)
+{
+	if (acoes & PDIR_ACAO_PDIST)
+		pkt_descarte(dados, pdist_update(dados->worker,
+					dados->interface, local_index,
+					dados->peso, dados->tamanho,
+					dados->fluxo),
+				DESCARTE_PDIST);
+
+	if (acoes & PDIR_ACAO_NLHOST) {
+		if (pkt_descarte(dados, nlhost_insereAtualiza(dados),
+					DESCARTE_NL) != SUCCESS) {
+			Debug("nlhost_insereAtualiza() falhou");
+		}
 	}
-	else {
-		prepacote->is_broadcast = 0;
+
+	if (acoes & PDIR_ACAO_NLMATRIX) {
+		pkt_descarte(dados, nlmatrix_SD_insereAtualiza(dados),
+				DESCARTE_NL);
+		pkt_descarte(dados, nlmatrix_DS_insereAtualiza(dados),
+				DESCARTE_NL);
 	}
 
-	/* verificar por TCP */
-	if (IP_PROTO(ip) == IPPROTO_TCP) {
-		tcp = (struct tcphdr *)(packet + prepacote->offset_trans);
-		prepacote->prot_transporte = IPPROTO_TCP;
-		prepacote->rede_sport = ntohs(TCP_SPORT(tcp));
-		prepacote->rede_dport = ntohs(TCP_DPORT(tcp));
-		prepacote->offset_aplic = prepacote->offset_trans + TCP_DOFF(tcp) * 4;
+	if (acoes & PDIR_ACAO_ALHOST) {
+		if (pkt_descarte(dados, alhost_insereAtualiza(dados),
+					DESCARTE_AL) != SUCCESS) {
+			Debug("alhost_insereAtualiza() falhou");
+		}
 	}
-	else {
-		/* verificar por UDP */
-		if (IP_PROTO(ip) == IPPROTO_UDP) {
-			udp = (struct udphdr *)(packet + prepacote->offset_trans);
-			prepacote->prot_transporte = IPPROTO_UDP;
-			prepacote->rede_sport = ntohs(UDP_SPORT(udp));
-			prepacote->rede_dport = ntohs(UDP_SPORT(udp));
-			prepacote->offset_aplic = prepacote->offset_trans + 8;
+
+	if (acoes & PDIR_ACAO_ALMATRIX) {
+		if (pkt_descarte(dados, almatrix_SD_insereAtualiza(dados),
+					DESCARTE_AL) != SUCCESS) {
+			Debug("almatrix_SD_insereAtualiza() falhou");
 		}
-		else {
-			/* verificar por ICMP */
-			if (IP_PROTO(ip) == IPPROTO_ICMP) {
-				prepacote->prot_transporte = IPPROTO_ICMP;
-				prepacote->rede_sport = 0;
-				prepacote->rede_dport = 0;
-				prepacote->offset_aplic = prepacote->offset_trans + 8;
-			}
-			else {
-				return ERROR_TRANSPLAYER;
-			}
+		if (pkt_descarte(dados, almatrix_DS_insereAtualiza(dados),
+					DESCARTE_AL) != SUCCESS) {
+			Debug("almatrix_DS_insereAtualiza() falhou");
 		}
 	}
+}
 
-	/* FIXME */
-	prepacote->interface = 2;
 
-	//    fprintf(stderr, "offsets: %3u | %3u | %3u\n", prepacote->offset_rede,
-	//	    prepacote->offset_trans, prepacote->offset_aplic);
+/*
+ * What pkt_process() may do with the packets of a batch (PDIR_ACAO_*), from
+ * the control rows of the interface, the aggregator and the shedding level;
+ * none of them changes within a batch.  0 if the interface is not active.
+ */
+static unsigned int
+pkt_acoes(const pedb_t *dados)
+{
+	unsigned int	acoes = PDIR_ACOES_TODAS;
+
+	if ((hlhost_getRowstatus(dados->interface) != ROWSTATUS_ACTIVE) ||
+			(pdist_control_busca_status(dados->interface) !=
+			 ROWSTATUS_ACTIVE)) {
+		if (dados->acoes != 0)
+			Debug("interface %u inactive, not accounted",
+					dados->interface);
+		return 0;
+	}
+
+	if (hlmatrix_getRowstatus(dados->interface) != ROWSTATUS_ACTIVE)
+		acoes &= ~(PDIR_ACAO_NLMATRIX | PDIR_ACAO_ALMATRIX);
+	if (agregando)
+		acoes &= ~(PDIR_ACAO_PDIST | PDIR_ACAO_NLHOST);
 
-	/* terminou bem */
-	return SUCCESS;
+	if (dados->corte >= CORTE_TRACOS)
+		acoes &= ~PDIR_ACAO_TRACOS;
+	if (dados->corte >= CORTE_MATRIZES)
+		acoes &= ~(PDIR_ACAO_NLMATRIX | PDIR_ACAO_ALMATRIX);
+	if (dados->corte >= CORTE_HOSTS)
+		acoes &= ~(PDIR_ACAO_NLHOST | PDIR_ACAO_ALHOST);
+
+	return acoes;
 }
 
 
-static int pkt_process(pedb_t *dados)
+/*
+ * Classifies a decoded packet and accounts it.  Each of its encapsulations
+ * found in protocolDir says, in its precomputed `acoes', which tables it
+ * feeds; that is masked by what the batch allows (dados->acoes, see
+ * pkt_acoes()).
+ */
+static int pkt_classifica(pedb_t *dados)
 {
 	pdir_node_t	*pdir_ptr;
 
@@ -378,16 +667,6 @@ static int pkt_process(pedb_t *dados)
 	char	informacao[10] = "   [ERTA]\0";
 #endif
 
-	if (hlhost_getRowstatus(dados->interface) != ROWSTATUS_ACTIVE) {
-		Debug("inactive hlHost interface %d", dados->interface);
-		return ERROR_ISINACTIVE;
-	}
-
-	if (pdist_control_busca_status(dados->interface) != ROWSTATUS_ACTIVE) {
-		Debug("inactive protocolDist interface %d", dados->interface);
-		return ERROR_ISINACTIVE;
-	}
-
 #if DEBUGMSG_INFO_PACOTE
 	Debug("packet: %d.%d.%d.(%ds/%dd)", dados->prot_enlace, dados->prot_rede,
 			dados->prot_transporte, dados->rede_sport,
@@ -395,36 +674,17 @@ static int pkt_process(pedb_t *dados)
 #endif
 
 	/* achar encapsulamento enlace.rede.(null).(null) */
-	pdir_ptr = pdir_localiza(dados->prot_enlace, dados->prot_rede, 0, 0);
+	pdir_ptr = pdir_localiza_ipv4(0, 0);
 
 	if (pdir_ptr != NULL) {
 		/* encapsulamento encontrado - salvar o localindex */
 		dados->nl_localindex = pdir_ptr->local_index;
-#if DEBUGMSG_PROC_PACOTE
-		Debug("enlace.rede.(null).(null)");
-#endif
 #if DEBUGMSG_INFO_PACOTE
 		informacao[4] = 'E';
 		informacao[5] = 'R';
 #endif
-		pdist_update(dados->interface, pdir_ptr->local_index, 1,
-				dados->tamanho);
-		/* encapsulamento suporta nlhost? */
-		if (pdir_ptr->host_config == PDIR_CFG_supportedOn) {
-			if (nlhost_insereAtualiza(dados) != SUCCESS) {
-				Debug("nlhost_insereAtualiza() falhou");
-			}
-		}
-
-		/* encapsulamento suporta nlmatrix? */
-		if (hlmatrix_getRowstatus(dados->interface) == ROWSTATUS_ACTIVE) {
-			/* pacote unicast e nlmatrix suportada */
-			if (pdir_ptr->matrix_config == PDIR_CFG_supportedOn) {
-				nlmatrix_SD_insereAtualiza(dados);
-				nlmatrix_DS_insereAtualiza(dados);
-			}
-		}
-
+		pkt_despacha(dados, pdir_ptr->acoes & dados->acoes,
+				pdir_ptr->local_index);
 #if PTSL
 		dados->prim_traco_rede = pdir_ptr->primeiro_traco;
 #endif
@@ -440,39 +700,16 @@ static int pkt_process(pedb_t *dados)
 	}
 
 	/* achar encapsulamento enlace.rede.transporte.(null) */
-	pdir_ptr = pdir_localiza(dados->prot_enlace, dados->prot_rede,
-			dados->prot_transporte, 0);
+	pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte, 0);
 
 	if (pdir_ptr != NULL) {
 		/* encapsulamento encontrado */
-#if DEBUGMSG_PROC_PACOTE
-		Debug("enlace.rede.transporte.(null)");
-#endif
 #if DEBUGMSG_INFO_PACOTE
 		informacao[6] = 'T';
 #endif
 		dados->al_localindex = pdir_ptr->local_index;
-
-		pdist_update(dados->interface, pdir_ptr->local_index, 1,
-				dados->tamanho);
-
-		/* encapsulamento suporta alhost? */
-		if (pdir_ptr->host_config == PDIR_CFG_supportedOn) {
-			if (alhost_insereAtualiza(dados) != SUCCESS) {
-				Debug("alhost_insereAtualiza() falhou");
-			}
-		}
-
-		/* encapsulamento suporta almatrix? */
-		if ((pdir_ptr->matrix_config == PDIR_CFG_supportedOn) &&
-				(hlmatrix_getRowstatus(dados->interface) == ROWSTATUS_ACTIVE)) {
-			if (almatrix_SD_insereAtualiza(dados) != SUCCESS) {
-				Debug("almatrix_SD_insereAtualiza() falhou");
-			}
-			if (almatrix_DS_insereAtualiza(dados) != SUCCESS) {
-				Debug("almatrix_DS_insereAtualiza() falhou");
-			}
-		}
+		pkt_despacha(dados, pdir_ptr->acoes & dados->acoes,
+				pdir_ptr->local_index);
 #if PTSL
 		dados->prim_traco_transporte = pdir_ptr->primeiro_traco;
 #endif
@@ -496,19 +733,26 @@ static int pkt_process(pedb_t *dados)
 		return SUCCESS;
 	}
 #endif
-	pdir_ptr = pdir_localiza(dados->prot_enlace, dados->prot_rede,
-			dados->prot_transporte, dados->rede_sport);
+	pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte, dados->rede_sport);
 	if (pdir_ptr == NULL) {
-		pdir_ptr = pdir_localiza(dados->prot_enlace, dados->prot_rede,
-				dados->prot_transporte, dados->rede_dport);
+		pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte,
+				dados->rede_dport);
 		if (pdir_ptr == NULL) {
 			/*
-			 *	protocol is not registered -- get out
+			 *	protocol is not registered -- unless its payload
+			 *	says what it is, get out
 			 */
+			pdir_ptr = assinaturas_classifica(dados);
+			if (pdir_ptr != NULL) {
+				dados->al_localindex = pdir_ptr->local_index;
+				pkt_despacha(dados, pdir_ptr->acoes & dados->acoes,
+						pdir_ptr->local_index);
+			}
 #if DEBUGMSG_INFO_PACOTE
-			informacao[7] = '-';
+			informacao[7] = (pdir_ptr != NULL) ? 'S' : '-';
 #endif
 #if PTSL
+			/* no port tells the server apart: no traces */
 			dados->prim_traco_aplicacao = NULL;
 			dados->direcao = FROM_ANY;
 #endif
@@ -548,28 +792,8 @@ static int pkt_process(pedb_t *dados)
 #if DEBUGMSG_INFO_PACOTE
 	informacao[7] = 'A';
 #endif
-	pdist_update(dados->interface, pdir_ptr->local_index, 1,
-			dados->tamanho);
-
-	/* encapsulamento suporta alhost? */
-	if (pdir_ptr->host_config == PDIR_CFG_supportedOn) {
-		if (alhost_insereAtualiza(dados) != SUCCESS) {
-			Debug("alhost_insereAtualiza falhou");
-		}
-	}
-
-	/* encapsulamento suporta almatrix? */
-	if (pdir_ptr->matrix_config == PDIR_CFG_supportedOn) {
-		if (hlmatrix_getRowstatus(dados->interface) == ROWSTATUS_ACTIVE) {
-			if (almatrix_SD_insereAtualiza(dados) != SUCCESS) {
-				Debug("almatrix_SD_insereAtualiza() falhou");
-			}
-
-			if (almatrix_DS_insereAtualiza(dados) != SUCCESS) {
-				Debug("almatrix_DS_insereAtualiza() falhou");
-			}
-		}
-	}
+	pkt_despacha(dados, pdir_ptr->acoes & dados->acoes,
+			pdir_ptr->local_index);
 
 #if PTSL
 	dados->prim_traco_aplicacao = pdir_ptr->primeiro_traco;
@@ -583,84 +807,972 @@ static int pkt_process(pedb_t *dados)
 }
 
 
-#if MEDIR_DESEMPENHO
-#include "rdtsc.h"
-#endif
-
-
-/* function that manage the conversion of entries of conexao table (DB cap_pac)
-   to the tables of DB RMON2 */
-void *
-captura_processa_pacote()
+/*
+ * Accounts a decoded packet: into its flow, if it is cached (the rows of
+ * the flow get it at the end of the batch), or through pkt_classifica(),
+ * which records the rows for the next packets.
+ */
+static int pkt_process(pedb_t *dados)
 {
-#if MEDIR_DESEMPENHO
-	uint64_t	    ticks_ini;
-	uint64_t	    ticks_meio;
-	uint64_t	    ticks_fim;
-	uint32_t	    aguardar = AGUARDAR;    /* medir o tempo para 10, 100, 1000 pacotes */
-	uint32_t	    medidos = 0;	    /* pacotes j medidos */
-	FILE	    *arq_ptr;
-
-	static const uint32_t AGUARDAR = 1000;
-#endif
-	pedb_t	    prepacote;
-
-	Debug("accounter has TID %p", pthread_self());
-
-#if MEDIR_DESEMPENHO
-	arq_ptr = fopen("/tmp/conversor.data", "w");
-	if (arq_ptr == NULL) {
-		perror("fopen(/tmp/conversor.data)");
-		exit(-10);
-	}
-#endif
+	fluxo_t		*f;
+	int		 ret;
 
-	/* inicializar a fila */
-	if (fila_inicializa() != SUCCESS) {
-		return (void *)ERROR_PKTQUEUE;
-	}
+	if (dados->acoes == 0)
+		return ERROR_ISINACTIVE;
 
-	if (pthread_create(&thr_sniffer, NULL, sniff, NULL) != 0) {
-		perror("pthread_create");
-		return (void *)ERROR_THREAD;
+	f = fluxos_localiza(dados);
+	if (f != NULL) {
+		fluxos_conta(f, dados);
+		return SUCCESS;
 	}
 
-	/* capturar e processar os pacotes */
-	while (1) {
-
-#if MEDIR_DESEMPENHO
-		aguardar--;
-		if (aguardar == 0) {
-			/* hora de medir */
-			rdtsc(ticks_ini);
-		}
-#endif
+	ret = pkt_classifica(dados);
+	fluxos_conclui(dados);
 
-		/* aguarda pacote */
-		fila_proximo();
+	return ret;
+}
 
-		/* chegou! */
-		prepacote.uptime = sysuptime();
-		prepacote.tamanho = fila[fila_fim].tam;
 
-		if (pkt_decode(fila[fila_fim].dados, &prepacote) == SUCCESS) {
-			pkt_process(&prepacote);
 #if PTSL
-			if ((prepacote.prim_traco_rede != NULL) ||
-					(prepacote.prim_traco_transporte != NULL) ||
-					(prepacote.prim_traco_aplicacao != NULL)) {
-				tracos_verifica(&prepacote, fila[fila_fim].dados);
-			}
+/* the trace state machines are not sharded: one worker at a time */
+static pthread_mutex_t	tracos_trava = PTHREAD_MUTEX_INITIALIZER;
 #endif
-		}
 
-		/* remover pacote */
-		fila_remove();
 
-#if MEDIR_DESEMPENHO
-		if (aguardar == 0) {
+/*
+ * prepara o pedb de um caminho de captura (um por thread)
+ */
+static void
+pkt_inicializa(pedb_t *prepacote, const unsigned int worker,
+		const unsigned int interface)
+{
+	prepacote->worker = worker;
+	prepacote->interface = interface;
+	prepacote->peso = amostragem;
+	prepacote->amostra = 0;
+	prepacote->corte = CORTE_NENHUM;
+	prepacote->acoes = PDIR_ACOES_TODAS;
+	prepacote->fluxo = NULL;
+
+	/* all that decodifica_lote() accepts */
+	prepacote->prot_enlace = 1;
+	prepacote->prot_rede = ETHERTYPE_IP;
+	prepacote->offset_rede = 14;
+}
+
+
+/*
+ * copia para o pedb os cabealhos decodificados do pacote `i' do lote
+ */
+static inline void
+pkt_carrega(pedb_t *dados, const decodifica_lote_t *lote, const unsigned int i)
+{
+	dados->tamanho = lote->tam[i] * dados->peso;
+	dados->is_broadcast = (lote->flags[i] & DECODIFICA_BROADCAST) != 0;
+	dados->ip_orig = lote->ip_orig[i];
+	dados->ip_dest = lote->ip_dest[i];
+	dados->prot_transporte = lote->transporte[i];
+	dados->rede_sport = lote->sport[i];
+	dados->rede_dport = lote->dport[i];
+	dados->offset_trans = lote->offset_trans[i];
+	dados->offset_aplic = lote->offset_aplic[i];
+	dados->quadro = lote->quadro[i];
+	dados->capturado = lote->capturado[i];
+}
+
+
+/*
+ * one step of the prefetching of the al* entries a packet of encapsulation
+ * `portas' (see alhost_insereAtualiza()) will update
+ */
+static inline void
+pkt_antecipa_al(const pedb_t *dados, const pdir_node_t *pdir_ptr,
+		const uint32_t portas, const int etapa)
+{
+	unsigned int	acoes = dados->acoes & pdir_ptr->acoes;
+
+	if (acoes & PDIR_ACAO_ALHOST) {
+		if (dados->is_broadcast == 0)
+			alhost_antecipa(dados->worker, dados->ip_dest ^ portas,
+					etapa);
+		alhost_antecipa(dados->worker, dados->ip_orig ^ portas, etapa);
+	}
+
+	if ((acoes & PDIR_ACAO_ALMATRIX) && (dados->is_broadcast == 0)) {
+		almatrix_SD_antecipa(dados->worker, dados->ip_orig ^ portas,
+				etapa);
+		almatrix_DS_antecipa(dados->worker, dados->ip_dest ^ portas,
+				etapa);
+	}
+}
+
+
+/*
+ * one step of the prefetching of the host and matrix entries that
+ * pkt_classifica() will update for the packet in `dados'
+ */
+static void
+pkt_antecipa(const pedb_t *dados, const int etapa)
+{
+	const pdir_node_t	*rede;
+	const pdir_node_t	*pdir_ptr;
+	unsigned int		 nl_localindex = dados->nl_localindex;
+
+	rede = pdir_localiza_ipv4(0, 0);
+	if (rede != NULL) {
+		nl_localindex = rede->local_index;
+
+		if (dados->acoes & rede->acoes & PDIR_ACAO_NLHOST) {
+			if (dados->is_broadcast == 0)
+				nlhost_antecipa(dados->worker, dados->ip_dest,
+						etapa);
+			nlhost_antecipa(dados->worker, dados->ip_orig, etapa);
+		}
+		if ((dados->acoes & rede->acoes & PDIR_ACAO_NLMATRIX) &&
+				(dados->is_broadcast == 0)) {
+			nlmatrix_SD_antecipa(dados->worker, dados->ip_dest,
+					etapa);
+			nlmatrix_DS_antecipa(dados->worker, dados->ip_orig,
+					etapa);
+		}
+	}
+
+	if (!(dados->acoes & (PDIR_ACAO_ALHOST | PDIR_ACAO_ALMATRIX)))
+		return;
+
+	pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte, 0);
+	if (pdir_ptr != NULL)
+		pkt_antecipa_al(dados, pdir_ptr,
+				(nl_localindex << 16) | pdir_ptr->local_index,
+				etapa);
+
+	pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte,
+			dados->rede_sport);
+	if (pdir_ptr == NULL)
+		pdir_ptr = pdir_localiza_ipv4(dados->prot_transporte,
+				dados->rede_dport);
+	if (pdir_ptr != NULL)
+		pkt_antecipa_al(dados, pdir_ptr,
+				(nl_localindex << 16) | pdir_ptr->local_index,
+				etapa);
+}
+
+
+#if DECODIFICA_LOTE > 64
+#error pkt_antecipa_lote() keeps one bit per packet of a batch in 64
+#endif
+
+/*
+ * Prefetches what the packets of a decoded batch will update, a step for
+ * the whole batch at a time, so that the cache misses of the packets
+ * overlap instead of stalling one packet after the other: the slots of
+ * their flows; then the rows of the flows found there, or, for the packets
+ * whose flow is not cached, the slots of the host and matrix tables; then
+ * the entries in those slots.
+ */
+static void
+pkt_antecipa_lote(const decodifica_lote_t *lote, pedb_t *dados)
+{
+	uint64_t	sem_fluxo = 0;	/* one bit per packet */
+	unsigned int	i;
+
+	for (i = 0; i < lote->qtd; i++) {
+		if (!(lote->flags[i] & DECODIFICA_VALIDO))
+			continue;
+		pkt_carrega(dados, lote, i);
+		fluxos_antecipa(dados, ANTECIPA_POSICAO);
+	}
+
+	for (i = 0; i < lote->qtd; i++) {
+		if (!(lote->flags[i] & DECODIFICA_VALIDO))
+			continue;
+		pkt_carrega(dados, lote, i);
+		if (fluxos_antecipa(dados, ANTECIPA_ENTRADA) != NULL)
+			continue;
+		sem_fluxo |= 1ULL << i;
+		pkt_antecipa(dados, ANTECIPA_POSICAO);
+	}
+
+	for (i = 0; sem_fluxo != 0; i++, sem_fluxo >>= 1) {
+		if (!(sem_fluxo & 1))
+			continue;
+		pkt_carrega(dados, lote, i);
+		pkt_antecipa(dados, ANTECIPA_ENTRADA);
+	}
+}
+
+
+/*
+ * contabiliza um lote de pacotes capturados: decodifica todos os cabealhos
+ * de uma vez, e depois atualiza as tabelas com cada pacote; quem chama j
+ * fez a amostragem e carimbou o lote (sysuptime_lote()).  A tabela do worker
+ * fica travada durante o lote, contra remoes de linhas.
+ */
+static void
+pkt_contabiliza_lote(decodifica_lote_t *lote, pedb_t *prepacote)
+{
+	unsigned int	i;
+
+	if (lote->qtd == 0)
+		return;
+
+	/* protocolDir may be replaced meanwhile, but not freed */
+	shards_trava(prepacote->worker);
+	carencia_entra(prepacote->worker);
+	decodifica_lote(lote);
+	prepacote->uptime = sysuptime();
+	prepacote->acoes = pkt_acoes(prepacote);
+	fluxos_sincroniza(prepacote->worker);
+
+	if (prepacote->acoes != 0)
+		pkt_antecipa_lote(lote, prepacote);
+
+	for (i = 0; i < lote->qtd; i++) {
+		if (!(lote->flags[i] & DECODIFICA_VALIDO))
+			continue;
+
+		pkt_carrega(prepacote, lote, i);
+		prepacote->descartes = 0;
+		pkt_process(prepacote);
+		if (prepacote->descartes != 0)
+			descartes_tabela(prepacote->worker,
+					prepacote->interface,
+					prepacote->descartes);
+#if PTSL
+		if ((prepacote->acoes & PDIR_ACAO_TRACOS) &&
+				((prepacote->prim_traco_rede != NULL) ||
+				 (prepacote->prim_traco_transporte != NULL) ||
+				 (prepacote->prim_traco_aplicacao != NULL))) {
+			pthread_mutex_lock(&tracos_trava);
+			tracos_verifica(prepacote, lote->quadro[i]);
+			pthread_mutex_unlock(&tracos_trava);
+		}
+#endif
+	}
+
+	/* what the cached flows summed up during the batch */
+	fluxos_descarrega(prepacote);
+	carencia_sai(prepacote->worker);
+	shards_destrava(prepacote->worker);
+	lote->qtd = 0;
+}
+
+
+/*
+ * pe um pacote no lote, contabilizando o lote se ele encheu
+ */
+static inline void
+pkt_enfileira(decodifica_lote_t *lote, const u_char *dados,
+		const uint32_t capturado, const uint32_t tamanho,
+		pedb_t *prepacote)
+{
+	lote->quadro[lote->qtd] = dados;
+	lote->capturado[lote->qtd] = capturado;
+	lote->tam[lote->qtd] = tamanho;
+	if (++lote->qtd == DECODIFICA_LOTE)
+		pkt_contabiliza_lote(lote, prepacote);
+}
+
+
+#ifdef __linux__
+/*
+ * now, in microseconds, for frames which carry no capture time (AF_XDP)
+ */
+static uint64_t
+relogio_instante()
+{
+	struct timespec	agora;
+
+	clock_gettime(CLOCK_MONOTONIC, &agora);
+	return (uint64_t)agora.tv_sec * 1000000 + agora.tv_nsec / 1000;
+}
+
+
+/*
+ * adds the kernel drops of a TPACKET_V3 ring to its interface
+ */
+static void
+descartes_tpacket(const int sniffer, const unsigned int interface)
+{
+	uint32_t	pacotes;
+	uint32_t	descartes;
+
+	if (sniffer_estatisticas(sniffer, &pacotes, &descartes) == SUCCESS)
+		descartes_captura(interface, descartes);
+}
+
+
+/*
+ * same, for the queues of an AF_XDP capture
+ */
+static void
+descartes_xsk(const int sniffer, const unsigned int interface)
+{
+	uint32_t	descartes;
+
+	if (xsk_estatisticas(sniffer, &descartes) == SUCCESS)
+		descartes_captura(interface, descartes);
+}
+
+
+/*
+ * accounts every frame of a TPACKET_V3 block, in place
+ */
+static inline void
+tpacket_contabiliza_bloco(struct tpacket_block_desc *bloco, pedb_t *prepacote)
+{
+	struct tpacket3_hdr	*frame;
+	decodifica_lote_t	 cabecalhos;
+	uint32_t		 i;
+
+	cabecalhos.qtd = 0;
+	frame = BLOCO_PRIMEIRO(bloco);
+	for (i = 0; i < BLOCO_QTD_FRAMES(bloco); i++) {
+		if (pkt_admite(prepacote->worker, &prepacote->amostra,
+					FRAME_DADOS(frame), FRAME_CAPLEN(frame),
+					FRAME_INSTANTE(frame)))
+			pkt_enfileira(&cabecalhos, FRAME_DADOS(frame),
+					FRAME_CAPLEN(frame), frame->tp_len,
+					prepacote);
+		frame = BLOCO_PROXIMO(frame);
+	}
+	pkt_contabiliza_lote(&cabecalhos, prepacote);
+}
+
+
+/*
+ * Accounts packets straight from the TPACKET_V3 ring: each block handed by
+ * the kernel is walked in place and given back, so there is no sniff()
+ * thread, no copy into the fila and no semaphore round-trip per packet.
+ *
+ * Only returns if the interface could not be opened.
+ */
+static int
+captura_tpacket()
+{
+	struct tpacket_block_desc	*bloco;
+	pedb_t				 prepacote;
+	unsigned int			 geracao = 0;	/* of the prefilter */
+	unsigned long			 proximo = 0;	/* next drop collection */
+	int				 sniffer;
+
+	sniffer = sniffer_open_interface_by_name(dev, FILA_SNAPLEN);
+	if (sniffer < 0) {
+		Debug("could not open ring on network device `%s'", dev);
+		return sniffer;
+	}
+	Debug("accounting from TPACKET_V3 ring on `%s'", dev);
+
+	pkt_inicializa(&prepacote, 0, interfaces[0].ifindex);
+	while (1) {
+		prefiltro_aplica_sniffer(sniffer, &geracao);
+		if (descartes_vencido(&proximo)) {
+			descartes_tpacket(sniffer, prepacote.interface);
+			descartes_publica();
+		}
+
+		bloco = sniffer_proximo_bloco(sniffer, 100);
+		sysuptime_lote();
+		if (bloco == NULL)
+			continue;
+
+		tpacket_contabiliza_bloco(bloco, &prepacote);
+		sniffer_libera_bloco(sniffer, bloco);
+	}
+}
+
+
+/*
+ * Same idea, for AF_XDP: frames are accounted where the NIC (or the kernel,
+ * in copy mode) left them in the UMEM, and then recycled to the fill ring.
+ *
+ * Only returns if the interface could not be opened.
+ */
+static int
+captura_xsk()
+{
+	xsk_quadro_t	quadros[FILA_LOTE];
+	decodifica_lote_t cabecalhos;
+	pedb_t		prepacote;
+	unsigned long	proximo = 0;	/* next drop collection */
+	uint64_t	instante;	/* of the batch, for duplicatas */
+	unsigned int	lote;
+	unsigned int	i;
+	int		sniffer;
+
+	sniffer = xsk_open_interface_by_name(dev);
+	if (sniffer < 0) {
+		Debug("could not attach AF_XDP to network device `%s'", dev);
+		return sniffer;
+	}
+	Debug("accounting from AF_XDP sockets on `%s'", dev);
+
+	pkt_inicializa(&prepacote, 0, interfaces[0].ifindex);
+	while (1) {
+		if (descartes_vencido(&proximo)) {
+			descartes_xsk(sniffer, prepacote.interface);
+			descartes_publica();
+		}
+
+		lote = xsk_recebe(sniffer, quadros, FILA_LOTE, 100);
+		sysuptime_lote();
+		instante = deduplicar ? relogio_instante() : 0;
+
+		cabecalhos.qtd = 0;
+		for (i = 0; i < lote; i++) {
+			if (!pkt_admite(0, &prepacote.amostra, quadros[i].dados,
+						quadros[i].tam, instante))
+				continue;
+			pkt_enfileira(&cabecalhos, quadros[i].dados,
+					quadros[i].tam, quadros[i].tam,
+					&prepacote);
+		}
+		pkt_contabiliza_lote(&cabecalhos, &prepacote);
+
+		xsk_libera(sniffer, quadros);
+	}
+}
+#endif
+
+
+/*****************************************************************************
+  Accounting workers
+
+  Used when there is more than one interface, or more than one worker per
+  interface.  Every worker has its own capture socket and accounts into its
+  own table shards (see shards.c), holding the shard lock only while it
+  walks a batch; its packets are accounted to the control rows of its
+  interface.  The workers of one interface join a PACKET_FANOUT group, so
+  the kernel spreads the flows among them (by hash, keeping both directions
+  of a flow together).
+ ****************************************************************************/
+#define CAPTURA_PCAP	0
+#define CAPTURA_TPACKET	1
+#define CAPTURA_XSK	2
+#define CAPTURA_NENHUMA	3	/* everything counted by agregador.c */
+
+typedef struct worker_s {
+	unsigned int	 id;
+	unsigned int	 ifindex;
+	int		 sniffer;	/* TPACKET_V3 ring or AF_XDP, or -1 */
+	int		 tipo;		/* CAPTURA_* */
+	pcap_t		*captura;	/* libpcap handle, when there is no ring */
+	pthread_t	 thread;
+} worker_t;
+
+static worker_t		workers[MAX_WORKERS];
+
+/* every worker waits here for the others to allocate their shards; a
+   failure of any of them, or of the accounter, sends them all back */
+static struct {
+	pthread_mutex_t	trava;
+	pthread_cond_t	sinal;
+	unsigned int	esperados;
+	unsigned int	chegados;
+	int		falha;		/* the first error, or SUCCESS */
+} workers_largada = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	0, 0, SUCCESS };
+
+/* frames of a pcap_dispatch(), copied since libpcap reuses their buffer */
+typedef struct worker_copias_s {
+	pedb_t			*prepacote;
+	decodifica_lote_t	 lote;
+	uint32_t		 snaplen;	/* bytes copied per frame */
+	u_char			 dados[DECODIFICA_LOTE][FILA_SNAPLEN];
+} worker_copias_t;
+
+
+/*
+ * Waits until every worker got here with `ret' SUCCESS, the last one to
+ * arrive turning sharding on.  Returns the first error instead, as soon as
+ * some worker or workers_aborta() reports it.
+ */
+static int
+workers_aguarda(const int ret)
+{
+	int	falha;
+
+	pthread_mutex_lock(&workers_largada.trava);
+	if ((ret != SUCCESS) && (workers_largada.falha == SUCCESS))
+		workers_largada.falha = ret;
+	workers_largada.chegados++;
+
+	if ((workers_largada.falha == SUCCESS) &&
+			(workers_largada.chegados == workers_largada.esperados))
+		shards_ativa();
+	pthread_cond_broadcast(&workers_largada.sinal);
+
+	while ((workers_largada.falha == SUCCESS) &&
+			(workers_largada.chegados < workers_largada.esperados))
+		pthread_cond_wait(&workers_largada.sinal,
+				&workers_largada.trava);
+	falha = workers_largada.falha;
+	pthread_mutex_unlock(&workers_largada.trava);
+
+	return falha;
+}
+
+
+/* sends back the workers waiting in workers_aguarda() */
+static void
+workers_aborta(const int ret)
+{
+	pthread_mutex_lock(&workers_largada.trava);
+	if (workers_largada.falha == SUCCESS)
+		workers_largada.falha = ret;
+	pthread_cond_broadcast(&workers_largada.sinal);
+	pthread_mutex_unlock(&workers_largada.trava);
+}
+
+
+/* copies a frame into the batch, accounting the batch if it filled */
+static inline void
+worker_copia(worker_copias_t *c, const u_char *packet,
+		const uint32_t capturado, const uint32_t tamanho)
+{
+	uint32_t	tam;
+
+	tam = (capturado < c->snaplen) ? capturado : c->snaplen;
+	memcpy(c->dados[c->lote.qtd], packet, tam);
+	pkt_enfileira(&c->lote, c->dados[c->lote.qtd], tam, tamanho,
+			c->prepacote);
+}
+
+
+/* pcap_dispatch() callback of the workers */
+static void
+worker_insere(u_char *usuario, const struct pcap_pkthdr *header,
+		const u_char *packet)
+{
+	worker_copias_t	*c = (worker_copias_t *)usuario;
+
+	if (pkt_admite(c->prepacote->worker, &c->prepacote->amostra, packet,
+				header->caplen, PCAP_INSTANTE(header)))
+		worker_copia(c, packet, header->caplen, header->len);
+}
+
+
+/*
+ * Opens the capture socket of a worker and, if `grupo' is not zero, joins it
+ * to that fanout group.  Done by the accounter, one worker at a time, before
+ * any worker runs.  Returns an error, with nothing left open, if the
+ * interface can't be captured from.
+ */
+static int
+worker_abre(worker_t *w, const char *nome, const uint16_t grupo)
+{
+	char	erro_pcap_string[PCAP_ERRBUF_SIZE];
+
+	w->sniffer = -1;
+	w->captura = NULL;
+
+#ifdef __linux__
+	if (w->tipo == CAPTURA_XSK) {
+		w->sniffer = xsk_open_interface_by_name(nome);
+		if (w->sniffer >= 0)
+			return SUCCESS;
+
+		w->sniffer = -1;
+		Debug("AF_XDP unavailable on `%s' for worker %u, "
+				"falling back to libpcap", nome, w->id);
+		w->tipo = CAPTURA_PCAP;
+	}
+
+	if (w->tipo == CAPTURA_TPACKET) {
+		w->sniffer = sniffer_open_interface_by_name(nome, FILA_SNAPLEN);
+		if ((w->sniffer >= 0) && ((grupo == 0) ||
+					(sniffer_define_fanout(w->sniffer,
+							       grupo) == SUCCESS)))
+			return SUCCESS;
+
+		if (w->sniffer >= 0)
+			sniffer_close(w->sniffer);
+		w->sniffer = -1;
+		Debug("TPACKET_V3 unavailable on `%s' for worker %u, "
+				"falling back to libpcap", nome, w->id);
+		w->tipo = CAPTURA_PCAP;
+	}
+#endif
+
+	w->captura = pcap_open_live(nome, FILA_SNAPLEN, 1, 100,
+			erro_pcap_string);
+	if (w->captura == NULL) {
+		Debug("could not open network device `%s': %s", nome,
+				erro_pcap_string);
+		return ERROR_IO;
+	}
+
+	/* wait in poll(), outside the shard lock, not inside pcap_dispatch */
+	if (pcap_setnonblock(w->captura, 1, erro_pcap_string) == -1) {
+		Debug("pcap_setnonblock: %s", erro_pcap_string);
+	}
+
+#ifdef __linux__
+	if ((grupo != 0) &&
+			(sniffer_fanout_fd(pcap_fileno(w->captura), grupo) != SUCCESS)) {
+		pcap_close(w->captura);
+		w->captura = NULL;
+		return ERROR_IO;
+	}
+#endif
+
+	return SUCCESS;
+}
+
+
+/* closes what worker_abre() opened */
+static void
+worker_fecha(worker_t *w)
+{
+#ifdef __linux__
+	if ((w->sniffer >= 0) && (w->tipo == CAPTURA_XSK))
+		xsk_close(w->sniffer);
+	else if (w->sniffer >= 0)
+		sniffer_close(w->sniffer);
+#endif
+	if (w->captura != NULL)
+		pcap_close(w->captura);
+
+	w->sniffer = -1;
+	w->captura = NULL;
+}
+
+
+/* thread of a worker; only returns if the workers could not start */
+static void *
+worker_executa(void *arg)
+{
+	worker_t			*w = arg;
+	struct pollfd			 pfd;
+	pedb_t				 prepacote;
+	worker_copias_t			 copias;
+	unsigned int			 geracao = 0;	/* of the prefilter */
+	unsigned long			 proximo = 0;	/* next drop collection */
+	uint32_t			 kernel = 0;	/* pcap drops collected */
+	int				 ret;
+#ifdef __linux__
+	struct tpacket_block_desc	*bloco;
+	xsk_quadro_t			 quadros[FILA_LOTE];
+	decodifica_lote_t		 cabecalhos;
+	uint64_t			 instante;
+	unsigned int			 lote;
+	unsigned int			 i;
+#endif
+
+	Debug("worker %u has TID %p", w->id, pthread_self());
+
+	/* the shard is allocated once the worker is on its own CPU */
+	afinidade_aplica(AFINIDADE_CONTABIL, w->id);
+	ret = workers_aguarda(shards_aloca(w->id));
+	if (ret != SUCCESS)
+		return (void *)(long)ret;
+
+	pkt_inicializa(&prepacote, w->id, w->ifindex);
+
+#ifdef __linux__
+	if (w->tipo == CAPTURA_TPACKET) {
+		while (1) {
+			prefiltro_aplica_sniffer(w->sniffer, &geracao);
+			if (descartes_vencido(&proximo)) {
+				descartes_tpacket(w->sniffer, w->ifindex);
+				descartes_publica();
+			}
+
+			bloco = sniffer_proximo_bloco(w->sniffer, 100);
+			sysuptime_lote();
+			if (bloco == NULL)
+				continue;
+
+			tpacket_contabiliza_bloco(bloco, &prepacote);
+
+			sniffer_libera_bloco(w->sniffer, bloco);
+		}
+	}
+
+	if (w->tipo == CAPTURA_XSK) {
+		while (1) {
+			if (descartes_vencido(&proximo)) {
+				descartes_xsk(w->sniffer, w->ifindex);
+				descartes_publica();
+			}
+
+			lote = xsk_recebe(w->sniffer, quadros, FILA_LOTE, 100);
+			sysuptime_lote();
+			instante = deduplicar ? relogio_instante() : 0;
+
+			cabecalhos.qtd = 0;
+			for (i = 0; i < lote; i++) {
+				if (!pkt_admite(w->id, &prepacote.amostra,
+							quadros[i].dados,
+							quadros[i].tam,
+							instante))
+					continue;
+				pkt_enfileira(&cabecalhos, quadros[i].dados,
+						quadros[i].tam, quadros[i].tam,
+						&prepacote);
+			}
+			pkt_contabiliza_lote(&cabecalhos, &prepacote);
+
+			xsk_libera(w->sniffer, quadros);
+		}
+	}
+#endif
+
+	copias.prepacote = &prepacote;
+	copias.lote.qtd = 0;
+	pfd.fd = pcap_get_selectable_fd(w->captura);
+	pfd.events = POLLIN;
+	while (1) {
+		prefiltro_aplica_pcap(w->captura, &geracao);
+		if (descartes_vencido(&proximo)) {
+			descartes_pcap(w->captura, w->ifindex, &kernel);
+			descartes_publica();
+		}
+
+		ret = poll(&pfd, 1, 100);
+		sysuptime_lote();
+		if (ret <= 0)
+			continue;
+
+		/* libpcap does not cut at the prefilter's snap length */
+		copias.snaplen = prefiltro_snaplen();
+		if (pcap_dispatch(w->captura, FILA_LOTE, worker_insere,
+					(u_char *)&copias) < 0) {
+			Debug("pcap_dispatch: %s", pcap_geterr(w->captura));
+		}
+		pkt_contabiliza_lote(&copias.lote, &prepacote);
+	}
+}
+
+
+/*
+ * Starts `por_interface' workers on every interface and turns the calling
+ * thread into worker 0.  An interface that some of its workers can't open
+ * is skipped.
+ *
+ * Only returns if no interface could be opened, or the workers could not
+ * start; then none of them is left running.
+ */
+static int
+captura_workers(const unsigned int por_interface, const int tipo)
+{
+	unsigned int	quantos = 0;	/* workers opened */
+	unsigned int	monitoradas = 0;
+	uint16_t	grupo;
+	unsigned int	i;
+	unsigned int	k;
+	unsigned int	n;
+	int		ret;
+
+	for (i = 0; i < interfaces_qtd; i++) {
+		grupo = (por_interface > 1) ? ((getpid() + i) & 0xffff) : 0;
+
+		for (k = 0; k < por_interface; k++) {
+			n = quantos + k;
+			workers[n].id = n;
+			workers[n].ifindex = interfaces[i].ifindex;
+			workers[n].tipo = tipo;
+			if (worker_abre(&workers[n], interfaces[i].nome,
+						grupo) != SUCCESS)
+				break;
+		}
+
+		if (k < por_interface) {
+			/* its flows would only reach some of the workers */
+			Debug("network device `%s' skipped, worker %u could not "
+					"open it", interfaces[i].nome, quantos + k);
+			while (k > 0)
+				worker_fecha(&workers[quantos + --k]);
+			continue;
+		}
+		quantos += por_interface;
+		monitoradas++;
+	}
+
+	if (quantos == 0)
+		return ERROR_IO;
+
+	ret = shards_inicializa(quantos);
+	if (ret != SUCCESS)
+		return ret;
+	workers_largada.esperados = quantos;
+	Debug("%u workers on %u interfaces", quantos, monitoradas);
+
+	for (n = 1; n < quantos; n++) {
+		if (pthread_create(&workers[n].thread, NULL, worker_executa,
+					&workers[n]) != 0) {
+			perror("pthread_create");
+			workers_aborta(ERROR_THREAD);
+			break;
+		}
+	}
+
+	if (n == quantos)
+		ret = (int)(long)worker_executa(&workers[0]);
+	else
+		ret = ERROR_THREAD;
+
+	/* they are all on their way back */
+	for (k = 1; k < n; k++)
+		pthread_join(workers[k].thread, NULL);
+	for (k = 0; k < quantos; k++)
+		worker_fecha(&workers[k]);
+
+	return ret;
+}
+
+
+/* function that manage the conversion of entries of conexao table (DB cap_pac)
+   to the tables of DB RMON2 */
+void *
+captura_processa_pacote()
+{
+#if MEDIR_DESEMPENHO
+	uint64_t	    ticks_ini;
+	uint64_t	    ticks_meio;
+	uint64_t	    ticks_fim;
+	uint32_t	    aguardar = AGUARDAR;    /* medir o tempo para 10, 100, 1000 pacotes */
+	uint32_t	    medidos = 0;	    /* pacotes j medidos */
+	FILE	    *arq_ptr;
+
+	static const uint32_t AGUARDAR = 1000;
+#endif
+	pedb_t	    prepacote;
+	decodifica_lote_t cabecalhos;
+	fila_t	    *pacote;
+	uint32_t    lote;
+	uint32_t    i;
+	char	    *captura;
+	unsigned int quantos;
+	int	    tipo = CAPTURA_PCAP;
+	int	    ret;
+
+	Debug("accounter has TID %p", pthread_self());
+
+	if (interfaces_qtd == 0) {
+		Error("no network interface to monitor");
+		return (void *)ERROR_IO;
+	}
+
+	/* keep uninteresting frames in the kernel (not for af_xdp, though) */
+	prefiltro_inicializa(FILA_SNAPLEN);
+
+	captura = conf_get_capture();
+#ifdef __linux__
+	if ((captura != NULL) && (strcmp(captura, CONF_CAPTURE_TPACKET) == 0))
+		tipo = CAPTURA_TPACKET;
+	else if ((captura != NULL) &&
+			(strcmp(captura, CONF_CAPTURE_AF_XDP) == 0))
+		tipo = CAPTURA_XSK;
+	else if ((captura != NULL) &&
+			(strcmp(captura, CONF_CAPTURE_NONE) == 0))
+		tipo = CAPTURA_NENHUMA;
+#endif
+	free(captura);
+
+	if (agregando && (tipo == CAPTURA_XSK)) {
+		/* only one XDP program per interface */
+		Debug("af_xdp can't share the interfaces with the aggregator");
+		tipo = CAPTURA_PCAP;
+	}
+	if (tipo == CAPTURA_NENHUMA) {
+		if (agregando) {
+			Debug("no capture, only protocolDist and nlHost are counted");
+			while (1)
+				pause();
+		}
+		Debug("capture = none needs aggregation = ebpf, using libpcap");
+		tipo = CAPTURA_PCAP;
+	}
+
+	/* workers per interface; without fanout, a single one */
+	quantos = conf_get_workers();
+#ifndef __linux__
+	quantos = 1;
+#endif
+	if ((quantos > 1) && (tipo == CAPTURA_XSK)) {
+		/* AF_XDP already has one socket per RX queue */
+		Debug("af_xdp capture uses a single worker per interface");
+		quantos = 1;
+	}
+	if (quantos * interfaces_qtd > MAX_WORKERS) {
+		quantos = MAX_WORKERS / interfaces_qtd;
+		Debug("at most %u workers per interface", quantos);
+	}
+
+	if (quantos * interfaces_qtd > 1) {
+		ret = captura_workers(quantos, tipo);
+		Debug("could not start %u workers (%d)",
+				quantos * interfaces_qtd, ret);
+		return (void *)(long)ret;
+	}
+
+	/* a single interface with a single worker: no shards at all */
+	afinidade_aplica(AFINIDADE_CONTABIL, 0);
+	dev = interfaces[0].nome;
+	pkt_inicializa(&prepacote, 0, interfaces[0].ifindex);
+#ifdef __linux__
+	if (tipo == CAPTURA_TPACKET) {
+		captura_tpacket();
+		Debug("TPACKET_V3 unavailable, falling back to libpcap");
+	}
+	else if (tipo == CAPTURA_XSK) {
+		captura_xsk();
+		Debug("AF_XDP unavailable, falling back to libpcap");
+	}
+#endif
+
+#if MEDIR_DESEMPENHO
+	arq_ptr = fopen("/tmp/conversor.data", "w");
+	if (arq_ptr == NULL) {
+		perror("fopen(/tmp/conversor.data)");
+		exit(-10);
+	}
+#endif
+
+	/* inicializar a fila */
+	if (fila_inicializa() != SUCCESS) {
+		return (void *)ERROR_PKTQUEUE;
+	}
+
+	if (pthread_create(&thr_sniffer, NULL, sniff, NULL) != 0) {
+		perror("pthread_create");
+		return (void *)ERROR_THREAD;
+	}
+
+	/* capturar e processar os pacotes */
+	while (1) {
+
+#if MEDIR_DESEMPENHO
+		aguardar--;
+		if (aguardar == 0) {
+			/* hora de medir */
+			rdtsc(ticks_ini);
+		}
+#endif
+
+		/* aguarda um lote de pacotes */
+		lote = fila_proximo_lote();
+		sysuptime_lote();
+		prepacote.corte = fila_corte(lote);
+
+		/* chegou! */
+		cabecalhos.qtd = 0;
+		for (i = 0; i < lote; i++) {
+			pacote = &fila[(fila_cons.fim + i) & FILA_MASCARA];
+			pkt_enfileira(&cabecalhos, pacote->dados,
+					pacote->capturado, pacote->tam,
+					&prepacote);
+		}
+		pkt_contabiliza_lote(&cabecalhos, &prepacote);
+
+		/* remover o lote */
+		fila_remove_lote(lote);
+
+#if MEDIR_DESEMPENHO
+		if (aguardar == 0) {
 			rdtsc(ticks_fim);
-			medidos += AGUARDAR + drop_atual;
+			medidos += lote + drop_atual;
 			aguardar = AGUARDAR;
 
 			fprintf(arq_ptr, "%u %0.0f %0.0f %0.0f %u\n", medidos,
@@ -673,69 +1785,389 @@ captura_processa_pacote()
 }
 
 
+/*
+ * creates the hlHostControl, hlMatrixControl and protocolDistControl rows of
+ * an interface
+ */
+static int
+interface_controles(const unsigned int ifindex)
+{
+	if (pdist_control_insere(ifindex, 0, owner) != SUCCESS) {
+		Debug("pdist_control_insere(%u, 0, %s) != SUCCESS",
+				ifindex, owner);
+		return ERROR_REALLYBAD;
+	}
+
+	if (hlhost_insere(ifindex, owner) != SUCCESS) {
+		Debug("hlhost_insere(%u, %s) falhou", ifindex, owner);
+		return ERROR_REALLYBAD;
+	}
+
+	if (hlmatrix_insere(ifindex, owner) != SUCCESS) {
+		Debug("hlmatrix_insere(%u, %s) falhou", ifindex, owner);
+		return ERROR_REALLYBAD;
+	}
+
+	return SUCCESS;
+}
+
+
 /**
  * Initializes the packet sniffer.
  *
- * FIXME: this should actually create the threads, and not use hardcoded
- * network interface identifiers.
+ * Every configured interface gets its hlHostControl, hlMatrixControl and
+ * protocolDistControl rows, indexed by its ifIndex (so the dataSource of
+ * each row is ifIndex.<n>).  Interfaces which do not exist, or whose
+ * ifIndex does not fit the control tables, are skipped.
+ *
+ * FIXME: this should actually create the threads.
+ *
+ * \retval SUCCESS		If at least one interface can be monitored.
+ * \retval ERROR_REALLYBAD	Otherwise.
  */
 int
 init_sniffer()
 {
-	if (pdist_control_insere(2, 0, owner) != SUCCESS) {
-		Debug("pdist_control_insere(2, 0, %s) != SUCCESS", owner);
-		return ERROR_REALLYBAD;
+	char		*nomes[MAX_INTERFACES];
+	unsigned int	 quantas;
+	unsigned int	 janela;
+	unsigned int	 ifindex;
+	unsigned int	 i;
+#ifdef __linux__
+	char		*agregacao;
+#endif
+
+	quantas = conf_get_interfaces(nomes, MAX_INTERFACES);
+	for (i = 0; i < quantas; i++) {
+		ifindex = if_nametoindex(nomes[i]);
+		if ((ifindex == 0) || (ifindex >= IFINDEX_MAX)) {
+			Debug("network interface `%s' skipped (ifIndex %u)",
+					nomes[i], ifindex);
+			free(nomes[i]);
+			continue;
+		}
+
+		if (interface_controles(ifindex) != SUCCESS)
+			return ERROR_REALLYBAD;
+
+		interfaces[interfaces_qtd].nome = nomes[i];
+		interfaces[interfaces_qtd].ifindex = ifindex;
+		interfaces_qtd++;
+		Debug("monitoring `%s' as control index %u", nomes[i], ifindex);
 	}
 
-	if (hlhost_insere(2, owner) != SUCCESS) {
-		Debug("hlhost_insere(2, %s) falhou", owner);
+	if (interfaces_qtd == 0) {
+		Error("no network interface configured");
 		return ERROR_REALLYBAD;
 	}
 
-	if (hlmatrix_insere(2, owner) != SUCCESS) {
-		Debug("hlmatrix_insere(2, %s) falhou", owner);
-		return ERROR_REALLYBAD;
+	amostragem = conf_get_sampling();
+	if (amostragem > 1)
+		Debug("sampling 1 in every %u packets", amostragem);
+
+	janela = conf_get_dedup_window();
+	duplicatas_inicializa(janela);
+	deduplicar = (janela > 0);
+
+	decodifica_inicializa();
+	assinaturas_inicializa(ASSINATURAS_CONF);
+
+#ifdef __linux__
+	agregacao = conf_get_aggregation();
+	if ((agregacao != NULL) &&
+			(strcmp(agregacao, CONF_AGGREGATION_EBPF) == 0)) {
+		for (i = 0; i < interfaces_qtd; i++) {
+			if (agregador_abre(interfaces[i].nome,
+						interfaces[i].ifindex) != SUCCESS)
+				break;
+		}
+		if (i == interfaces_qtd)
+			agregando = 1;
+		else {
+			agregador_fecha();
+			Debug("in-kernel aggregation unavailable on `%s', "
+					"counting in userspace", interfaces[i].nome);
+		}
 	}
+	free(agregacao);
+#endif
+
+	return SUCCESS;
+}
+
+
+/*
+ * How many packets each accounted one stands for: counters are estimates
+ * when this is not 1.
+ */
+unsigned int
+conversor_amostragem()
+{
+	return amostragem;
+}
+
+
+/*
+ * Current load shedding level (CORTE_*); only the libpcap capture, which
+ * has a fila, sheds load.
+ */
+unsigned int
+conversor_corte()
+{
+	return __atomic_load_n(&fila_cons.corte, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * How many packets were accounted without the analyses cut at `nivel'
+ */
+uint32_t
+conversor_cortados(const unsigned int nivel)
+{
+	if ((nivel == CORTE_NENHUM) || (nivel >= CORTE_NIVEIS))
+		return 0;
+
+	return __atomic_load_n(&fila_cons.cortados[nivel], __ATOMIC_RELAXED);
+}
+
+
+/*****************************************************************************
+  Replay of capture files
+
+  Packets read from a pcap file are copied into batches and go through
+  pkt_contabiliza_lote(), as captured ones, and the uptime clock is driven
+  by their timestamps: a batch is closed whenever the uptime moves, so each
+  packet still gets its own.  Two runs over the same file build the same
+  tables, so builds can be compared on recorded traffic without a live
+  NIC.
+ ****************************************************************************/
+
+/* control index of the replayed "interface" */
+#define REPLAY_IFINDEX	1
+
+
+/**
+ * Creates the control rows for a replay, in place of init_sniffer().
+ *
+ * \retval SUCCESS		If the rows were created.
+ * \retval ERROR_REALLYBAD	Otherwise.
+ */
+int
+init_replay()
+{
+	if (interface_controles(REPLAY_IFINDEX) != SUCCESS)
+		return ERROR_REALLYBAD;
+
+	interfaces[0].nome = NULL;
+	interfaces[0].ifindex = REPLAY_IFINDEX;
+	interfaces_qtd = 1;
+
+	decodifica_inicializa();
+	assinaturas_inicializa(ASSINATURAS_CONF);
 
 	return SUCCESS;
 }
 
 
-//	/* verificar se houve perda de pacotes */
-//	if (pcap_stats(cap, &stats) == 0) {
-//	    /* stats.ps_drop tem o numero de pacotes descartados desde a ultima consulta */
-//	    drop_atual = stats.ps_drop;
-//	    if (drop_atual != drop_quantidade) {
-//		/* houve perda de pacotes */
-//		drop_quantidade = drop_atual;
-//		drop_acumulado += drop_atual;
-//
-//		/* atualizar tabelas */
-//		if (protdist_control_updateEntry(prepacote.interface, drop_acumulado) != SUCCESS) {
-//		    Debug("updateEntry falhou");
-//		}
-//
-//		if (hlhost_atualizaNlDroppedFrames(prepacote.interface, drop_acumulado) != SUCCESS) {
-//		    Debug("hlhost_atualizaNlDroppedFrames(%d, %u) falhou",
-//			    prepacote.interface, drop_acumulado);
-//		}
-//
-//		if (hlhost_atualizaAlDroppedFrames(prepacote.interface, drop_acumulado) != SUCCESS) {
-//		    Debug("hlhost_atualizaAlDroppedFrames(%d, %u) falhou",
-//			    prepacote.interface, drop_acumulado);
-//		}
-//
-//		if (hlmatrix_atualizaNlDroppedFrames(prepacote.interface, drop_acumulado) != SUCCESS) {
-//		    Debug("hlmatrix_atualizaNlDroppedFrames(%d, %u) falhou",
-//			    prepacote.interface, drop_acumulado);
-//		}
-//
-//		if (hlmatrix_atualizaAlDroppedFrames(prepacote.interface, drop_acumulado) != SUCCESS) {
-//		    Debug("hlmatrix_atualizaAlDroppedFrames(%d, %u) falhou",
-//			    prepacote.interface, drop_acumulado);
-//		}
-//
-//		Debug("dropped package");
-//	    }
-//	}
+/* seconds from `b' to `a' */
+static inline double
+replay_diferenca(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+
+/*
+ * opens a capture file, checking it is Ethernet
+ */
+static pcap_t *
+replay_abre(const char *arquivo)
+{
+	char	 erro_pcap_string[PCAP_ERRBUF_SIZE];
+	pcap_t	*captura;
+
+	captura = pcap_open_offline(arquivo, erro_pcap_string);
+	if (captura == NULL) {
+		Error("could not open capture file `%s': %s", arquivo,
+				erro_pcap_string);
+		return NULL;
+	}
+	if (pcap_datalink(captura) != DLT_EN10MB) {
+		Error("capture file `%s' is not Ethernet", arquivo);
+		pcap_close(captura);
+		return NULL;
+	}
+
+	return captura;
+}
+
+
+/*
+ * Accounts every packet of `captura'.  The uptime of a packet is `base' plus
+ * the time since `origem' (the first packet, if `origem' is not set yet);
+ * with a nonzero `velocidade' that time is also waited for.  Returns what
+ * the last pcap_next_ex() did.
+ */
+static int
+replay_laco(pcap_t *captura, pedb_t *prepacote, struct timeval *origem,
+		const uint64_t base, const double velocidade,
+		uint64_t *pacotes)
+{
+	struct pcap_pkthdr	*header;
+	const u_char		*packet;
+	worker_copias_t		 copias;
+	struct timespec		 inicio;
+	struct timespec		 agora;
+	struct timespec		 espera;
+	uint64_t		 uptime;
+	uint64_t		 uptime_lote = 0;
+	double			 alvo;
+	double			 segundos;
+	int			 ret;
+
+	/* frames of pcap_next_ex() last until the next call: copy them */
+	copias.prepacote = prepacote;
+	copias.lote.qtd = 0;
+	copias.snaplen = FILA_SNAPLEN;
+
+	clock_gettime(CLOCK_MONOTONIC, &inicio);
+	while ((ret = pcap_next_ex(captura, &header, &packet)) == 1) {
+		if (!timerisset(origem))
+			*origem = header->ts;
+
+		alvo = (header->ts.tv_sec - origem->tv_sec) +
+			(header->ts.tv_usec - origem->tv_usec) / 1e6;
+		if (alvo < 0)
+			alvo = 0;	/* out of order */
+
+		/* +1: 0 would give the real clock back */
+		uptime = base + (uint64_t)(alvo * 1000) + 1;
+		if (uptime != uptime_lote) {
+			/* a batch has a single uptime */
+			pkt_contabiliza_lote(&copias.lote, prepacote);
+
+			if (velocidade > 0) {
+				clock_gettime(CLOCK_MONOTONIC, &agora);
+				segundos = alvo / velocidade -
+					replay_diferenca(&agora, &inicio);
+				if (segundos > 0) {
+					espera.tv_sec = segundos;
+					espera.tv_nsec = (segundos -
+							espera.tv_sec) * 1e9;
+					nanosleep(&espera, NULL);
+				}
+			}
+
+			sysuptime_define(uptime);
+			uptime_lote = uptime;
+		}
+
+		worker_copia(&copias, packet, header->caplen, header->len);
+		(*pacotes)++;
+	}
+	pkt_contabiliza_lote(&copias.lote, prepacote);
 
+	return ret;
+}
+
+
+/**
+ * Accounts every packet of a pcap file, then prints how fast it went and
+ * how many entries each table ended up with.
+ *
+ * \param arquivo	The pcap file (Ethernet only).
+ * \param velocidade	0 to go as fast as possible, or how many times the
+ *			original pace to follow (1 is real time).
+ *
+ * \retval SUCCESS	If the whole file was read.
+ * \retval ERROR_IO	If it could not be opened or read.
+ */
+int
+captura_arquivo(const char *arquivo, const double velocidade)
+{
+	pcap_t			*captura;
+	pedb_t			 prepacote;
+	struct timeval		 primeiro;
+	struct timespec		 inicio;
+	struct timespec		 agora;
+	uint64_t		 ticks_ini;
+	uint64_t		 ticks_fim;
+	uint64_t		 pacotes = 0;
+	double			 segundos;
+	int			 ret;
+
+	captura = replay_abre(arquivo);
+	if (captura == NULL)
+		return ERROR_IO;
+
+	pkt_inicializa(&prepacote, 0, interfaces[0].ifindex);
+
+	/* the first packet happens now; the others, as far apart as recorded */
+	timerclear(&primeiro);
+
+	clock_gettime(CLOCK_MONOTONIC, &inicio);
+	rdtsc(ticks_ini);
+	ret = replay_laco(captura, &prepacote, &primeiro, sysuptime_mili(),
+			velocidade, &pacotes);
+	rdtsc(ticks_fim);
+	clock_gettime(CLOCK_MONOTONIC, &agora);
+
+	if (ret == -1)
+		Error("reading `%s': %s", arquivo, pcap_geterr(captura));
+	pcap_close(captura);
+
+	segundos = replay_diferenca(&agora, &inicio);
+	printf("%s: %llu packets in %.3f s", arquivo,
+			(unsigned long long)pacotes, segundos);
+	if ((pacotes > 0) && (segundos > 0)) {
+		printf(", %.0f packets/s, %.0f cycles/packet",
+				pacotes / segundos,
+				(double)(ticks_fim - ticks_ini) / pacotes);
+	}
+	printf("\n");
+	printf("nlHost %u, alHost %u, nlMatrix %u/%u, alMatrix %u/%u, "
+			"protocolDist %u\n",
+			nlhost_quantidade(), alhost_quantidade(),
+			nlmatrix_SD_quantidade(), nlmatrix_DS_quantidade(),
+			almatrix_SD_quantidade(), almatrix_DS_quantidade(),
+			protdist_stats_getQtd());
+
+	return (ret == -1) ? ERROR_IO : SUCCESS;
+}
+
+
+/**
+ * Accounts a capture file into the table shard of \a worker, as fast as
+ * possible, for the batch tool.  Packet uptimes are counted from
+ * \a origem, so several files share one time line.
+ *
+ * Must only be called by the thread which owns \a worker.
+ *
+ * \param pacotes	Incremented for every packet read.
+ *
+ * \retval SUCCESS	If the whole file was read.
+ * \retval ERROR_IO	If it could not be opened or read.
+ */
+int
+captura_arquivo_lote(const char *arquivo, const unsigned int worker,
+		const struct timeval *origem, uint64_t *pacotes)
+{
+	pcap_t		*captura;
+	pedb_t		 prepacote;
+	struct timeval	 inicio = *origem;
+	int		 ret;
+
+	captura = replay_abre(arquivo);
+	if (captura == NULL)
+		return ERROR_IO;
+
+	pkt_inicializa(&prepacote, worker, interfaces[0].ifindex);
+
+	ret = replay_laco(captura, &prepacote, &inicio, 0, 0, pacotes);
+
+	if (ret == -1)
+		Error("reading `%s': %s", arquivo, pcap_geterr(captura));
+	pcap_close(captura);
+
+	return (ret == -1) ? ERROR_IO : SUCCESS;
+}
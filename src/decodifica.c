@@ -0,0 +1,337 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file decodifica.c
+ *
+ *  Decoding of Ethernet/IPv4/transport headers, a batch of frames at a time,
+ *  into one array per field (see decodifica_lote_t).
+ *
+ *  On x86 with SSSE3 or AVX2 (detected at run time, whatever -march the
+ *  agent was built for), the common frame, an IPv4 header without options,
+ *  is decoded from two unaligned 16-byte loads: one compare classifies
+ *  broadcast, ethertype and version/IHL at once, and one byte shuffle picks
+ *  the addresses, the transport and both ports, already in host order.  AVX2
+ *  does two frames per instruction.  Anything else (IP options, a frame that
+ *  is not ether2.ipv4, or too short for the loads) goes through the scalar
+ *  decoder, which is the only one on other architectures.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+#include "decodifica.h"
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DECODIFICA_SIMD	1
+#include <immintrin.h>
+#else
+#define DECODIFICA_SIMD	0
+#endif
+
+
+/* offsets in an untagged Ethernet frame */
+#define OFS_ETHERTYPE	12
+#define OFS_IP		14
+#define OFS_IP_PROTO	(OFS_IP + 9)
+#define OFS_IP_ORIG	(OFS_IP + 12)
+#define OFS_IP_DEST	(OFS_IP + 16)
+#define OFS_L4_SIMPLES	(OFS_IP + 20)	/* transport, if no IP options */
+
+/* reads a 16-bit field in network order */
+#define REDE16(p)		((uint16_t)(((p)[0] << 8) | (p)[1]))
+
+
+/*
+ * decodes frame `i' of the batch, one field at a time; a frame too short
+ * for the headers it claims is left invalid, since the bytes after it may
+ * be another frame's, or past the end of the ring
+ */
+static void
+decodifica_escalar_um(decodifica_lote_t *lote, const unsigned int i)
+{
+	const uint8_t	*q = lote->quadro[i];
+	const uint32_t	 capturado = lote->capturado[i];
+	unsigned int	 trans;
+
+	lote->flags[i] = 0;
+	if (capturado < OFS_L4_SIMPLES)
+		return;
+	if ((REDE16(q + OFS_ETHERTYPE) != 0x0800) || ((q[OFS_IP] >> 4) != 4))
+		return;
+
+	trans = OFS_IP + (q[OFS_IP] & 0x0f) * 4;
+	if (trans < OFS_L4_SIMPLES)
+		return;
+	lote->offset_trans[i] = trans;
+	lote->transporte[i] = q[OFS_IP_PROTO];
+	memcpy(&lote->ip_orig[i], q + OFS_IP_ORIG, sizeof(in_addr_t));
+	memcpy(&lote->ip_dest[i], q + OFS_IP_DEST, sizeof(in_addr_t));
+
+	switch (q[OFS_IP_PROTO]) {
+	case IPPROTO_TCP:
+		if (capturado < trans + 13)
+			return;
+		lote->sport[i] = REDE16(q + trans);
+		lote->dport[i] = REDE16(q + trans + 2);
+		lote->offset_aplic[i] = trans + (q[trans + 12] >> 4) * 4;
+		break;
+	case IPPROTO_UDP:
+		if (capturado < trans + 4)
+			return;
+		lote->sport[i] = REDE16(q + trans);
+		lote->dport[i] = REDE16(q + trans + 2);
+		lote->offset_aplic[i] = trans + 8;
+		break;
+	case IPPROTO_ICMP:
+		lote->sport[i] = 0;
+		lote->dport[i] = 0;
+		lote->offset_aplic[i] = trans + 8;
+		break;
+	default:
+		return;
+	}
+
+	lote->flags[i] = DECODIFICA_VALIDO;
+	if ((q[0] & q[1] & q[2] & q[3] & q[4] & q[5]) == 0xff)
+		lote->flags[i] |= DECODIFICA_BROADCAST;
+}
+
+
+static void
+decodifica_escalar(decodifica_lote_t *lote)
+{
+	unsigned int	i;
+
+	for (i = 0; i < lote->qtd; i++)
+		decodifica_escalar_um(lote, i);
+}
+
+
+#if DECODIFICA_SIMD
+
+/*
+ * The first 16 bytes of a frame are compared with `modelo': bits 0-5 of the
+ * mask say broadcast, bits 12-13 ether2.ipv4 and bit 14 a 20-byte IPv4
+ * header.  The 16 bytes from offset 22 (TTL onwards) are shuffled by
+ * `embaralha' into the layout of `simd_campos_t'.
+ */
+#define MASCARA_BROADCAST	0x003f
+#define MASCARA_SIMPLES		0x7000
+
+/* the shuffled header of a frame */
+typedef struct simd_campos_s {
+	in_addr_t	ip_orig;
+	in_addr_t	ip_dest;
+	uint16_t	sport;
+	uint16_t	dport;
+	uint8_t		transporte;
+	uint8_t		nada[3];
+} simd_campos_t;
+
+#define OFS_SIMD	(OFS_IP_PROTO - 1)
+#define SIMD_MINIMO	(OFS_SIMD + 16)		/* bytes the loads read */
+
+static const uint8_t	modelo[16] __attribute__((aligned(16))) = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff,	/* destination MAC */
+	0, 0, 0, 0, 0, 0,
+	0x08, 0x00,				/* ETHERTYPE_IP */
+	0x45,					/* IPv4, 5 words */
+	0
+};
+
+static const int8_t	embaralha[16] __attribute__((aligned(16))) = {
+	4, 5, 6, 7,		/* source address, as is */
+	8, 9, 10, 11,		/* destination address */
+	13, 12,			/* source port, to host order */
+	15, 14,			/* destination port */
+	1,			/* transport */
+	-1, -1, -1
+};
+
+
+/*
+ * fills frame `i' from its shuffled header, or leaves it to the scalar
+ * decoder if it is not the common case
+ */
+static inline void
+decodifica_simd_um(decodifica_lote_t *lote, const unsigned int i,
+		const simd_campos_t *c, const unsigned int mascara)
+{
+	const uint8_t	*q = lote->quadro[i];
+
+	if ((mascara & MASCARA_SIMPLES) != MASCARA_SIMPLES) {
+		decodifica_escalar_um(lote, i);
+		return;
+	}
+
+	lote->ip_orig[i] = c->ip_orig;
+	lote->ip_dest[i] = c->ip_dest;
+	lote->transporte[i] = c->transporte;
+	lote->offset_trans[i] = OFS_L4_SIMPLES;
+	lote->flags[i] = DECODIFICA_VALIDO;
+	if ((mascara & MASCARA_BROADCAST) == MASCARA_BROADCAST)
+		lote->flags[i] |= DECODIFICA_BROADCAST;
+
+	switch (c->transporte) {
+	case IPPROTO_TCP:
+		if (lote->capturado[i] < OFS_L4_SIMPLES + 13) {
+			lote->flags[i] = 0;
+			break;
+		}
+		lote->sport[i] = c->sport;
+		lote->dport[i] = c->dport;
+		lote->offset_aplic[i] = OFS_L4_SIMPLES +
+			(q[OFS_L4_SIMPLES + 12] >> 4) * 4;
+		break;
+	case IPPROTO_UDP:
+		lote->sport[i] = c->sport;
+		lote->dport[i] = c->dport;
+		lote->offset_aplic[i] = OFS_L4_SIMPLES + 8;
+		break;
+	case IPPROTO_ICMP:
+		lote->sport[i] = 0;
+		lote->dport[i] = 0;
+		lote->offset_aplic[i] = OFS_L4_SIMPLES + 8;
+		break;
+	default:
+		lote->flags[i] = 0;
+	}
+}
+
+
+__attribute__((target("ssse3")))
+static void
+decodifica_ssse3(decodifica_lote_t *lote)
+{
+	const __m128i	m = _mm_load_si128((const __m128i *)modelo);
+	const __m128i	e = _mm_load_si128((const __m128i *)embaralha);
+	simd_campos_t	c __attribute__((aligned(16)));
+	__m128i		inicio;
+	__m128i		ip;
+	unsigned int	i;
+
+	for (i = 0; i < lote->qtd; i++) {
+		if (lote->capturado[i] < SIMD_MINIMO) {
+			decodifica_escalar_um(lote, i);
+			continue;
+		}
+		inicio = _mm_loadu_si128((const __m128i *)lote->quadro[i]);
+		ip = _mm_loadu_si128((const __m128i *)
+				(lote->quadro[i] + OFS_SIMD));
+
+		_mm_store_si128((__m128i *)&c, _mm_shuffle_epi8(ip, e));
+		decodifica_simd_um(lote, i, &c,
+				_mm_movemask_epi8(_mm_cmpeq_epi8(inicio, m)));
+	}
+}
+
+
+__attribute__((target("avx2")))
+static void
+decodifica_avx2(decodifica_lote_t *lote)
+{
+	const __m256i	m = _mm256_broadcastsi128_si256(
+			_mm_load_si128((const __m128i *)modelo));
+	const __m256i	e = _mm256_broadcastsi128_si256(
+			_mm_load_si128((const __m128i *)embaralha));
+	simd_campos_t	c[2] __attribute__((aligned(32)));
+	__m256i		inicio;
+	__m256i		ip;
+	unsigned int	mascara;
+	unsigned int	i;
+
+	/* two frames at a time, one per 128-bit lane */
+	for (i = 0; i + 1 < lote->qtd; i += 2) {
+		if ((lote->capturado[i] < SIMD_MINIMO) ||
+				(lote->capturado[i + 1] < SIMD_MINIMO)) {
+			decodifica_escalar_um(lote, i);
+			decodifica_escalar_um(lote, i + 1);
+			continue;
+		}
+		inicio = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)
+					lote->quadro[i])),
+				_mm_loadu_si128((const __m128i *)
+					lote->quadro[i + 1]), 1);
+		ip = _mm256_inserti128_si256(_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)
+					(lote->quadro[i] + OFS_SIMD))),
+				_mm_loadu_si128((const __m128i *)
+					(lote->quadro[i + 1] + OFS_SIMD)), 1);
+
+		_mm256_store_si256((__m256i *)c, _mm256_shuffle_epi8(ip, e));
+		mascara = _mm256_movemask_epi8(_mm256_cmpeq_epi8(inicio, m));
+		decodifica_simd_um(lote, i, &c[0], mascara & 0xffff);
+		decodifica_simd_um(lote, i + 1, &c[1], mascara >> 16);
+	}
+
+	if (i < lote->qtd)
+		decodifica_escalar_um(lote, i);
+}
+
+#endif	/* DECODIFICA_SIMD */
+
+
+/* the decoder chosen for this CPU */
+static void	(*decodificador)(decodifica_lote_t *) = decodifica_escalar;
+
+
+/** \brief Chooses the fastest decoder this CPU can run.
+ *
+ *  Must be called before the first batch is decoded.
+ */
+void
+decodifica_inicializa()
+{
+#if DECODIFICA_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		decodificador = decodifica_avx2;
+		Debug("decoding headers with AVX2");
+		return;
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		decodificador = decodifica_ssse3;
+		Debug("decoding headers with SSSE3");
+		return;
+	}
+#endif
+	decodificador = decodifica_escalar;
+}
+
+
+/** \brief Decodes the headers of every frame of \a lote.
+ *
+ *  Frames without the DECODIFICA_VALIDO flag afterwards are not to be
+ *  accounted (not ether2.ipv4, or neither TCP, UDP nor ICMP).
+ */
+void
+decodifica_lote(decodifica_lote_t *lote)
+{
+	if (lote->qtd == 1)
+		decodifica_escalar_um(lote, 0);
+	else
+		decodificador(lote);
+}
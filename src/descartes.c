@@ -0,0 +1,159 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file descartes.c
+ *  \brief Drop accounting, published to the DroppedFrames columns
+ *
+ *  A frame may be lost before accounting (the kernel ring or the fila was
+ *  full) or during it (some table had no room for a new entry).  The first
+ *  kind is reported by the capture threads, per interface; the second is
+ *  counted by each worker, so the hot path never shares a cache line.
+ *
+ *  Every DESCARTES_INTERVALO the sums are written to
+ *  protocolDistControlDroppedFrames and to the Nl/AlDroppedFrames columns of
+ *  hlHostControl and hlMatrixControl: a frame lost before accounting counts
+ *  for all of them, a table-full rejection only for the tables it missed.
+ */
+
+#include <stdint.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "sysuptime.h"
+#include "shards.h"
+#include "protocoldist.h"
+#include "hlhost.h"
+#include "hlmatrix.h"
+#include "descartes.h"
+#include "log.h"
+
+
+/** \brief Frames lost before accounting, per interface */
+static uint32_t		captura[IFINDEX_MAX];
+
+/** \brief Table-full rejections, per worker and interface */
+static struct {
+	uint32_t	nl[IFINDEX_MAX];
+	uint32_t	al[IFINDEX_MAX];
+	uint32_t	pdist[IFINDEX_MAX];
+} tabelas[MAX_WORKERS];
+
+/** \brief Uptime of the last publication */
+static unsigned long	ultima;
+
+
+/** \brief Adds frames lost by the kernel or the fila on an interface. */
+void
+descartes_captura(const unsigned int interface, const uint32_t quantos)
+{
+	if ((interface < IFINDEX_MAX) && (quantos > 0))
+		__atomic_add_fetch(&captura[interface], quantos,
+				__ATOMIC_RELAXED);
+}
+
+
+/** \brief Counts one frame which some tables could not account.
+ *
+ *  Only called by \a worker itself.
+ *
+ *  \param  quais	DESCARTE_* flags of the tables which missed it.
+ */
+void
+descartes_tabela(const unsigned int worker, const unsigned int interface,
+		const unsigned int quais)
+{
+	if ((worker >= MAX_WORKERS) || (interface >= IFINDEX_MAX))
+		return;
+
+	if (quais & DESCARTE_NL)
+		tabelas[worker].nl[interface]++;
+	if (quais & DESCARTE_AL)
+		tabelas[worker].al[interface]++;
+	if (quais & DESCARTE_PDIST)
+		tabelas[worker].pdist[interface]++;
+}
+
+
+/** \brief Tells a capture thread whether it is time to collect its drops.
+ *
+ *  \param  proximo	Uptime of the next collection, kept by the caller.
+ *  \retval 1 once every DESCARTES_INTERVALO
+ *  \retval 0 otherwise
+ */
+int
+descartes_vencido(unsigned long *proximo)
+{
+	unsigned long	agora = sysuptime();
+
+	if (agora < *proximo)
+		return 0;
+
+	*proximo = agora + DESCARTES_INTERVALO;
+	return 1;
+}
+
+
+/** \brief Writes the drop counters to the control tables.
+ *
+ *  Any capture thread may call it; only one publication happens per
+ *  DESCARTES_INTERVALO.
+ */
+void
+descartes_publica()
+{
+	unsigned long	anterior = __atomic_load_n(&ultima, __ATOMIC_RELAXED);
+	unsigned long	agora = sysuptime();
+	unsigned int	workers = shards_quantidade();
+	uint32_t	base;
+	uint32_t	nl;
+	uint32_t	al;
+	uint32_t	pdist;
+	unsigned int	i;
+	unsigned int	w;
+
+	if ((anterior != 0) && (agora - anterior < DESCARTES_INTERVALO))
+		return;
+	if (!__atomic_compare_exchange_n(&ultima, &anterior, agora, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+
+	for (i = 0; i < IFINDEX_MAX; i++) {
+		base = __atomic_load_n(&captura[i], __ATOMIC_RELAXED);
+		nl = al = pdist = base;
+		for (w = 0; w < workers; w++) {
+			nl += __atomic_load_n(&tabelas[w].nl[i], __ATOMIC_RELAXED);
+			al += __atomic_load_n(&tabelas[w].al[i], __ATOMIC_RELAXED);
+			pdist += __atomic_load_n(&tabelas[w].pdist[i],
+					__ATOMIC_RELAXED);
+		}
+
+		if ((nl | al | pdist) == 0)
+			continue;
+
+		/* rows which do not exist (or are not active) refuse it */
+		pdist_control_atualiza_drops(i, pdist);
+		hlhost_atualizaNlDroppedFrames(i, nl);
+		hlhost_atualizaAlDroppedFrames(i, al);
+		hlmatrix_atualizaNlDroppedFrames(i, nl);
+		hlmatrix_atualizaAlDroppedFrames(i, al);
+	}
+}
@@ -0,0 +1,209 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file duplicatas.c
+ *  \brief Suppression of duplicate frames (SPAN ports mirroring both ways)
+ *
+ *  A SPAN session copying ingress and egress delivers most frames twice,
+ *  microseconds apart.  Each capture path remembers, in a small direct
+ *  mapped table, a signature of the IPv4 packets it saw recently; a packet
+ *  whose signature is found there, within the window, is a repeat.
+ *
+ *  The signature covers the IP identification, addresses, protocol and
+ *  total length, plus the ports and the checksum of TCP, UDP and ICMP.  The
+ *  IP header checksum is left out on purpose: it changes with the TTL when
+ *  the mirrored traffic crosses a router, while the transport one does not.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "shards.h"
+#include "duplicatas.h"
+#include "log.h"
+
+
+/** \brief A packet seen recently */
+typedef struct recente_s {
+	uint64_t	assinatura;
+	uint64_t	instante;	/* microseconds */
+} recente_t;
+
+/** \brief Recent packets and repeats removed, per worker */
+static struct {
+	recente_t	*recentes;	/* DUPLICATAS_TAM, allocated on first use */
+	uint32_t	 removidas;
+} tabelas[MAX_WORKERS];
+
+/** \brief How far apart (microseconds) two copies may be; 0 is disabled */
+static uint64_t		janela = 0;
+
+
+/* final mix of splitmix64: every input bit reaches every output bit */
+static inline uint64_t
+mistura(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return x;
+}
+
+
+/*
+ * computes the signature of an Ethernet frame; returns 0 if it does not
+ * carry IPv4, which is never taken for a repeat
+ */
+static int
+assinatura(const u_char *quadro, const uint32_t caplen, uint64_t *resultado)
+{
+	const u_char	*ip = quadro + ETHER_HDR_LEN;
+	const u_char	*transp;
+	uint64_t	 enderecos;
+	uint64_t	 cabecalho;
+	uint32_t	 portas = 0;
+	uint16_t	 soma = 0;
+	unsigned int	 ihl;
+
+	if (caplen < ETHER_HDR_LEN + 20)
+		return 0;
+	if ((quadro[12] != 0x08) || (quadro[13] != 0x00) || ((ip[0] >> 4) != 4))
+		return 0;
+
+	ihl = (ip[0] & 0x0f) * 4;
+	transp = ip + ihl;
+
+	/* identification, total length and protocol */
+	cabecalho = ((uint64_t)ip[4] << 40) | ((uint64_t)ip[5] << 32) |
+		((uint64_t)ip[2] << 24) | ((uint64_t)ip[3] << 16) | ip[9];
+	memcpy(&enderecos, ip + 12, sizeof(enderecos));
+
+	/* only the first fragment has the transport header */
+	if (((ip[6] & 0x1f) | ip[7]) == 0) {
+		switch (ip[9]) {
+			case IPPROTO_TCP:
+				if (caplen >= ETHER_HDR_LEN + ihl + 18) {
+					memcpy(&portas, transp, 4);
+					memcpy(&soma, transp + 16, 2);
+				}
+				break;
+
+			case IPPROTO_UDP:
+				if (caplen >= ETHER_HDR_LEN + ihl + 8) {
+					memcpy(&portas, transp, 4);
+					memcpy(&soma, transp + 6, 2);
+				}
+				break;
+
+			case IPPROTO_ICMP:
+				if (caplen >= ETHER_HDR_LEN + ihl + 4)
+					memcpy(&soma, transp + 2, 2);
+				break;
+		}
+	}
+
+	*resultado = mistura(mistura(enderecos) ^ cabecalho ^
+			((uint64_t)portas << 16) ^ soma) | 1;	/* never 0 */
+
+	return 1;
+}
+
+
+/** \brief Sets the window, in microseconds (0 disables the suppression). */
+int
+duplicatas_inicializa(const unsigned int microssegundos)
+{
+	janela = microssegundos;
+	if (janela > 0)
+		Debug("dropping repeated frames up to %u us apart",
+				microssegundos);
+
+	return SUCCESS;
+}
+
+
+/** \brief Tells whether a frame repeats one seen within the window.
+ *
+ *  Only called by \a worker itself, with the capture time of the frame;
+ *  a frame which is not a repeat is remembered.
+ *
+ *  \retval 1 a repeat, not to be accounted
+ *  \retval 0 otherwise
+ */
+int
+duplicatas_verifica(const unsigned int worker, const u_char *quadro,
+		const uint32_t caplen, const uint64_t instante)
+{
+	recente_t	*r;
+	uint64_t	 chave;
+
+	if ((janela == 0) || (worker >= MAX_WORKERS))
+		return 0;
+	if (!assinatura(quadro, caplen, &chave))
+		return 0;
+
+	if (tabelas[worker].recentes == NULL) {
+		tabelas[worker].recentes = calloc(DUPLICATAS_TAM,
+				sizeof(recente_t));
+		if (tabelas[worker].recentes == NULL) {
+			Debug("no memory for the duplicates of worker %u",
+					worker);
+			return 0;
+		}
+	}
+
+	r = &tabelas[worker].recentes[chave & (DUPLICATAS_TAM - 1)];
+	if ((r->assinatura == chave) && (instante - r->instante <= janela)) {
+		__atomic_store_n(&tabelas[worker].removidas,
+				tabelas[worker].removidas + 1,
+				__ATOMIC_RELAXED);
+		return 1;
+	}
+
+	r->assinatura = chave;
+	r->instante = instante;
+
+	return 0;
+}
+
+
+/** \brief How many repeated frames were dropped, by all workers. */
+uint32_t
+duplicatas_removidas()
+{
+	uint32_t	total = 0;
+	unsigned int	w;
+
+	for (w = 0; w < MAX_WORKERS; w++)
+		total += __atomic_load_n(&tabelas[w].removidas,
+				__ATOMIC_RELAXED);
+
+	return total;
+}
@@ -0,0 +1,319 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file fluxos.c
+ *  \brief Cache of flows, with the table rows each one is accounted in
+ *
+ *  Every packet of a conversation looks up the same rows of protocolDist,
+ *  nlHost, alHost and the matrices.  While the first packet of a flow goes
+ *  through pkt_process(), the tables record here the counters they updated;
+ *  the next packets of that flow add to those counters directly, after a
+ *  single lookup.
+ *
+ *  A flow is only kept while nothing it depends on changed: protocolDir
+ *  (which encapsulations exist, and what is done with them) and the rows
+ *  themselves, which may be freed from the SNMP side.  Any such change bumps
+ *  a generation, which each worker picks up at the start of a batch, making
+ *  every older flow stale at once.  Rows are only removed after the bump,
+ *  holding the lock of the worker whose table they are in (its shard, or
+ *  the merged table when it is alone: the lock is taken either way), and a
+ *  worker holds that lock for a whole batch, so a batch never sees a
+ *  removed row.
+ *
+ *  Within a batch, the packets of a cached flow are only summed up in it;
+ *  the rows get the sums once, when the batch ends, so that a flow
+ *  carrying most of a batch costs one pass over its rows instead of one
+ *  per packet.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+
+#if PTSL
+#include "stateful.h"
+#endif
+
+#include "pedb.h"
+#include "fluxos.h"
+#include "shards.h"
+#include "log.h"
+
+
+/** \brief The flows of each worker, the generation they must carry, and
+ *  those with packets of the current batch */
+static struct {
+	fluxo_t		*fluxos;	/* FLUXOS_TAM, allocated on first use */
+	unsigned int	 geracao;
+	unsigned int	 pendentes_qtd;
+	fluxo_t		*pendentes[FLUXOS_PENDENTES];
+} tabelas[MAX_WORKERS];
+
+/** \brief Bumped whenever cached flows may point at the wrong rows */
+static unsigned int	geracao_atual = 1;
+
+
+/** \brief Makes every cached flow stale.
+ *
+ *  Called before protocolDir changes, or table rows are freed.
+ */
+void
+fluxos_invalida()
+{
+	__atomic_add_fetch(&geracao_atual, 1, __ATOMIC_RELEASE);
+}
+
+
+/** \brief Called by \a worker at the start of each batch, with its shard
+ *  locked: flows from an older generation will not be used.
+ */
+void
+fluxos_sincroniza(const unsigned int worker)
+{
+	if (worker >= MAX_WORKERS)
+		return;
+
+	if (tabelas[worker].fluxos == NULL) {
+		tabelas[worker].fluxos = calloc(FLUXOS_TAM, sizeof(fluxo_t));
+		if (tabelas[worker].fluxos == NULL) {
+			Debug("no memory for the flows of worker %u", worker);
+			return;
+		}
+	}
+
+	tabelas[worker].geracao = __atomic_load_n(&geracao_atual,
+			__ATOMIC_ACQUIRE);
+}
+
+
+/* slot of a flow: addresses, ports and protocol, well mixed */
+static inline unsigned int
+fluxos_posicao(const pedb_t *dados)
+{
+	uint64_t	x;
+
+	x = ((uint64_t)dados->ip_orig << 32) | dados->ip_dest;
+	x ^= ((uint64_t)(dados->rede_sport & 0xffff) << 48) |
+		((uint64_t)(dados->rede_dport & 0xffff) << 32) |
+		((uint64_t)dados->prot_transporte << 8) | dados->interface;
+	x *= 0x9e3779b97f4a7c15ULL;
+	x ^= x >> 29;
+
+	return (unsigned int)x & (FLUXOS_TAM - 1);
+}
+
+
+/* whether `f' is the current flow of the packet in `dados' */
+static inline int
+fluxos_confere(const fluxo_t *f, const pedb_t *dados)
+{
+	return (f->geracao == tabelas[dados->worker].geracao) &&
+		(f->ip_orig == dados->ip_orig) &&
+		(f->ip_dest == dados->ip_dest) &&
+		(f->sport == dados->rede_sport) &&
+		(f->dport == dados->rede_dport) &&
+		(f->transporte == dados->prot_transporte) &&
+		(f->broadcast == dados->is_broadcast) &&
+		(f->interface == dados->interface) &&
+		(f->acoes == dados->acoes);
+}
+
+
+/** \brief Prefetches, for a batch, the slot of the flow of \a dados
+ *  (ANTECIPA_POSICAO), or the rows of the flow found there
+ *  (ANTECIPA_ENTRADA).
+ *
+ *  \return The flow, if it is cached (ANTECIPA_ENTRADA only), or NULL.
+ */
+const fluxo_t *
+fluxos_antecipa(const pedb_t *dados, const int etapa)
+{
+	const fluxo_t		*f;
+	const fluxo_conta_t	*c;
+
+	if ((dados->worker >= MAX_WORKERS) ||
+			(tabelas[dados->worker].fluxos == NULL))
+		return NULL;
+
+	f = &tabelas[dados->worker].fluxos[fluxos_posicao(dados)];
+	if (etapa == ANTECIPA_POSICAO) {
+		__builtin_prefetch(f, 0, 3);
+		return NULL;
+	}
+
+	if (!fluxos_confere(f, dados))
+		return NULL;
+
+	for (c = f->contas; c < f->contas + f->contas_qtd; c++)
+		__builtin_prefetch(c->pkts, 1, 3);
+
+	return f;
+}
+
+
+/** \brief Looks up the flow of the packet in \a dados.
+ *
+ *  \return The flow, to be passed to fluxos_conta(), or NULL if the packet
+ *	    must go through pkt_process(); then \a dados->fluxo tells the
+ *	    tables where to record it (or is NULL), and fluxos_conclui() must
+ *	    be called afterwards.
+ */
+fluxo_t *
+fluxos_localiza(pedb_t *dados)
+{
+	fluxo_t		*f;
+
+	dados->fluxo = NULL;
+	if ((dados->worker >= MAX_WORKERS) ||
+			(tabelas[dados->worker].fluxos == NULL))
+		return NULL;
+
+	f = &tabelas[dados->worker].fluxos[fluxos_posicao(dados)];
+	if (fluxos_confere(f, dados))
+		return f;
+
+	/* its packets still owe the rows of the flow leaving */
+	if (f->lote_pkts != 0)
+		fluxos_descarrega(dados);
+
+	/* taken over by this flow, usable once the packet is accounted */
+	f->geracao = 0;
+	f->ip_orig = dados->ip_orig;
+	f->ip_dest = dados->ip_dest;
+	f->sport = dados->rede_sport;
+	f->dport = dados->rede_dport;
+	f->transporte = dados->prot_transporte;
+	f->broadcast = dados->is_broadcast;
+	f->interface = dados->interface;
+	f->acoes = dados->acoes;
+	f->contas_qtd = 0;
+	dados->fluxo = f;
+
+	return NULL;
+}
+
+
+/** \brief Adds the sums of the current batch to the rows of each flow that
+ *  got packets in it.  Called when the batch ends, with the worker's shard
+ *  still locked.
+ */
+void
+fluxos_descarrega(const pedb_t *dados)
+{
+	fluxo_t			*f;
+	const fluxo_conta_t	*c;
+	unsigned int		 i;
+
+	if (dados->worker >= MAX_WORKERS)
+		return;
+
+	for (i = 0; i < tabelas[dados->worker].pendentes_qtd; i++) {
+		f = tabelas[dados->worker].pendentes[i];
+
+		for (c = f->contas; c < f->contas + f->contas_qtd; c++) {
+			*c->pkts += f->lote_pkts;
+			if (c->octets == NULL)
+				continue;
+			*c->octets += f->lote_octets;
+			if (c->create_time == NULL)
+				continue;
+
+			/* packets of replayed files may be older than the entry */
+			if (dados->uptime < *c->create_time)
+				*c->create_time = dados->uptime;
+#ifdef USE_TIMEFILTER
+			*c->timemark = dados->uptime;
+#endif
+		}
+
+		f->lote_pkts = 0;
+		f->lote_octets = 0;
+	}
+
+	tabelas[dados->worker].pendentes_qtd = 0;
+}
+
+
+/** \brief Accounts the packet in \a dados in its flow \a f, to be added to
+ *  its rows by fluxos_descarrega(), and leaves \a dados as pkt_process()
+ *  would.
+ */
+void
+fluxos_conta(fluxo_t *f, pedb_t *dados)
+{
+	if (f->lote_pkts == 0) {
+		if (tabelas[dados->worker].pendentes_qtd == FLUXOS_PENDENTES)
+			fluxos_descarrega(dados);
+		tabelas[dados->worker].pendentes[
+			tabelas[dados->worker].pendentes_qtd++] = f;
+	}
+	f->lote_pkts += dados->peso;
+	f->lote_octets += dados->tamanho;
+
+	dados->nl_localindex = f->nl_localindex;
+	dados->al_localindex = f->al_localindex;
+#if PTSL
+	dados->direcao = f->direcao;
+	dados->ip_cliente = f->ip_cliente;
+	dados->ip_servidor = f->ip_servidor;
+	dados->porta_cliente = f->porta_cliente;
+	dados->porta_servidor = f->porta_servidor;
+	dados->prim_traco_rede = f->prim_traco_rede;
+	dados->prim_traco_transporte = f->prim_traco_transporte;
+	dados->prim_traco_aplicacao = f->prim_traco_aplicacao;
+#endif
+}
+
+
+/** \brief Ends the recording of a flow started by fluxos_localiza(), once
+ *  pkt_process() accounted its packet.  The flow is kept only if every
+ *  table took the packet and the rows fit in it.
+ */
+void
+fluxos_conclui(pedb_t *dados)
+{
+	fluxo_t		*f = dados->fluxo;
+
+	if (f == NULL)
+		return;
+	dados->fluxo = NULL;
+
+	if (f->contas_qtd > FLUXO_CONTAS)
+		return;
+
+	f->nl_localindex = dados->nl_localindex;
+	f->al_localindex = dados->al_localindex;
+#if PTSL
+	f->direcao = dados->direcao;
+	f->ip_cliente = dados->ip_cliente;
+	f->ip_servidor = dados->ip_servidor;
+	f->porta_cliente = dados->porta_cliente;
+	f->porta_servidor = dados->porta_servidor;
+	f->prim_traco_rede = dados->prim_traco_rede;
+	f->prim_traco_transporte = dados->prim_traco_transporte;
+	f->prim_traco_aplicacao = dados->prim_traco_aplicacao;
+#endif
+	f->geracao = tabelas[dados->worker].geracao;
+}
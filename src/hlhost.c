@@ -39,7 +39,7 @@
 
 
 /* local defines */
-#define HLHOST_TAM  4
+#define HLHOST_TAM  IFINDEX_MAX
 
 
 /* tabela pr-inicializada com tudo zerado */
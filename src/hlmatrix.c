@@ -38,7 +38,7 @@
 #include "exit_codes.h"
 
 /* local defines */
-#define HLMATRIX_TAM	4
+#define HLMATRIX_TAM	IFINDEX_MAX
 
 
 /* Main hlMatrix table. */
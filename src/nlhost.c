@@ -29,286 +29,243 @@
 #include "configuracao.h"
 #include "exit_codes.h"
 
-#include "primo.h"
-#include "funcao_hash.h"
-
 #if PTSL
 #include "stateful.h"
 #endif
 
 #include "pedb.h"
+#include "fluxos.h"
 #include "hlhost.h"
 #include "nlhost.h"
+#include "shards.h"
+#include "tabela.h"
 #include "log.h"
 
 
 /* these are needed only here */
-#define NLHOST_MAX  65536   /* maximum entries number */
-#define NLHOST_TAM  PRIMO   /* hash table size */
+#define NLHOST_TAM  TABELAS_POSICOES	/* slots of a table */
+
 
+/* the merged table (read by SNMP) */
+TABELA_ESTATICA(principal, nlhost_t, NLHOST_TAM);
+/* where each worker accounts: its private shard or, with a single worker,
+   straight into principal */
+static tabela_t		*tabelas[MAX_WORKERS] = { &principal, };
 
-static nlhost_t	    *tabela_hash[NLHOST_TAM] = {NULL, };
-static unsigned int quantidade = 0;	// quantidade de entradas na tabela
-static unsigned int profundidade = 0;   // maior profundidade (limite de busca)
+#define NLHOST(t, indice)	((nlhost_t *)tabela_entrada((t), (indice)))
 
 
 #define QUERO_PROXIMO	1
 #define QUERO_PRIMEIRO	1
-#undef	QUERO_REMOVER
+#define QUERO_REMOVER	1
 #include "lista_indices.h"
 
 
 unsigned int nlhost_quantidade()
 {
-	return quantidade;
+	return principal.quantidade;
 }
 
 
-static unsigned int nlhost_localiza(const uint32_t address)
+/* an entry is a host (address) seen on an interface */
+static int nlhost_confere(const void *entrada, const void *chave)
 {
-	unsigned int i = 0;		/* offset da hash */
-	unsigned int hash_index;	// = hash(address, i);
-
-	/* compute hash and try to access */
-	HASH(address, i, hash_index);
-	if ((tabela_hash[hash_index] != NULL) &&
-			(tabela_hash[hash_index]->address == address)) {
-		/* found! */
-		return hash_index;
-	}
-
-	/* not found in the first try - start probing */
-	i++;
-	while (i <= profundidade) {
-		HASH(address, i, hash_index);
-		if ((tabela_hash[hash_index] == NULL) ||
-				(tabela_hash[hash_index]->address != address)) {
-			/* nao encontrou */
-			i++;
-		}
-		else {
-			/* encontrou a entrada */
-			return hash_index;
-		}
-	}
+	const nlhost_t	*e = entrada;
+	const nlhost_t	*c = chave;
 
-	/* we can't return a negative number, so we return table's size */
-	return NLHOST_TAM;
+	return (e->address == c->address) &&
+		(e->hlhost_index == c->hlhost_index);
 }
 
 
-int nlhost_insereAtualiza(pedb_t *dados)
+static unsigned int nlhost_localiza(const tabela_t *t, const uint32_t address,
+		const unsigned int interface)
 {
-	/* se a entrada existe, atualizar, caso contrrio, criar uma */
-	unsigned int i;
-	unsigned int indice_entrada;
-	unsigned int indice_saida;
-
-	/* estranho.. pq s atualiza entrada de pacotes se o pacote for unicast?? */
-	if (dados->is_broadcast == 0) {
-		indice_entrada = nlhost_localiza(dados->ip_dest);
-
-		/* atualizar/criar ENTRADA de pacotes */
-		if (indice_entrada != NLHOST_TAM) {
-#if DEBUG_NLHOST == 1
-			Debug("atualizando (%d)", indice_entrada);
-#endif
-			tabela_hash[indice_entrada]->in_pkts++;
-			tabela_hash[indice_entrada]->in_octets += dados->tamanho;
+	nlhost_t	modelo;
 
-#ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#endif
-		}
-		else {
-			/* alocar uma posio na tabela */
-#if DEBUG_NLHOST == 1
-			Debug("inserindo nova (%d)", indice_entrada);
-#endif
-			i = 0;
-			HASH(dados->ip_dest, i, indice_entrada);
-
-			while ((i < NLHOST_MAX) && (tabela_hash[indice_entrada] != NULL)) {
-				i++;
-				HASH(dados->ip_dest, i, indice_entrada);
-			}
-			if (i >= NLHOST_MAX) {
-				Debug("tabela cheia (%u/%u) - descartando",
-						quantidade, NLHOST_MAX);
-				return ERROR_FULL;
-			}
-			if (i > profundidade) {
-				profundidade = i;
-			}
-
-			/* criar a entrada */
-			tabela_hash[indice_entrada] = calloc(1, sizeof(nlhost_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-			if (tabela_hash[indice_entrada] == NULL) {
-				Debug("Error in hash entry memory allocation!");
-				return ERROR_MALLOC;
-			}
-#endif
-			tabela_hash[indice_entrada]->create_time = dados->uptime;
-
-#ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#else
-			tabela_hash[indice_entrada]->timemark = 0;
-#endif
-
-			tabela_hash[indice_entrada]->localindex = dados->nl_localindex;
-			tabela_hash[indice_entrada]->hlhost_index = dados->interface;
-			tabela_hash[indice_entrada]->in_pkts = 1;
-			tabela_hash[indice_entrada]->in_octets = dados->tamanho;
+	modelo.address = address;
+	modelo.hlhost_index = interface;
 
-			/* zerar os de saida, ainda nao registrados */
-			tabela_hash[indice_entrada]->out_pkts =
-				tabela_hash[indice_entrada]->out_octets =
-				tabela_hash[indice_entrada]->out_macbroadcast_pkts = 0;
+	/* we can't return a negative number, so we return table's size */
+	return tabela_busca(t, tabela_hash(address), nlhost_confere, &modelo);
+}
 
-			tabela_hash[indice_entrada]->address = dados->ip_dest;
 
-			/* atualizar NlInserts na HlHost */
-			if (hlhost_atualizaNlInserts(dados->interface) != SUCCESS) {
-				Debug("hlhost_atualizaNlInserts(%d) falhou",
-						dados->interface);
-			}
+/*
+ *  prefetches the control bytes of `chave' in the table of `worker'
+ *  (ANTECIPA_POSICAO), or the entry they point at (ANTECIPA_ENTRADA), ahead
+ *  of nlhost_insereAtualiza()
+ */
+void nlhost_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa)
+{
+	if (etapa == ANTECIPA_POSICAO)
+		tabela_antecipa_grupo(tabelas[worker], tabela_hash(chave));
+	else
+		tabela_antecipa_entrada(tabelas[worker], tabela_hash(chave));
+}
 
-			if (lista_insere(indice_entrada) != SUCCESS) {
-				Debug("lista_insere() falhou");
-			}
 
-			quantidade++;
-		}
-	}
+/*
+ *  the entry of `address' in `t', for the packet in `dados': created, with
+ *  its counters zeroed, if it did not exist.  NULL if the table is full.
+ */
+static nlhost_t *nlhost_obtem(tabela_t *t, const pedb_t *dados,
+		const in_addr_t address)
+{
+	nlhost_t	*p;
+	unsigned int	indice;
 
-	/* atualizar/criar SAIDA de pacotes */
-	indice_saida = nlhost_localiza(dados->ip_orig);
-	if (indice_saida != NLHOST_TAM) {
+	indice = nlhost_localiza(t, address, dados->interface);
+	if (indice != NLHOST_TAM) {
 #if DEBUG_NLHOST == 1
-		Debug("updating (%d)", indice_saida);
+		Debug("atualizando (%u)", indice);
 #endif
-		tabela_hash[indice_saida]->out_pkts++;
-		tabela_hash[indice_saida]->out_octets += dados->tamanho;
-		if (dados->is_broadcast != 0) {
-			tabela_hash[indice_saida]->out_macbroadcast_pkts++;
-		}
+		p = NLHOST(t, indice);
+
+		/* packets of replayed files may be older than the entry */
+		if (dados->uptime < p->create_time)
+			p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
+		p->timemark = dados->uptime;
 #endif
+		return p;
+	}
+
+	/* alocar uma posio na tabela */
+	indice = tabela_insere(t, tabela_hash(address));
+	if (indice == NLHOST_TAM) {
+		Debug("tabela cheia (%u/%u) - descartando",
+				t->quantidade, t->maximo);
+		return NULL;
 	}
-	else {
-		/* alocar uma posio na tabela */
 #if DEBUG_NLHOST == 1
-		Debug("inserindo nova (%d)", indice_saida);
+	Debug("inserindo nova (%u)", indice);
 #endif
-		i = 0;
-		HASH(dados->ip_orig, i, indice_saida);
-
-		while ((i < NLHOST_MAX) && (tabela_hash[indice_saida] != NULL)) {
-			i++;
-			HASH(dados->ip_orig, i, indice_saida);
-		}
-		if (i >= NLHOST_MAX) {
-			Debug("Table full (%u/%u) - discarding data",
-					quantidade, NLHOST_MAX);
-			return ERROR_FULL;
-		}
-		if (i > profundidade) {
-			profundidade = i;
-		}
 
-		/* criar a entrada */
-		tabela_hash[indice_saida] = calloc(1, sizeof(nlhost_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-		if (tabela_hash[indice_saida] == NULL) {
-			Debug("Error in hash entry memory allocation!%s\n");
-			return ERROR_MALLOC;
-		}
-#endif
-		tabela_hash[indice_saida]->create_time = dados->uptime;
+	p = NLHOST(t, indice);
+	p->address = address;
+	p->localindex = dados->nl_localindex;
+	p->hlhost_index = dados->interface;
+	p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#else
-		tabela_hash[indice_saida]->timemark = 0;
+	p->timemark = dados->uptime;
 #endif
 
-		tabela_hash[indice_saida]->localindex = dados->nl_localindex;
-		tabela_hash[indice_saida]->hlhost_index = dados->interface;
-		tabela_hash[indice_saida]->out_pkts = 1;
-		tabela_hash[indice_saida]->out_octets = dados->tamanho;
-		if (dados->is_broadcast != 0) {
-			tabela_hash[indice_saida]->out_macbroadcast_pkts = 1;
-		}
-		else {
-			tabela_hash[indice_saida]->out_macbroadcast_pkts = 0;
-		}
-
-		/* zerar os de entrada, ainda nao registrados */
-		tabela_hash[indice_saida]->in_pkts =
-			tabela_hash[indice_saida]->in_octets = 0;
-
-		tabela_hash[indice_saida]->address = dados->ip_orig;
-
+	if (t == &principal) {
 		/* atualizar NlInserts na HlHost */
 		if (hlhost_atualizaNlInserts(dados->interface) != SUCCESS) {
 			Debug("hlhost_atualizaNlInserts(%d) falhou",
 					dados->interface);
 		}
 
-		if (lista_insere(indice_saida) != SUCCESS) {
+		if (lista_insere(indice) != SUCCESS) {
 			Debug("lista_insere() falhou");
 		}
+	}
+
+	return p;
+}
+
+
+int nlhost_insereAtualiza(pedb_t *dados)
+{
+	tabela_t	*t = tabelas[dados->worker];
+	nlhost_t	*p;
+
+	/* estranho.. pq s atualiza entrada de pacotes se o pacote for unicast?? */
+	if (dados->is_broadcast == 0) {
+		/* atualizar/criar ENTRADA de pacotes */
+		p = nlhost_obtem(t, dados, dados->ip_dest);
+		if (p == NULL)
+			return ERROR_FULL;
+
+		p->in_pkts += dados->peso;
+		p->in_octets += dados->tamanho;
 
-		quantidade++;
+		fluxo_registra(dados->fluxo, &p->in_pkts, &p->in_octets,
+				&p->create_time, &p->timemark);
 	}
 
+	/* atualizar/criar SAIDA de pacotes */
+	p = nlhost_obtem(t, dados, dados->ip_orig);
+	if (p == NULL)
+		return ERROR_FULL;
+
+	p->out_pkts += dados->peso;
+	p->out_octets += dados->tamanho;
+	if (dados->is_broadcast != 0) {
+		p->out_macbroadcast_pkts += dados->peso;
+	}
+
+	fluxo_registra(dados->fluxo, &p->out_pkts, &p->out_octets,
+			&p->create_time, &p->timemark);
+	if (dados->is_broadcast != 0)
+		fluxo_registra(dados->fluxo, &p->out_macbroadcast_pkts,
+				NULL, NULL, NULL);
+
 	return SUCCESS;
 }
 
+
+/* removes from `t' the entries of the encapsulation `pdir_localindex' */
+static void nlhost_purga(tabela_t *t, const unsigned int pdir_localindex)
+{
+	unsigned int	indice;
+
+	TABELA_PERCORRE(t, indice) {
+		if (NLHOST(t, indice)->localindex != pdir_localindex)
+			continue;
+
+		if (t == &principal)
+			lista_remove_indice(indice);
+		tabela_remove(t, indice);
+	}
+}
+
+
 /*
- * Function that removes an entry into the Hash table.
+ *  removes the entries of the encapsulation `pdir_localindex', from the
+ *  merged table and from the shards of the workers, so that the next
+ *  consolidation does not bring them back.  A table a worker accounts into
+ *  is only purged with that worker locked.
  */
 int nlhost_remove_pdir(const unsigned int pdir_localindex)
 {
-	/* FIXME!!! */
-	if (pdir_localindex <= NLHOST_TAM) {
-		tabela_hash[pdir_localindex]->address = 0;
-		tabela_hash[pdir_localindex]->localindex = 0;
-		tabela_hash[pdir_localindex]->hlhost_index = 0;
-		tabela_hash[pdir_localindex]->in_pkts = 0;
-		tabela_hash[pdir_localindex]->in_octets = 0;
-		tabela_hash[pdir_localindex]->out_pkts = 0;
-		tabela_hash[pdir_localindex]->out_octets = 0;
-		tabela_hash[pdir_localindex]->out_macbroadcast_pkts = 0;
-		tabela_hash[pdir_localindex]->timemark = 0;
-		tabela_hash[pdir_localindex]->create_time = 0;
-		free(tabela_hash[pdir_localindex]);
-		return SUCCESS;
-	}
-	else {
-		return ERROR_NOSUCHENTRY;
+	unsigned int	w;
+
+	/* the flows may point at the entries going away */
+	fluxos_invalida();
+
+	for (w = 0; w < shards_quantidade(); w++) {
+		shards_trava(w);
+		nlhost_purga(tabelas[w], pdir_localindex);
+		shards_destrava(w);
 	}
+
+	if (tabelas[0] != &principal)
+		nlhost_purga(&principal, pdir_localindex);
+
+	return SUCCESS;
 }
 
 
 void nlhost_hashStats()
 {
-	Debug("entradas: %d, profundidade: %d", quantidade, profundidade);
+	Debug("entradas: %d, profundidade: %d", principal.quantidade, principal.profundidade);
 }
 
 
 int nlhost_helper(const unsigned int index, uint32_t *hlcindex,
 		uint32_t *nl_tmark, uint32_t *p_lindex, uint32_t *nl_address)
 {
-	if (tabela_hash[index] != NULL) {
-		*hlcindex = tabela_hash[index]->hlhost_index;
-		*nl_tmark = tabela_hash[index]->timemark;
-		*p_lindex = tabela_hash[index]->localindex;
-		*nl_address = tabela_hash[index]->address;
+	if (tabela_ocupada(&principal, index)) {
+		*hlcindex = NLHOST(&principal, index)->hlhost_index;
+		*nl_tmark = NLHOST(&principal, index)->timemark;
+		*p_lindex = NLHOST(&principal, index)->localindex;
+		*nl_address = NLHOST(&principal, index)->address;
 
 		return SUCCESS;
 	}
@@ -324,6 +281,8 @@ int nlhost_helper(const unsigned int index, uint32_t *hlcindex,
  */
 int nlhost_tabela_prepara(unsigned int *ptr)
 {
+	shards_consolida();
+
 	if (lista_primeiro() == SUCCESS) {
 		*ptr = lista_atual->indice;
 		return SUCCESS;
@@ -355,7 +314,7 @@ int nlhost_tabela_proximo(unsigned int *ptr)
  */
 int nlhost_tabela_testa(const unsigned int index)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
+	if (tabela_ocupada(&principal, index)) {
 		return SUCCESS;
 	}
 	else {
@@ -369,8 +328,8 @@ int nlhost_tabela_testa(const unsigned int index)
  */
 int nlhost_busca_inpkts(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->in_pkts;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->in_pkts;
 		return SUCCESS;
 	}
 	else {
@@ -381,8 +340,8 @@ int nlhost_busca_inpkts(const unsigned int index, uint32_t *ptr)
 
 int nlhost_busca_outpkts(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->out_pkts;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->out_pkts;
 		return SUCCESS;
 	}
 	else {
@@ -393,8 +352,8 @@ int nlhost_busca_outpkts(const unsigned int index, uint32_t *ptr)
 
 int nlhost_busca_inoctets(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->in_octets;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->in_octets;
 		return SUCCESS;
 	}
 	else {
@@ -405,8 +364,8 @@ int nlhost_busca_inoctets(const unsigned int index, uint32_t *ptr)
 
 int nlhost_busca_outoctets(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->out_octets;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->out_octets;
 		return SUCCESS;
 	}
 	else {
@@ -417,8 +376,8 @@ int nlhost_busca_outoctets(const unsigned int index, uint32_t *ptr)
 
 int nlhost_busca_outmacnonunicast(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->out_macbroadcast_pkts;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->out_macbroadcast_pkts;
 		return SUCCESS;
 	}
 	else {
@@ -429,8 +388,8 @@ int nlhost_busca_outmacnonunicast(const unsigned int index, uint32_t *ptr)
 
 int nlhost_busca_createtime(const unsigned int index, uint32_t *ptr)
 {
-	if ((index < NLHOST_TAM) && (tabela_hash[index] != NULL)) {
-		*ptr = tabela_hash[index]->create_time;
+	if (tabela_ocupada(&principal, index)) {
+		*ptr = NLHOST(&principal, index)->create_time;
 		return SUCCESS;
 	}
 	else {
@@ -438,3 +397,98 @@ int nlhost_busca_createtime(const unsigned int index, uint32_t *ptr)
 	}
 }
 
+
+/*
+ *  allocates the private shard of one worker (only used with 2+ workers);
+ *  called from the worker itself, so the pages come from its NUMA node
+ */
+int nlhost_shard_aloca(const unsigned int worker)
+{
+	tabelas[worker] = tabela_cria(sizeof(nlhost_t), NLHOST_TAM);
+	if (tabelas[worker] == NULL)
+		return ERROR_CALLOC;
+
+	return SUCCESS;
+}
+
+
+/*
+ *  zeroes the counters of the merged table, before the shards are summed
+ */
+void nlhost_consolida_zera()
+{
+	lista_t		*l;
+	nlhost_t	*p;
+
+	for (l = lista_cabeca; l != NULL; l = l->prox) {
+		p = NLHOST(&principal, l->indice);
+		p->in_pkts = 0;
+		p->in_octets = 0;
+		p->out_pkts = 0;
+		p->out_octets = 0;
+		p->out_macbroadcast_pkts = 0;
+	}
+}
+
+
+/*
+ *  sums the counters of `e' into the merged table, creating the entry (as a
+ *  copy of `e') if it does not exist yet
+ */
+int nlhost_consolida_soma(const nlhost_t *e)
+{
+	nlhost_t	*p;
+	unsigned int	destino;
+
+	destino = tabela_busca(&principal, tabela_hash(e->address),
+			nlhost_confere, e);
+	if (destino == NLHOST_TAM) {
+		/* new in the merged table */
+		destino = tabela_insere(&principal, tabela_hash(e->address));
+		if (destino == NLHOST_TAM) {
+			Debug("tabela cheia - descartando");
+			return ERROR_FULL;
+		}
+
+		p = NLHOST(&principal, destino);
+		*p = *e;
+		p->in_pkts = 0;
+		p->in_octets = 0;
+		p->out_pkts = 0;
+		p->out_octets = 0;
+		p->out_macbroadcast_pkts = 0;
+
+		if (hlhost_atualizaNlInserts(p->hlhost_index) != SUCCESS) {
+			Debug("hlhost_atualizaNlInserts() falhou");
+		}
+		if (lista_insere(destino) != SUCCESS) {
+			Debug("lista_insere() falhou");
+		}
+	}
+
+	p = NLHOST(&principal, destino);
+	p->in_pkts += e->in_pkts;
+	p->in_octets += e->in_octets;
+	p->out_pkts += e->out_pkts;
+	p->out_octets += e->out_octets;
+	p->out_macbroadcast_pkts += e->out_macbroadcast_pkts;
+	if (e->create_time < p->create_time)
+		p->create_time = e->create_time;
+	if (e->timemark > p->timemark)
+		p->timemark = e->timemark;
+
+	return SUCCESS;
+}
+
+
+/*
+ *  sums the shard of worker `w' into the merged table, creating the entries
+ *  it does not have yet.  The shard must be locked by the caller.
+ */
+void nlhost_consolida(const unsigned int w)
+{
+	unsigned int	indice;
+
+	TABELA_PERCORRE(tabelas[w], indice)
+		nlhost_consolida_soma(NLHOST(tabelas[w], indice));
+}
@@ -33,229 +33,194 @@
 #include "stateful.h"
 #endif
 
-#include "primo.h"
-#include "funcao_hash.h"
-
 #include "pedb.h"
+#include "fluxos.h"
 #include "hlmatrix.h"
 #include "nlmatrix_DS.h"
+#include "shards.h"
+#include "tabela.h"
 #include "log.h"
 
 /* local defines */
-#define NLMATRIXDS_MAX	65536
-#define NLMATRIXDS_TAM	PRIMO
+#define NLMATRIXDS_TAM	TABELAS_POSICOES
 
+/* the merged table (read by SNMP) */
+TABELA_ESTATICA(principal, nlmatrix_t, NLMATRIXDS_TAM);
+/* where each worker accounts: its private shard or, with a single worker,
+   straight into principal */
+static tabela_t		*tabelas[MAX_WORKERS] = { &principal, };
 
-static nlmatrix_t   *tabela_hash[NLMATRIXDS_TAM] = {NULL, };
-static unsigned int quantidade = 0;	// quantidade de entradas na tabela
-static unsigned int profundidade = 0;	// maior profundidade (limite de busca)
+#define NLMATRIX(t, indice)	((nlmatrix_t *)tabela_entrada((t), (indice)))
 
 
 #define QUERO_PROXIMO   1
-#define	QUERO_PRIMEIRO	1
-#undef	QUERO_REMOVER
+#define QUERO_PRIMEIRO	1
+#define QUERO_REMOVER	1
 #include "lista_indices.h"
 
 
 unsigned int nlmatrix_DS_quantidade()
 {
-	return quantidade;
+	return principal.quantidade;
 }
 
 
-/* AMD Guide: pg 32 */
-/* NlMatrix SD: hash usa src_address */
-static unsigned int nlmatrix_DS_localiza(const in_addr_t src_address, const in_addr_t dest_address)
+/* an entry is a pair of hosts seen on an interface */
+static int nlmatrix_DS_confere(const void *entrada, const void *chave)
 {
-	unsigned int i = 0;	    /* offset da hash */
-	unsigned int hash_index;
-
-	HASH(src_address, i, hash_index);
-	if ((tabela_hash[hash_index] != NULL) &&
-			(tabela_hash[hash_index]->source_addr == src_address) &&
-			(tabela_hash[hash_index]->destin_addr == dest_address)) {
-		/* found! */
-		return hash_index;
-	}
+	const nlmatrix_t	*e = entrada;
+	const nlmatrix_t	*c = chave;
 
-	/* need probing... */
-	i++;
-	while (i <= profundidade) {
-		HASH(src_address, i, hash_index);
-		if ((tabela_hash[hash_index] == NULL) ||
-				(tabela_hash[hash_index]->source_addr != src_address) ||
-				(tabela_hash[hash_index]->destin_addr != dest_address)) {
-			/* nao encontrou */
-			i++;
-		}
-		else {
-			/* encontrou a entrada */
-			return hash_index;
-		}
-	}
+	return (e->hlmatrix_index == c->hlmatrix_index) &&
+		(e->source_addr == c->source_addr) &&
+		(e->destin_addr == c->destin_addr);
+}
+
+
+/* NlMatrix DS: hash usa src_address */
+static unsigned int nlmatrix_DS_localiza(const tabela_t *t, const in_addr_t src_address, const in_addr_t dest_address,
+		const unsigned int interface)
+{
+	nlmatrix_t	modelo;
+
+	modelo.source_addr = src_address;
+	modelo.destin_addr = dest_address;
+	modelo.hlmatrix_index = interface;
 
-	/* as we can't return a negative number, ... */
-	return NLMATRIXDS_TAM;
+	/* NLMATRIXDS_TAM if not found */
+	return tabela_busca(t, tabela_hash(src_address), nlmatrix_DS_confere,
+			&modelo);
+}
+
+
+/*
+ *  prefetching ahead of nlmatrix_DS_insereAtualiza(), as in nlhost_antecipa()
+ */
+void nlmatrix_DS_antecipa(const unsigned int worker, const uint32_t chave,
+		const int etapa)
+{
+	if (etapa == ANTECIPA_POSICAO)
+		tabela_antecipa_grupo(tabelas[worker], tabela_hash(chave));
+	else
+		tabela_antecipa_entrada(tabelas[worker], tabela_hash(chave));
 }
 
 
 int nlmatrix_DS_insereAtualiza(pedb_t *dados)
 {
+	tabela_t	*t = tabelas[dados->worker];
+	nlmatrix_t	*p;
 	/* se a entrada existe, atualizar, caso contrrio, criar uma */
-	unsigned int i;
-	unsigned int indice_entrada;
-	unsigned int indice_saida;
+	unsigned int	indice_entrada;
 
 
 	/* estranho.. pq s atualiza entrada de pacotes se o pacote for unicast?? */
 	if (dados->is_broadcast == 0) {
-		indice_entrada = nlmatrix_DS_localiza(dados->ip_orig, dados->ip_dest);
+		indice_entrada = nlmatrix_DS_localiza(t, dados->ip_orig, dados->ip_dest,
+				dados->interface);
 
 		/* atualizar/criar ENTRADA de pacotes */
 		if (indice_entrada < NLMATRIXDS_TAM) {
 #if DEBUG_NLMATRIX_DS == 1
 			Debug("atualizando (%d)", indice_entrada);
 #endif
-			tabela_hash[indice_entrada]->pkts++;
-			tabela_hash[indice_entrada]->octets += dados->tamanho;
+			p = NLMATRIX(t, indice_entrada);
+			p->pkts += dados->peso;
+			p->octets += dados->tamanho;
+
+			if (dados->uptime < p->create_time)
+				p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
+			p->timemark = dados->uptime;
 #endif
 		}
 		else {
 			/* alocar uma posio na tabela */
-#if DEBUG_NLMATRIX_DS == 1
-			Debug("inserindo nova (%d)", indice_entrada);
-#endif
-			i = 0;
-			HASH(dados->ip_orig, i, indice_entrada);
-
-			while ((i < NLMATRIXDS_MAX) && (tabela_hash[indice_entrada] != NULL)) {
-				i++;
-				HASH(dados->ip_orig, i, indice_entrada);
-			}
-			if (i >= NLMATRIXDS_MAX) {
+			indice_entrada = tabela_insere(t, tabela_hash(dados->ip_orig));
+			if (indice_entrada == NLMATRIXDS_TAM) {
 				Debug("tabela cheia (%u/%u) - descartando",
-						quantidade, NLMATRIXDS_MAX);
+						t->quantidade, t->maximo);
 				return ERROR_FULL;
 			}
-			if (i > profundidade) {
-				profundidade = i;
-			}
+#if DEBUG_NLMATRIX_DS == 1
+			Debug("inserindo nova (%d)", indice_entrada);
+#endif
 
 			/* criar a entrada */
-			tabela_hash[indice_entrada] = calloc(1, sizeof(nlmatrix_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-			if (tabela_hash[indice_entrada] == NULL) {
-				Debug("erro no malloc!");
-				return ERROR_MALLOC;
-			}
-#endif
-			tabela_hash[indice_entrada]->localindex = dados->nl_localindex;
-			tabela_hash[indice_entrada]->pkts = 1;
-			tabela_hash[indice_entrada]->octets = dados->tamanho;
+			p = NLMATRIX(t, indice_entrada);
+			p->localindex = dados->nl_localindex;
+			p->pkts = dados->peso;
+			p->octets = dados->tamanho;
 
-			tabela_hash[indice_entrada]->create_time = dados->uptime;
+			p->create_time = dados->uptime;
 
 #ifdef USE_TIMEFILTER
-			tabela_hash[indice_entrada]->timemark = dados->uptime;
-#else
-			tabela_hash[indice_entrada]->timemark = 0;
+			p->timemark = dados->uptime;
 #endif
 
-			tabela_hash[indice_entrada]->source_addr = dados->ip_orig;
-			tabela_hash[indice_entrada]->destin_addr = dados->ip_dest;
+			p->source_addr = dados->ip_orig;
+			p->destin_addr = dados->ip_dest;
 
-			tabela_hash[indice_entrada]->hlmatrix_index = dados->interface;
+			p->hlmatrix_index = dados->interface;
 
-			/* atualizar NlInserts na HlHost */
-			if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
-				Debug("hlmatrix_atualizaNlInserts(%d) falhou",
-						dados->interface);
-			}
+			if (t == &principal) {
+				/* atualizar NlInserts na HlHost */
+				if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
+					Debug("hlmatrix_atualizaNlInserts(%d) falhou",
+							dados->interface);
+				}
 
-			if (lista_insere(indice_entrada) != SUCCESS) {
-				Debug("lista_insere() falhou");
+				if (lista_insere(indice_entrada) != SUCCESS) {
+					Debug("lista_insere() falhou");
+				}
 			}
-
-			quantidade++;
 		}
-	}
 
-#if 0
-	/* atualizar/criar SAIDA de pacotes */
-	indice_saida = nlmatrix_DS_localiza(dados->ip_dest, dados->ip_orig);
-	if (indice_saida < NLMATRIXDS_TAM) {
-#if DEBUG_NLMATRIX_DS == 1
-		Debug("atualizando (%d)", indice_saida);
-#endif
-		tabela_hash[indice_saida]->pkts++;
-		tabela_hash[indice_saida]->octets += dados->tamanho;
-
-#ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#endif
+		fluxo_registra(dados->fluxo, &p->pkts, &p->octets,
+				&p->create_time, &p->timemark);
 	}
-	else {
-		/* alocar uma posio na tabela */
-#if DEBUG_NLMATRIX_DS == 1
-		Debug("inserindo nova (%d)", indice_saida);
-#endif
-		i = 0;
-		HASH(dados->ip_dest, i, indice_saida);
 
-		while ((i < NLMATRIXDS_MAX) && (tabela_hash[indice_saida] != NULL)) {
-			i++;
-			HASH(dados->ip_dest, i, indice_saida);
-		}
-		if (i >= NLMATRIXDS_MAX) {
-			Debug("tabela cheia (%u/%u) - descartando",
-					quantidade, NLMATRIXDS_MAX);
-			return ERROR_FULL;
-		}
-		if (i > profundidade) {
-			profundidade = i;
-		}
+	return SUCCESS;
+}
 
-		/* criar a entrada */
-		tabela_hash[indice_saida] = calloc(1, sizeof(nlmatrix_t));
-#if PLEASE_CHECK_FOR_ERRORS == 1
-		if (tabela_hash[indice_saida] == NULL) {
-			Debug("erro no malloc!");
-			return ERROR_MALLOC;
-		}
-#endif
-		tabela_hash[indice_saida]->localindex = dados->nl_localindex;
-		tabela_hash[indice_saida]->pkts = 1;
-		tabela_hash[indice_saida]->octets = dados->tamanho;
 
-		tabela_hash[indice_saida]->create_time = dados->uptime;
+/* removes from `t' the entries of the encapsulation `pdir_localindex' */
+static void nlmatrix_DS_purga(tabela_t *t, const unsigned int pdir_localindex)
+{
+	unsigned int	indice;
 
-#ifdef USE_TIMEFILTER
-		tabela_hash[indice_saida]->timemark = dados->uptime;
-#else
-		tabela_hash[indice_saida]->timemark = 0;
-#endif
+	TABELA_PERCORRE(t, indice) {
+		if (NLMATRIX(t, indice)->localindex != pdir_localindex)
+			continue;
 
-		tabela_hash[indice_saida]->source_addr = dados->ip_dest;
-		tabela_hash[indice_saida]->destin_addr = dados->ip_orig;
+		if (t == &principal)
+			lista_remove_indice(indice);
+		tabela_remove(t, indice);
+	}
+}
 
-		tabela_hash[indice_saida]->hlmatrix_index = dados->interface;
 
-		/* atualizar NlInserts na HlHost */
-		if (hlmatrix_atualizaNlInserts(dados->interface) != SUCCESS) {
-			Debug("hlmatrix_atualizaNlInserts(%d) falhou",
-					dados->interface);
-		}
+/*
+ *  removes the entries of the encapsulation `pdir_localindex', from the
+ *  merged table and from the shards of the workers; a table a worker
+ *  accounts into is only purged with that worker locked
+ */
+int nlmatrix_DS_remove_pdir(const unsigned int pdir_localindex)
+{
+	unsigned int	w;
 
-		if (lista_insere(indice_saida) != SUCCESS) {
-			Debug("lista_insere() falhou");
-		}
+	/* the flows may point at the entries going away */
+	fluxos_invalida();
 
-		quantidade++;
+	for (w = 0; w < shards_quantidade(); w++) {
+		shards_trava(w);
+		nlmatrix_DS_purga(tabelas[w], pdir_localindex);
+		shards_destrava(w);
 	}
-#endif
+
+	if (tabelas[0] != &principal)
+		nlmatrix_DS_purga(&principal, pdir_localindex);
 
 	return SUCCESS;
 }
@@ -263,7 +228,7 @@ int nlmatrix_DS_insereAtualiza(pedb_t *dados)
 
 void nlmatrix_DS_hashStats()
 {
-	Debug("entradas: %d, profundidade: %d", quantidade, profundidade);
+	Debug("entradas: %d, profundidade: %d", principal.quantidade, principal.profundidade);
 }
 
 
@@ -274,12 +239,12 @@ void nlmatrix_DS_hashStats()
  */
 int nlmatrix_ds_helper(const unsigned int indice, uint32_t tripa[])
 {
-	if ((indice < NLMATRIXDS_TAM) && (tabela_hash[indice] != NULL)) {
-		tripa[0] = tabela_hash[indice]->hlmatrix_index;
-		tripa[1] = tabela_hash[indice]->timemark;
-		tripa[2] = tabela_hash[indice]->localindex;
-		tripa[3] = tabela_hash[indice]->destin_addr;
-		tripa[4] = tabela_hash[indice]->source_addr;
+	if (tabela_ocupada(&principal, indice)) {
+		tripa[0] = NLMATRIX(&principal, indice)->hlmatrix_index;
+		tripa[1] = NLMATRIX(&principal, indice)->timemark;
+		tripa[2] = NLMATRIX(&principal, indice)->localindex;
+		tripa[3] = NLMATRIX(&principal, indice)->destin_addr;
+		tripa[4] = NLMATRIX(&principal, indice)->source_addr;
 
 		return SUCCESS;
 	}
@@ -294,6 +259,8 @@ int nlmatrix_ds_helper(const unsigned int indice, uint32_t tripa[])
  */
 int nlmatrix_ds_tabela_prepara(unsigned int *ptr)
 {
+	shards_consolida();
+
 	if (lista_primeiro() == SUCCESS) {
 		*ptr = lista_atual->indice;
 		return SUCCESS;
@@ -320,7 +287,7 @@ int nlmatrix_ds_tabela_proximo(unsigned int *ptr)
 
 int nlmatrix_ds_testa(const unsigned int indice)
 {
-	if ((indice < NLMATRIXDS_TAM) && (tabela_hash[indice] != NULL)) {
+	if (tabela_ocupada(&principal, indice)) {
 		return SUCCESS;
 	}
 	else {
@@ -334,8 +301,8 @@ int nlmatrix_ds_testa(const unsigned int indice)
  */
 int nlmatrix_ds_busca_pkts(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < NLMATRIXDS_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->pkts;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = NLMATRIX(&principal, indice)->pkts;
 		return SUCCESS;
 	}
 	else {
@@ -346,8 +313,8 @@ int nlmatrix_ds_busca_pkts(const unsigned int indice, uint32_t *ptr)
 
 int nlmatrix_ds_busca_octets(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < NLMATRIXDS_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->octets;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = NLMATRIX(&principal, indice)->octets;
 		return SUCCESS;
 	}
 	else {
@@ -358,8 +325,8 @@ int nlmatrix_ds_busca_octets(const unsigned int indice, uint32_t *ptr)
 
 int nlmatrix_ds_busca_createtime(const unsigned int indice, uint32_t *ptr)
 {
-	if ((indice < NLMATRIXDS_TAM) && (tabela_hash[indice] != NULL)) {
-		*ptr = tabela_hash[indice]->create_time;
+	if (tabela_ocupada(&principal, indice)) {
+		*ptr = NLMATRIX(&principal, indice)->create_time;
 		return SUCCESS;
 	}
 	else {
@@ -367,3 +334,81 @@ int nlmatrix_ds_busca_createtime(const unsigned int indice, uint32_t *ptr)
 	}
 }
 
+
+/*
+ *  allocates the private shard of one worker (only used with 2+ workers);
+ *  called from the worker itself, so the pages come from its NUMA node
+ */
+int nlmatrix_DS_shard_aloca(const unsigned int worker)
+{
+	tabelas[worker] = tabela_cria(sizeof(nlmatrix_t), NLMATRIXDS_TAM);
+	if (tabelas[worker] == NULL)
+		return ERROR_CALLOC;
+
+	return SUCCESS;
+}
+
+
+/*
+ *  zeroes the counters of the merged table, before the shards are summed
+ */
+void nlmatrix_DS_consolida_zera()
+{
+	lista_t		*l;
+	nlmatrix_t	*p;
+
+	for (l = lista_cabeca; l != NULL; l = l->prox) {
+		p = NLMATRIX(&principal, l->indice);
+		p->pkts = 0;
+		p->octets = 0;
+	}
+}
+
+
+/*
+ *  sums the shard of worker `w' into the merged table, creating the entries
+ *  it does not have yet.  The shard must be locked by the caller.
+ */
+void nlmatrix_DS_consolida(const unsigned int w)
+{
+	nlmatrix_t	*e;
+	nlmatrix_t	*p;
+	unsigned int	indice;
+	unsigned int	destino;
+	uint32_t	hash;
+
+	TABELA_PERCORRE(tabelas[w], indice) {
+		e = NLMATRIX(tabelas[w], indice);
+
+		hash = tabela_hash(e->source_addr);
+		destino = tabela_busca(&principal, hash, nlmatrix_DS_confere, e);
+		if (destino == NLMATRIXDS_TAM) {
+			/* new in the merged table */
+			destino = tabela_insere(&principal, hash);
+			if (destino == NLMATRIXDS_TAM) {
+				Debug("tabela cheia - descartando");
+				continue;
+			}
+
+			p = NLMATRIX(&principal, destino);
+			*p = *e;
+			p->pkts = 0;
+			p->octets = 0;
+
+			if (hlmatrix_atualizaNlInserts(p->hlmatrix_index) != SUCCESS) {
+				Debug("hlmatrix_atualizaNlInserts() falhou");
+			}
+			if (lista_insere(destino) != SUCCESS) {
+				Debug("lista_insere() falhou");
+			}
+		}
+
+		p = NLMATRIX(&principal, destino);
+		p->pkts += e->pkts;
+		p->octets += e->octets;
+		if (e->create_time < p->create_time)
+			p->create_time = e->create_time;
+		if (e->timemark > p->timemark)
+			p->timemark = e->timemark;
+	}
+}
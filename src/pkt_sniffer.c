@@ -24,111 +24,377 @@
  *
  *  This file contains the code for the packet sniffer, which captures packets
  *  on network interfaces.  It also obsoletes the ``conversor.c'' module.
+ *
+ *  Packets are received through a PACKET_RX_RING shared with the kernel, using
+ *  the TPACKET_V3 layout: the ring is split in blocks, and the kernel fills a
+ *  whole block with (variable sized) frames before handing it to userspace.
+ *  The accounting thread walks the frames of a block directly in the ring, and
+ *  then gives the block back to the kernel -- no copies are made.
  */
 
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <net/ethernet.h>
 #include <net/if.h>
-#include <netpacket/packet.h>
-#include <stdio.h>
-#include <pthread.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "pkt_sniffer.h"
+#include "log.h"
 
 
 /*
  *  local defines
  */
-/** \brief The maximum number of network interfaces we'll be prepared to sniff */
-#define MAX_INTERFACES	4
-/** \brief Number of slots in the buffer to hold packets */
-#define MAX_PACKETS	1024
-/** \brief How many bytes (from layer 2) of the packet we should sniff */
-#define PACKET_SIZE	68
+/** \brief Size of each block of the ring (must be a multiple of PAGE_SIZE) */
+#define BLOCK_SIZE	(1 << 20)
+/** \brief Number of blocks in the ring */
+#define BLOCK_NR	32
+/** \brief Nominal frame size, used only to compute tp_frame_nr */
+#define FRAME_SIZE	2048
+/** \brief Milliseconds before the kernel retires a partially filled block */
+#define BLOCK_TIMEOUT	8
 /** \brief Desired socket buffer (rmem_max) to pass to SO_RCVBUF */
 #define RECEIVE_BUFFER	524288
 
 
+/** \brief State of one opened network interface */
+typedef struct sniffer_s {
+	int		 socket;	/* PF_PACKET socket */
+	int		 ifindex;	/* kernel interface index */
+	uint8_t		*anel;		/* the mmap'ed ring */
+	size_t		 anel_tam;	/* ring size, in bytes */
+	unsigned int	 bloco_atual;	/* next block we expect to be ready */
+	unsigned int	 em_uso;	/* is this slot taken? */
+} sniffer_t;
+
+
 /*
  *  global variables
  */
-/** \brief The packet buffer */
-unsigned char	packet_buffer[MAX_PACKETS][PACKET_SIZE];
-/** \brief Threads, each one for each network interface we expect to sniff from */
-pthread_t	thr_sniffer[MAX_INTERFACES] = {0,};
-/** \brief Sockets, one for each thread */
-int		sck_sniffer[MAX_INTERFACES] = {0,};
+/** \brief Sniffers, one for each network interface (and worker) we sniff from */
+static sniffer_t	sniffers[MAX_SNIFFERS];
+
+
+/** \brief Attaches a classic BPF program to a sniffer.
+ *
+ *  Frames accepted by \a programa are truncated by the kernel to the value
+ *  returned by the program, so this is also how the snap length is set.
+ *
+ *  \retval SUCCESS	If the kernel accepted the program.
+ *  \retval ERROR_IO	Otherwise.
+ */
+int
+sniffer_define_filtro(const int sniffer, struct sock_filter *programa,
+		const unsigned int tamanho)
+{
+	struct sock_fprog	fprog;
 
+	if ((sniffer < 0) || (sniffer >= MAX_SNIFFERS) ||
+			(sniffers[sniffer].em_uso == 0))
+		return ERROR_NOSUCHENTRY;
 
-/** \brief Creates a thread to sniff packets from a given interface.
+	fprog.len = tamanho;
+	fprog.filter = programa;
+
+	if (setsockopt(sniffers[sniffer].socket, SOL_SOCKET, SO_ATTACH_FILTER,
+				&fprog, sizeof(fprog)) == -1) {
+		perror("sniffer.so_attach_filter");
+		return ERROR_IO;
+	}
+
+	return SUCCESS;
+}
+
+
+/** \brief Opens a network interface and maps its receive ring.
  *
- *  This function is used when a network interface will be sniffed.
+ *  This function is used when a network interface will be sniffed.  After it
+ *  returns, frames may be read with sniffer_proximo_bloco() from any thread.
  *
  *  \param  if_name A string (like "eth0") with the interface to open.
+ *  \param  snaplen How many bytes (from layer 2) of each packet we want.
+ *
+ *  \return The sniffer identifier (>= 0), or an error code (< 0).
  */
 int
-sniffer_open_interface_by_name(char *if_name)
+sniffer_open_interface_by_name(const char *if_name, const unsigned int snaplen)
 {
-	struct ifreq    ifr;
-	int		    ifindex;
-	int		    ifname_len;
-	short	    ifflags;
-	unsigned char   choose;
-
-	/* try to pick up a thread slot */
-	for (choose = 0; choose < MAX_INTERFACES; choose++) {
-		if (thr_sniffer[choose] == 0) {
+	struct sock_filter	filtro = BPF_STMT(BPF_RET | BPF_K, 0);
+	struct tpacket_req3	req;
+	struct sockaddr_ll	sll;
+	struct ifreq		ifr;
+	sniffer_t		*s;
+	int			valor;
+	int			choose;
+
+	if ((if_name == NULL) || (strlen(if_name) >= IFNAMSIZ))
+		return ERROR_PARAMETER;
+
+	/* try to pick up a slot */
+	for (choose = 0; choose < MAX_SNIFFERS; choose++) {
+		if (sniffers[choose].em_uso == 0) {
 			break;
 		}
 	}
-	if (choose == MAX_INTERFACES) {
-		fprintf(stderr, "sniffer: too many interfaces, can't open more\n");
+	if (choose == MAX_SNIFFERS) {
+		Debug("too many interfaces, can't open `%s'", if_name);
 		return ERROR_FULL;
 	}
+	s = &sniffers[choose];
 
-	/* get a socket */
-	sck_sniffer[choose] = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IP));
-	if (sck_sniffer[choose] == -1) {
+	/* get a socket -- protocol 0 receives nothing until bind() below */
+	s->socket = socket(PF_PACKET, SOCK_RAW, 0);
+	if (s->socket == -1) {
 		perror("sniffer.socket");
 		return ERROR_IO;
 	}
+	s->em_uso = 1;
 
 	/* try to use larger receive buffers */
-	ifname_len = RECEIVE_BUFFER;
-	if (setsockopt(sck_sniffer[choose], SOL_SOCKET, SO_RCVBUF, &ifname_len,
-				sizeof(ifname_len)) == -1) {
+	valor = RECEIVE_BUFFER;
+	if (setsockopt(s->socket, SOL_SOCKET, SO_RCVBUF, &valor,
+				sizeof(valor)) == -1) {
 		perror("sniffer.so_rcvbuf");
-		fprintf(stderr, "sniffer: could not enlarge receive buffer to %d\n", ifname_len);
+		Debug("could not enlarge receive buffer to %d", valor);
 	}
 
-	/* try to bind it to the interface if_name */
-	ifname_len = strlen(if_name);
-	if (setsockopt(sck_sniffer[choose], SOL_SOCKET, SO_BINDTODEVICE, if_name,
-				ifname_len) == -1) {
-		perror("sniffer.so_bindtodevice");
-		return ERROR_IO;
+	/* truncate frames to snaplen -- a real filter may replace this later */
+	filtro.k = snaplen;
+	if (sniffer_define_filtro(choose, &filtro, 1) != SUCCESS)
+		goto erro;
+
+	/* find out interface index -- needed by protocolDist */
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, if_name);
+	if (ioctl(s->socket, SIOCGIFINDEX, &ifr) == -1) {
+		perror("sniffer.siocgifindex");
+		goto erro;
 	}
+	s->ifindex = ifr.ifr_ifindex;
 
 	/* get interface flags and set IFF_PROMISC */
-	strcpy(ifr.ifr_name, if_name);
-	if (ioctl(sck_sniffer[choose], SIOGIFFLAGS, &ifr) == -1) {
-		perror("sniffer.siogifflags");
-		return ERROR_IO;
+	if (ioctl(s->socket, SIOCGIFFLAGS, &ifr) == -1) {
+		perror("sniffer.siocgifflags");
+		goto erro;
 	}
-	ifr.if_flags |= IFF_PROMISC;
-	if (ioctl(sck_sniffer[choose], SIOSIFFLAGS, &ifr) == -1) {
-		perror("sniffer.siosifflags");
-		return ERROR_IO;
+	ifr.ifr_flags |= IFF_PROMISC;
+	if (ioctl(s->socket, SIOCSIFFLAGS, &ifr) == -1) {
+		perror("sniffer.siocsifflags");
+		goto erro;
 	}
 
-	/* find out interface index -- needed by protocolDist */
-	if (ioctl(sck_sniffer[choose], SIOGIFINDEX, &ifr) == -1) {
-		perror("sniffer.siogifindex");
+	/* ask for the block-based ring */
+	valor = TPACKET_V3;
+	if (setsockopt(s->socket, SOL_PACKET, PACKET_VERSION, &valor,
+				sizeof(valor)) == -1) {
+		perror("sniffer.packet_version");
+		goto erro;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_block_nr = BLOCK_NR;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = (BLOCK_SIZE / FRAME_SIZE) * BLOCK_NR;
+	req.tp_retire_blk_tov = BLOCK_TIMEOUT;
+	if (setsockopt(s->socket, SOL_PACKET, PACKET_RX_RING, &req,
+				sizeof(req)) == -1) {
+		perror("sniffer.packet_rx_ring");
+		goto erro;
+	}
+
+	s->anel_tam = (size_t)req.tp_block_size * req.tp_block_nr;
+	s->anel = mmap(NULL, s->anel_tam, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_LOCKED, s->socket, 0);
+	if (s->anel == MAP_FAILED) {
+		/* MAP_LOCKED needs privileges we might lack, retry without */
+		s->anel = mmap(NULL, s->anel_tam, PROT_READ | PROT_WRITE,
+				MAP_SHARED, s->socket, 0);
+	}
+	if (s->anel == MAP_FAILED) {
+		perror("sniffer.mmap");
+		s->anel = NULL;
+		goto erro;
+	}
+	s->bloco_atual = 0;
+
+	/* only now start receiving, with the ring and the filter in place */
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = s->ifindex;
+	if (bind(s->socket, (struct sockaddr *)&sll, sizeof(sll)) == -1) {
+		perror("sniffer.bind");
+		goto erro;
+	}
+
+	Debug("`%s' (ifindex %d): %u blocks of %u bytes mapped",
+			if_name, s->ifindex, BLOCK_NR, BLOCK_SIZE);
+
+	return choose;
+
+erro:
+	sniffer_close(choose);
+	return ERROR_IO;
+}
+
+
+/** \brief Joins a packet socket to a PACKET_FANOUT group.
+ *
+ *  Sockets of the same process bound to the same interface and joined to the
+ *  same \a grupo share its traffic; PACKET_FANOUT_HASH keeps both directions
+ *  of a flow on the same socket.  Works on any PF_PACKET socket, including
+ *  the one inside a libpcap handle (see pcap_fileno()).
+ *
+ *  \retval SUCCESS	If the socket joined the group.
+ *  \retval ERROR_IO	Otherwise.
+ */
+int
+sniffer_fanout_fd(const int fd, const uint16_t grupo)
+{
+	int	valor = grupo | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &valor,
+				sizeof(valor)) == -1) {
+		perror("sniffer.packet_fanout");
 		return ERROR_IO;
 	}
-	ifindex = ifr.ifr_ifindex;
 
-	/* TODO: enable interface in protocolDistControl */
+	return SUCCESS;
+}
+
+
+/** \brief Joins an opened sniffer to a PACKET_FANOUT group. */
+int
+sniffer_define_fanout(const int sniffer, const uint16_t grupo)
+{
+	if ((sniffer < 0) || (sniffer >= MAX_SNIFFERS) ||
+			(sniffers[sniffer].em_uso == 0))
+		return ERROR_NOSUCHENTRY;
+
+	return sniffer_fanout_fd(sniffers[sniffer].socket, grupo);
+}
+
+
+/** \brief Returns the interface index of an opened sniffer. */
+int
+sniffer_ifindex(const int sniffer)
+{
+	if ((sniffer < 0) || (sniffer >= MAX_SNIFFERS) ||
+			(sniffers[sniffer].em_uso == 0))
+		return ERROR_NOSUCHENTRY;
+
+	return sniffers[sniffer].ifindex;
+}
+
+
+/** \brief Waits for the next block filled by the kernel.
+ *
+ *  The returned block belongs to the caller until it is handed back with
+ *  sniffer_libera_bloco().  Blocks must be released in the same order they
+ *  were obtained.
+ *
+ *  \param  timeout_ms	How long to wait (-1 waits forever).
+ *  \return A pointer to the block, or NULL if nothing arrived.
+ */
+struct tpacket_block_desc *
+sniffer_proximo_bloco(const int sniffer, const int timeout_ms)
+{
+	struct tpacket_block_desc	*bloco;
+	struct pollfd			 pfd;
+	sniffer_t			*s = &sniffers[sniffer];
+
+	bloco = (struct tpacket_block_desc *)
+		(s->anel + (size_t)s->bloco_atual * BLOCK_SIZE);
+
+	if ((bloco->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+		/* not ready yet, sleep until the kernel retires it */
+		pfd.fd = s->socket;
+		pfd.events = POLLIN | POLLERR;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return NULL;
+
+		if ((bloco->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+			return NULL;
+	}
+
+	/* the kernel wrote the block before flipping its status */
+	__sync_synchronize();
+
+	s->bloco_atual = (s->bloco_atual + 1) % BLOCK_NR;
 
-	/* TODO: start sniffing packets */
+	return bloco;
 }
 
+
+/** \brief Gives a block back to the kernel. */
+void
+sniffer_libera_bloco(const int sniffer, struct tpacket_block_desc *bloco)
+{
+	const sniffer_t	*s = &sniffers[sniffer];
+
+	if (((uint8_t *)bloco < s->anel) ||
+			((uint8_t *)bloco >= s->anel + s->anel_tam)) {
+		Debug("block %p is not from sniffer %d", (void *)bloco, sniffer);
+		return;
+	}
+
+	__sync_synchronize();
+	bloco->hdr.bh1.block_status = TP_STATUS_KERNEL;
+}
+
+
+/** \brief Reads (and resets) the kernel counters of a sniffer.
+ *
+ *  \param  pacotes	Packets received since the last call.
+ *  \param  descartes	Packets dropped by the kernel since the last call.
+ */
+int
+sniffer_estatisticas(const int sniffer, uint32_t *pacotes, uint32_t *descartes)
+{
+	struct tpacket_stats_v3	stats;
+	socklen_t		tamanho = sizeof(stats);
+
+	if ((sniffer < 0) || (sniffer >= MAX_SNIFFERS) ||
+			(sniffers[sniffer].em_uso == 0))
+		return ERROR_NOSUCHENTRY;
+
+	if (getsockopt(sniffers[sniffer].socket, SOL_PACKET, PACKET_STATISTICS,
+				&stats, &tamanho) == -1)
+		return ERROR_IO;
+
+	*pacotes = stats.tp_packets;
+	*descartes = stats.tp_drops;
+
+	return SUCCESS;
+}
+
+
+/** \brief Unmaps the ring and closes a sniffer, freeing its slot. */
+void
+sniffer_close(const int sniffer)
+{
+	sniffer_t	*s;
+
+	if ((sniffer < 0) || (sniffer >= MAX_SNIFFERS))
+		return;
+
+	s = &sniffers[sniffer];
+	if (s->anel != NULL)
+		munmap(s->anel, s->anel_tam);
+	if (s->em_uso)
+		close(s->socket);
+
+	memset(s, 0, sizeof(sniffer_t));
+}
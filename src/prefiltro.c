@@ -0,0 +1,245 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+/** \file prefiltro.c
+ *  \brief Kernel prefilter generated from the protocolDir
+ *
+ *  The agent only ever accounts Ethernet II frames carrying IPv4 with TCP,
+ *  UDP or ICMP inside (see pkt_decode()), and only when some encapsulation
+ *  in the protocolDir covers them.  Everything else (ARP, IPv6, LLDP,
+ *  unmonitored transports) is better dropped by the kernel than copied to
+ *  us and thrown away.
+ *
+ *  The classic BPF program is rebuilt whenever the protocolDir changes;
+ *  each capture thread picks it up between two batches, so a handle is only
+ *  ever touched by its own thread.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <pcap.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#if PTSL
+#include <netinet/in.h>
+#include "stateful.h"
+#endif
+#include "protocoldir.h"
+#include "assinaturas.h"
+#include "fila_cap.h"
+#ifdef __linux__
+#include "pkt_sniffer.h"
+#endif
+#include "prefiltro.h"
+#include "log.h"
+
+
+/* the only transports pkt_decode() understands */
+static const unsigned char	decodificados[] = { 1, 6, 17 };
+
+/* 6 loads and tests, one test per transport, reject and accept */
+#define PREFILTRO_MAX	(6 + sizeof(decodificados) + 2)
+
+static struct bpf_insn	programa[PREFILTRO_MAX];
+static unsigned int	tamanho;
+/* bumped at each new program; 0 means no program yet */
+static unsigned int	geracao_atual;
+static unsigned int	snaplen_max = 65535;
+/* bytes of an accepted frame actually kept, see prefiltro_gera() */
+static unsigned int	snaplen_atual = 65535;
+static pthread_mutex_t	trava = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** \brief Builds the first program, and rebuilds it on protocolDir changes.
+ *
+ *  \param  snaplen	The most bytes of an accepted frame ever kept.
+ */
+void
+prefiltro_inicializa(const unsigned int snaplen)
+{
+	snaplen_max = snaplen;
+	prefiltro_gera();
+	pdir_define_observador(prefiltro_gera);
+}
+
+
+/** \brief Rebuilds the program from the current protocolDir. */
+void
+prefiltro_gera()
+{
+	struct bpf_insn	 novo[PREFILTRO_MAX];
+	unsigned char	 transportes[256];
+	unsigned char	 aceitos[sizeof(decodificados)];
+	unsigned int	 qtd = 0;
+	unsigned int	 n = 0;
+	unsigned int	 snaplen;
+	unsigned int	 rejeita;	/* where RET 0 lands */
+	unsigned int	 i;
+
+	if (pdir_ipv4_interesse(transportes)) {
+		/* ether2.ipv4 counts every frame pkt_decode() accepts */
+		memcpy(aceitos, decodificados, sizeof(decodificados));
+		qtd = sizeof(decodificados);
+	}
+	else {
+		for (i = 0; i < sizeof(decodificados); i++) {
+			if (transportes[decodificados[i]])
+				aceitos[qtd++] = decodificados[i];
+		}
+	}
+
+	/* keep only what the running traces and signatures may look at */
+	snaplen = assinaturas_alcance();
+#if PTSL
+	if (pdir_tracos_alcance() > snaplen)
+		snaplen = pdir_tracos_alcance();
+#endif
+	if (snaplen < FILA_SNAPLEN_MIN)
+		snaplen = FILA_SNAPLEN_MIN;
+	if (snaplen > snaplen_max)
+		snaplen = snaplen_max;
+
+	if (qtd > 0) {
+		/*
+		 * ethertype == IPv4 && version == 4 && protocol in aceitos;
+		 * jump offsets count from the instruction after the jump, up to
+		 * the reject (6 instructions and the tests before it), or to the
+		 * accept right after it
+		 */
+		rejeita = 6 + qtd;
+		novo[n++] = (struct bpf_insn)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+		novo[n] = (struct bpf_insn)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				0x0800, 0, rejeita - (n + 1));
+		n++;
+		novo[n++] = (struct bpf_insn)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 14);
+		novo[n++] = (struct bpf_insn)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0);
+		novo[n] = (struct bpf_insn)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+				0x40, 0, rejeita - (n + 1));
+		n++;
+		novo[n++] = (struct bpf_insn)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23);
+		for (i = 0; i < qtd; i++) {
+			/* match: skip the remaining tests and the reject */
+			novo[n] = (struct bpf_insn)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+					aceitos[i], rejeita + 1 - (n + 1), 0);
+			n++;
+		}
+	}
+	novo[n++] = (struct bpf_insn)BPF_STMT(BPF_RET | BPF_K, 0);
+	if (qtd > 0)
+		novo[n++] = (struct bpf_insn)BPF_STMT(BPF_RET | BPF_K, snaplen);
+
+	pthread_mutex_lock(&trava);
+	memcpy(programa, novo, n * sizeof(struct bpf_insn));
+	tamanho = n;
+	__atomic_store_n(&snaplen_atual, snaplen, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&geracao_atual, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trava);
+
+	Debug("prefilter: %u instructions, %u transports, snaplen %u",
+			n, qtd, snaplen);
+}
+
+
+/** \brief How many bytes of each accepted frame are of any use now.
+ *
+ *  The kernel already truncates frames to this on TPACKET_V3 rings, but
+ *  libpcap keeps its own snap length, so its callers must bound their
+ *  copies with this.
+ */
+unsigned int
+prefiltro_snaplen()
+{
+	return __atomic_load_n(&snaplen_atual, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * copies the current program if it is newer than `geracao'
+ */
+static unsigned int
+prefiltro_copia(struct bpf_insn *copia, unsigned int *geracao)
+{
+	unsigned int	n = 0;
+
+	/* the usual case, once per batch: nothing new */
+	if (__atomic_load_n(&geracao_atual, __ATOMIC_ACQUIRE) == *geracao)
+		return 0;
+
+	pthread_mutex_lock(&trava);
+	if (*geracao != geracao_atual) {
+		n = tamanho;
+		memcpy(copia, programa, n * sizeof(struct bpf_insn));
+		*geracao = geracao_atual;
+	}
+	pthread_mutex_unlock(&trava);
+
+	return n;
+}
+
+
+/** \brief Installs the current program on a libpcap handle, if the one it
+ *  has (\a geracao, 0 for none) is outdated.
+ *
+ *  Must be called by the thread which captures from \a captura.
+ *
+ *  \retval SUCCESS	If the handle has the current program.
+ *  \retval ERROR_IO	If libpcap refused it.
+ */
+int
+prefiltro_aplica_pcap(pcap_t *captura, unsigned int *geracao)
+{
+	struct bpf_insn		copia[PREFILTRO_MAX];
+	struct bpf_program	prog;
+
+	prog.bf_len = prefiltro_copia(copia, geracao);
+	if (prog.bf_len == 0)
+		return SUCCESS;
+
+	prog.bf_insns = copia;
+	if (pcap_setfilter(captura, &prog) == -1) {
+		Debug("pcap_setfilter: %s", pcap_geterr(captura));
+		return ERROR_IO;
+	}
+
+	return SUCCESS;
+}
+
+
+#ifdef __linux__
+/** \brief Same as prefiltro_aplica_pcap(), for a TPACKET_V3 ring. */
+int
+prefiltro_aplica_sniffer(const int sniffer, unsigned int *geracao)
+{
+	struct bpf_insn	copia[PREFILTRO_MAX];
+	unsigned int	n;
+
+	n = prefiltro_copia(copia, geracao);
+	if (n == 0)
+		return SUCCESS;
+
+	/* struct bpf_insn and struct sock_filter share the same layout */
+	return sniffer_define_filtro(sniffer, (struct sock_filter *)copia, n);
+}
+#endif
@@ -25,7 +25,9 @@
 #include <stdint.h> /* uint32_t */
 #include <stdio.h>  /* FILE fread fopen fclose */
 #include <string.h> /* strncpy */
+#include <limits.h> /* UINT_MAX */
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 
 #include "configuracao.h"
@@ -46,7 +48,13 @@
 /* para remoo nas tabelas */
 #include "alhost.h"
 #include "nlhost.h"
+#include "nlmatrix_SD.h"
+#include "nlmatrix_DS.h"
+#include "almatrix_SD.h"
+#include "almatrix_DS.h"
 #include "protocoldist.h"
+#include "fluxos.h"
+#include "carencia.h"
 
 #include "hlhost.h"
 #include "hlmatrix.h"
@@ -71,27 +79,44 @@
 static pdir_node_t	*pdir_table[PDIR_TAM] = {NULL, };
 
 
-/** \brief  a new structure to see if an encapsulation is registered in the
- *	    protocol directory (protocolDir).
+/** \brief Direct lookup of the ether2.ipv4 encapsulations.
  *
- *  This new structure consists of a bitmap, where each bit stores if a
- *  application protocol should or should not be further analysed.
+ *  Decoded packets are always ether2.ipv4, so pkt_process() finds their
+ *  encapsulations here, with two loads instead of hash probes:
+ *  portas[transport][port] is what pdir_localiza(1, 2048, transport, port)
+ *  returns, port 0 being the transport itself and [0][0] ether2.ipv4.
  *
- *  The size is determined by:
- *
- *	total_size = Entries / (8 * sizeof(long))
+ *  Transports without any encapsulation share pdir_ipv4_vazio.  The
+ *  accounting reads it without locks, so it is never updated in place:
+ *  every change builds a new version, publishes it, and frees the previous
+ *  one (and whatever left pdir_table) after a grace period (carencia.c).
  */
-#define WORDSIZE_BITS (sizeof(long) * 8)
-static unsigned long	pdir_bit_table[65536 / WORDSIZE_BITS];
+#define PDIR_PORTAS	65536
+typedef struct pdir_ipv4_s {
+	pdir_node_t	**portas[256];
+	int		incompleto;	/* no memory for it: use the hash */
+} pdir_ipv4_t;
+
+static pdir_node_t	*pdir_ipv4_vazio[PDIR_PORTAS];
+static pdir_ipv4_t	pdir_ipv4_hash = { { NULL, }, 1 };
+static pdir_ipv4_t	*pdir_ipv4 = &pdir_ipv4_hash;
 
 static unsigned long	lastchange;	    /* system uptime when last changed */
 static unsigned int	quantidade;	    /* number of entries in the table */
 static unsigned int	profundidade;   /* depth of the hash table */
+static unsigned int	proximo_indice = 1; /* local index of the next entry */
+static unsigned int	recargas;	    /* times pdir_recarrega() succeeded */
+
+/* one reload at a time, and no trace run or removed in the middle of one */
+static pthread_mutex_t	pdir_trava = PTHREAD_MUTEX_INITIALIZER;
 
 #ifdef PTSL
 static traco_t		*traco_novo_ptr;
 #endif
 
+/* told whenever the set of encapsulations changes */
+static pdir_observador_t	observadores[PDIR_OBSERVADORES];
+
 /* lista de ndices */
 #define QUERO_REMOVER	1
 #define QUERO_PRIMEIRO	1
@@ -99,62 +124,268 @@ static traco_t		*traco_novo_ptr;
 #include "lista_indices.h"
 
 
-/**  \brief  Lookup function for the protocolDir
+static void pdir_ipv4_libera(pdir_ipv4_t *versao)
+{
+	unsigned int	t;
+
+	if (versao == &pdir_ipv4_hash)
+		return;
+
+	for (t = 0; t < 256; t++) {
+		if (versao->portas[t] != pdir_ipv4_vazio)
+			free(versao->portas[t]);
+	}
+	free(versao);
+}
+
+
+/* a version of pdir_ipv4 for what pdir_table holds now, or NULL */
+static pdir_ipv4_t *pdir_ipv4_constroi()
+{
+	pdir_ipv4_t	*versao;
+	pdir_node_t	*ptr;
+	unsigned int	t;
+	unsigned int	a;
+
+	versao = malloc(sizeof(pdir_ipv4_t));
+	if (versao == NULL)
+		return NULL;
+	for (t = 0; t < 256; t++)
+		versao->portas[t] = pdir_ipv4_vazio;
+	versao->incompleto = 0;
+
+	for (a = 0; a < PDIR_TAM; a++) {
+		ptr = pdir_table[a];
+		if ((ptr == NULL) || (ptr->idlink != 1) || (ptr->idnet != 2048) ||
+				(ptr->idtrans > 255) || (ptr->idapp >= PDIR_PORTAS))
+			continue;
+
+		t = ptr->idtrans;
+		if (versao->portas[t] == pdir_ipv4_vazio) {
+			versao->portas[t] = calloc(PDIR_PORTAS,
+					sizeof(pdir_node_t *));
+			if (versao->portas[t] == NULL) {
+				Debug("no memory for the ports of transport %u", t);
+				versao->portas[t] = pdir_ipv4_vazio;
+				pdir_ipv4_libera(versao);
+				return NULL;
+			}
+		}
+		versao->portas[t][ptr->idapp] = ptr;
+	}
+
+	return versao;
+}
+
+
+/*
+ *  brings pdir_ipv4 in line with pdir_table; once it returns, no worker
+ *  holds an entry that was out of pdir_table when it was called
+ */
+static void pdir_ipv4_publica()
+{
+	pdir_ipv4_t	*novo;
+	pdir_ipv4_t	*velho;
+
+	novo = pdir_ipv4_constroi();
+	if (novo == NULL) {
+		/* pdir_localiza_ipv4() goes back to hashing */
+		novo = &pdir_ipv4_hash;
+	}
+
+	velho = __atomic_exchange_n(&pdir_ipv4, novo, __ATOMIC_ACQ_REL);
+	carencia_aguarda();
+	pdir_ipv4_libera(velho);
+}
+
+
+/*
+ *  derives what pkt_process() does with the packets of an encapsulation
+ *  from its configs; network layer encapsulations (no transport) feed the
+ *  nl* tables, the others the al* ones
+ */
+static void pdir_acoes_calcula(pdir_node_t *ptr)
+{
+	unsigned int	acoes = PDIR_ACAO_PDIST | PDIR_ACAO_TRACOS;
+
+	fluxos_invalida();
+	if (ptr->host_config == PDIR_CFG_supportedOn)
+		acoes |= (ptr->idtrans == 0) ? PDIR_ACAO_NLHOST : PDIR_ACAO_ALHOST;
+	if (ptr->matrix_config == PDIR_CFG_supportedOn)
+		acoes |= (ptr->idtrans == 0) ?
+			PDIR_ACAO_NLMATRIX : PDIR_ACAO_ALMATRIX;
+
+	ptr->acoes = acoes;
+}
+
+
+/** \brief Finds the ether2.ipv4.<transport>.<port> encapsulation.
  *
- *  This function searches the protocolDir table, telling the caller if the
- *  RMON2 agent is programmed to completely decode the packet.
+ *  Same as pdir_localiza(1, 2048, transporte, porta), where \a porta 0 means
+ *  ether2.ipv4.<transport> and \a transporte 0 ether2.ipv4 itself.
  *
- *  \param port	packet port (found in the TCP/UDP header)
- *  \retval nonzero if the agent is programmed to decode the packet
+ *  \return The encapsulation, or NULL if there is none.
+ */
+pdir_node_t *pdir_localiza_ipv4(const unsigned int transporte,
+		const unsigned int porta)
+{
+	const pdir_ipv4_t	*versao;
+
+	versao = __atomic_load_n(&pdir_ipv4, __ATOMIC_ACQUIRE);
+	if (versao->incompleto)
+		return pdir_localiza(1, 2048, transporte, porta);
+
+	return versao->portas[transporte & 0xff][porta & 0xffff];
+}
+
+
+/** \brief Registers a function to be called whenever an encapsulation is
+ *  added, removed, or has its status changed.  Up to #PDIR_OBSERVADORES are
+ *  kept; registering one twice has no effect.
+ */
+void pdir_define_observador(pdir_observador_t funcao)
+{
+	unsigned int	i;
+
+	for (i = 0; i < PDIR_OBSERVADORES; i++) {
+		if (observadores[i] == funcao)
+			return;
+		if (observadores[i] == NULL) {
+			observadores[i] = funcao;
+			return;
+		}
+	}
+
+	Debug("too many observers, not registered");
+}
+
+
+static void pdir_notifica()
+{
+	unsigned int	i;
+
+	fluxos_invalida();
+	pdir_ipv4_publica();
+
+	for (i = 0; (i < PDIR_OBSERVADORES) && (observadores[i] != NULL); i++)
+		observadores[i]();
+}
+
+
+/** \brief Tells which IPv4 transports the agent has any use for.
+ *
+ *  An encapsulation is of use if it is active, or (PTSL) if it has traces
+ *  hung on it.
+ *
+ *  \param  transportes	256 flags, one per IP protocol number, set if some
+ *			encapsulation below ether2.ipv4.<protocol> is of use
+ *  \retval nonzero if ether2.ipv4 itself is of use (so is every transport)
  *  \retval 0	    otherwise
  */
-int pdir_bit_localiza(const unsigned int port)
+int pdir_ipv4_interesse(unsigned char *transportes)
 {
-	return (pdir_bit_table[port / WORDSIZE_BITS] & (1 << (port % WORDSIZE_BITS)));
+	pdir_node_t	*ptr;
+	unsigned int	i;
+	int		ipv4 = 0;
+
+	memset(transportes, 0, 256);
+
+	for (i = 0; i < PDIR_TAM; i++) {
+		ptr = pdir_table[i];
+		if ((ptr == NULL) || (ptr->idlink != 1) || (ptr->idnet != 2048))
+			continue;
+
+		if (ptr->row_status != ROWSTATUS_ACTIVE) {
+#if PTSL
+			if (ptr->primeiro_traco == NULL)
+				continue;
+#else
+			continue;
+#endif
+		}
+
+		if (ptr->idtrans == 0)
+			ipv4 = 1;
+		else if (ptr->idtrans < 256)
+			transportes[ptr->idtrans] = 1;
+	}
+
+	return ipv4;
+}
+
+
+/** \brief Lists the application ports known below ether2.ipv4.
+ *
+ *  pkt_process() looks applications up by port whatever their status, so
+ *  every ether2.ipv4.<transport>.<port> encapsulation is listed.
+ *
+ *  \param  chaves	Where to store the ports, as (transport << 16) | port.
+ *  \param  max		Size of \a chaves.
+ *  \return How many ports were stored.
+ */
+unsigned int pdir_ipv4_portas(uint32_t *chaves, const unsigned int max)
+{
+	pdir_node_t	*ptr;
+	unsigned int	i;
+	unsigned int	qtd = 0;
+
+	for (i = 0; (i < PDIR_TAM) && (qtd < max); i++) {
+		ptr = pdir_table[i];
+		if ((ptr == NULL) || (ptr->idlink != 1) || (ptr->idnet != 2048) ||
+				(ptr->idtrans == 0) || (ptr->idapp == 0))
+			continue;
+
+		chaves[qtd++] = ptr->transp_aplic;
+	}
+
+	return qtd;
 }
 
 
 /*
-   busca uma entrada na tabela hash.
-   retorna o ponteiro se encontrar, ou NULL
-   */
-pdir_node_t *pdir_localiza(const unsigned int enlace, const unsigned int rede,
-		const unsigned int transporte, const unsigned int aplicacao)
+ *  busca uma chave em `tabela', olhando at `prof' tentativas; retorna a
+ *  posio se encontrar, ou PDIR_TAM
+ */
+static unsigned int pdir_busca(pdir_node_t **tabela, const unsigned int prof,
+		const uint32_t chave, const uint32_t verifica)
 {
 	/* chave existe SE:
-	   1) estiver antes de 'profundidade'
+	   1) estiver antes de 'prof'
 	   2) a posio sendo verificada conter dados
 	   3) os dados passados conferirem
 	   */
 
-	uint32_t chave = (transporte << 16) | (aplicacao & 0x0000ffff);
-	uint32_t verifica = (enlace << 16) | (rede & 0x0000ffff);
-	unsigned int i = 0;
+	unsigned int i;
 	unsigned int indice;
 
-	HASH(chave, i, indice);
-
-	/* verificar se a primeira tentativa foi bem sucedida */
-	if ((pdir_table[indice] != NULL) &&
-			(pdir_table[indice]->transp_aplic == chave) &&
-			(pdir_table[indice]->enlace_rede == verifica)) {
-		return pdir_table[indice];
-	}
-
-	/* ok, executaremos uma busca completa */
-	i++;
-	while (i <= profundidade) {
+	for (i = 0; i <= prof; i++) {
 		HASH(chave, i, indice);
-		if ((pdir_table[indice] != NULL) &&
-				(pdir_table[indice]->transp_aplic == chave) &&
-				(pdir_table[indice]->enlace_rede == verifica)) {
-			/* encontrada */
-			return pdir_table[indice];
-		}
-		i++;
+		if ((tabela[indice] != NULL) &&
+				(tabela[indice]->transp_aplic == chave) &&
+				(tabela[indice]->enlace_rede == verifica))
+			return indice;
 	}
 
-	return NULL;
+	return PDIR_TAM;
+}
+
+
+/*
+   busca uma entrada na tabela hash.
+   retorna o ponteiro se encontrar, ou NULL
+   */
+pdir_node_t *pdir_localiza(const unsigned int enlace, const unsigned int rede,
+		const unsigned int transporte, const unsigned int aplicacao)
+{
+	uint32_t chave = (transporte << 16) | (aplicacao & 0x0000ffff);
+	uint32_t verifica = (enlace << 16) | (rede & 0x0000ffff);
+	unsigned int indice;
+
+	indice = pdir_busca(pdir_table, profundidade, chave, verifica);
+	if (indice == PDIR_TAM)
+		return NULL;
+
+	return pdir_table[indice];
 }
 
 
@@ -173,41 +404,10 @@ pdir_node_t *pdir_localiza(const unsigned int enlace, const unsigned int rede,
 unsigned int pdir_localiza_indice(const unsigned int enlace, const unsigned int rede,
 		const unsigned int transporte, const unsigned int aplicacao)
 {
-	/*
-	 *	chave existe SE:
-	 *	    1) estiver antes de 'profundidade'
-	 *	    2) a posio sendo verificada conter dados
-	 *	    3) os dados passados conferirem
-	 */
-
 	uint32_t chave = (transporte << 16) | (aplicacao & 0x0000ffff);
 	uint32_t verifica = (enlace << 16) | (rede & 0x0000ffff);
-	unsigned int i = 0;
-	unsigned int indice;
-
-	HASH(chave, i, indice);
-
-	/* verificar se a primeira tentativa foi bem sucedida */
-	if ((pdir_table[indice] != NULL) &&
-			(pdir_table[indice]->transp_aplic == chave) &&
-			(pdir_table[indice]->enlace_rede == verifica)) {
-		return indice;
-	}
-
-	/* ok, executaremos uma busca completa */
-	i++;
-	while (i <= profundidade) {
-		HASH(chave, i, indice);
-		if ((pdir_table[indice] != NULL) &&
-				(pdir_table[indice]->transp_aplic == chave) &&
-				(pdir_table[indice]->enlace_rede == verifica)) {
-			/* encontrada */
-			return indice;
-		}
-		i++;
-	}
 
-	return PDIR_TAM;
+	return pdir_busca(pdir_table, profundidade, chave, verifica);
 }
 
 
@@ -233,121 +433,378 @@ static int test_isstring(char *ptr) {
 	return 1;
 }
 
+static void pdir_libera(pdir_node_t *ptr)
+{
+	free(ptr->descricao);
+	free(ptr->owner);
+	free(ptr);
+}
+
+
+/* how many tries it takes `chave' to land on `indice' */
+static unsigned int pdir_passos(const uint32_t chave, const unsigned int indice)
+{
+	unsigned int i;
+	unsigned int r;
+
+	for (i = 0; i < PDIR_MAX; i++) {
+		HASH(chave, i, r);
+		if (r == indice)
+			break;
+	}
+
+	return i;
+}
+
+
+/*
+ *  reads a line of protocoldir.conf into `*pdn_ptr', which is left NULL if
+ *  the line has no entry (empty, comment, or discarded)
+ */
 /* regex: '^ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[\.0-9A-Za-z]+ +[0-9]+ +[0-9]+ +[0-9]+ +[0-9]+ +[\.0-9A-Za-z\-]+ *$' */
-	int
-init_protocoldir(char *filename)
+static int pdir_le_linha(char *linha, const unsigned int line,
+		pdir_node_t **pdn_ptr)
 {
 	const char	 sep_ptr[] = "\n\t\r ";
-	char		 linha[256];
 	char		*token_ar[16];
-	unsigned int	 contador = 1;
-	unsigned int	 line = 0;
-	int		 ret;
-	FILE		*file_ptr;
-	pdir_node_t	*pdn_ptr;
+	char		*resto;
+	pdir_node_t	*ptr;
+	unsigned int	 i;
 
-	if (filename == NULL)
-		filename = PDIR_CONF;
+	*pdn_ptr = NULL;
 
-	Debug("initializing protocolDir (%s)", filename);
-	file_ptr = fopen(filename, "r");
+	/* locate all tokens: 8 and 13 are strings, 15 preferrably nothing */
+	token_ar[0] = strtok_r(linha, sep_ptr, &resto);
+	for (i = 1; i < 16; i++)
+		token_ar[i] = strtok_r(NULL, sep_ptr, &resto);
 
+	/* inspect them: first check for NULL strings (empty or incomplete line) */
+	for (i = 0; i < 15; i++) {
+		if (token_ar[i] == NULL)
+			return SUCCESS;
+	}
 
-	/* read all lines */
-	while (fgets(linha, sizeof(linha), file_ptr) != NULL) {
-		line++;
-		/* locate all tokens */
-		token_ar[0] = strtok(linha, sep_ptr);
-		token_ar[1] = strtok(NULL, sep_ptr);
-		token_ar[2] = strtok(NULL, sep_ptr);
-		token_ar[3] = strtok(NULL, sep_ptr);
-		token_ar[4] = strtok(NULL, sep_ptr);
-		token_ar[5] = strtok(NULL, sep_ptr);
-		token_ar[6] = strtok(NULL, sep_ptr);
-		token_ar[7] = strtok(NULL, sep_ptr);
-		token_ar[8] = strtok(NULL, sep_ptr);	/* string */
-		token_ar[9] = strtok(NULL, sep_ptr);
-		token_ar[10] = strtok(NULL, sep_ptr);
-		token_ar[11] = strtok(NULL, sep_ptr);
-		token_ar[12] = strtok(NULL, sep_ptr);
-		token_ar[13] = strtok(NULL, sep_ptr);	/* string */
-		token_ar[14] = strtok(NULL, sep_ptr);
-		token_ar[15] = strtok(NULL, sep_ptr);	/* preferrably nothing, but... */
-
-		/* inspect them: first check for NULL strings (empty or incomplete line) */
-		if ((token_ar[0] == NULL) || (token_ar[1] == NULL) ||
-				(token_ar[2] == NULL) || (token_ar[3] == NULL) ||
-				(token_ar[4] == NULL) || (token_ar[5] == NULL) ||
-				(token_ar[6] == NULL) || (token_ar[7] == NULL) ||
-				(token_ar[8] == NULL) || (token_ar[9] == NULL) ||
-				(token_ar[10] == NULL) || (token_ar[11] == NULL) ||
-				(token_ar[12] == NULL) || (token_ar[13] == NULL) ||
-				(token_ar[14] == NULL))
+	/* then check for comments */
+	if (token_ar[0][0] == '#') {
+		return SUCCESS;
+	}
+	if ((token_ar[15] != NULL) && (token_ar[15][0] != '#')) {
+		Debug("warning, garbage after last field on line %u",
+				line);
+	}
+
+	/* after check for valid fields, starting with numbers */
+	if (!test_isnumber(token_ar[0]) || !test_isnumber(token_ar[1]) ||
+			!test_isnumber(token_ar[2]) || !test_isnumber(token_ar[3]) ||
+			!test_isnumber(token_ar[4]) || !test_isnumber(token_ar[5]) ||
+			!test_isnumber(token_ar[6]) || !test_isnumber(token_ar[7]) ||
+			!test_isnumber(token_ar[9]) || !test_isnumber(token_ar[10]) ||
+			!test_isnumber(token_ar[11]) || !test_isnumber(token_ar[12]) ||
+			!test_isnumber(token_ar[14])) {
+		Debug("discarding line %u (number test faile)",
+				line);
+		return SUCCESS;
+	}
+	if (!test_isstring(token_ar[8]) || !test_isstring(token_ar[13])) {
+		Debug("discarding line %u (control character found)",
+				line);
+		return SUCCESS;
+	}
+
+	/* OK, should be correct then */
+	ptr = calloc(1, sizeof(pdir_node_t));
+	if (ptr == NULL)
+		return ERROR_CALLOC;
+
+	ptr->idlink		= strtol(token_ar[0], NULL, 10);
+	ptr->idnet		= strtol(token_ar[1], NULL, 10);
+	ptr->idtrans		= strtol(token_ar[2], NULL, 10);
+	ptr->idapp		= strtol(token_ar[3], NULL, 10);
+	ptr->param1		= strtol(token_ar[4], NULL, 10);
+	ptr->param2		= strtol(token_ar[5], NULL, 10);
+	ptr->param3		= strtol(token_ar[6], NULL, 10);
+	ptr->param4		= strtol(token_ar[7], NULL, 10);
+	ptr->descricao		= strdup(token_ar[8]);
+	ptr->tipo		= strtol(token_ar[9], NULL, 10);
+	ptr->addrmap_config	= strtol(token_ar[10], NULL, 10);
+	ptr->host_config	= strtol(token_ar[11], NULL, 10);
+	ptr->matrix_config	= strtol(token_ar[12], NULL, 10);
+	ptr->owner		= strdup(token_ar[13]);
+	ptr->row_status		= strtol(token_ar[14], NULL, 10);
+
+	ptr->transp_aplic = (ptr->idtrans << 16) | (ptr->idapp & 0x0000ffff);
+	ptr->enlace_rede = (ptr->idlink << 16) | (ptr->idnet & 0x0000ffff);
+	pdir_acoes_calcula(ptr);
+
+	if ((ptr->descricao == NULL) || (ptr->owner == NULL))
+		Debug("warning, short on memory");
+
+	*pdn_ptr = ptr;
+	return SUCCESS;
+}
+
+
+/*
+ *  lays the entries read from a file out in `nova': those already in
+ *  pdir_table on their current slot, with their local index; the others
+ *  where they fit, with local indexes from `*proximo'.  `*prof' gets the
+ *  depth of `nova'.
+ */
+static int pdir_posiciona(pdir_node_t **lidas, const unsigned int qtd,
+		pdir_node_t **nova, unsigned int *prof, unsigned int *proximo)
+{
+	pdir_node_t	*ptr;
+	unsigned int	indice;
+	unsigned int	i;
+	unsigned int	j;
+
+	*prof = 0;
+	for (i = 0; i < qtd; i++) {
+		ptr = lidas[i];
+		indice = pdir_localiza_indice(ptr->idlink, ptr->idnet,
+				ptr->idtrans, ptr->idapp);
+		if (indice == PDIR_TAM)
+			continue;
+		if (nova[indice] != NULL)
+			goto duplicada;
+
+		nova[indice] = ptr;
+		ptr->local_index = pdir_table[indice]->local_index;
+		j = pdir_passos(ptr->transp_aplic, indice);
+		if (j > *prof)
+			*prof = j;
+	}
+
+#ifdef PTSL
+	/* an entry gone from the file stays while traces hang on it */
+	for (indice = 0; indice < PDIR_TAM; indice++) {
+		ptr = pdir_table[indice];
+		if ((ptr == NULL) || (ptr->nr_tracos == 0) ||
+				(nova[indice] != NULL))
 			continue;
 
-		/* then check for comments */
-		if (token_ar[0][0] == '#') {
+		Debug("keeping `%s', which has traces", ptr->descricao);
+		nova[indice] = ptr;
+		j = pdir_passos(ptr->transp_aplic, indice);
+		if (j > *prof)
+			*prof = j;
+	}
+#endif
+
+	for (i = 0; i < qtd; i++) {
+		ptr = lidas[i];
+		if (ptr->local_index != 0)
 			continue;
+		if (pdir_busca(nova, *prof, ptr->transp_aplic,
+					ptr->enlace_rede) != PDIR_TAM)
+			goto duplicada;
+
+		/* OK, entrada nao existe. busca espao livre na tabela */
+		for (j = 0; j < PDIR_MAX; j++) {
+			HASH(ptr->transp_aplic, j, indice);
+			if (nova[indice] == NULL)
+				break;
 		}
-		if ((token_ar[15] != NULL) && (token_ar[15][0] != '#')) {
-			Debug("warning, garbage after last field on line %u",
-					line);
+		if (j == PDIR_MAX) {
+			/* WOW! existe espao na tabela mas no foi encontrado */
+			Debug("could NOT add entry (%u/%u)", qtd, PDIR_TAM);
+			return ERROR_HASH;
 		}
 
-		/* after check for valid fields, starting with numbers */
-		if (!test_isnumber(token_ar[0]) || !test_isnumber(token_ar[1]) ||
-				!test_isnumber(token_ar[2]) || !test_isnumber(token_ar[3]) ||
-				!test_isnumber(token_ar[4]) || !test_isnumber(token_ar[5]) ||
-				!test_isnumber(token_ar[6]) || !test_isnumber(token_ar[7]) ||
-				!test_isnumber(token_ar[9]) || !test_isnumber(token_ar[10]) ||
-				!test_isnumber(token_ar[11]) || !test_isnumber(token_ar[12]) ||
-				!test_isnumber(token_ar[14])) {
-			Debug("discarding line %u (number test faile)",
-					line);
+		nova[indice] = ptr;
+		ptr->local_index = (*proximo)++;
+		if (j > *prof) {
+			/* atualizar limite de busca */
+			*prof = j;
+		}
+	}
+
+	return SUCCESS;
+
+duplicada:
+	Debug("entry {%u, %u, %u, %u} found twice, ignoring the file",
+			ptr->idlink, ptr->idnet, ptr->idtrans, ptr->idapp);
+	return ERROR_ALREADYEXISTS;
+}
+
+
+/*
+ *  drops the rows the tables accounted on the encapsulation `local_index';
+ *  a table that fails does not keep the others from trying
+ */
+static void pdir_remove_linhas(const unsigned int local_index)
+{
+	unsigned int	falhas = 0;
+
+	falhas += (nlhost_remove_pdir(local_index) != SUCCESS);
+	falhas += (alhost_remove_pdir(local_index) != SUCCESS);
+	falhas += (nlmatrix_SD_remove_pdir(local_index) != SUCCESS);
+	falhas += (nlmatrix_DS_remove_pdir(local_index) != SUCCESS);
+	falhas += (almatrix_SD_remove_pdir(local_index) != SUCCESS);
+	falhas += (almatrix_DS_remove_pdir(local_index) != SUCCESS);
+	falhas += (pdist_stats_remove_cascata(local_index) != SUCCESS);
+
+	if (falhas != 0)
+		Debug("erro na remoo em cascata (%u)", local_index);
+}
+
+
+/*
+ *  puts `nova' in place of pdir_table, then drops what was left out of it,
+ *  along with the rows accounted on it, once no worker can see it
+ */
+static void pdir_troca(pdir_node_t **nova, const unsigned int prof)
+{
+	pdir_node_t	*velha[PDIR_TAM];
+	pdir_node_t	*ptr;
+	unsigned int	qtd = 0;
+	unsigned int	removidas = 0;
+	unsigned int	i;
+
+	memcpy(velha, pdir_table, sizeof(velha));
+
+	/* whoever hashes meanwhile must find both */
+	if (prof > profundidade)
+		profundidade = prof;
+
+	for (i = 0; i < PDIR_TAM; i++) {
+		ptr = velha[i];
+		if (nova[i] != NULL)
+			qtd++;
+		if (ptr == nova[i])
 			continue;
+
+		if ((ptr != NULL) && ((nova[i] == NULL) ||
+					(nova[i]->local_index != ptr->local_index)))
+			lista_remove_indice(i);
+		if ((nova[i] != NULL) && ((ptr == NULL) ||
+					(nova[i]->local_index != ptr->local_index))) {
+			if (lista_insere(i) != SUCCESS)
+				Debug("could not list entry %u", i);
+		}
+#ifdef PTSL
+		/* same slot, same entry: its traces move along */
+		if ((ptr != NULL) && (nova[i] != NULL) &&
+				(nova[i]->local_index == ptr->local_index)) {
+			nova[i]->nr_tracos = ptr->nr_tracos;
+			nova[i]->primeiro_traco = ptr->primeiro_traco;
+			nova[i]->ultimo_traco = ptr->ultimo_traco;
 		}
-		if (!test_isstring(token_ar[8]) || !test_isstring(token_ar[13])) {
-			Debug("discarding line %u (control character found)",
-					line);
+#endif
+		pdir_table[i] = nova[i];
+	}
+
+	profundidade = prof;
+	quantidade = qtd;
+	lastchange = sysuptime();
+	pdir_notifica();
+
+	/*
+	 * no worker reaches the old entries any more: the rows accounted on
+	 * those gone can go too, and will not come back
+	 */
+	for (i = 0; i < PDIR_TAM; i++) {
+		ptr = velha[i];
+		if ((ptr == NULL) || (ptr == nova[i]))
 			continue;
+
+		if ((nova[i] == NULL) ||
+				(nova[i]->local_index != ptr->local_index)) {
+			removidas++;
+			pdir_remove_linhas(ptr->local_index);
 		}
+		pdir_libera(ptr);
+	}
 
-		/* OK, should be correct then */
-		pdn_ptr = calloc(1, sizeof(pdir_node_t));
-		if (pdn_ptr == NULL)
-			return ERROR_CALLOC;
-
-		pdn_ptr->idlink		= strtol(token_ar[0], NULL, 10);
-		pdn_ptr->idnet		= strtol(token_ar[1], NULL, 10);
-		pdn_ptr->idtrans	= strtol(token_ar[2], NULL, 10);
-		pdn_ptr->idapp		= strtol(token_ar[3], NULL, 10);
-		pdn_ptr->param1		= strtol(token_ar[4], NULL, 10);
-		pdn_ptr->param2		= strtol(token_ar[5], NULL, 10);
-		pdn_ptr->param3		= strtol(token_ar[6], NULL, 10);
-		pdn_ptr->param4		= strtol(token_ar[7], NULL, 10);
-		pdn_ptr->descricao	= strdup(token_ar[8]);
-		pdn_ptr->tipo		= strtol(token_ar[9], NULL, 10);
-		pdn_ptr->addrmap_config	= strtol(token_ar[10], NULL, 10);
-		pdn_ptr->host_config	= strtol(token_ar[11], NULL, 10);
-		pdn_ptr->matrix_config	= strtol(token_ar[12], NULL, 10);
-		pdn_ptr->owner		= strdup(token_ar[13]);
-		pdn_ptr->row_status	= strtol(token_ar[14], NULL, 10);
-		pdn_ptr->local_index	= contador;
-
-		if ((pdn_ptr->descricao == NULL) || (pdn_ptr->owner == NULL))
-			Debug("warning, short on memory");
-
-		ret = protdir_insere(pdn_ptr);
-		if (ret != SUCCESS)
-			return ret;
+	if (removidas != 0)
+		Debug("%u entries removed", removidas);
+}
 
-		contador++;
-		quantidade++;
+
+/*
+ *  builds a new table from `filename' aside, and puts it in place of the
+ *  current one; nothing changes if the file has any problem
+ */
+static int pdir_carrega(char *filename)
+{
+	char		 linha[256];
+	pdir_node_t	**lidas;
+	pdir_node_t	**nova;
+	pdir_node_t	*pdn_ptr;
+	unsigned int	 qtd = 0;
+	unsigned int	 prof;
+	unsigned int	 proximo = proximo_indice;
+	unsigned int	 line = 0;
+	unsigned int	 i;
+	int		 ret = SUCCESS;
+	FILE		*file_ptr;
+
+	file_ptr = fopen(filename, "r");
+	if (file_ptr == NULL) {
+		Debug("could not open %s", filename);
+		return ERROR_IO;
 	}
 
-	lastchange = sysuptime();
-	Debug("reporting %u entries, hash-table depth is %u",
-			quantidade, profundidade);
+	lidas = calloc(PDIR_MAX, sizeof(pdir_node_t *));
+	nova = calloc(PDIR_TAM, sizeof(pdir_node_t *));
+	if ((lidas == NULL) || (nova == NULL)) {
+		free(lidas);
+		free(nova);
+		fclose(file_ptr);
+		return ERROR_CALLOC;
+	}
+
+	/* read all lines */
+	while ((ret == SUCCESS) &&
+			(fgets(linha, sizeof(linha), file_ptr) != NULL)) {
+		line++;
+		ret = pdir_le_linha(linha, line, &pdn_ptr);
+		if ((ret != SUCCESS) || (pdn_ptr == NULL))
+			continue;
+
+		if (qtd == PDIR_MAX) {
+			pdir_libera(pdn_ptr);
+			ret = ERROR_FULL;
+			continue;
+		}
+		lidas[qtd++] = pdn_ptr;
+	}
+	fclose(file_ptr);
+
+	if (ret == SUCCESS)
+		ret = pdir_posiciona(lidas, qtd, nova, &prof, &proximo);
+
+	if (ret == SUCCESS) {
+		proximo_indice = proximo;
+		pdir_troca(nova, prof);
+		Debug("reporting %u entries, hash-table depth is %u",
+				quantidade, profundidade);
+	}
+	else {
+		for (i = 0; i < qtd; i++)
+			pdir_libera(lidas[i]);
+	}
+
+	free(lidas);
+	free(nova);
+	return ret;
+}
+
+
+	int
+init_protocoldir(char *filename)
+{
+	int		 ret;
+
+	if (filename == NULL)
+		filename = PDIR_CONF;
+
+	Debug("initializing protocolDir (%s)", filename);
+	pthread_mutex_lock(&pdir_trava);
+	ret = pdir_carrega(filename);
+	pthread_mutex_unlock(&pdir_trava);
+	if (ret != SUCCESS)
+		return ret;
 
 #ifdef PTSL
 	if (pdir_tracos_init() != SUCCESS)
@@ -358,6 +815,47 @@ init_protocoldir(char *filename)
 }
 
 
+/** \brief Reloads protocolDir from \a filename (#PDIR_CONF if NULL), while
+ *  packets keep being accounted.
+ *
+ *  The new table is built aside and takes the place of the current one at
+ *  once; the accounting never waits for it.  Entries still in the file keep
+ *  their local index, so the rows accounted on them stay; those gone from
+ *  the file are removed along with their rows (PTSL: unless traces hang on
+ *  them).  New entries get local indexes never used before.
+ *
+ *  \retval SUCCESS	if the new table is in place
+ *  \retval otherwise	the file could not be read or has a problem; the
+ *			current table is kept
+ */
+int pdir_recarrega(char *filename)
+{
+	int		 ret;
+
+	if (filename == NULL)
+		filename = PDIR_CONF;
+
+	Debug("reloading protocolDir (%s)", filename);
+	pthread_mutex_lock(&pdir_trava);
+	ret = pdir_carrega(filename);
+	if (ret == SUCCESS)
+		recargas++;
+	pthread_mutex_unlock(&pdir_trava);
+
+	if (ret != SUCCESS)
+		Debug("reload failed (%d), protocolDir left as it was", ret);
+
+	return ret;
+}
+
+
+/** \brief How many times protocolDir was reloaded since the agent started. */
+unsigned int pdir_recargas()
+{
+	return recargas;
+}
+
+
 #if 0
 /*
    inicializao da protocolDir, lendo a configurao do arquivo
@@ -646,6 +1144,8 @@ int protdir_insere(pdir_node_t *pdir_ptr)
 			return ERROR_ALREADYEXISTS;
 		}
 
+		pdir_acoes_calcula(pdir_ptr);
+
 		/* OK, entrada nao existe. busca espao livre na tabela */
 		i = 0;
 		chave = (pdir_ptr->idtrans << 16) | (pdir_ptr->idapp & 0x0000ffff);
@@ -673,6 +1173,7 @@ int protdir_insere(pdir_node_t *pdir_ptr)
 				return ERROR_INDEXLIST;
 			}
 
+			pdir_notifica();
 			return SUCCESS;
 		}
 		else {
@@ -696,37 +1197,26 @@ int pdir_remove(const unsigned int e, const unsigned int r,
 		const unsigned int t, const unsigned int a)
 {
 	pdir_node_t	    *ptr = pdir_localiza(e, r, t, a);
-	unsigned int    indice;
+	unsigned int    indice = pdir_localiza_indice(e, r, t, a);
 
 	if (ptr != NULL) {
-		/* passar o endereo do campo localindex para a remoo */
-
-		if ((nlhost_remove_pdir(ptr->local_index) != SUCCESS) ||
-				(alhost_remove_pdir(ptr->local_index) != SUCCESS) ||
-				(pdist_stats_remove_cascata(ptr->local_index) != SUCCESS)) {
-			/* OK, houve um erro, nada de pnico */
-			Debug("erro na remoo em cascata");
-		}
-
 		/* remover da lista de ndices */
-		/* FIXME!!! */
 		if (lista_remove_indice(indice) != SUCCESS) {
 			Debug("ndice %u no encontrado na lista",
 					indice);
 		}
 
-		/* aritmtica com ponteiros para descobrir o ndice real */
-		indice = ((unsigned int)ptr - (unsigned int)pdir_table) / sizeof(pdir_node_t *);
 		pdir_table[indice] = NULL;
 		quantidade--;
 
-		/* OK, referncias j foram removidas */
-		free(ptr->descricao);
-		free(ptr->owner);
-		free(ptr);
-
-		/* atualizar last change */
+		/* atualizar last change; pdir_ipv4 esquece o ponteiro, e nenhum
+		   worker o tem mais quando pdir_notifica() retorna */
 		lastchange = sysuptime();
+		pdir_notifica();
+
+		/* s agora: antes, um worker poderia recriar as linhas */
+		pdir_remove_linhas(ptr->local_index);
+		pdir_libera(ptr);
 
 		return SUCCESS;
 	}
@@ -1102,6 +1592,7 @@ int pdir_define_host_config(const unsigned int e, const unsigned int r,
 		}
 
 		ptr->host_config = (unsigned char)config;
+		pdir_acoes_calcula(ptr);
 		lastchange = sysuptime();
 
 		return SUCCESS;
@@ -1125,6 +1616,7 @@ int pdir_define_matrix_config(const unsigned int e, const unsigned int r,
 		}
 
 		ptr->matrix_config = (unsigned char)config;
+		pdir_acoes_calcula(ptr);
 		lastchange = sysuptime();
 
 		return SUCCESS;
@@ -1159,6 +1651,7 @@ int pdir_define_status(const unsigned int e, const unsigned int r,
 
 		/* FIXME: se o status NAO for ROWSTATUS_ACTIVE, deve remover entrada */
 
+		pdir_notifica();
 		return SUCCESS;
 	}
 	else {
@@ -1262,6 +1755,7 @@ int pdir_traco_run(const unsigned int id_traco)
 	t_ptr = tracos_localiza_por_id(id_traco);
 
 	if (t_ptr != NULL) {
+		pthread_mutex_lock(&pdir_trava);
 		if (t_ptr->running == 0) {
 			t_ptr->proximo_traco = NULL;
 
@@ -1283,8 +1777,11 @@ int pdir_traco_run(const unsigned int id_traco)
 			pdir_table[t_ptr->pdir_index]->nr_tracos++;
 			Debug("RUN %s [%u]",
 					t_ptr->descricao->descricao, t_ptr->pdir_index);
+			pdir_notifica();
+			pthread_mutex_unlock(&pdir_trava);
 			return (SUCCESS);
 		} else {
+			pthread_mutex_unlock(&pdir_trava);
 			return (ERROR_ALREADYEXISTS);
 		}
 	} else {
@@ -1295,9 +1792,122 @@ int pdir_traco_run(const unsigned int id_traco)
 }
 
 
-int pdir_traco_remove()
+/* worst case for where each layer starts: Ethernet II, then IPv4 and TCP
+   headers carrying as many options as they can */
+#define ALCANCE_REDE		14
+#define ALCANCE_TRANSPORTE	(ALCANCE_REDE + 60)
+#define ALCANCE_APLICACAO	(ALCANCE_TRANSPORTE + 60)
+
+/** \brief How many bytes of a frame the running traces may look at.
+ *
+ *  Bit counter messages read at a fixed offset from the start of some layer
+ *  (see testa_mensagem()); field counter and no offset messages walk the
+ *  payload, so there is no bound for them.
+ *
+ *  \retval 0		if no trace is running
+ *  \retval UINT_MAX	if some running trace has no bound
+ *  \retval otherwise	bytes counted from the start of the frame
+ */
+unsigned int pdir_tracos_alcance()
+{
+	traco_t		*t_ptr;
+	mensagem_t	*msg_ptr;
+	unsigned int	alcance = 0;
+	unsigned int	fim;
+	unsigned int	i;
+	unsigned int	j;
+
+	for (i = 0; i < PDIR_TAM; i++) {
+		if (pdir_table[i] == NULL)
+			continue;
+
+		for (t_ptr = pdir_table[i]->primeiro_traco; t_ptr != NULL;
+				t_ptr = t_ptr->proximo_traco) {
+			for (j = 0; j < t_ptr->nr_mensagens; j++) {
+				msg_ptr = &t_ptr->mensagens[j];
+				if (msg_ptr->flags.tipo != MSG_BITCT)
+					return UINT_MAX;
+
+				switch (msg_ptr->flags.encaps) {
+					case OFF_REDE:
+						fim = ALCANCE_REDE;
+						break;
+					case OFF_TRANSPORTE:
+						fim = ALCANCE_TRANSPORTE;
+						break;
+					case OFF_APLICACAO:
+						fim = ALCANCE_APLICACAO;
+						break;
+					default:
+						fim = 0;
+				}
+				fim += msg_ptr->offset / 8;
+
+				/* compared against the key or the variable */
+				if ((msg_ptr->variavel != NULL) &&
+						(msg_ptr->variavel->tamanho > msg_ptr->tam_chave))
+					fim += msg_ptr->variavel->tamanho;
+				else
+					fim += msg_ptr->tam_chave;
+
+				if (fim > alcance)
+					alcance = fim;
+			}
+		}
+	}
+
+	return alcance;
+}
+
+
+/** \brief Takes a running trace out of its encapsulation.
+ *
+ *  The inverse of pdir_traco_run().  The trace stays installed, since its
+ *  instances in the host tables still point to it; the workers walking the
+ *  list may still be on it, so its own \a proximo_traco is left alone.
+ */
+int pdir_traco_remove(const unsigned int id_traco)
 {
-	return (ERROR_NEEDCODING);
+	pdir_node_t	*ptr;
+	traco_t		*t_ptr;
+	traco_t		*anterior = NULL;
+	traco_t		*atual;
+
+	t_ptr = tracos_localiza_por_id(id_traco);
+	if (t_ptr == NULL) {
+		Debug("trao no encontrado");
+		return (ERROR_NOSUCHENTRY);
+	}
+
+	pthread_mutex_lock(&pdir_trava);
+	ptr = pdir_table[t_ptr->pdir_index];
+	if ((t_ptr->running == 0) || (ptr == NULL)) {
+		pthread_mutex_unlock(&pdir_trava);
+		return (ERROR_NOSUCHENTRY);
+	}
+
+	for (atual = ptr->primeiro_traco; (atual != NULL) && (atual != t_ptr);
+			atual = atual->proximo_traco)
+		anterior = atual;
+	if (atual == NULL) {
+		pthread_mutex_unlock(&pdir_trava);
+		return (ERROR_NOSUCHENTRY);
+	}
+
+	if (anterior == NULL)
+		ptr->primeiro_traco = t_ptr->proximo_traco;
+	else
+		anterior->proximo_traco = t_ptr->proximo_traco;
+	if (ptr->ultimo_traco == t_ptr)
+		ptr->ultimo_traco = anterior;
+	ptr->nr_tracos--;
+	t_ptr->running = 0;
+
+	Debug("REMOVE %s [%u]", t_ptr->descricao->descricao, t_ptr->pdir_index);
+	pdir_notifica();
+	pthread_mutex_unlock(&pdir_trava);
+
+	return (SUCCESS);
 }
 
 
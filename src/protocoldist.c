@@ -35,35 +35,44 @@
 #include "configuracao.h"
 #include "exit_codes.h"
 
-#include "primo.h"
-#include "funcao_hash.h"
+#include <netinet/in.h>
 
 #if PTSL
-#include <netinet/in.h>
 #include "stateful.h"
 #endif
 
+#include "pedb.h"
+#include "fluxos.h"
 #include "protocoldist.h"
 #include "protocoldir.h"
 #include "sysuptime.h"
 
 #include "rowstatus.h"
+#include "shards.h"
+#include "tabela.h"
 #include "log.h"
 
 /* local defines */
-#define PDISTSTATS_MAX	65536
-#define PDISTSTATS_TAM	PRIMO
-#define PDISTCNTRL_TAM	4
+#define PDISTSTATS_TAM	TABELAS_POSICOES
+#define PDISTCNTRL_TAM	IFINDEX_MAX
 
 
 /* os vetores das tabelas */
 static pdistcontrol_t	*cntrl_table[PDISTCNTRL_TAM];
-static pdist_stats_t	*stats_hashtable[PDISTSTATS_TAM];
 
 /* informaes sobre as tabelas */
 static unsigned int	cntrl_quantidade;
-static unsigned int	stats_quantidade;
-static unsigned int	stats_profundidade;
+
+/* the merged stats table (read by SNMP) */
+TABELA_ESTATICA(principal, pdist_stats_t, PDISTSTATS_TAM);
+/* where each worker accounts: its private shard or, with a single worker,
+   straight into principal */
+static tabela_t		*tabelas[MAX_WORKERS] = { &principal, };
+
+#define PDIST(t, indice)	((pdist_stats_t *)tabela_entrada((t), (indice)))
+
+/* curinga para pdist_shards_purga() */
+#define PDIST_QUALQUER	(~0U)
 
 
 #define QUERO_REMOVER	1
@@ -302,39 +311,82 @@ int pdist_control_define_status(const unsigned int indice, const int novo_status
 }
 
 
+/*
+   remove de `t' as entradas stats de um controle, de um encapsulamento, ou
+   ambos (PDIST_QUALQUER serve para qualquer valor); devolve quantas.
+   */
+static unsigned int pdist_tabela_purga(tabela_t *t, const unsigned int controle,
+		const unsigned int protdir)
+{
+	pdist_stats_t	*e;
+	unsigned int	indice;
+	unsigned int	remocoes = 0;
+
+	TABELA_PERCORRE(t, indice) {
+		e = PDIST(t, indice);
+		if (((controle != PDIST_QUALQUER) &&
+				 (e->control_index != controle)) ||
+				((protdir != PDIST_QUALQUER) &&
+				 (e->protdir_index != protdir)))
+			continue;
+
+		if (t == &principal)
+			lista_remove_indice(indice);
+		tabela_remove(t, indice);
+		remocoes++;
+	}
+
+	return remocoes;
+}
+
+
+/*
+   remove as entradas stats de um controle e/ou encapsulamento da tabela
+   consolidada e das shards dos workers, para que a prxima consolidao
+   no as traga de volta; devolve quantas saram da consolidada.
+
+   cada tabela onde um worker contabiliza  purgada com ele travado, e o
+   fluxos_invalida() de quem chama vem antes, para que o prximo lote no
+   use linhas removidas.  sem shards, a consolidada  a do worker 0.
+   */
+static unsigned int pdist_purga(const unsigned int controle,
+		const unsigned int protdir)
+{
+	unsigned int	remocoes = 0;
+	unsigned int	w;
+
+	for (w = 0; w < shards_quantidade(); w++) {
+		shards_trava(w);
+		remocoes = pdist_tabela_purga(tabelas[w], controle, protdir);
+		shards_destrava(w);
+	}
+
+	if (tabelas[0] != &principal)
+		remocoes = pdist_tabela_purga(&principal, controle, protdir);
+
+#if PDIST_DEBUG
+	Debug("%u entrada(s) removida(s)", remocoes);
+#endif
+
+	return remocoes;
+}
+
+
 /*
    remove uma entrada da tabela control, mas antes removendo todos os elementos
    dependentes na tabela stats.
    */
 int pdist_control_remove(const unsigned int vitima)
 {
-	unsigned int    remocoes_stats = 0;
-	unsigned int    indice_stats = 0;
-
 	/* verificar se a entrada existe */
 	if ((vitima < PDISTCNTRL_TAM ) && (cntrl_table[vitima] == NULL)) {
 		return ERROR_NOSUCHENTRY;
 	}
 
-	while (1) {
-		while ((indice_stats < PRIMO) || ((stats_hashtable[indice_stats] != NULL) &&
-					(stats_hashtable[indice_stats]->control_index != vitima))) {
-			indice_stats++;
-		}
+	/* the flows may point at the entries going away */
+	fluxos_invalida();
 
-		if (indice_stats < PRIMO) {
-			/* encontrado */
-			lista_remove_indice(indice_stats);
-			free(stats_hashtable[indice_stats]);
-			stats_hashtable[indice_stats] = NULL;
-			stats_quantidade--;
-			remocoes_stats++;
-		}
-		else {
-			/* percorreu toda a tabela - interromper o 'while (1)' */
-			break;
-		}
-	}
+	pdist_purga(vitima, PDIST_QUALQUER);
 
 	/* agora  seguro remover a entrada na control */
 	free(cntrl_table[vitima]);
@@ -342,7 +394,7 @@ int pdist_control_remove(const unsigned int vitima)
 	cntrl_quantidade--;
 
 #if PDIST_DEBUG
-	Debug("1 interface e %u entradas removidas", remocoes_stats);
+	Debug("1 interface removida");
 #endif
 
 	return SUCCESS;
@@ -446,55 +498,45 @@ int pdist_control_atualiza_drops(const unsigned int indice, const uint32_t drp_f
 /* ProtocolDist STATS *********************************************************/
 unsigned int protdist_stats_getQtd()
 {
-	return stats_quantidade;
+	return principal.quantidade;
 }
 
 
-static unsigned int protdist_stats_localiza(const unsigned int index_control,
+/* a chave junta os ndices de controle e da protocolDir */
+static inline uint32_t pdist_chave(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int i = 0;	    /* offset da hash */
-	unsigned int chave = ((index_control & 0xffff) << 16) | (index_stats & 0xffff);
-	unsigned int hash_index;
-
-	HASH(chave, i, hash_index);
-
-	/* encontraremos a entrada se:
-	   1) estiver antes de 'profundidade'
-	   2) a posio atual conter algum dado (!= NULL)
-	   3) os dados da chave forem iguais aos de confirmao
-	   */
-	if ((stats_hashtable[hash_index] != NULL) &&
-			(stats_hashtable[hash_index]->chave_confirma == chave)) {
-		/* bala! achamos na primeira */
-		return hash_index;
-	}
-
-	/* holy.. coliso */
-	i++;
-	while (i <= stats_profundidade) {
-		HASH(chave, i, hash_index);
-		if ((stats_hashtable[hash_index] != NULL) &&
-				(stats_hashtable[hash_index]->chave_confirma == chave)) {
-			/* Wheee! :) */
-			return hash_index;
-		}
-		i++;
-	}
+	return ((index_control & 0xffff) << 16) | (index_stats & 0xffff);
+}
+
 
-	/* clever! */
-	return PDISTSTATS_TAM;
+static int pdist_confere(const void *entrada, const void *chave)
+{
+	return ((const pdist_stats_t *)entrada)->chave_confirma ==
+		*(const uint32_t *)chave;
+}
+
+
+static unsigned int protdist_stats_localiza(const tabela_t *t,
+		const unsigned int index_control,
+		const unsigned int index_stats)
+{
+	uint32_t chave = pdist_chave(index_control, index_stats);
+
+	/* clever! PDISTSTATS_TAM se no encontrada */
+	return tabela_busca(t, tabela_hash(chave), pdist_confere, &chave);
 }
 
 
 int protdist_stats_getControlIndex(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	unsigned int hash_index = protdist_stats_localiza(&principal, index_control,
+			index_stats);
 
 	if (hash_index != PDISTSTATS_TAM) {
 		/* acho que achou ;) */
-		return stats_hashtable[hash_index]->control_index;
+		return PDIST(&principal, hash_index)->control_index;
 	}
 
 	return ERROR_NOSUCHENTRY;
@@ -506,8 +548,8 @@ int protdist_stats_getControlIndex(const unsigned int index_control,
    */
 int pdist_stats_tabela_busca_controlindex(const unsigned int indice, uint32_t *coloca)
 {
-	if (stats_hashtable[indice] != NULL) {
-		*coloca = stats_hashtable[indice]->control_index;
+	if (tabela_ocupada(&principal, indice)) {
+		*coloca = PDIST(&principal, indice)->control_index;
 		return SUCCESS;
 	}
 	else {
@@ -519,11 +561,12 @@ int pdist_stats_tabela_busca_controlindex(const unsigned int indice, uint32_t *c
 int protdist_stats_getProtIndex(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	unsigned int hash_index = protdist_stats_localiza(&principal, index_control,
+			index_stats);
 
 	if (hash_index != PDISTSTATS_TAM) {
 		/* acho que achou ;) */
-		return stats_hashtable[hash_index]->protdir_index;
+		return PDIST(&principal, hash_index)->protdir_index;
 	}
 
 	return ERROR_NOSUCHENTRY;
@@ -535,8 +578,8 @@ int protdist_stats_getProtIndex(const unsigned int index_control,
    */
 int pdist_stats_tabela_busca_protdirindex(const unsigned int indice, uint32_t *coloca)
 {
-	if (stats_hashtable[indice] != NULL) {
-		*coloca = stats_hashtable[indice]->protdir_index;
+	if (tabela_ocupada(&principal, indice)) {
+		*coloca = PDIST(&principal, indice)->protdir_index;
 		return SUCCESS;
 	}
 	else {
@@ -548,11 +591,12 @@ int pdist_stats_tabela_busca_protdirindex(const unsigned int indice, uint32_t *c
 int protdist_stats_getPkts(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	unsigned int hash_index = protdist_stats_localiza(&principal, index_control,
+			index_stats);
 
 	if (hash_index != PDISTSTATS_TAM) {
 		/* acho que achou ;) */
-		return stats_hashtable[hash_index]->pkts;
+		return PDIST(&principal, hash_index)->pkts;
 	}
 
 	return ERROR_NOSUCHENTRY;
@@ -564,8 +608,8 @@ int protdist_stats_getPkts(const unsigned int index_control,
    */
 int pdist_stats_tabela_busca_pkts(const unsigned int indice, uint32_t *copia)
 {
-	if (stats_hashtable[indice] != NULL) {
-		*copia = stats_hashtable[indice]->pkts;
+	if (tabela_ocupada(&principal, indice)) {
+		*copia = PDIST(&principal, indice)->pkts;
 		return SUCCESS;
 	}
 	else {
@@ -577,11 +621,12 @@ int pdist_stats_tabela_busca_pkts(const unsigned int indice, uint32_t *copia)
 int protdist_stats_getOctets(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	unsigned int hash_index = protdist_stats_localiza(&principal, index_control,
+			index_stats);
 
 	if (hash_index != PDISTSTATS_TAM) {
 		/* acho que achou ;) */
-		return stats_hashtable[hash_index]->octets;
+		return PDIST(&principal, hash_index)->octets;
 	}
 
 	return ERROR_NOSUCHENTRY;
@@ -593,8 +638,8 @@ int protdist_stats_getOctets(const unsigned int index_control,
    */
 int pdist_stats_tabela_busca_octets(const unsigned int indice, uint32_t *copia)
 {
-	if (stats_hashtable[indice] != NULL) {
-		*copia = stats_hashtable[indice]->octets;
+	if (tabela_ocupada(&principal, indice)) {
+		*copia = PDIST(&principal, indice)->octets;
 		return SUCCESS;
 	}
 	else {
@@ -606,12 +651,9 @@ int pdist_stats_tabela_busca_octets(const unsigned int indice, uint32_t *copia)
 int protdist_stats_deleteEntry(const unsigned int index_control,
 		const unsigned int index_stats)
 {
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	fluxos_invalida();
 
-	if (hash_index != PDISTSTATS_TAM) {
-		free(stats_hashtable[hash_index]);
-		stats_hashtable[hash_index] = NULL;
-		stats_quantidade--;
+	if (pdist_purga(index_control, index_stats) != 0) {
 		return SUCCESS;
 	}
 	else {
@@ -622,21 +664,23 @@ int protdist_stats_deleteEntry(const unsigned int index_control,
 
 /**
  * Updates an existing entry for the given protocol encapsulation, or add a new
- * entry with the data provided.
+ * entry with the data provided.  The entry is recorded in \a fluxo, if not
+ * NULL.
  *
  * \retval SUCCESS	If no errors during creation/updating.
  * \retval ERROR_FULL	If protocolDist table is full.
- * \retval ERROR_HASH	If too many collisions occured in the hash table.
- * \retval ERROR_MALLOC	If memory could not be allocated.
  */
-int
-pdist_update(const unsigned int index_control, const unsigned int index_stats,
-		const uint32_t pkts, const uint32_t octets)
+static int
+pdist_tabela_atualiza(tabela_t *t, const unsigned int index_control,
+		const unsigned int index_stats, const uint32_t pkts,
+		const uint32_t octets, fluxo_t *fluxo)
 {
-	unsigned int i = 0;	    /* offset da hash */
-	unsigned int chave = ((index_control & 0xffff) << 16) | (index_stats & 0xffff);
-	unsigned int hash_index = protdist_stats_localiza(index_control, index_stats);
+	uint32_t	chave = pdist_chave(index_control, index_stats);
+	uint32_t	hash = tabela_hash(chave);
+	unsigned int	hash_index;
+	pdist_stats_t	*e;
 
+	hash_index = tabela_busca(t, hash, pdist_confere, &chave);
 	if (hash_index != PDISTSTATS_TAM) {
 		/* Entry exists -- only update. */
 
@@ -644,65 +688,58 @@ pdist_update(const unsigned int index_control, const unsigned int index_stats,
 		Debug("(%d, %d, %u, %u)[%u]: updating", index_control,
 				index_stats, pkts, octets, hash_index);
 #endif
-		stats_hashtable[hash_index]->pkts += pkts;
-		stats_hashtable[hash_index]->octets += octets;
+		e = PDIST(t, hash_index);
+		e->pkts += pkts;
+		e->octets += octets;
+		fluxo_registra(fluxo, &e->pkts, &e->octets, NULL, NULL);
 		return SUCCESS;
 	}
 
-	if (stats_quantidade >= PDISTSTATS_MAX) {
+	hash_index = tabela_insere(t, hash);
+	if (hash_index == PDISTSTATS_TAM) {
 		/* Table is full, cannot create entry. */
 		Debug("(%d, %d, %u, %u): table is full", index_control,
 				index_stats, pkts, octets);
 		return ERROR_FULL;
 	}
 
-	/* Compute index for this entry. */
-	HASH(chave, i, hash_index);
-
-	while ((i < PDISTSTATS_MAX) && (stats_hashtable[hash_index] != NULL)) {
-		/* Compute another index, last one collided. */
-		i++;
-		HASH(chave, i, hash_index);
-	}
-	if (i >= PDISTSTATS_MAX) {
-		Debug("could not add entry, too many collisions: (%u/%u)",
-				stats_quantidade, PDISTSTATS_TAM);
-		return ERROR_HASH;
-	}
-
 #if PDIST_DEBUG
 	Debug("(%d, %d, %u, %u): new entry at %u", index_control, index_stats,
 			pkts, octets, hash_index);
 #endif
 
-	/* Get a struct and fill the data. */
-	stats_hashtable[hash_index] = malloc(sizeof(pdist_stats_t));
-	if (stats_hashtable[hash_index] == NULL) {
-#if PDIST_DEBUG
-		Debug("not enough memory");
-#endif
-		return ERROR_MALLOC;
-	}
-
-	stats_hashtable[hash_index]->control_index = index_control;
-	stats_hashtable[hash_index]->protdir_index = index_stats;
-	stats_hashtable[hash_index]->pkts = pkts;
-	stats_hashtable[hash_index]->octets = octets;
-	stats_hashtable[hash_index]->chave_confirma = chave;
-	stats_quantidade++;
-
-	/* Update depth of this hash table. */
-	if (i > stats_profundidade)
-		stats_profundidade = i;
+	/* Fill the data. */
+	e = PDIST(t, hash_index);
+	e->control_index = index_control;
+	e->protdir_index = index_stats;
+	e->pkts = pkts;
+	e->octets = octets;
+	e->chave_confirma = chave;
+	fluxo_registra(fluxo, &e->pkts, &e->octets, NULL, NULL);
 
 	/* Include this entry in the list, for OID traversal. */
-	if (lista_insere(hash_index) != SUCCESS)
+	if ((t == &principal) && (lista_insere(hash_index) != SUCCESS))
 		Debug("lista_insere(%u, %u) failed", chave, hash_index);
 
 	return SUCCESS;
 }
 
 
+/**
+ * Accounts packets of an encapsulation in the stats table of a worker.
+ *
+ * \see pdist_tabela_atualiza()
+ */
+int
+pdist_update(const unsigned int worker, const unsigned int index_control,
+		const unsigned int index_stats, const uint32_t pkts,
+		const uint32_t octets, fluxo_t *fluxo)
+{
+	return pdist_tabela_atualiza(tabelas[worker], index_control,
+			index_stats, pkts, octets, fluxo);
+}
+
+
 /* explicitamente solicita a ordenao da tabela */
 int pdist_stats_tabela_prepara()
 {
@@ -718,6 +755,8 @@ int pdist_stats_tabela_prepara()
 /* posiciona e retorna o primeiro ndice da lista */
 int pdist_stats_tabela_primeiro(unsigned int *resultado)
 {
+	shards_consolida();
+
 	if (lista_primeiro() == SUCCESS) {
 		*resultado = lista_atual->indice;
 		return SUCCESS;
@@ -744,7 +783,7 @@ int pdist_stats_tabela_prox(unsigned int *resultado)
 /* apenas verifica se o ndice pode ser usado */
 int pdist_stats_tabela_testa(const unsigned int indice)
 {
-	if (stats_hashtable[indice] != NULL) {
+	if (tabela_ocupada(&principal, indice)) {
 		return SUCCESS;
 	}
 	else {
@@ -777,33 +816,67 @@ void pdist_stats_tabela_debug()
    */
 int pdist_stats_remove_cascata(unsigned int pdir_index)
 {
-	unsigned int indice = 0;
-	unsigned int remocoes = 0;
+	fluxos_invalida();
+	pdist_purga(PDIST_QUALQUER, pdir_index);
 
-	while (1) {
-		while ((indice < PRIMO) || ((stats_hashtable[indice] != NULL) &&
-					(stats_hashtable[indice]->protdir_index != pdir_index))) {
-			indice++;
-		}
+	return SUCCESS;
+}
 
-		if (indice < PRIMO) {
-			/* referncia encontrada */
-			lista_remove_indice(indice);
-			free(stats_hashtable[indice]);
-			stats_hashtable[indice] = NULL;
-			stats_quantidade--;
-			remocoes++;
-		}
-		else {
-			/* toda a tabela foi percorrida - interromper o 'while (1)' */
-			break;
-		}
-	}
 
-#if PDIST_DEBUG
-	Debug("%u entrada(s) removida(s)", remocoes);
-#endif
+/*
+ *  allocates the private stats shard of one worker (only used with 2+ workers);
+ *  called from the worker itself, so the pages come from its NUMA node
+ */
+int pdist_shard_aloca(const unsigned int worker)
+{
+	tabelas[worker] = tabela_cria(sizeof(pdist_stats_t), PDISTSTATS_TAM);
+	if (tabelas[worker] == NULL)
+		return ERROR_CALLOC;
 
 	return SUCCESS;
 }
 
+
+/*
+ *  zeroes the counters of the merged stats table, before the shards are summed
+ */
+void pdist_consolida_zera()
+{
+	lista_t		*l;
+
+	for (l = lista_cabeca; l != NULL; l = l->prox) {
+		PDIST(&principal, l->indice)->pkts = 0;
+		PDIST(&principal, l->indice)->octets = 0;
+	}
+}
+
+
+/*
+ *  sums packets and octets of an encapsulation into the merged stats table
+ */
+int pdist_consolida_soma(const unsigned int index_control,
+		const unsigned int index_stats, const uint32_t pkts,
+		const uint32_t octets)
+{
+	return pdist_tabela_atualiza(&principal, index_control, index_stats,
+			pkts, octets, NULL);
+}
+
+
+/*
+ *  sums the stats shard of worker `w' into the merged table.  The shard must
+ *  be locked by the caller.
+ */
+void pdist_consolida(const unsigned int w)
+{
+	pdist_stats_t	*e;
+	unsigned int	indice;
+
+	/* creating the entries the merged table does not have yet */
+	TABELA_PERCORRE(tabelas[w], indice) {
+		e = PDIST(tabelas[w], indice);
+		pdist_tabela_atualiza(&principal, e->control_index,
+				e->protdir_index, e->pkts, e->octets, NULL);
+	}
+}
+
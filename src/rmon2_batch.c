@@ -0,0 +1,519 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file rmon2_batch.c
+ *  \brief Offline recomputation of the RMON2 tables from capture files
+ *
+ *  Rebuilds protocolDist, nlHost, alHost, nlMatrix and alMatrix from a set
+ *  of pcap files (or directories of them), without replaying them onto an
+ *  interface.  Files are shared among threads in a fixed round-robin, each
+ *  thread accounting into its own table shard; the shards are merged at the
+ *  end (sums, earliest creation, latest change), so the result does not
+ *  depend on which thread finished first.
+ *
+ *  The shards are kept per thread, not per file: a thread sums all of its
+ *  files into one shard.  While no shard fills up, the result does not
+ *  depend on the number of threads either; once one does, which rows were
+ *  left out depends on how the files were shared, so on -j.
+ *
+ *  Every packet is timestamped relative to the earliest packet of all
+ *  files, and the tables are printed sorted by their indexes, as
+ *  tab-separated lines, so two runs over the same files give the same
+ *  output.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <pcap.h>
+
+#include "configuracao.h"
+#include "globals.h"
+#include "exit_codes.h"
+
+#if PTSL
+#include <netinet/in.h>
+#include "stateful.h"
+#endif
+
+#include "pedb.h"
+#include "conversor.h"
+#include "protocoldir.h"
+#include "protocoldist.h"
+#include "nlhost.h"
+#include "alhost.h"
+#include "nlmatrix_SD.h"
+#include "almatrix_SD.h"
+#include "shards.h"
+#include "sysuptime.h"
+#include "log.h"
+
+
+/** \brief Most capture files accepted in one run */
+#define BATCH_MAX_ARQUIVOS	65536
+
+static char		*arquivos[BATCH_MAX_ARQUIVOS];
+static unsigned int	 arquivos_qtd = 0;
+/** \brief Earliest packet among all files: uptime 0 */
+static struct timeval	 origem;
+
+/** \brief One accounting thread, owner of the shard with its id */
+typedef struct lote_s {
+	unsigned int	id;
+	unsigned int	passo;		/* how many threads there are */
+	uint64_t	pacotes;
+	int		ret;
+	pthread_t	thread;
+} lote_t;
+
+static lote_t		lotes[MAX_WORKERS];
+
+
+/** \brief A table row, as dumped: its index columns, then its counters */
+typedef struct linha_s {
+	uint32_t	chave[5];
+	uint32_t	valor[6];
+} linha_t;
+
+/** \brief What is needed to dump one table */
+typedef struct despejo_s {
+	const char	*nome;
+	const char	*colunas;	/* header line, after the name */
+	unsigned int	 chaves;	/* chave[] columns in use */
+	unsigned int	 valores;	/* valor[] columns in use */
+	unsigned int	 enderecos;	/* bit n set: chave[n] is an address */
+	linha_t		*linhas;
+	unsigned int	 qtd;
+} despejo_t;
+
+
+static void uso(const char *nome)
+{
+	fprintf(stderr, "usage: %s [-j threads] <file.pcap | directory>...\n",
+			nome);
+	exit(1);
+}
+
+
+static int compara_nomes(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/*
+ * adds a capture file, or every regular file inside a directory
+ */
+static void arquivo_adiciona(const char *nome)
+{
+	struct stat	 info;
+	struct dirent	*entrada;
+	DIR		*dir;
+	char		*caminho;
+
+	if (stat(nome, &info) == -1) {
+		Fatal("could not stat `%s'", nome);
+	}
+
+	if (!S_ISDIR(info.st_mode)) {
+		if (arquivos_qtd == BATCH_MAX_ARQUIVOS) {
+			Fatal("too many capture files (at most %u)",
+					BATCH_MAX_ARQUIVOS);
+		}
+		arquivos[arquivos_qtd++] = strdup(nome);
+		return;
+	}
+
+	dir = opendir(nome);
+	if (dir == NULL) {
+		Fatal("could not open directory `%s'", nome);
+	}
+	while ((entrada = readdir(dir)) != NULL) {
+		if (entrada->d_name[0] == '.')
+			continue;
+
+		caminho = malloc(strlen(nome) + strlen(entrada->d_name) + 2);
+		if (caminho == NULL) {
+			Fatal("not enough memory");
+		}
+		sprintf(caminho, "%s/%s", nome, entrada->d_name);
+		if ((stat(caminho, &info) == 0) && S_ISREG(info.st_mode))
+			arquivo_adiciona(caminho);
+		free(caminho);
+	}
+	closedir(dir);
+}
+
+
+/*
+ * moves `origem' back to the first packet of `nome', if it is earlier
+ */
+static void arquivo_origem(const char *nome)
+{
+	char			 erro_pcap_string[PCAP_ERRBUF_SIZE];
+	struct pcap_pkthdr	*header;
+	const u_char		*packet;
+	pcap_t			*captura;
+
+	captura = pcap_open_offline(nome, erro_pcap_string);
+	if (captura == NULL)
+		return;		/* will be reported when accounted */
+
+	if (pcap_next_ex(captura, &header, &packet) == 1) {
+		if (!timerisset(&origem) || timercmp(&header->ts, &origem, <))
+			origem = header->ts;
+	}
+	pcap_close(captura);
+}
+
+
+/* thread which accounts every `passo'-th file, starting with its own id */
+static void *lote_executa(void *arg)
+{
+	lote_t		*l = arg;
+	unsigned int	 i;
+
+	l->ret = SUCCESS;
+	for (i = l->id; i < arquivos_qtd; i += l->passo) {
+		if (captura_arquivo_lote(arquivos[i], l->id, &origem,
+					&l->pacotes) != SUCCESS)
+			l->ret = ERROR_IO;
+	}
+
+	return NULL;
+}
+
+
+static int compara_linhas(const void *a, const void *b)
+{
+	const linha_t	*x = a;
+	const linha_t	*y = b;
+	unsigned int	 i;
+
+	for (i = 0; i < 5; i++) {
+		if (x->chave[i] != y->chave[i])
+			return (x->chave[i] < y->chave[i]) ? -1 : 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * sorts and prints the rows of a table
+ */
+static void despeja(despejo_t *d)
+{
+	struct in_addr	endereco;
+	unsigned int	i;
+	unsigned int	j;
+
+	qsort(d->linhas, d->qtd, sizeof(linha_t), compara_linhas);
+
+	printf("# %s\t%s\n", d->nome, d->colunas);
+	for (i = 0; i < d->qtd; i++) {
+		printf("%s", d->nome);
+		for (j = 0; j < d->chaves; j++) {
+			if (d->enderecos & (1 << j)) {
+				endereco.s_addr = htonl(d->linhas[i].chave[j]);
+				printf("\t%s", inet_ntoa(endereco));
+			}
+			else {
+				printf("\t%u", d->linhas[i].chave[j]);
+			}
+		}
+		for (j = 0; j < d->valores; j++)
+			printf("\t%u", d->linhas[i].valor[j]);
+		printf("\n");
+	}
+
+	free(d->linhas);
+}
+
+
+static linha_t *linhas_aloca(const unsigned int qtd)
+{
+	linha_t	*l = calloc(qtd + 1, sizeof(linha_t));
+
+	if (l == NULL) {
+		Fatal("not enough memory");
+	}
+
+	return l;
+}
+
+
+static void despeja_pdist()
+{
+	despejo_t	d = { "protocolDist", "control\tprotocolDir\tpkts\toctets",
+		2, 2, 0, NULL, 0 };
+	linha_t		*l;
+	uint32_t	 i;
+	unsigned int	 qtd;
+	int		 ret;
+
+	/* first, as it merges the shards */
+	ret = pdist_stats_tabela_primeiro(&i);
+	qtd = protdist_stats_getQtd();
+	d.linhas = linhas_aloca(qtd);
+	for (; (ret == SUCCESS) && (d.qtd < qtd);
+			ret = pdist_stats_tabela_prox(&i)) {
+		l = &d.linhas[d.qtd++];
+		pdist_stats_tabela_busca_controlindex(i, &l->chave[0]);
+		pdist_stats_tabela_busca_protdirindex(i, &l->chave[1]);
+		pdist_stats_tabela_busca_pkts(i, &l->valor[0]);
+		pdist_stats_tabela_busca_octets(i, &l->valor[1]);
+	}
+
+	despeja(&d);
+}
+
+
+static void despeja_nlhost()
+{
+	despejo_t	d = { "nlHost", "control\tprotocolDir\taddress\tinPkts\t"
+		"outPkts\tinOctets\toutOctets\toutMacNonUnicastPkts\tcreateTime",
+		3, 6, 0x4, NULL, 0 };
+	linha_t		*l;
+	uint32_t	 i;
+	uint32_t	 timemark;
+	uint32_t	 endereco;
+	unsigned int	 qtd;
+	int		 ret;
+
+	ret = nlhost_tabela_prepara(&i);
+	qtd = nlhost_quantidade();
+	d.linhas = linhas_aloca(qtd);
+	for (; (ret == SUCCESS) && (d.qtd < qtd);
+			ret = nlhost_tabela_proximo(&i)) {
+		l = &d.linhas[d.qtd++];
+		nlhost_helper(i, &l->chave[0], &timemark, &l->chave[1],
+				&endereco);
+		l->chave[2] = ntohl(endereco);
+		nlhost_busca_inpkts(i, &l->valor[0]);
+		nlhost_busca_outpkts(i, &l->valor[1]);
+		nlhost_busca_inoctets(i, &l->valor[2]);
+		nlhost_busca_outoctets(i, &l->valor[3]);
+		nlhost_busca_outmacnonunicast(i, &l->valor[4]);
+		nlhost_busca_createtime(i, &l->valor[5]);
+	}
+
+	despeja(&d);
+}
+
+
+static void despeja_alhost()
+{
+	despejo_t	d = { "alHost", "control\tnlProtocolDir\taddress\t"
+		"alProtocolDir\tinPkts\toutPkts\tinOctets\toutOctets\tcreateTime",
+		4, 5, 0x4, NULL, 0 };
+	linha_t		*l;
+	uint32_t	 i;
+	uint32_t	 timemark;
+	uint32_t	 endereco;
+	unsigned int	 qtd;
+	int		 ret;
+
+	ret = alhost_tabela_prepara(&i);
+	qtd = alhost_quantidade();
+	d.linhas = linhas_aloca(qtd);
+	for (; (ret == SUCCESS) && (d.qtd < qtd);
+			ret = alhost_tabela_proximo(&i)) {
+		l = &d.linhas[d.qtd++];
+		alhost_helper(i, &l->chave[0], &timemark, &l->chave[1],
+				&endereco, &l->chave[3]);
+		l->chave[2] = ntohl(endereco);
+		alhost_busca_inpkts(i, &l->valor[0]);
+		alhost_busca_outpkts(i, &l->valor[1]);
+		alhost_busca_inoctets(i, &l->valor[2]);
+		alhost_busca_outoctets(i, &l->valor[3]);
+		alhost_busca_createtime(i, &l->valor[4]);
+	}
+
+	despeja(&d);
+}
+
+
+/* the DS tables hold the same rows, indexed the other way around */
+static void despeja_nlmatrix()
+{
+	despejo_t	d = { "nlMatrix", "control\tprotocolDir\tsource\t"
+		"destination\tpkts\toctets\tcreateTime",
+		4, 3, 0xc, NULL, 0 };
+	linha_t		*l;
+	uint32_t	 tripa[5];
+	uint32_t	 i;
+	unsigned int	 qtd;
+	int		 ret;
+
+	ret = nlmatrix_sd_tabela_prepara(&i);
+	qtd = nlmatrix_SD_quantidade();
+	d.linhas = linhas_aloca(qtd);
+	for (; (ret == SUCCESS) && (d.qtd < qtd);
+			ret = nlmatrix_sd_tabela_proximo(&i)) {
+		l = &d.linhas[d.qtd++];
+		nlmatrix_sd_helper(i, tripa);
+		l->chave[0] = tripa[0];
+		l->chave[1] = tripa[2];
+		l->chave[2] = ntohl(tripa[3]);
+		l->chave[3] = ntohl(tripa[4]);
+		nlmatrix_sd_busca_pkts(i, &l->valor[0]);
+		nlmatrix_sd_busca_octets(i, &l->valor[1]);
+		nlmatrix_sd_busca_createtime(i, &l->valor[2]);
+	}
+
+	despeja(&d);
+}
+
+
+static void despeja_almatrix()
+{
+	despejo_t	d = { "alMatrix", "control\tnlProtocolDir\tsource\t"
+		"destination\talProtocolDir\tpkts\toctets\tcreateTime",
+		5, 3, 0xc, NULL, 0 };
+	linha_t		*l;
+	uint32_t	 i;
+	uint32_t	 timemark;
+	uint32_t	 origem_end;
+	uint32_t	 destino_end;
+	unsigned int	 qtd;
+	int		 ret;
+
+	ret = almatrix_sd_tabela_prepara(&i);
+	qtd = almatrix_SD_quantidade();
+	d.linhas = linhas_aloca(qtd);
+	for (; (ret == SUCCESS) && (d.qtd < qtd);
+			ret = almatrix_sd_tabela_proximo(&i)) {
+		l = &d.linhas[d.qtd++];
+		almatrix_sd_helper(i, &l->chave[0], &timemark, &l->chave[1],
+				&origem_end, &destino_end, &l->chave[4]);
+		l->chave[2] = ntohl(origem_end);
+		l->chave[3] = ntohl(destino_end);
+		almatrix_sd_busca_pkts(i, &l->valor[0]);
+		almatrix_sd_busca_octets(i, &l->valor[1]);
+		almatrix_sd_busca_createtime(i, &l->valor[2]);
+	}
+
+	despeja(&d);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct timeval	inicio;
+	struct timeval	fim;
+	uint64_t	pacotes = 0;
+	long		threads;
+	unsigned int	i;
+	int		opcao;
+	int		ret = 0;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opcao = getopt(argc, argv, "j:")) != -1) {
+		switch (opcao) {
+			case 'j':
+				threads = atol(optarg);
+				if (threads <= 0)
+					uso(argv[0]);
+				break;
+			default:
+				uso(argv[0]);
+		}
+	}
+	if (optind == argc)
+		uso(argv[0]);
+
+	for (i = optind; i < (unsigned int)argc; i++)
+		arquivo_adiciona(argv[i]);
+	if (arquivos_qtd == 0) {
+		Fatal("no capture files");
+	}
+	qsort(arquivos, arquivos_qtd, sizeof(char *), compara_nomes);
+
+	if (threads > MAX_WORKERS)
+		threads = MAX_WORKERS;
+	if (threads > arquivos_qtd)
+		threads = arquivos_qtd;
+
+	for (i = 0; i < arquivos_qtd; i++)
+		arquivo_origem(arquivos[i]);
+
+	if (init_sysuptime() != SUCCESS) {
+		Fatal("error while initializing uptime accounting");
+	}
+
+	if (init_protocoldir(NULL) != SUCCESS) {
+		Fatal("error while initializing protocolDir group");
+	}
+
+	if (init_replay() != SUCCESS) {
+		Fatal("error while initializing replay");
+	}
+
+	if (shards_inicializa(threads) != SUCCESS) {
+		Fatal("could not create %ld table shards", threads);
+	}
+	for (i = 0; i < threads; i++) {
+		if (shards_aloca(i) != SUCCESS) {
+			Fatal("could not create %ld table shards", threads);
+		}
+	}
+	shards_ativa();
+
+	gettimeofday(&inicio, NULL);
+	for (i = 0; i < threads; i++) {
+		lotes[i].id = i;
+		lotes[i].passo = threads;
+		if (pthread_create(&lotes[i].thread, NULL, lote_executa,
+					&lotes[i]) != 0) {
+			Fatal("could not create accounting thread");
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(lotes[i].thread, NULL);
+		pacotes += lotes[i].pacotes;
+		if (lotes[i].ret != SUCCESS)
+			ret = 1;
+	}
+	gettimeofday(&fim, NULL);
+	timersub(&fim, &inicio, &fim);
+
+	fprintf(stderr, "%u files, %llu packets, %ld threads, %ld.%03ld s\n",
+			arquivos_qtd, (unsigned long long)pacotes, threads,
+			(long)fim.tv_sec, (long)fim.tv_usec / 1000);
+
+	/* the first traversal merges the shards */
+	despeja_pdist();
+	despeja_nlhost();
+	despeja_alhost();
+	despeja_nlmatrix();
+	despeja_almatrix();
+
+	return ret;
+}
@@ -0,0 +1,388 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file rmon2_bench.c
+ *  \brief Microbenchmark of the hash table of the data tables
+ *
+ *  Times tabela.c against the table nlHost and the others used before it:
+ *  PRIMO pointers to entries allocated one by one, probed by double
+ *  hashing.  Both get the same nlHost entries, keyed by address and
+ *  interface, and the same work: creating the entries, updating them in
+ *  random order (as packets do), looking up absent keys, and walking
+ *  every entry (as a consolidation does).  Addresses are either random or
+ *  consecutive, as those of a subnet.
+ *
+ *  Each step prints nanoseconds per operation, and a checksum that must be
+ *  the same for both tables.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "configuracao.h"
+#include "primo.h"
+#include "funcao_hash.h"
+#if PTSL
+#include "stateful.h"
+#endif
+#include "nl.h"
+#include "tabela.h"
+
+
+/* the table before tabela.c, as nlhost.c had it */
+#define PONTEIROS_MAX	65536
+
+typedef struct ponteiros_s {
+	nlhost_t	*hash[PRIMO];
+	unsigned int	quantidade;
+	unsigned int	profundidade;
+} ponteiros_t;
+
+/* the work of a run */
+typedef struct carga_s {
+	uint32_t	*chaves;	/* present */
+	uint32_t	*ausentes;
+	uint32_t	*sorteio;	/* indexes into chaves, for the updates */
+	unsigned int	 qtd;
+	unsigned int	 operacoes;
+} carga_t;
+
+
+static void uso(const char *nome)
+{
+	fprintf(stderr, "usage: %s [-n entries] [-o operations]\n", nome);
+	exit(1);
+}
+
+
+static uint64_t agora_ns()
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint32_t aleatorio(uint64_t *estado)
+{
+	*estado ^= *estado << 13;
+	*estado ^= *estado >> 7;
+	*estado ^= *estado << 17;
+	return (uint32_t)(*estado >> 16);
+}
+
+
+/* Pointers ******************************************************************/
+static unsigned int ponteiros_localiza(const ponteiros_t *t,
+		const uint32_t address, const unsigned int interface)
+{
+	unsigned int	i;
+	unsigned int	indice;
+
+	for (i = 0; i <= t->profundidade; i++) {
+		HASH(address, i, indice);
+		if ((t->hash[indice] != NULL) &&
+				(t->hash[indice]->hlhost_index == interface) &&
+				(t->hash[indice]->address == address))
+			return indice;
+	}
+
+	return PRIMO;
+}
+
+
+static nlhost_t *ponteiros_obtem(ponteiros_t *t, const uint32_t address,
+		const unsigned int interface)
+{
+	unsigned int	i = 0;
+	unsigned int	indice;
+
+	indice = ponteiros_localiza(t, address, interface);
+	if (indice != PRIMO)
+		return t->hash[indice];
+
+	HASH(address, i, indice);
+	while ((i < PONTEIROS_MAX) && (t->hash[indice] != NULL)) {
+		i++;
+		HASH(address, i, indice);
+	}
+	if (i >= PONTEIROS_MAX)
+		return NULL;
+	if (i > t->profundidade)
+		t->profundidade = i;
+
+	t->hash[indice] = calloc(1, sizeof(nlhost_t));
+	if (t->hash[indice] == NULL)
+		return NULL;
+	t->hash[indice]->address = address;
+	t->hash[indice]->hlhost_index = interface;
+	t->quantidade++;
+
+	return t->hash[indice];
+}
+
+
+static uint64_t ponteiros_percorre(const ponteiros_t *t)
+{
+	uint64_t	soma = 0;
+	unsigned int	indice;
+
+	for (indice = 0; indice < PRIMO; indice++)
+		if (t->hash[indice] != NULL)
+			soma += t->hash[indice]->in_pkts;
+
+	return soma;
+}
+
+
+static void ponteiros_libera(ponteiros_t *t)
+{
+	unsigned int	indice;
+
+	for (indice = 0; indice < PRIMO; indice++)
+		free(t->hash[indice]);
+	free(t);
+}
+
+
+/* Inline ********************************************************************/
+static int inline_confere(const void *entrada, const void *chave)
+{
+	const nlhost_t	*e = entrada;
+	const nlhost_t	*c = chave;
+
+	return (e->address == c->address) &&
+		(e->hlhost_index == c->hlhost_index);
+}
+
+
+static nlhost_t *inline_obtem(tabela_t *t, const uint32_t address,
+		const unsigned int interface)
+{
+	nlhost_t	 modelo;
+	nlhost_t	*p;
+	uint32_t	 hash = tabela_hash(address);
+	unsigned int	 indice;
+
+	modelo.address = address;
+	modelo.hlhost_index = interface;
+
+	indice = tabela_busca(t, hash, inline_confere, &modelo);
+	if (indice != t->posicoes)
+		return tabela_entrada(t, indice);
+
+	indice = tabela_insere(t, hash);
+	if (indice == t->posicoes)
+		return NULL;
+	p = tabela_entrada(t, indice);
+	p->address = address;
+	p->hlhost_index = interface;
+
+	return p;
+}
+
+
+static uint64_t inline_percorre(const tabela_t *t)
+{
+	uint64_t	soma = 0;
+	unsigned int	indice;
+
+	TABELA_PERCORRE(t, indice)
+		soma += ((const nlhost_t *)tabela_entrada(t, indice))->in_pkts;
+
+	return soma;
+}
+
+
+/* Runs **********************************************************************/
+static void mostra(const char *passo, const uint64_t ns,
+		const unsigned int operacoes, const uint64_t soma)
+{
+	printf("  %-8s %8.1f ns/op  (checksum %llu)\n", passo,
+			(double)ns / operacoes, (unsigned long long)soma);
+}
+
+
+static void roda_ponteiros(const carga_t *c)
+{
+	ponteiros_t	*t;
+	nlhost_t	*p;
+	uint64_t	 inicio;
+	uint64_t	 soma = 0;
+	unsigned int	 i;
+
+	t = calloc(1, sizeof(ponteiros_t));
+	if (t == NULL) {
+		fprintf(stderr, "not enough memory\n");
+		exit(1);
+	}
+
+	printf("pointers to calloc'd entries, %u slots (PRIMO)\n", PRIMO);
+
+	inicio = agora_ns();
+	for (i = 0; i < c->qtd; i++) {
+		p = ponteiros_obtem(t, c->chaves[i], 1);
+		if (p != NULL)
+			p->in_pkts++;
+	}
+	mostra("insert", agora_ns() - inicio, c->qtd, t->quantidade);
+
+	inicio = agora_ns();
+	for (i = 0; i < c->operacoes; i++) {
+		p = ponteiros_obtem(t, c->chaves[c->sorteio[i]], 1);
+		if (p != NULL)
+			p->in_pkts++;
+	}
+	mostra("update", agora_ns() - inicio, c->operacoes,
+			ponteiros_percorre(t));
+
+	inicio = agora_ns();
+	for (i = 0; i < c->qtd; i++)
+		soma += ponteiros_localiza(t, c->ausentes[i], 1) != PRIMO;
+	mostra("miss", agora_ns() - inicio, c->qtd, soma);
+
+	inicio = agora_ns();
+	soma = ponteiros_percorre(t);
+	mostra("walk", agora_ns() - inicio, c->qtd, soma);
+
+	ponteiros_libera(t);
+}
+
+
+static void roda_inline(const carga_t *c)
+{
+	tabela_t	*t;
+	nlhost_t	*p;
+	nlhost_t	 modelo;
+	uint64_t	 inicio;
+	uint64_t	 soma = 0;
+	unsigned int	 i;
+
+	t = tabela_cria(sizeof(nlhost_t), TABELAS_POSICOES);
+	if (t == NULL) {
+		fprintf(stderr, "not enough memory\n");
+		exit(1);
+	}
+
+	printf("inline entries, %u slots (TABELAS_POSICOES), %s\n",
+			TABELAS_POSICOES, TABELA_SIMD ? "SSE2" : "no SIMD");
+
+	inicio = agora_ns();
+	for (i = 0; i < c->qtd; i++) {
+		p = inline_obtem(t, c->chaves[i], 1);
+		if (p != NULL)
+			p->in_pkts++;
+	}
+	mostra("insert", agora_ns() - inicio, c->qtd, t->quantidade);
+
+	inicio = agora_ns();
+	for (i = 0; i < c->operacoes; i++) {
+		p = inline_obtem(t, c->chaves[c->sorteio[i]], 1);
+		if (p != NULL)
+			p->in_pkts++;
+	}
+	mostra("update", agora_ns() - inicio, c->operacoes,
+			inline_percorre(t));
+
+	modelo.hlhost_index = 1;
+	inicio = agora_ns();
+	for (i = 0; i < c->qtd; i++) {
+		modelo.address = c->ausentes[i];
+		soma += tabela_busca(t, tabela_hash(modelo.address),
+				inline_confere, &modelo) != t->posicoes;
+	}
+	mostra("miss", agora_ns() - inicio, c->qtd, soma);
+
+	inicio = agora_ns();
+	soma = inline_percorre(t);
+	mostra("walk", agora_ns() - inicio, c->qtd, soma);
+
+	free(t->controle);
+	free(t->entradas);
+	free(t);
+}
+
+
+int main(int argc, char *argv[])
+{
+	carga_t		c;
+	uint64_t	estado = 0x2545f4914f6cdd1dULL;
+	unsigned int	i;
+	int		sequencial;
+	int		opcao;
+
+	c.qtd = TABELAS_ENTRADAS - 1;
+	c.operacoes = 10000000;
+	while ((opcao = getopt(argc, argv, "n:o:")) != -1) {
+		switch (opcao) {
+			case 'n':
+				c.qtd = atoi(optarg);
+				break;
+			case 'o':
+				c.operacoes = atoi(optarg);
+				break;
+			default:
+				uso(argv[0]);
+		}
+	}
+	if ((c.qtd == 0) || (c.qtd > TABELAS_ENTRADAS) ||
+			(c.operacoes == 0))
+		uso(argv[0]);
+
+	c.chaves = malloc(c.qtd * sizeof(uint32_t));
+	c.ausentes = malloc(c.qtd * sizeof(uint32_t));
+	c.sorteio = malloc(c.operacoes * sizeof(uint32_t));
+	if ((c.chaves == NULL) || (c.ausentes == NULL) || (c.sorteio == NULL)) {
+		fprintf(stderr, "not enough memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < c.operacoes; i++)
+		c.sorteio[i] = aleatorio(&estado) % c.qtd;
+
+	for (sequencial = 0; sequencial <= 1; sequencial++) {
+		/* odd addresses present, even ones absent */
+		for (i = 0; i < c.qtd; i++) {
+			if (sequencial) {
+				c.chaves[i] = 0x0a000001 + 2 * i;
+			}
+			else {
+				c.chaves[i] = aleatorio(&estado) | 1;
+			}
+			c.ausentes[i] = c.chaves[i] + 1;
+		}
+
+		printf("\n%u %s addresses, %u updates\n", c.qtd,
+				sequencial ? "consecutive" : "random",
+				c.operacoes);
+		roda_ponteiros(&c);
+		roda_inline(&c);
+	}
+
+	return 0;
+}
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include "configuracao.h"
 
@@ -43,24 +44,92 @@
 #include "conversor.h"
 #include "protocoldir.h"
 #include "sysuptime.h"
+#include "afinidade.h"
 #include "log.h"
 
 
-int main()
+static void uso(const char *nome)
+{
+	fprintf(stderr, "usage: %s [-r file.pcap [-s speed]]\n"
+			"  -r  account the packets of a capture file and exit\n"
+			"  -s  follow the capture timestamps, `speed' times "
+			"faster (default: as fast\n"
+			"      as possible)\n", nome);
+	exit(1);
+}
+
+
+/* reloads protocolDir on each SIGHUP, which every other thread blocks */
+static void *recarrega(void *arg)
+{
+	sigset_t	sinais;
+	int		sinal;
+
+	sigemptyset(&sinais);
+	sigaddset(&sinais, SIGHUP);
+
+	for (;;) {
+		if (sigwait(&sinais, &sinal) != 0)
+			continue;
+		pdir_recarrega(NULL);
+	}
+
+	return arg;
+}
+
+
+int main(int argc, char *argv[])
 {
 	pthread_t	captura;
+	pthread_t	recarga;
+	sigset_t	sinais;
 #if PTSL
 	pthread_t	servidor;
 #endif
+	char		*arquivo = NULL;
+	double		velocidade = 0;
+	int		opcao;
+
+	while ((opcao = getopt(argc, argv, "r:s:")) != -1) {
+		switch (opcao) {
+			case 'r':
+				arquivo = optarg;
+				break;
+			case 's':
+				velocidade = atof(optarg);
+				if (velocidade <= 0)
+					uso(argv[0]);
+				break;
+			default:
+				uso(argv[0]);
+		}
+	}
+	if ((optind < argc) || ((velocidade > 0) && (arquivo == NULL)))
+		uso(argv[0]);
 
 	if (init_sysuptime() != SUCCESS) {
 		Fatal("error while initializing uptime accounting");
 	}
+	afinidade_inicializa();
 
 	if (init_protocoldir(NULL) != SUCCESS) {
 		Fatal("error while initializing protocolDir group");
 	}
 
+	if (arquivo != NULL) {
+		/* offline: no capture, no server, just the tables */
+		if (init_replay() != SUCCESS) {
+			Fatal("error while initializing replay");
+		}
+
+		return (captura_arquivo(arquivo, velocidade) == SUCCESS) ? 0 : 1;
+	}
+
+	/* before any thread exists, so that only `recarga' takes SIGHUP */
+	sigemptyset(&sinais);
+	sigaddset(&sinais, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sinais, NULL);
+
 	if (init_sniffer() != SUCCESS) {
 		Fatal("error while initializing packet sniffer");
 	}
@@ -69,6 +138,10 @@ int main()
 		Fatal("could not create packet sniffer thread");
 	}
 
+	if (pthread_create(&recarga, NULL, recarrega, NULL) != 0) {
+		Fatal("could not create protocolDir reload thread");
+	}
+
 #if PTSL
 	if (pthread_create(&servidor, NULL, server_start, NULL)) {
 		Fatal("could not create server thread");
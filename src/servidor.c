@@ -43,6 +43,7 @@
 #include "exit_codes.h"
 #include "pedb.h"
 #include "tracos.h"
+#include "afinidade.h"
 //#include "debug.h"
 
 #define SERVER_QUEUE	16
@@ -91,6 +92,8 @@ server_start()
 	int			socket_client;
 	int			buflen;
 
+	afinidade_aplica(AFINIDADE_PTSL, 0);
+
 	/* acquire socket */
 	socket_main = socket(AF_INET, SOCK_STREAM, 0);
 	if (socket_main == -1) {
@@ -285,8 +288,13 @@ server_execute(int peer, char *command_string)
 			break;
 
 		case CMD_REMOVE:
-			Debug("REMOVE not implemented yet :(");
-			return ERROR_NEEDCODING;
+			if (pdir_traco_remove(atoi(ptsl_id)) != SUCCESS) {
+#ifdef DEBUG_SERVER
+				Debug("failed to remove ptsl_id:%d", atoi(ptsl_id));
+#endif
+				return ERROR_PARAMETER;
+			}
+			return SUCCESS;
 			break;
 
 		default:
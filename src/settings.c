@@ -21,29 +21,199 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-char *
-conf_get_interface() {
+#include "settings.h"
+
+
+/** \brief Looks up a "key = value" pair in the configuration file.
+ *
+ *  \return A malloc'ed copy of the value, or NULL if \a chave is not there.
+ */
+static char *
+conf_get_valor(const char *chave)
+{
 	/* FIXME: this is UGLY */
-	FILE	*file = fopen("/etc/rmon2/rmon2.conf", "r");
+	FILE	*file = fopen(CONF_ARQUIVO, "r");
 	char	linha[96] = {0,};
 	char	*token;
+	char	*valor = NULL;
+
+	if (file == NULL)
+		return NULL;
 
 	while (fgets(linha, 96, file) != NULL) {
 		token = strtok(linha, "\n\r\t ");
 		if (token == NULL)
 			continue;
-		if (strcmp(token, "interface") != 0)
+		if (strcmp(token, chave) != 0)
 			continue;
 
 		token = strtok(NULL, "\n\r\t ");
 		token = strtok(NULL, "\n\r\t ");
+		if (token != NULL)
+			valor = strdup(token);
+		break;
+	}
+
+	fclose(file);
+	return valor;
+}
+
+
+/** \brief Which network interfaces to monitor.
+ *
+ *  The "interface" key takes one name or a comma separated list of them
+ *  (e.g. "eth0,eth1").
+ *
+ *  \param nomes	Receives up to \a max malloc'ed interface names.
+ *  \return How many names were stored in \a nomes.
+ */
+unsigned int
+conf_get_interfaces(char **nomes, const unsigned int max) {
+	char		*valor = conf_get_valor("interface");
+	char		*resto;
+	char		*nome;
+	unsigned int	quantas = 0;
+
+	if (valor == NULL)
+		return 0;
+
+	for (nome = strtok_r(valor, ",", &resto);
+			(nome != NULL) && (quantas < max);
+			nome = strtok_r(NULL, ",", &resto)) {
+		nomes[quantas++] = strdup(nome);
+	}
+
+	free(valor);
+	return quantas;
+}
+
+
+/** \brief Reads a list of CPUs, such as "2", "0-3" or "0,2,4-5".
+ *
+ *  \param chave	Which key to read (cpu_capture, cpu_accounting...).
+ *  \param cpus		Receives up to \a max CPU numbers, in the given order.
+ *  \return How many CPUs were stored in \a cpus (0 if the key is unset).
+ */
+unsigned int
+conf_get_cpus(const char *chave, unsigned int *cpus, const unsigned int max) {
+	char		*valor = conf_get_valor(chave);
+	char		*resto;
+	char		*faixa;
+	char		*fim;
+	unsigned long	primeira;
+	unsigned long	ultima;
+	unsigned int	quantas = 0;
+
+	if (valor == NULL)
+		return 0;
 
-		fclose(file);
-		return strdup(token);
+	for (faixa = strtok_r(valor, ",", &resto);
+			(faixa != NULL) && (quantas < max);
+			faixa = strtok_r(NULL, ",", &resto)) {
+		primeira = ultima = strtoul(faixa, &fim, 10);
+		if (fim == faixa)
+			continue;
+		if (*fim == '-')
+			ultima = strtoul(fim + 1, NULL, 10);
+
+		while ((primeira <= ultima) && (quantas < max))
+			cpus[quantas++] = primeira++;
 	}
 
-	return NULL;
+	free(valor);
+	return quantas;
 }
 
+
+/** \brief Whether the other threads must stay off the cpu_snmp CPUs.
+ *
+ *  \return 1 if cpu_isolate_snmp is "yes", 0 otherwise.
+ */
+int
+conf_get_isolate_snmp() {
+	char	*valor = conf_get_valor("cpu_isolate_snmp");
+	int	isolar;
+
+	if (valor == NULL)
+		return 0;
+
+	isolar = (strcmp(valor, "yes") == 0);
+	free(valor);
+
+	return isolar;
+}
+
+
+/** \brief Which capture backend to use ("pcap", the default, "tpacket" or
+ *  "af_xdp"). */
+char *
+conf_get_capture() {
+	char	*valor = conf_get_valor("capture");
+
+	if (valor == NULL)
+		return strdup(CONF_CAPTURE_PCAP);
+
+	return valor;
+}
+
+
+/** \brief Where protocolDist and nlHost are counted ("user", the default, or
+ *  "ebpf"). */
+char *
+conf_get_aggregation() {
+	char	*valor = conf_get_valor("aggregation");
+
+	if (valor == NULL)
+		return strdup(CONF_AGGREGATION_USER);
+
+	return valor;
+}
+
+
+/** \brief How many accounting workers to run (1, the default, if unset). */
+unsigned int
+conf_get_workers() {
+	char		*valor = conf_get_valor("workers");
+	unsigned int	workers = 1;
+
+	if (valor != NULL) {
+		workers = strtoul(valor, NULL, 10);
+		free(valor);
+	}
+
+	return (workers > 0) ? workers : 1;
+}
+
+
+/** \brief Accounts 1 in every `sampling' packets (1, the default, is all). */
+unsigned int
+conf_get_sampling() {
+	char		*valor = conf_get_valor("sampling");
+	unsigned int	sampling = 1;
+
+	if (valor != NULL) {
+		sampling = strtoul(valor, NULL, 10);
+		free(valor);
+	}
+
+	return (sampling > 0) ? sampling : 1;
+}
+
+
+/** \brief Window (microseconds) to drop repeated frames in (0, the default,
+ *  keeps them). */
+unsigned int
+conf_get_dedup_window() {
+	char		*valor = conf_get_valor("dedup_window");
+	unsigned int	janela = 0;
+
+	if (valor != NULL) {
+		janela = strtoul(valor, NULL, 10);
+		free(valor);
+	}
+
+	return janela;
+}
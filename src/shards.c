@@ -0,0 +1,204 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file shards.c
+ *  \brief Per-worker table shards and their merged view
+ *
+ *  With more than one accounting worker, each worker updates private copies
+ *  (shards) of the data tables, so they never share a cache line nor need a
+ *  lock per packet.  Managers keep seeing a single table: when the SNMP side
+ *  starts walking a table, the shards are summed into the merged table, at
+ *  most once every SHARDS_INTERVALO.
+ *
+ *  A worker holds its shard lock while it accounts a batch of packets; the
+ *  merge takes each lock in turn, so it only ever stalls one worker.  A
+ *  single worker takes its lock too, as its table is the one SNMP reads:
+ *  rows are only removed with the lock of the table they are in.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "sysuptime.h"
+#include "shards.h"
+#ifdef __linux__
+#include "agregador.h"
+#endif
+#include "log.h"
+
+
+/** \brief Number of workers (1 means no shards at all) */
+static unsigned int	shards_qtd = 1;
+/** \brief Number of workers once every shard is allocated */
+static unsigned int	shards_previstos = 1;
+/** \brief One lock per shard, held by its worker during a batch */
+static pthread_mutex_t	shards_travas[MAX_WORKERS] = {
+	[0 ... MAX_WORKERS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+/** \brief Uptime of the last merge */
+static unsigned long	shards_ultima;
+
+
+/** \brief Prepares the shards of \a workers workers.
+ *
+ *  Must be called before the workers start.  Each worker then allocates its
+ *  own shard with shards_aloca(), and once all of them did, shards_ativa()
+ *  turns sharding on.
+ *
+ *  \retval SUCCESS		If the shards can be created (or are not needed).
+ *  \retval ERROR_PARAMETER	If \a workers is out of range.
+ */
+int
+shards_inicializa(const unsigned int workers)
+{
+	if ((workers == 0) || (workers > MAX_WORKERS))
+		return ERROR_PARAMETER;
+
+	shards_previstos = workers;
+
+	return SUCCESS;
+}
+
+
+/** \brief Allocates the shard of \a worker in every table.
+ *
+ *  Meant to be called by the worker itself, after it was placed on its CPU,
+ *  so that its tables are local to it.
+ *
+ *  \retval SUCCESS		If the shard was created (or is not needed).
+ *  \retval ERROR_CALLOC	If there is not enough memory.
+ */
+int
+shards_aloca(const unsigned int worker)
+{
+	if (shards_previstos == 1)
+		return SUCCESS;
+
+	if ((nlhost_shard_aloca(worker) != SUCCESS) ||
+			(alhost_shard_aloca(worker) != SUCCESS) ||
+			(nlmatrix_SD_shard_aloca(worker) != SUCCESS) ||
+			(nlmatrix_DS_shard_aloca(worker) != SUCCESS) ||
+			(almatrix_SD_shard_aloca(worker) != SUCCESS) ||
+			(almatrix_DS_shard_aloca(worker) != SUCCESS) ||
+			(pdist_shard_aloca(worker) != SUCCESS)) {
+		Debug("not enough memory for the shard of worker %u", worker);
+		return ERROR_CALLOC;
+	}
+
+	return SUCCESS;
+}
+
+
+/** \brief Starts using the shards, once every worker allocated its own. */
+void
+shards_ativa()
+{
+	shards_qtd = shards_previstos;
+	if (shards_qtd > 1)
+		Debug("%u workers, tables are sharded", shards_qtd);
+}
+
+
+/** \brief Returns the number of workers. */
+unsigned int
+shards_quantidade()
+{
+	return shards_qtd;
+}
+
+
+/** \brief Locks the table \a worker accounts into (its shard, or the
+ *  merged table when it is alone), against removals of rows. */
+void
+shards_trava(const unsigned int worker)
+{
+	pthread_mutex_lock(&shards_travas[worker]);
+}
+
+
+void
+shards_destrava(const unsigned int worker)
+{
+	pthread_mutex_unlock(&shards_travas[worker]);
+}
+
+
+/* zeroes the merged tables and sums every shard into them */
+static void
+shards_soma()
+{
+	unsigned int	w;
+
+	nlhost_consolida_zera();
+	alhost_consolida_zera();
+	nlmatrix_SD_consolida_zera();
+	nlmatrix_DS_consolida_zera();
+	almatrix_SD_consolida_zera();
+	almatrix_DS_consolida_zera();
+	pdist_consolida_zera();
+
+	for (w = 0; w < shards_qtd; w++) {
+		pthread_mutex_lock(&shards_travas[w]);
+		nlhost_consolida(w);
+		alhost_consolida(w);
+		nlmatrix_SD_consolida(w);
+		nlmatrix_DS_consolida(w);
+		almatrix_SD_consolida(w);
+		almatrix_DS_consolida(w);
+		pdist_consolida(w);
+		pthread_mutex_unlock(&shards_travas[w]);
+	}
+}
+
+
+/** \brief Rebuilds the merged view of every table from the shards.
+ *
+ *  Called by the SNMP side before traversing a table.  Does nothing with a
+ *  single worker (unless protocolDist and nlHost are counted in the kernel),
+ *  or if the last merge is recent enough.
+ */
+void
+shards_consolida()
+{
+	unsigned long	agora;
+
+#ifdef __linux__
+	if ((shards_qtd == 1) && !agregador_ativo())
+		return;
+#else
+	if (shards_qtd == 1)
+		return;
+#endif
+
+	agora = sysuptime();
+	if ((shards_ultima != 0) && (agora - shards_ultima < SHARDS_INTERVALO))
+		return;
+	shards_ultima = agora;
+
+	if (shards_qtd > 1)
+		shards_soma();
+#ifdef __linux__
+	agregador_consolida();
+#endif
+}
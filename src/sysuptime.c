@@ -27,10 +27,17 @@
  *  uptime counter and also to retrieve uptime timestamps, both in
  *  centiseconds (as required by the RMON2-MIB) and milliseconds (needed by
  *  ID-Trace)
+ *
+ *  The uptime is kept in 64-bit milliseconds, read from a coarse monotonic
+ *  clock (no system call, a few milliseconds of resolution) plus the offset
+ *  to the system uptime taken at initialization.  The capture threads do
+ *  not even read it per packet: sysuptime_lote() stamps a whole batch, and
+ *  every packet and PTSL deadline of that batch shares the stamp.
  */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
 
 #ifdef __FreeBSD__
 #include <sys/types.h>
@@ -38,35 +45,36 @@
 #include <sys/sysctl.h>
 #endif
 
-#include "rdtsc.h"
 #include "sysuptime.h"
 #include "configuracao.h"
 #include "exit_codes.h"
 
+#if defined(CLOCK_MONOTONIC_COARSE)
+#   define RELOGIO	CLOCK_MONOTONIC_COARSE
+#elif defined(CLOCK_MONOTONIC_FAST)
+#   define RELOGIO	CLOCK_MONOTONIC_FAST
+#else
+#   define RELOGIO	CLOCK_MONOTONIC
+#endif
 
-/** \brief Persistent variable used only to obtain processor ticks. */
-static uint64_t		to_store_rdtsc;
 
-/** \brief Persistent variable which stores the processor ticks synchronized to
- *  system uptime (as read from \c /proc/uptime), in reciprocal form (multiply
- *  is faster than divide).
- */
-static float		base_cputicks_inverse;
-/** \brief Persistent variable which holds current processor ticks in floating
- *  point format.
- */
-static float		last_cputicks;		/* avoid dynamic memory allocation */
+/** \brief System uptime minus RELOGIO, in milliseconds */
+static int64_t		base_mili;
+/** \brief Uptime in milliseconds set by sysuptime_define() or
+ *  sysuptime_lote(), or 0 to read the clock; each thread has its own */
+static __thread uint64_t	manual_mili;
+
+
+/* RELOGIO, in milliseconds */
+static inline uint64_t
+relogio_mili()
+{
+	struct timespec	agora;
+
+	clock_gettime(RELOGIO, &agora);
+	return (uint64_t)agora.tv_sec * 1000 + agora.tv_nsec / 1000000;
+}
 
-/** \brief Uptime read from \c /proc/uptime */
-static float		base_uptime;
-/** \brief Persistent variable used to calculate system uptime and then return.
- *
- *  Used to calculate system uptime from processor ticks, using a simple formula:
- *  \f[ lastcputicks * basecputicksinverse \f]
- *  Which is a simplified (and faster) than this equivalent formula:
- *  \f[ lastcputicks * \frac{1}{basecputicks} \f]
- */
-static float		last_uptime;
 
 /** \brief Initializes the uptime counter.
  *
@@ -81,38 +89,29 @@ static float		last_uptime;
 int
 init_sysuptime()
 {
-	uint64_t    base_cputicks_64;
-	float	    raw_uptime;
+	double	    raw_uptime;
 
 #ifdef __linux__
 	FILE	    *f_ptr = fopen("/proc/uptime", "r");
-	if ((f_ptr == NULL) || (fscanf(f_ptr, "%f", &raw_uptime) != 1)) {
+	if ((f_ptr == NULL) || (fscanf(f_ptr, "%lf", &raw_uptime) != 1)) {
 		return ERROR_IO;
 	}
 	fclose(f_ptr);
 #endif
 #ifdef __FreeBSD__
 	int mib[2] = {CTL_KERN, KERN_BOOTTIME};
-	int len = sizeof(struct timeval);
+	size_t len = sizeof(struct timeval);
 	struct timeval uptime = {.tv_sec = 0, .tv_usec = 0};
 	struct timeval now = {.tv_sec = 0, .tv_usec = 0};
 	if (sysctl(mib, 2, &uptime, &len, NULL, 0) == -1) {
 		return ERROR_IO;
 	}
 	gettimeofday(&now, NULL);
-	raw_uptime = ((float)(now.tv_sec) + (float)(now.tv_usec / 1000000.0)) -
-		((float)(uptime.tv_sec) + (float)(uptime.tv_usec / 1000000.0));
+	raw_uptime = ((double)(now.tv_sec) + (double)(now.tv_usec / 1000000.0)) -
+		((double)(uptime.tv_sec) + (double)(uptime.tv_usec / 1000000.0));
 #endif
 
-	/* evitar distanciamento entre uptime e cpu_ticks */
-	rdtsc(base_cputicks_64);
-
-	/* to avoid a further SIGFPE, and be faster */
-	base_cputicks_inverse = base_cputicks_64;
-	base_cputicks_inverse = 1.0 / base_cputicks_inverse;
-
-	/* adjust integer uptime */
-	base_uptime = raw_uptime * 100;
+	base_mili = (int64_t)(raw_uptime * 1000) - (int64_t)relogio_mili();
 
 	return SUCCESS;
 }
@@ -126,11 +125,7 @@ init_sysuptime()
 unsigned long
 sysuptime()
 {
-	rdtsc(to_store_rdtsc);
-	last_cputicks = (float)to_store_rdtsc;
-	last_uptime = base_uptime * last_cputicks * base_cputicks_inverse;
-
-	return last_uptime;
+	return sysuptime_mili() / 10;
 }
 
 
@@ -139,13 +134,40 @@ sysuptime()
  *  Calculates and returns system uptime in milliseconds.
  *  \return Milliseconds since system boot-up.
  */
-unsigned long
+uint64_t
 sysuptime_mili()
 {
-	rdtsc(to_store_rdtsc);
-	last_cputicks = (float)to_store_rdtsc;
-	last_uptime = 10 * base_uptime * last_cputicks * base_cputicks_inverse;
+	if (manual_mili != 0)
+		return manual_mili;
 
-	return last_uptime;
+	return relogio_mili() + base_mili;
 }
 
+
+/** \brief Stamps the batch the calling thread is about to account.
+ *
+ *  Until the next call, sysuptime() and sysuptime_mili() return the uptime
+ *  of this call to this thread.  Called by the capture loops once per
+ *  wake-up, empty or not, so the stamp is never older than their poll
+ *  timeout.
+ */
+void
+sysuptime_lote()
+{
+	manual_mili = 0;
+	manual_mili = sysuptime_mili();
+}
+
+
+/** \brief Stops the clock of the calling thread at the given uptime.
+ *
+ *  Used when replaying capture files, so the tables are timestamped by the
+ *  packets, not by the replay.  Until the next call, sysuptime() and
+ *  sysuptime_mili() return \a mili (in milliseconds) to this thread; 0
+ *  goes back to the real clock.
+ */
+void
+sysuptime_define(const uint64_t mili)
+{
+	manual_mili = mili;
+}
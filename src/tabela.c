@@ -0,0 +1,166 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file tabela.c
+ *  \brief The hash table under nlHost, alHost, the matrices and
+ *  protocolDist
+ *
+ *  Slots come in groups of TABELA_GRUPO, each with one control byte; a
+ *  lookup compares the 7 bits of the hash kept there for a whole group at
+ *  once, and only reads the entries (stored inline, right in the table)
+ *  whose byte matched.  Probing goes from group to group, and stops at the
+ *  first group with a slot never used.
+ *
+ *  The capacity is fixed when the table is made: it never grows, so the
+ *  flow cache may keep pointers to the entries.  A slot also serves as the
+ *  index of its entry for the SNMP side, for as long as it is there.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "configuracao.h"
+#include "tabela.h"
+
+#if (TABELAS_POSICOES < TABELA_GRUPO) || \
+	(TABELAS_POSICOES & (TABELAS_POSICOES - 1))
+#error TABELAS_POSICOES must be a power of 2, and TABELA_GRUPO at least
+#endif
+#if TABELA_MAXIMO(TABELAS_POSICOES) < TABELAS_ENTRADAS
+#error TABELAS_POSICOES too small to hold TABELAS_ENTRADAS
+#endif
+
+
+/** \brief Allocates an empty table of \a posicoes slots (a power of 2) for
+ *  entries of \a tamanho bytes.  The memory is only touched as used, so
+ *  the pages come from the NUMA node of whoever fills them.
+ *
+ *  \return The table, or NULL if there is no memory for it.
+ */
+tabela_t *
+tabela_cria(const size_t tamanho, const unsigned int posicoes)
+{
+	tabela_t	*t;
+
+	if ((posicoes < TABELA_GRUPO) || (posicoes & (posicoes - 1)))
+		return NULL;
+
+	t = calloc(1, sizeof(tabela_t));
+	if (t == NULL)
+		return NULL;
+
+	t->controle = calloc(posicoes, 1);
+	t->entradas = calloc(posicoes, tamanho);
+	if ((t->controle == NULL) || (t->entradas == NULL)) {
+		free(t->controle);
+		free(t->entradas);
+		free(t);
+		return NULL;
+	}
+
+	t->tamanho = tamanho;
+	t->posicoes = posicoes;
+	t->maximo = TABELA_MAXIMO(posicoes);
+
+	return t;
+}
+
+
+/** \brief Takes a slot for a new entry whose key gave \a hash, which must
+ *  not be in \a t already.  The entry comes zeroed.
+ *
+ *  \return Its slot, or \a t->posicoes if the table is full.
+ */
+unsigned int
+tabela_insere(tabela_t *t, const uint32_t hash)
+{
+	uint8_t		*c;
+	unsigned int	 grupo = tabela_grupo(t, hash);
+	unsigned int	 passo;
+	unsigned int	 livres;
+	unsigned int	 slot;
+
+	if (t->quantidade >= t->maximo)
+		return t->posicoes;
+
+	/* below the maximum, some group has a free slot */
+	for (passo = 0; ; passo++) {
+		c = t->controle + grupo * TABELA_GRUPO;
+		livres = ~tabela_ocupados(c) & ((1U << TABELA_GRUPO) - 1);
+		if (livres != 0)
+			break;
+		grupo = tabela_seguinte(t, grupo, passo);
+	}
+
+	slot = grupo * TABELA_GRUPO + __builtin_ctz(livres);
+	t->controle[slot] = TABELA_OCUPADO | (hash & 0x7f);
+	memset(tabela_entrada(t, slot), 0, t->tamanho);
+
+	t->quantidade++;
+	if (passo > t->profundidade)
+		t->profundidade = passo;
+
+	return slot;
+}
+
+
+/** \brief Frees \a slot of \a t.  Whoever may hold pointers to its entry
+ *  (the flow cache) must have let go of them. */
+void
+tabela_remove(tabela_t *t, const unsigned int slot)
+{
+	const uint8_t	*c;
+
+	if (!tabela_ocupada(t, slot))
+		return;
+
+	/* if no probe went on past this group, none has to in the future */
+	c = t->controle + (slot & ~(TABELA_GRUPO - 1));
+	if (tabela_iguais(c, TABELA_VAZIO) != 0)
+		t->controle[slot] = TABELA_VAZIO;
+	else
+		t->controle[slot] = TABELA_APAGADO;
+
+	t->quantidade--;
+}
+
+
+/** \brief The first slot from \a slot on holding an entry, or
+ *  \a t->posicoes */
+unsigned int
+tabela_proximo(const tabela_t *t, unsigned int slot)
+{
+	unsigned int	grupo;
+	unsigned int	bits;
+
+	while (slot < t->posicoes) {
+		grupo = slot / TABELA_GRUPO;
+		bits = tabela_ocupados(t->controle + grupo * TABELA_GRUPO) >>
+			(slot % TABELA_GRUPO);
+		if (bits != 0)
+			return slot + __builtin_ctz(bits);
+		slot = (grupo + 1) * TABELA_GRUPO;
+	}
+
+	return t->posicoes;
+}
@@ -69,7 +69,7 @@ static u_int		nr_colisoes = 0;
 static pedb_t		*pedb = NULL;
 
 /** \brief Pointer to the packet data area. \hideinitializer*/
-static u_char		*dados_ptr = NULL;
+static const u_char	*dados_ptr = NULL;
 
 /** \brief Pointer to the state being processed \hideinitializer*/
 static estado_t		*estado_pendente_ptr = NULL;
@@ -116,7 +116,7 @@ static u_int		    li_tracos_qtd = 0;
  *  \param len How many chars to copy from \a src to \a dst.
  */
 static void
-do_char_memcpy(u_char *dst, u_char *src, unsigned long len)
+do_char_memcpy(u_char *dst, const u_char *src, unsigned long len)
 {
 	while (len) {
 		len--;
@@ -320,7 +320,7 @@ pend_remove()
 static int
 testa_mensagem(mensagem_t *msg_ptr)
 {
-	u_char	    *cru_ptr;
+	const u_char	    *cru_ptr;
 	variavel_t	    *v_ptr;
 	u_int	    i,j;
 
@@ -868,7 +868,7 @@ void *
 tracos_check_remove_pend()
 {
 	unsigned long   chave;
-	unsigned long   actual_time;
+	uint64_t	actual_time;
 	u_int	    indice, i;
 	li_inst_t	    *instPtr;
 	estado_t	    *statePtr;
@@ -1477,7 +1477,7 @@ tracos_localiza_corrige_id(const u_int id)
  *  main function to deal with traces (new or pendencies)
  */
 int
-tracos_verifica(pedb_t *prepacote, u_char *area_dados_ptr)
+tracos_verifica(pedb_t *prepacote, const u_char *area_dados_ptr)
 {
 	uint32_t	ip;
 	/*
@@ -1516,7 +1516,9 @@ tracos_verifica(pedb_t *prepacote, u_char *area_dados_ptr)
 			/* check timeout, if there is one */
 			if ((li_atual_ptr->validade_ms) && (sysuptime_mili() > li_atual_ptr->validade_ms)) {
 				/* expired */
-				Debug("timeout: %u // %lu", li_atual_ptr->validade_ms, sysuptime_mili());
+				Debug("timeout: %llu // %llu",
+						(unsigned long long)li_atual_ptr->validade_ms,
+						(unsigned long long)sysuptime_mili());
 				li_atual_ptr->traco_ptr->nr_falhas++;
 				pend_remove();
 				continue;
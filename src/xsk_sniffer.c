@@ -0,0 +1,617 @@
+/*
+ * Ramon - A RMON2 Network Monitoring Agent
+ * Copyright (C) 2005 Ricardo Nabinger Sanchez
+ *
+ * This file is part of Ramon, a network monitoring agent which implements
+ * the MIB proposed in RFC-2021.
+ *
+ * Ramon is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * Ramon is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with program; see the file COPYING. If not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/** \file xsk_sniffer.c
+ *
+ *  AF_XDP capture backend.  A tiny XDP program is attached to the interface
+ *  and redirects every frame to an XSK socket bound to the receive queue it
+ *  arrived on.  Frames land in a memory area (UMEM) shared with the kernel --
+ *  without copies at all if the driver supports zero-copy mode -- and are
+ *  accounted in place, then handed back through the fill ring.
+ *
+ *  No libbpf is needed: the program is assembled here and everything is done
+ *  with the bpf() syscall and plain socket options.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/if_packet.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#include "configuracao.h"
+#include "exit_codes.h"
+#include "pkt_sniffer.h"
+#include "xsk_sniffer.h"
+#include "log.h"
+
+
+/*
+ *  local defines
+ */
+/** \brief Maximum number of receive queues per interface */
+#define XSK_MAX_FILAS	16
+/** \brief UMEM chunk size (one frame per chunk) */
+#define XSK_FRAME_TAM	2048
+/** \brief UMEM chunks per receive queue */
+#define XSK_FRAMES	4096
+/** \brief Descriptors in the RX ring */
+#define XSK_RX_TAM	2048
+/** \brief Descriptors in the fill ring (room for every chunk) */
+#define XSK_FILL_TAM	XSK_FRAMES
+/** \brief Descriptors in the completion ring (unused, we never transmit) */
+#define XSK_COMP_TAM	64
+
+
+/** \brief One of the single-producer/single-consumer rings shared with the kernel */
+typedef struct xsk_anel_s {
+	volatile uint32_t	*produtor;
+	volatile uint32_t	*consumidor;
+	volatile uint32_t	*flags;
+	void			*descritores;
+	uint32_t		 mascara;
+	void			*mapa;		/* as returned by mmap() */
+	size_t			 mapa_tam;
+} xsk_anel_t;
+
+/** \brief An XSK socket, bound to one receive queue, with its own UMEM */
+typedef struct xsk_fila_s {
+	int		 socket;
+	uint8_t		*umem;
+	xsk_anel_t	 rx;
+	xsk_anel_t	 fill;
+} xsk_fila_t;
+
+/** \brief State of one network interface captured through AF_XDP */
+typedef struct xsk_s {
+	int		 ifindex;
+	int		 mapa_fd;	/* XSKMAP: queue index -> socket */
+	int		 prog_fd;
+	int		 link_fd;	/* closing it detaches the program */
+	int		 promisc_fd;	/* closing it leaves promiscuous mode */
+	unsigned int	 qtd_filas;
+	unsigned int	 fila_atual;	/* queue of the last xsk_recebe() */
+	uint32_t	 recebidos;	/* frames held by the caller */
+	uint64_t	 descartes;	/* kernel drops already reported */
+	struct pollfd	 pfd[XSK_MAX_FILAS];
+	xsk_fila_t	 filas[XSK_MAX_FILAS];
+	unsigned int	 em_uso;
+} xsk_t;
+
+
+/*
+ *  global variables
+ */
+static xsk_t	xsks[MAX_INTERFACES];
+
+
+static inline int
+sys_bpf(const int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/** \brief Loads the XDP program that feeds the XSKMAP.
+ *
+ *  Equivalent to:
+ *  \code
+ *  return bpf_redirect_map(&xskmap, ctx->rx_queue_index, XDP_PASS);
+ *  \endcode
+ *  so frames of queues without a socket keep going up the stack.
+ */
+static int
+xsk_carrega_programa(const int mapa_fd)
+{
+	struct bpf_insn	programa[] = {
+		/* r2 = ctx->rx_queue_index */
+		{ .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2,
+		  .src_reg = BPF_REG_1,
+		  .off = offsetof(struct xdp_md, rx_queue_index) },
+		/* r1 = xskmap (64 bit immediate, takes two slots) */
+		{ .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+		  .src_reg = BPF_PSEUDO_MAP_FD, .imm = mapa_fd },
+		{ .code = 0 },
+		/* r3 = XDP_PASS (action when the queue has no socket) */
+		{ .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+		  .imm = XDP_PASS },
+		{ .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+		{ .code = BPF_JMP | BPF_EXIT },
+	};
+	static char	licenca[] = "GPL";
+	static char	log_verificador[4096];
+	union bpf_attr	attr;
+	int		fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)programa;
+	attr.insn_cnt = sizeof(programa) / sizeof(struct bpf_insn);
+	attr.license = (uintptr_t)licenca;
+	attr.log_buf = (uintptr_t)log_verificador;
+	attr.log_size = sizeof(log_verificador);
+	attr.log_level = 1;
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd == -1) {
+		perror("xsk.bpf_prog_load");
+		Debug("verifier said: %s", log_verificador);
+	}
+
+	return fd;
+}
+
+
+/** \brief How many receive queues the interface has (1 if unknown). */
+static unsigned int
+xsk_conta_filas(const int sck, const char *if_name)
+{
+	struct ethtool_channels	canais;
+	struct ifreq		ifr;
+	unsigned int		qtd;
+
+	memset(&canais, 0, sizeof(canais));
+	canais.cmd = ETHTOOL_GCHANNELS;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, if_name);
+	ifr.ifr_data = (void *)&canais;
+
+	if (ioctl(sck, SIOCETHTOOL, &ifr) == -1)
+		return 1;
+
+	qtd = canais.combined_count + canais.rx_count;
+	if (qtd == 0)
+		return 1;
+	if (qtd > XSK_MAX_FILAS) {
+		Debug("`%s' has %u queues, only %u will be captured", if_name,
+				qtd, XSK_MAX_FILAS);
+		qtd = XSK_MAX_FILAS;
+	}
+
+	return qtd;
+}
+
+
+/** \brief Maps one of the rings of an XSK socket. */
+static int
+xsk_mapeia_anel(xsk_anel_t *anel, const int sck, const struct xdp_ring_offset *off,
+		const uint32_t tamanho, const size_t tam_descritor,
+		const off_t pgoff)
+{
+	anel->mapa_tam = off->desc + tamanho * tam_descritor;
+	anel->mapa = mmap(NULL, anel->mapa_tam, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, sck, pgoff);
+	if (anel->mapa == MAP_FAILED) {
+		perror("xsk.mmap");
+		anel->mapa = NULL;
+		return ERROR_IO;
+	}
+
+	anel->produtor = (uint32_t *)((uint8_t *)anel->mapa + off->producer);
+	anel->consumidor = (uint32_t *)((uint8_t *)anel->mapa + off->consumer);
+	anel->flags = (uint32_t *)((uint8_t *)anel->mapa + off->flags);
+	anel->descritores = (uint8_t *)anel->mapa + off->desc;
+	anel->mascara = tamanho - 1;
+
+	return SUCCESS;
+}
+
+
+/** \brief Sets up the UMEM, rings and socket for one receive queue. */
+static int
+xsk_abre_fila(xsk_fila_t *f, const int ifindex, const unsigned int fila)
+{
+	struct xdp_umem_reg	umem;
+	struct xdp_mmap_offsets	off;
+	struct sockaddr_xdp	sxdp;
+	socklen_t		tamanho;
+	uint64_t		*enderecos;
+	uint32_t		i;
+	int			valor;
+
+	f->socket = socket(AF_XDP, SOCK_RAW, 0);
+	if (f->socket == -1) {
+		perror("xsk.socket");
+		return ERROR_IO;
+	}
+
+	f->umem = mmap(NULL, (size_t)XSK_FRAMES * XSK_FRAME_TAM,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (f->umem == MAP_FAILED) {
+		perror("xsk.umem");
+		f->umem = NULL;
+		return ERROR_MALLOC;
+	}
+
+	memset(&umem, 0, sizeof(umem));
+	umem.addr = (uintptr_t)f->umem;
+	umem.len = (uint64_t)XSK_FRAMES * XSK_FRAME_TAM;
+	umem.chunk_size = XSK_FRAME_TAM;
+	if (setsockopt(f->socket, SOL_XDP, XDP_UMEM_REG, &umem,
+				sizeof(umem)) == -1) {
+		perror("xsk.xdp_umem_reg");
+		return ERROR_IO;
+	}
+
+	valor = XSK_FILL_TAM;
+	if (setsockopt(f->socket, SOL_XDP, XDP_UMEM_FILL_RING, &valor,
+				sizeof(valor)) == -1) {
+		perror("xsk.xdp_umem_fill_ring");
+		return ERROR_IO;
+	}
+	valor = XSK_COMP_TAM;
+	if (setsockopt(f->socket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &valor,
+				sizeof(valor)) == -1) {
+		perror("xsk.xdp_umem_completion_ring");
+		return ERROR_IO;
+	}
+	valor = XSK_RX_TAM;
+	if (setsockopt(f->socket, SOL_XDP, XDP_RX_RING, &valor,
+				sizeof(valor)) == -1) {
+		perror("xsk.xdp_rx_ring");
+		return ERROR_IO;
+	}
+
+	tamanho = sizeof(off);
+	if (getsockopt(f->socket, SOL_XDP, XDP_MMAP_OFFSETS, &off,
+				&tamanho) == -1) {
+		perror("xsk.xdp_mmap_offsets");
+		return ERROR_IO;
+	}
+
+	if (xsk_mapeia_anel(&f->rx, f->socket, &off.rx, XSK_RX_TAM,
+				sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != SUCCESS)
+		return ERROR_IO;
+	if (xsk_mapeia_anel(&f->fill, f->socket, &off.fr, XSK_FILL_TAM,
+				sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != SUCCESS)
+		return ERROR_IO;
+
+	/* give every chunk to the kernel */
+	enderecos = f->fill.descritores;
+	for (i = 0; i < XSK_FRAMES; i++)
+		enderecos[i] = (uint64_t)i * XSK_FRAME_TAM;
+	__atomic_store_n(f->fill.produtor, XSK_FRAMES, __ATOMIC_RELEASE);
+
+	/* zero-copy if the driver can, otherwise let the kernel copy */
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = fila;
+	sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+	if (bind(f->socket, (struct sockaddr *)&sxdp, sizeof(sxdp)) == -1) {
+		sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+		if (bind(f->socket, (struct sockaddr *)&sxdp,
+					sizeof(sxdp)) == -1) {
+			perror("xsk.bind");
+			return ERROR_IO;
+		}
+		Debug("queue %u: copy mode", fila);
+	}
+	else
+		Debug("queue %u: zero-copy mode", fila);
+
+	return SUCCESS;
+}
+
+
+static void
+xsk_fecha_fila(xsk_fila_t *f)
+{
+	if (f->rx.mapa != NULL)
+		munmap(f->rx.mapa, f->rx.mapa_tam);
+	if (f->fill.mapa != NULL)
+		munmap(f->fill.mapa, f->fill.mapa_tam);
+	if (f->socket > 0)
+		close(f->socket);
+	if (f->umem != NULL)
+		munmap(f->umem, (size_t)XSK_FRAMES * XSK_FRAME_TAM);
+
+	memset(f, 0, sizeof(xsk_fila_t));
+}
+
+
+/** \brief Attaches the XDP program to an interface and opens its queues.
+ *
+ *  If anything goes wrong, everything is undone and the interface is left as
+ *  it was, so the caller can fall back to another capture backend.
+ *
+ *  \return The sniffer identifier (>= 0), or an error code (< 0).
+ */
+int
+xsk_open_interface_by_name(const char *if_name)
+{
+	union bpf_attr		 attr;
+	struct packet_mreq	 mreq;
+	xsk_t			*x;
+	unsigned int		 i;
+	int			 sck;
+	int			 chave;
+	int			 choose;
+
+	if ((if_name == NULL) || (strlen(if_name) >= IFNAMSIZ))
+		return ERROR_PARAMETER;
+
+	for (choose = 0; choose < MAX_INTERFACES; choose++) {
+		if (xsks[choose].em_uso == 0)
+			break;
+	}
+	if (choose == MAX_INTERFACES) {
+		Debug("too many interfaces, can't open `%s'", if_name);
+		return ERROR_FULL;
+	}
+	x = &xsks[choose];
+	x->em_uso = 1;
+	x->mapa_fd = x->prog_fd = x->link_fd = x->promisc_fd = -1;
+
+	x->ifindex = if_nametoindex(if_name);
+	if (x->ifindex == 0) {
+		perror("xsk.if_nametoindex");
+		goto erro;
+	}
+
+	/* any socket will do for the ethtool query */
+	sck = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sck == -1) {
+		perror("xsk.socket");
+		goto erro;
+	}
+	x->qtd_filas = xsk_conta_filas(sck, if_name);
+	close(sck);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = XSK_MAX_FILAS;
+	x->mapa_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (x->mapa_fd == -1) {
+		perror("xsk.bpf_map_create");
+		goto erro;
+	}
+
+	x->prog_fd = xsk_carrega_programa(x->mapa_fd);
+	if (x->prog_fd == -1)
+		goto erro;
+
+	for (i = 0; i < x->qtd_filas; i++) {
+		if (xsk_abre_fila(&x->filas[i], x->ifindex, i) != SUCCESS)
+			goto erro;
+
+		chave = i;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = x->mapa_fd;
+		attr.key = (uintptr_t)&chave;
+		attr.value = (uintptr_t)&x->filas[i].socket;
+		if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+			perror("xsk.bpf_map_update_elem");
+			goto erro;
+		}
+
+		x->pfd[i].fd = x->filas[i].socket;
+		x->pfd[i].events = POLLIN;
+	}
+
+	/* SPAN ports carry frames for other MACs; the membership holds the
+	   interface in promiscuous mode while this (silent) socket is open */
+	x->promisc_fd = socket(PF_PACKET, SOCK_RAW, 0);
+	if (x->promisc_fd == -1) {
+		perror("xsk.promisc_socket");
+		goto erro;
+	}
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = x->ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	if (setsockopt(x->promisc_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+				&mreq, sizeof(mreq)) == -1) {
+		perror("xsk.packet_add_membership");
+		goto erro;
+	}
+
+	/* a bpf link is detached automatically if we die */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = x->prog_fd;
+	attr.link_create.target_ifindex = x->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	x->link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (x->link_fd == -1) {
+		perror("xsk.bpf_link_create");
+		goto erro;
+	}
+
+	Debug("`%s' (ifindex %d): XDP attached, %u queue(s)", if_name,
+			x->ifindex, x->qtd_filas);
+
+	return choose;
+
+erro:
+	xsk_close(choose);
+	return ERROR_IO;
+}
+
+
+/** \brief Gets the next batch of frames.
+ *
+ *  Frames stay in the UMEM and belong to the caller until xsk_libera() is
+ *  called; each call to xsk_recebe() must be paired with one to xsk_libera().
+ *
+ *  \param  quadros	Where to store pointers to the frames.
+ *  \param  max		Size of \a quadros.
+ *  \param  timeout_ms	How long to wait if all queues are empty.
+ *  \return How many frames were stored in \a quadros.
+ */
+unsigned int
+xsk_recebe(const int sniffer, xsk_quadro_t *quadros, const unsigned int max,
+		const int timeout_ms)
+{
+	xsk_t			*x = &xsks[sniffer];
+	xsk_fila_t		*f;
+	struct xdp_desc		*descritores;
+	uint32_t		 consumidor;
+	uint32_t		 disponiveis;
+	uint32_t		 i;
+	unsigned int		 tentativas;
+
+	for (tentativas = 0; tentativas < 2; tentativas++) {
+		for (i = 0; i < x->qtd_filas; i++) {
+			/* round-robin between queues */
+			x->fila_atual = (x->fila_atual + 1) % x->qtd_filas;
+			f = &x->filas[x->fila_atual];
+
+			consumidor = *f->rx.consumidor;
+			disponiveis = __atomic_load_n(f->rx.produtor,
+					__ATOMIC_ACQUIRE) - consumidor;
+			if (disponiveis != 0)
+				goto recebeu;
+		}
+
+		/* nothing anywhere: sleep until some queue has frames */
+		if (poll(x->pfd, x->qtd_filas, timeout_ms) <= 0)
+			break;
+	}
+	x->recebidos = 0;
+	return 0;
+
+recebeu:
+	if (disponiveis > max)
+		disponiveis = max;
+
+	descritores = f->rx.descritores;
+	for (i = 0; i < disponiveis; i++) {
+		struct xdp_desc	*d = &descritores[(consumidor + i) & f->rx.mascara];
+
+		quadros[i].dados = f->umem + d->addr;
+		quadros[i].tam = d->len;
+		quadros[i].endereco = d->addr;
+	}
+	x->recebidos = disponiveis;
+
+	return disponiveis;
+}
+
+
+/** \brief Hands the frames of the last xsk_recebe() back to the kernel. */
+void
+xsk_libera(const int sniffer, const xsk_quadro_t *quadros)
+{
+	xsk_t		*x = &xsks[sniffer];
+	xsk_fila_t	*f = &x->filas[x->fila_atual];
+	uint64_t	*enderecos = f->fill.descritores;
+	uint32_t	 produtor;
+	uint32_t	 i;
+
+	if (x->recebidos == 0)
+		return;
+
+	/* the fill ring has room for every chunk, so it is never full here */
+	produtor = *f->fill.produtor;
+	for (i = 0; i < x->recebidos; i++) {
+		enderecos[(produtor + i) & f->fill.mascara] =
+			quadros[i].endereco & ~((uint64_t)XSK_FRAME_TAM - 1);
+	}
+	__atomic_store_n(f->fill.produtor, produtor + x->recebidos,
+			__ATOMIC_RELEASE);
+	__atomic_store_n(f->rx.consumidor, *f->rx.consumidor + x->recebidos,
+			__ATOMIC_RELEASE);
+
+	/* the driver may be sleeping, waiting for fill entries */
+	if (*f->fill.flags & XDP_RING_NEED_WAKEUP)
+		recvfrom(f->socket, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+	x->recebidos = 0;
+}
+
+
+/** \brief Reads the kernel drop counters of every queue.
+ *
+ *  \param  descartes	Frames dropped since the last call (the socket had
+ *			no room for them in its RX ring or UMEM).
+ */
+int
+xsk_estatisticas(const int sniffer, uint32_t *descartes)
+{
+	xsk_t			*x;
+	struct xdp_statistics	 stats;
+	socklen_t		 tamanho;
+	uint64_t		 total = 0;
+	unsigned int		 i;
+
+	if ((sniffer < 0) || (sniffer >= MAX_INTERFACES) ||
+			(xsks[sniffer].em_uso == 0))
+		return ERROR_NOSUCHENTRY;
+
+	x = &xsks[sniffer];
+	for (i = 0; i < x->qtd_filas; i++) {
+		memset(&stats, 0, sizeof(stats));
+		tamanho = sizeof(stats);
+		if (getsockopt(x->filas[i].socket, SOL_XDP, XDP_STATISTICS,
+					&stats, &tamanho) == -1)
+			return ERROR_IO;
+
+		total += stats.rx_dropped + stats.rx_ring_full;
+	}
+
+	*descartes = total - x->descartes;
+	x->descartes = total;
+
+	return SUCCESS;
+}
+
+
+/** \brief Detaches the XDP program, releases every queue and drops the
+ *  promiscuous mode. */
+void
+xsk_close(const int sniffer)
+{
+	xsk_t		*x;
+	unsigned int	 i;
+
+	if ((sniffer < 0) || (sniffer >= MAX_INTERFACES))
+		return;
+
+	x = &xsks[sniffer];
+	if (x->link_fd > 0)
+		close(x->link_fd);
+	if (x->prog_fd > 0)
+		close(x->prog_fd);
+	for (i = 0; i < XSK_MAX_FILAS; i++)
+		xsk_fecha_fila(&x->filas[i]);
+	if (x->mapa_fd > 0)
+		close(x->mapa_fd);
+	if (x->promisc_fd > 0)
+		close(x->promisc_fd);
+
+	memset(x, 0, sizeof(xsk_t));
+}